@@ -74,6 +74,7 @@
 #include "program/program.h"
 #include "util/mesa-sha1.h"
 #include "util/set.h"
+#include "util/simple_mtx.h"
 #include "string_to_uint_map.h"
 #include "linker.h"
 #include "linker_util.h"
@@ -4746,8 +4747,8 @@ linker_optimisation_loop(struct gl_context *ctx, exec_list *ir,
       }
 }
 
-void
-link_shaders(struct gl_context *ctx, struct gl_shader_program *prog)
+static void
+link_shaders_locked(struct gl_context *ctx, struct gl_shader_program *prog)
 {
    prog->data->LinkStatus = LINKING_SUCCESS; /* All error paths will set this to false */
    prog->data->Validated = false;
@@ -5155,3 +5156,20 @@ done:
 
    ralloc_free(mem_ctx);
 }
+
+/**
+ * Shaders can be attached to several programs that are linked on different
+ * KHR_parallel_shader_compile threads at once.  Linking reads the attached
+ * shaders' IR, and a shader cache miss recompiles it in place (see
+ * shader_cache_read_program_metadata()), so links are serialised.  The
+ * driver's part of the link still runs in parallel.
+ */
+static simple_mtx_t link_mutex = _SIMPLE_MTX_INITIALIZER_NP;
+
+void
+link_shaders(struct gl_context *ctx, struct gl_shader_program *prog)
+{
+   simple_mtx_lock(&link_mutex);
+   link_shaders_locked(ctx, prog);
+   simple_mtx_unlock(&link_mutex);
+}
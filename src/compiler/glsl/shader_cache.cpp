@@ -67,6 +67,11 @@ extern "C" {
 #include "program/program.h"
 }
 
+/**
+ * Recompile the shaders in place.  Other programs they are attached to may
+ * be linked on other KHR_parallel_shader_compile threads at the same time;
+ * link_shaders() serialises links, so none of them reads the IR freed here.
+ */
 static void
 compile_shaders(struct gl_context *ctx, struct gl_shader_program *prog) {
    for (unsigned i = 0; i < prog->NumShaders; i++) {
@@ -493,6 +493,158 @@ test_put_key_and_get_key(void)
 
    disk_cache_destroy(cache);
 }
+
+static void
+test_put_and_get_pack(void)
+{
+   struct disk_cache *cache;
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t blob_key[20];
+   char string[] = "While this string has thirty-four";
+   uint8_t string_key[20];
+   uint8_t *one_KB;
+   uint8_t one_KB_key[20];
+   uint32_t seed = 1;
+   char *result;
+   size_t size;
+   int count;
+
+   setenv("MESA_GLSL_CACHE_PACK", "true", 1);
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/mesa-glsl-cache-pack", 1);
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "1M", 1);
+
+   cache = disk_cache_create("test", "make_check", 0);
+
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   disk_cache_compute_key(cache, string, sizeof(string), string_key);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_null(result, "pack get with non-existent item (pointer)");
+   expect_equal(size, 0, "pack get with non-existent item (size)");
+
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_put(cache, string_key, string, sizeof(string), NULL);
+
+   /* disk_cache_put() hands things off to a thread give it some time to
+    * finish.
+    */
+   wait_until_file_written(cache, blob_key);
+   wait_until_file_written(cache, string_key);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_equal_str(blob, result, "pack get of existing item (pointer)");
+   expect_equal(size, sizeof(blob), "pack get of existing item (size)");
+   free(result);
+
+   result = disk_cache_get(cache, string_key, &size);
+   expect_equal_str(string, result, "2nd pack get of existing item (pointer)");
+   expect_equal(size, sizeof(string), "2nd pack get of existing item (size)");
+   free(result);
+
+   /* Entries must survive reopening the pack, removals too. */
+   disk_cache_remove(cache, string_key);
+   expect_true(!does_cache_contain(cache, string_key), "pack remove");
+
+   disk_cache_destroy(cache);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   expect_true(does_cache_contain(cache, blob_key),
+               "pack entry persists after reopen");
+   expect_true(!does_cache_contain(cache, string_key),
+               "pack removal persists after reopen");
+
+   /* Set the cache size to 1KB and add a 1KB item that doesn't compress to
+    * force a compaction, which only keeps the newest entry.
+    */
+   disk_cache_destroy(cache);
+
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "1K", 1);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   disk_cache_put(cache, string_key, string, sizeof(string), NULL);
+   wait_until_file_written(cache, string_key);
+
+   one_KB = malloc(1024);
+   for (unsigned i = 0; i < 1024; i++) {
+      seed = seed * 1103515245 + 12345;
+      one_KB[i] = seed >> 24;
+   }
+   disk_cache_compute_key(cache, one_KB, 1024, one_KB_key);
+   disk_cache_put(cache, one_KB_key, one_KB, 1024, NULL);
+   free(one_KB);
+
+   wait_until_file_written(cache, one_KB_key);
+
+   count = 0;
+   if (does_cache_contain(cache, blob_key))
+       count++;
+
+   if (does_cache_contain(cache, string_key))
+       count++;
+
+   if (does_cache_contain(cache, one_KB_key))
+       count++;
+
+   expect_true(does_cache_contain(cache, one_KB_key),
+               "pack compaction keeps the newest entry");
+   expect_equal(count, 1, "pack compaction with MAX_SIZE=1K");
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_GLSL_CACHE_PACK");
+}
+
+static void
+test_bundle(void)
+{
+   struct disk_cache *cache;
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t blob_key[20];
+   uint8_t marker_key[20] = { 1, 2, 3 };
+   char *result;
+   size_t size;
+   int err;
+
+   /* Write a pack with uncompressed entries. */
+   setenv("MESA_GLSL_CACHE_PACK", "true", 1);
+   setenv("MESA_GLSL_CACHE_CODEC", "none", 1);
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/bundle-source", 1);
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "1M", 1);
+   mkdir(CACHE_TEST_TMP "/bundle-source", 0755);
+
+   cache = disk_cache_create("test", "make_check", 0);
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_put_key(cache, marker_key);
+   wait_until_file_written(cache, blob_key);
+   disk_cache_destroy(cache);
+
+   err = rename(CACHE_TEST_TMP "/bundle-source/" CACHE_DIR_NAME "/pack",
+                CACHE_TEST_TMP "/bundle");
+   expect_equal(err, 0, "moving the pack to a bundle");
+
+   /* Use it as a bundle for a file based cache that compresses with the
+    * default codec.
+    */
+   unsetenv("MESA_GLSL_CACHE_PACK");
+   unsetenv("MESA_GLSL_CACHE_CODEC");
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/bundle-user", 1);
+   setenv("MESA_GLSL_CACHE_BUNDLE", CACHE_TEST_TMP "/bundle", 1);
+   mkdir(CACHE_TEST_TMP "/bundle-user", 0755);
+
+   cache = disk_cache_create("test", "make_check", 0);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_equal_str(blob, result, "bundle get (pointer)");
+   expect_equal(size, sizeof(blob), "bundle get (size)");
+   free(result);
+
+   expect_true(disk_cache_has_key(cache, marker_key), "bundle has_key");
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_GLSL_CACHE_BUNDLE");
+}
 #endif /* ENABLE_SHADER_CACHE */
 
 int
@@ -507,6 +659,10 @@ main(void)
 
    test_put_key_and_get_key();
 
+   test_put_and_get_pack();
+
+   test_bundle();
+
    err = rmrf_local(CACHE_TEST_TMP);
    expect_equal(err, 0, "Removing " CACHE_TEST_TMP " again");
 #endif /* ENABLE_SHADER_CACHE */
@@ -25,7 +25,7 @@
 
 from __future__ import print_function
 import ast
-from collections import OrderedDict
+from collections import defaultdict
 import itertools
 import struct
 import sys
@@ -77,7 +77,7 @@ class Value(object):
 
    __template = mako.template.Template("""
 static const ${val.c_type} ${val.name} = {
-   { ${val.type_enum}, ${val.bit_size} },
+   { ${val.type_enum}, ${val.c_bit_size} },
 % if isinstance(val, Constant):
    ${val.type()}, { ${val.hex()} /* ${val.value} */ },
 % elif isinstance(val, Variable):
@@ -109,6 +109,12 @@ static const ${val.c_type} ${val.name} = {
    def c_ptr(self):
       return "&{0}.value".format(self.name)
 
+   @property
+   def c_bit_size(self):
+      # Values of a replacement expression carry the bit size deduced by
+      # BitSizeValidator, see nir_search_value::bit_size.
+      return getattr(self, 'replace_bit_size', self.bit_size)
+
    def render(self):
       return self.__template.render(val=self,
                                     Constant=Constant,
@@ -296,16 +302,18 @@ class BitSizeValidator(object):
    generate any code.  This ensures that bugs are caught at compile time
    rather than at run time.
 
-   The basic operation of the validator is very similar to the bitsize_tree in
-   nir_search only a little more subtle.  Instead of simply tracking bit
-   sizes, it tracks "bit classes" where each class is represented by an
-   integer.  A value of 0 means we don't know anything yet, positive values
-   are actual bit-sizes, and negative values are used to track equivalence
-   classes of sizes that must be the same but have yet to receive an actual
-   size.  The first stage uses the bitsize_tree algorithm to assign bit
+   The validator doesn't simply track bit sizes, it tracks "bit classes"
+   where each class is represented by an integer.  A value of 0 means we
+   don't know anything yet, positive values are actual bit-sizes, and
+   negative values are used to track equivalence classes of sizes that must
+   be the same but have yet to receive an actual size.  The first stage
+   propagates sizes up and then down the search expression to assign bit
    classes to each variable.  If it ever comes across an inconsistency, it
    assert-fails.  Then the second stage uses that information to prove that
-   the resulting expression can always validly be constructed.
+   the resulting expression can always validly be constructed.  Finally, the
+   class of every value in the replacement is turned into something
+   nir_search can evaluate without any further inference, see
+   _assign_replace_bit_size().
    """
 
    def __init__(self, varset):
@@ -322,6 +330,7 @@ class BitSizeValidator(object):
       validate_dst_class = self._validate_bit_class_up(replace)
       assert validate_dst_class == 0 or validate_dst_class == dst_class
       self._validate_bit_class_down(replace, dst_class)
+      self._assign_replace_bit_size(replace, dst_class)
 
    def _new_class(self):
       self._num_classes += 1
@@ -448,6 +457,7 @@ class BitSizeValidator(object):
       # At this point, everything *must* have a bit class.  Otherwise, we have
       # a value we don't know how to define.
       assert bit_class != 0
+      val.bit_class = bit_class
 
       if isinstance(val, Constant):
          assert val.bit_size == 0 or val.bit_size == bit_class
@@ -471,6 +481,31 @@ class BitSizeValidator(object):
             else:
                self._validate_bit_class_down(val.sources[i], val.common_class)
 
+   def _assign_replace_bit_size(self, val, dst_class):
+      """Turn the bit classes of the replacement into bit sizes
+
+      Every value in the replacement has, by now, a class that is either an
+      actual bit size, the class of the destination of the search expression
+      or the class of one of the variables.  This lets nir_search pick the
+      size of each value it constructs without redoing the inference at run
+      time: a positive size is used as-is, 0 means the size of the
+      instruction being replaced, and -(N + 1) means the size of variable N.
+      """
+      bit_class = self._class_relation.get_canonical(val.bit_class)
+      if bit_class > 0:
+         val.replace_bit_size = bit_class
+      elif bit_class == self._class_relation.get_canonical(dst_class):
+         val.replace_bit_size = 0
+      else:
+         var_ids = [i for i in range(len(self._var_classes))
+                    if self._get_var_bit_class(i) == bit_class]
+         assert var_ids, "Unable to deduce a bit size for " + val.name
+         val.replace_bit_size = -(var_ids[0] + 1)
+
+      if isinstance(val, Expression):
+         for src in val.sources:
+            self._assign_replace_bit_size(src, dst_class)
+
 _optimization_ids = itertools.count()
 
 condition_list = ['true']
@@ -505,6 +540,192 @@ class SearchAndReplace(object):
 
       BitSizeValidator(varset).validate(self.search, self.replace)
 
+class TreeAutomaton(object):
+   """Bottom-up tree automaton matching the search expressions of a pass
+
+   Instead of trying every transform for an opcode one after another, each
+   SSA value produced by an ALU instruction is assigned a state which is
+   computed from its opcode and the states of its sources with a table
+   lookup.  A state stands for the set of pattern subtrees ("items") that
+   the value structurally matches, so after a single forward walk over the
+   shader we know, for every instruction, exactly which search expressions
+   may match with it as the root.  nir_replace_instr() still checks
+   everything the automaton ignores: variables, constants, conditions, bit
+   sizes and exactness.
+
+   To keep the tables small, the source states are first reduced per opcode
+   by a filter which only keeps the items that appear as a source of that
+   opcode in some pattern.  The transition table of an opcode is then
+   indexed by the filtered states of its sources.  This is the
+   reachability-based construction of bottom-up tree automata, see e.g.
+   "Tree Automata Techniques and Applications", Comon et al.
+   """
+
+   class IndexMap(object):
+      """A list of unique objects which can also be indexed by object"""
+      def __init__(self):
+         self.objects = []
+         self.map = {}
+
+      def __getitem__(self, i):
+         return self.objects[i]
+
+      def __contains__(self, obj):
+         return obj in self.map
+
+      def __len__(self):
+         return len(self.objects)
+
+      def __iter__(self):
+         return iter(self.objects)
+
+      def clear(self):
+         self.objects = []
+         self.map = {}
+
+      def index(self, obj):
+         return self.map[obj]
+
+      def add(self, obj):
+         if obj not in self.map:
+            self.map[obj] = len(self.objects)
+            self.objects.append(obj)
+         return self.map[obj]
+
+   class Item(object):
+      """A subtree of one or more search expressions
+
+      Identical subtrees are shared between patterns.  Variables and
+      constants are all represented by the wildcard item.
+      """
+      def __init__(self, opcode, children):
+         self.opcode = opcode
+         self.children = children
+         # Indices of the patterns this item is the root of
+         self.patterns = []
+         # Opcodes of the expressions this item is a source of
+         self.parent_ops = set()
+
+   def __init__(self, transforms):
+      self.patterns = [t.search for t in transforms]
+      self._compute_items()
+      self._build_table()
+
+   def _compute_items(self):
+      # Map from (opcode, children) to item.  Commutative expressions are
+      # entered with both orders of their sources, like nir_search tries
+      # both orders when matching them.
+      self.items = {}
+      # The opcodes used by the patterns, only those get tables.
+      self.opcodes = self.IndexMap()
+
+      def get_item(opcode, children, pattern=None):
+         item = self.items.setdefault((opcode, children),
+                                      self.Item(opcode, children))
+         if len(children) == 2 and \
+            'commutative' in opcodes[opcode].algebraic_properties:
+            self.items[opcode, (children[1], children[0])] = item
+         if pattern is not None:
+            item.patterns.append(pattern)
+         return item
+
+      self.wildcard = self.Item(None, ())
+
+      def process_subpattern(src, pattern=None):
+         if not isinstance(src, Expression):
+            assert pattern is None
+            return self.wildcard
+
+         children = tuple(process_subpattern(c) for c in src.sources)
+         item = get_item(src.opcode, children, pattern)
+         for child in children:
+            child.parent_ops.add(src.opcode)
+         self.opcodes.add(src.opcode)
+         return item
+
+      for i, pattern in enumerate(self.patterns):
+         process_subpattern(pattern, i)
+
+   def _build_table(self):
+      # All the states found so far, as frozensets of items.  State 0 only
+      # contains the wildcard; it is the state of everything that isn't an
+      # ALU instruction the automaton knows about.
+      self.states = self.IndexMap()
+      # Sorted pattern indices for each state
+      self.state_patterns = []
+      # For each opcode, the filtered state index of every state
+      self.filter = defaultdict(list)
+      # For each opcode, all filtered states
+      self.rep = defaultdict(self.IndexMap)
+      # For each opcode, the transitions from a tuple of filtered source
+      # state indices to the resulting state index
+      self.table = defaultdict(dict)
+
+      # Filtered states of an opcode with an index at least this have not
+      # been combined into transitions yet.
+      rep_worklist_index = defaultdict(int)
+      # Opcodes with filtered states on their worklist
+      new_opcodes = self.IndexMap()
+
+      def process_new_states():
+         while len(self.state_patterns) < len(self.states):
+            state = self.states[len(self.state_patterns)]
+
+            # Patterns are tried in the order they are listed in the pass.
+            self.state_patterns.append(
+               sorted(p for item in state for p in item.patterns))
+
+            for op in self.opcodes:
+               rep = self.rep[op]
+               filtered = frozenset(item for item in state
+                                    if op in item.parent_ops)
+               if filtered not in rep:
+                  new_opcodes.add(op)
+               self.filter[op].append(rep.add(filtered))
+
+      self.states.add(frozenset((self.wildcard,)))
+      process_new_states()
+
+      while len(new_opcodes) > 0:
+         for op in new_opcodes:
+            rep = self.rep[op]
+            table = self.table[op]
+            first_new = rep_worklist_index[op]
+
+            # Visit every combination of sources where at least one of them
+            # is new.
+            for src_indices in itertools.product(
+                  range(len(rep)), repeat=opcodes[op].num_inputs):
+               if all(i < first_new for i in src_indices):
+                  continue
+
+               srcs = tuple(rep[i] for i in src_indices)
+               state = set(self.items[op, children]
+                           for children in itertools.product(*srcs)
+                           if (op, children) in self.items)
+               # Any value can be a variable of some other pattern.
+               state.add(self.wildcard)
+               table[src_indices] = self.states.add(frozenset(state))
+
+            rep_worklist_index[op] = len(rep)
+
+         new_opcodes.clear()
+         process_new_states()
+
+      assert len(self.states) <= 1 << 16, "Too many automaton states"
+
+   def flat_table(self, op):
+      """The transition table of op in nir_algebraic_automaton() order"""
+      return [self.table[op][src_indices] for src_indices in
+              itertools.product(range(len(self.rep[op])),
+                                repeat=opcodes[op].num_inputs)]
+
+def _format_table(values, indent='   ', per_line=16):
+   """Format a list of integers as the body of a C array initializer"""
+   values = list(values)
+   return '\n'.join(indent + ', '.join(str(v) for v in values[i:i + per_line]) + ','
+                    for i in range(0, len(values), per_line))
+
 _algebraic_pass_template = mako.template.Template("""
 #include "nir.h"
 #include "nir_search.h"
@@ -521,22 +742,54 @@ struct transform {
 
 #endif
 
-% for (opcode, xform_list) in xform_dict.items():
-% for xform in xform_list:
+% for xform in xforms:
    ${xform.search.render()}
    ${xform.replace.render()}
 % endfor
 
-static const struct transform ${pass_name}_${opcode}_xforms[] = {
-% for xform in xform_list:
-   { &${xform.search.name}, ${xform.replace.c_ptr}, ${xform.condition_index} },
+% for state_id, patterns in enumerate(automaton.state_patterns):
+% if patterns:
+static const struct transform ${pass_name}_state${state_id}_xforms[] = {
+% for i in patterns:
+   { &${xforms[i].search.name}, ${xforms[i].replace.c_ptr}, ${xforms[i].condition_index} },
+% endfor
+};
+% endif
 % endfor
+
+static const struct transform *${pass_name}_state_xforms[] = {
+% for state_id, patterns in enumerate(automaton.state_patterns):
+   ${'{0}_state{1}_xforms'.format(pass_name, state_id) if patterns else 'NULL'},
+% endfor
+};
+
+static const uint16_t ${pass_name}_state_num_xforms[] = {
+${format_table(len(patterns) for patterns in automaton.state_patterns)}
+};
+
+% for op in automaton.opcodes:
+static const uint16_t ${pass_name}_${op}_filter[] = {
+${format_table(automaton.filter[op])}
 };
+
+static const uint16_t ${pass_name}_${op}_table[] = {
+${format_table(automaton.flat_table(op))}
+};
+
+% endfor
+static const struct per_op_table ${pass_name}_op_table[nir_num_opcodes] = {
+% for op in automaton.opcodes:
+   [nir_op_${op}] = {
+      ${pass_name}_${op}_filter,
+      ${len(automaton.rep[op])},
+      ${pass_name}_${op}_table,
+   },
 % endfor
+};
 
 static bool
-${pass_name}_block(nir_block *block, const bool *condition_flags,
-                   void *mem_ctx)
+${pass_name}_block(nir_block *block, const uint16_t *states,
+                   const bool *condition_flags, void *mem_ctx)
 {
    bool progress = false;
 
@@ -548,22 +801,21 @@ ${pass_name}_block(nir_block *block, const bool *condition_flags,
       if (!alu->dest.dest.is_ssa)
          continue;
 
-      switch (alu->op) {
-      % for opcode in xform_dict.keys():
-      case nir_op_${opcode}:
-         for (unsigned i = 0; i < ARRAY_SIZE(${pass_name}_${opcode}_xforms); i++) {
-            const struct transform *xform = &${pass_name}_${opcode}_xforms[i];
-            if (condition_flags[xform->condition_offset] &&
-                nir_replace_instr(alu, xform->search, xform->replace,
-                                  mem_ctx)) {
-               progress = true;
-               break;
-            }
+      /* Replacements only add instructions in front of the one being
+       * replaced and rewrite its uses, which we have already visited, so the
+       * states of the instructions left to visit remain valid.
+       */
+      uint16_t state = states[alu->dest.dest.ssa.index];
+      const struct transform *xforms = ${pass_name}_state_xforms[state];
+
+      for (unsigned i = 0; i < ${pass_name}_state_num_xforms[state]; i++) {
+         const struct transform *xform = &xforms[i];
+         if (condition_flags[xform->condition_offset] &&
+             nir_replace_instr(alu, xform->search, xform->replace,
+                               mem_ctx)) {
+            progress = true;
+            break;
          }
-         break;
-      % endfor
-      default:
-         break;
       }
    }
 
@@ -576,10 +828,22 @@ ${pass_name}_impl(nir_function_impl *impl, const bool *condition_flags)
    void *mem_ctx = ralloc_parent(impl);
    bool progress = false;
 
+   /* State 0 is the state of everything the automaton doesn't look at, so
+    * only ALU instructions have to be visited.
+    */
+   uint16_t *states = calloc(impl->ssa_alloc, sizeof(*states));
+
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block)
+         nir_algebraic_automaton(instr, states, ${pass_name}_op_table);
+   }
+
    nir_foreach_block_reverse(block, impl) {
-      progress |= ${pass_name}_block(block, condition_flags, mem_ctx);
+      progress |= ${pass_name}_block(block, states, condition_flags, mem_ctx);
    }
 
+   free(states);
+
    if (progress)
       nir_metadata_preserve(impl, nir_metadata_block_index |
                                   nir_metadata_dominance);
@@ -611,7 +875,7 @@ ${pass_name}(nir_shader *shader)
 
 class AlgebraicPass(object):
    def __init__(self, pass_name, transforms):
-      self.xform_dict = OrderedDict()
+      self.xforms = []
       self.pass_name = pass_name
 
       error = False
@@ -628,15 +892,16 @@ class AlgebraicPass(object):
                error = True
                continue
 
-         if xform.search.opcode not in self.xform_dict:
-            self.xform_dict[xform.search.opcode] = []
-
-         self.xform_dict[xform.search.opcode].append(xform)
+         self.xforms.append(xform)
 
       if error:
          sys.exit(1)
 
+      self.automaton = TreeAutomaton(self.xforms)
+
    def render(self):
       return _algebraic_pass_template.render(pass_name=self.pass_name,
-                                             xform_dict=self.xform_dict,
+                                             xforms=self.xforms,
+                                             automaton=self.automaton,
+                                             format_table=_format_table,
                                              condition_list=condition_list)
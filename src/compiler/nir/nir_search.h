@@ -41,7 +41,18 @@ typedef enum {
 typedef struct {
    nir_search_value_type type;
 
-   unsigned bit_size;
+   /**
+    * Bit size of the value.
+    *
+    * In a search expression, a positive value only matches SSA values of
+    * that bit size and 0 matches any bit size.
+    *
+    * In a replace expression, a positive value is the bit size to construct
+    * the value with, 0 means the bit size of the instruction being replaced
+    * and a negative value means the bit size of variable (-bit_size - 1).
+    * These are worked out by nir_algebraic.py at build time.
+    */
+   int bit_size;
 } nir_search_value;
 
 typedef struct {
@@ -123,6 +134,24 @@ NIR_DEFINE_CAST(nir_search_value_as_expression, nir_search_value,
                 nir_search_expression, value,
                 type, nir_search_value_expression)
 
+/**
+ * Per-opcode tables of the tree automaton generated by nir_algebraic.py
+ */
+struct per_op_table {
+   /** Maps a state to the index of the filtered state for this opcode */
+   const uint16_t *filter;
+   unsigned num_filtered_states;
+   /**
+    * Transition table, indexed by the filtered states of the sources with
+    * the first source as the most significant digit.
+    */
+   const uint16_t *table;
+};
+
+void
+nir_algebraic_automaton(nir_instr *instr, uint16_t *states,
+                        const struct per_op_table *pass_op_table);
+
 nir_alu_instr *
 nir_replace_instr(nir_alu_instr *instr, const nir_search_expression *search,
                   const nir_search_value *replace, void *mem_ctx);
@@ -230,6 +230,22 @@ void draw_destroy( struct draw_context *draw )
 
 
 
+/**
+ * Let the driver look up and store the object code of the JIT-compiled
+ * vertex and geometry shader variants in its on-disk shader cache.
+ */
+void
+draw_set_disk_cache_callbacks(struct draw_context *draw,
+                              void *data_cookie,
+                              draw_disk_cache_func find_shader,
+                              draw_disk_cache_func insert_shader)
+{
+   draw->disk_cache.data_cookie = data_cookie;
+   draw->disk_cache.find_shader = find_shader;
+   draw->disk_cache.insert_shader = insert_shader;
+}
+
+
 void draw_flush( struct draw_context *draw )
 {
    draw_do_flush( draw, DRAW_FLUSH_BACKEND );
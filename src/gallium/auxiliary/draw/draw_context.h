@@ -72,6 +72,17 @@ struct draw_context *draw_create_with_llvm_context(struct pipe_context *pipe,
 
 struct draw_context *draw_create_no_llvm(struct pipe_context *pipe);
 
+struct lp_cached_code;
+
+typedef void (*draw_disk_cache_func)(void *data_cookie,
+                                     struct lp_cached_code *cache,
+                                     const unsigned char ir_sha1_cache_key[20]);
+
+void draw_set_disk_cache_callbacks(struct draw_context *draw,
+                                   void *data_cookie,
+                                   draw_disk_cache_func find_shader,
+                                   draw_disk_cache_func insert_shader);
+
 void draw_destroy( struct draw_context *draw );
 
 void draw_flush(struct draw_context *draw);
@@ -46,6 +46,8 @@
 
 #include "tgsi/tgsi_scan.h"
 
+#include "draw_context.h"
+
 #ifdef HAVE_LLVM
 struct gallivm_state;
 #endif
@@ -326,6 +328,13 @@ struct draw_context
 
    struct draw_llvm *llvm;
 
+   /** Driver hooks for caching JIT-compiled shader variants on disk */
+   struct {
+      void *data_cookie;
+      draw_disk_cache_func find_shader;
+      draw_disk_cache_func insert_shader;
+   } disk_cache;
+
    /** Texture sampler and sampler view state.
     * Note that we have arrays indexed by shader type.  At this time
     * we only handle vertex and geometry shaders in the draw module, but
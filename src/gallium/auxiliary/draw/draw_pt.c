@@ -148,6 +148,9 @@ draw_pt_arrays(struct draw_context *draw,
 
    frontend->run( frontend, start, count );
 
+   if (middle->flush)
+      middle->flush(middle);
+
    return TRUE;
 }
 
@@ -124,6 +124,13 @@ struct draw_pt_middle_end {
 
    int (*get_max_vertex_count)( struct draw_pt_middle_end * );
 
+   /**
+    * Complete everything handed to the run functions so far.  Called at
+    * the end of each draw, as the vertex buffers may go away after that.
+    * Optional, for middle ends which defer work.
+    */
+   void (*flush)( struct draw_pt_middle_end * );
+
    void (*finish)( struct draw_pt_middle_end * );
    void (*destroy)( struct draw_pt_middle_end * );
 };
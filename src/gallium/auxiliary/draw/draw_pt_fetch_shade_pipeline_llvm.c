@@ -25,9 +25,12 @@
  *
  **************************************************************************/
 
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_prim.h"
+#include "util/u_queue.h"
 #include "draw/draw_context.h"
 #include "draw/draw_gs.h"
 #include "draw/draw_vbuf.h"
@@ -40,6 +43,46 @@
 #include "gallivm/lp_bld_debug.h"
 
 
+/** Max number of worker threads for vertex shading */
+#define DRAW_LLVM_MAX_THREADS 8
+
+/**
+ * Segments with fewer vertices than this are shaded on the calling thread,
+ * where they are not worth the hand-off.
+ */
+#define DRAW_LLVM_THREAD_MIN_VERTICES 256
+
+
+/**
+ * A vsplit segment handed to the worker threads.  Fetch and vertex shading
+ * (including the cliptest) run on a worker; everything after that (GS,
+ * stream output, clipping, emit) runs on the draw thread, in submission
+ * order, once the segment is done.
+ */
+struct llvm_segment {
+   struct llvm_middle_end *fpme;
+   struct util_queue_fence fence;
+
+   struct draw_llvm_variant *variant;
+   struct draw_fetch_info fetch_info;
+   struct draw_prim_info prim_info;
+   struct draw_vertex_info vert_info;
+   unsigned draw_count;
+
+   unsigned start_or_maxelt;
+   unsigned vid_base;
+   unsigned instance_id;
+   unsigned start_instance;
+   boolean clipped;
+
+   /* copies of the vsplit element lists, which get reused */
+   unsigned *fetch_elts;
+   unsigned max_fetch_elts;
+   ushort *draw_elts;
+   unsigned max_draw_elts;
+};
+
+
 struct llvm_middle_end {
    struct draw_pt_middle_end base;
    struct draw_context *draw;
@@ -57,6 +100,13 @@ struct llvm_middle_end {
 
    struct draw_llvm *llvm;
    struct draw_llvm_variant *current_variant;
+
+   /* vertex shading worker threads, only initialized if threaded */
+   struct util_queue queue;
+   struct llvm_segment *segments;   /**< ring of max_segments */
+   unsigned max_segments;
+   unsigned first_segment;
+   unsigned num_segments;           /**< queued, not yet emitted */
 };
 
 
@@ -347,72 +397,53 @@ emit(struct pt_emit *emit,
 }
 
 
+/**
+ * Fetch and vertex shade, filling in vert_info->verts.
+ * Returns whether any vertex needs clipping (or has a non-one edgeflag).
+ */
+static boolean
+llvm_vertex_shade(struct llvm_middle_end *fpme,
+                  struct draw_llvm_variant *variant,
+                  const struct draw_fetch_info *fetch_info,
+                  struct draw_vertex_info *vert_info,
+                  unsigned start_or_maxelt,
+                  unsigned vid_base,
+                  unsigned instance_id,
+                  unsigned start_instance)
+{
+   struct draw_context *draw = fpme->draw;
+
+   return variant->jit_func(&fpme->llvm->jit_context,
+                            vert_info->verts,
+                            draw->pt.user.vbuffer,
+                            fetch_info->count,
+                            start_or_maxelt,
+                            fpme->vertex_size,
+                            draw->pt.vertex_buffer,
+                            instance_id,
+                            vid_base,
+                            start_instance,
+                            fetch_info->linear ? NULL : fetch_info->elts);
+}
+
+
+/**
+ * Run the rest of the pipeline on shaded vertices, and free them.
+ */
 static void
-llvm_pipeline_generic(struct draw_pt_middle_end *middle,
-                      const struct draw_fetch_info *fetch_info,
-                      const struct draw_prim_info *in_prim_info)
+llvm_pipeline_post_vs(struct llvm_middle_end *fpme,
+                      struct draw_vertex_info *vert_info,
+                      const struct draw_prim_info *prim_info,
+                      boolean clipped)
 {
-   struct llvm_middle_end *fpme = llvm_middle_end(middle);
    struct draw_context *draw = fpme->draw;
    struct draw_geometry_shader *gshader = draw->gs.geometry_shader;
    struct draw_prim_info gs_prim_info;
-   struct draw_vertex_info llvm_vert_info;
    struct draw_vertex_info gs_vert_info;
-   struct draw_vertex_info *vert_info;
    struct draw_prim_info ia_prim_info;
    struct draw_vertex_info ia_vert_info;
-   const struct draw_prim_info *prim_info = in_prim_info;
    boolean free_prim_info = FALSE;
    unsigned opt = fpme->opt;
-   boolean clipped = 0;
-   unsigned start_or_maxelt, vid_base;
-   const unsigned *elts;
-
-   assert(fetch_info->count > 0);
-   llvm_vert_info.count = fetch_info->count;
-   llvm_vert_info.vertex_size = fpme->vertex_size;
-   llvm_vert_info.stride = fpme->vertex_size;
-   llvm_vert_info.verts = (struct vertex_header *)
-      MALLOC(fpme->vertex_size *
-             align(fetch_info->count, lp_native_vector_width / 32));
-   if (!llvm_vert_info.verts) {
-      assert(0);
-      return;
-   }
-
-   if (draw->collect_statistics) {
-      draw->statistics.ia_vertices += prim_info->count;
-      draw->statistics.ia_primitives +=
-         u_decomposed_prims_for_vertices(prim_info->prim, prim_info->count);
-      draw->statistics.vs_invocations += fetch_info->count;
-   }
-
-   if (fetch_info->linear) {
-      start_or_maxelt = fetch_info->start;
-      vid_base = draw->start_index;
-      elts = NULL;
-   }
-   else {
-      start_or_maxelt = draw->pt.user.eltMax;
-      vid_base = draw->pt.user.eltBias;
-      elts = fetch_info->elts;
-   }
-   clipped = fpme->current_variant->jit_func(&fpme->llvm->jit_context,
-                                             llvm_vert_info.verts,
-                                             draw->pt.user.vbuffer,
-                                             fetch_info->count,
-                                             start_or_maxelt,
-                                             fpme->vertex_size,
-                                             draw->pt.vertex_buffer,
-                                             draw->instance_id,
-                                             vid_base,
-                                             draw->start_instance,
-                                             elts);
-
-   /* Finished with fetch and vs:
-    */
-   fetch_info = NULL;
-   vert_info = &llvm_vert_info;
 
    if ((opt & PT_SHADE) && gshader) {
       struct draw_vertex_shader *vshader = draw->vs.vertex_shader;
@@ -495,6 +526,182 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
 }
 
 
+static void
+llvm_segment_execute(void *data, int thread_index)
+{
+   struct llvm_segment *seg = (struct llvm_segment *) data;
+
+   /* same float environment as draw_vbo() sets up for the draw thread */
+   util_fpstate_set_denorms_to_zero(util_fpstate_get());
+
+   seg->clipped = llvm_vertex_shade(seg->fpme, seg->variant,
+                                    &seg->fetch_info, &seg->vert_info,
+                                    seg->start_or_maxelt, seg->vid_base,
+                                    seg->instance_id, seg->start_instance);
+}
+
+
+/**
+ * Wait for the oldest queued segment and run the rest of the pipeline
+ * on it.
+ */
+static void
+llvm_finish_segment(struct llvm_middle_end *fpme)
+{
+   struct llvm_segment *seg = &fpme->segments[fpme->first_segment];
+
+   assert(fpme->num_segments);
+
+   util_queue_fence_wait(&seg->fence);
+
+   fpme->first_segment = (fpme->first_segment + 1) % fpme->max_segments;
+   fpme->num_segments--;
+
+   llvm_pipeline_post_vs(fpme, &seg->vert_info, &seg->prim_info,
+                         seg->clipped);
+}
+
+
+/**
+ * Emit all queued segments, in order.
+ */
+static void
+llvm_finish_segments(struct llvm_middle_end *fpme)
+{
+   while (fpme->num_segments)
+      llvm_finish_segment(fpme);
+}
+
+
+/**
+ * Queue a segment for shading on the worker threads.  The element lists
+ * are copied since vsplit reuses its buffers for the next segment.
+ */
+static boolean
+llvm_queue_segment(struct llvm_middle_end *fpme,
+                   const struct draw_fetch_info *fetch_info,
+                   const struct draw_prim_info *prim_info,
+                   const struct draw_vertex_info *vert_info,
+                   unsigned start_or_maxelt,
+                   unsigned vid_base)
+{
+   struct draw_context *draw = fpme->draw;
+   struct llvm_segment *seg;
+
+   if (fpme->num_segments == fpme->max_segments)
+      llvm_finish_segment(fpme);
+
+   seg = &fpme->segments[(fpme->first_segment + fpme->num_segments) %
+                         fpme->max_segments];
+
+   if (!fetch_info->linear && fetch_info->count > seg->max_fetch_elts) {
+      unsigned *elts = REALLOC(seg->fetch_elts,
+                               seg->max_fetch_elts * sizeof(unsigned),
+                               fetch_info->count * sizeof(unsigned));
+      if (!elts)
+         return FALSE;
+      seg->fetch_elts = elts;
+      seg->max_fetch_elts = fetch_info->count;
+   }
+   if (!prim_info->linear && prim_info->count > seg->max_draw_elts) {
+      ushort *elts = REALLOC(seg->draw_elts,
+                             seg->max_draw_elts * sizeof(ushort),
+                             prim_info->count * sizeof(ushort));
+      if (!elts)
+         return FALSE;
+      seg->draw_elts = elts;
+      seg->max_draw_elts = prim_info->count;
+   }
+
+   seg->fpme = fpme;
+   seg->variant = fpme->current_variant;
+   seg->fetch_info = *fetch_info;
+   seg->prim_info = *prim_info;
+   seg->vert_info = *vert_info;
+   seg->draw_count = prim_info->count;
+   seg->prim_info.primitive_lengths = &seg->draw_count;
+
+   if (!fetch_info->linear) {
+      memcpy(seg->fetch_elts, fetch_info->elts,
+             fetch_info->count * sizeof(unsigned));
+      seg->fetch_info.elts = seg->fetch_elts;
+   }
+   if (!prim_info->linear) {
+      memcpy(seg->draw_elts, prim_info->elts,
+             prim_info->count * sizeof(ushort));
+      seg->prim_info.elts = seg->draw_elts;
+   }
+
+   seg->start_or_maxelt = start_or_maxelt;
+   seg->vid_base = vid_base;
+   seg->instance_id = draw->instance_id;
+   seg->start_instance = draw->start_instance;
+
+   fpme->num_segments++;
+   util_queue_add_job(&fpme->queue, seg, &seg->fence,
+                      llvm_segment_execute, NULL);
+   return TRUE;
+}
+
+
+static void
+llvm_pipeline_generic(struct draw_pt_middle_end *middle,
+                      const struct draw_fetch_info *fetch_info,
+                      const struct draw_prim_info *prim_info)
+{
+   struct llvm_middle_end *fpme = llvm_middle_end(middle);
+   struct draw_context *draw = fpme->draw;
+   struct draw_vertex_info llvm_vert_info;
+   boolean clipped;
+   unsigned start_or_maxelt, vid_base;
+
+   assert(fetch_info->count > 0);
+   llvm_vert_info.count = fetch_info->count;
+   llvm_vert_info.vertex_size = fpme->vertex_size;
+   llvm_vert_info.stride = fpme->vertex_size;
+   llvm_vert_info.verts = (struct vertex_header *)
+      MALLOC(fpme->vertex_size *
+             align(fetch_info->count, lp_native_vector_width / 32));
+   if (!llvm_vert_info.verts) {
+      assert(0);
+      return;
+   }
+
+   if (draw->collect_statistics) {
+      draw->statistics.ia_vertices += prim_info->count;
+      draw->statistics.ia_primitives +=
+         u_decomposed_prims_for_vertices(prim_info->prim, prim_info->count);
+      draw->statistics.vs_invocations += fetch_info->count;
+   }
+
+   if (fetch_info->linear) {
+      start_or_maxelt = fetch_info->start;
+      vid_base = draw->start_index;
+   }
+   else {
+      start_or_maxelt = draw->pt.user.eltMax;
+      vid_base = draw->pt.user.eltBias;
+   }
+
+   if (fpme->max_segments &&
+       fetch_info->count >= DRAW_LLVM_THREAD_MIN_VERTICES &&
+       llvm_queue_segment(fpme, fetch_info, prim_info, &llvm_vert_info,
+                          start_or_maxelt, vid_base)) {
+      return;
+   }
+
+   /* keep the emission order */
+   llvm_finish_segments(fpme);
+
+   clipped = llvm_vertex_shade(fpme, fpme->current_variant,
+                               fetch_info, &llvm_vert_info,
+                               start_or_maxelt, vid_base,
+                               draw->instance_id, draw->start_instance);
+
+   llvm_pipeline_post_vs(fpme, &llvm_vert_info, prim_info, clipped);
+}
+
+
 static inline unsigned
 prim_type(unsigned prim, unsigned flags)
 {
@@ -595,10 +802,17 @@ llvm_middle_end_linear_run_elts(struct draw_pt_middle_end *middle,
 }
 
 
+static void
+llvm_middle_end_flush(struct draw_pt_middle_end *middle)
+{
+   llvm_finish_segments(llvm_middle_end(middle));
+}
+
+
 static void
 llvm_middle_end_finish(struct draw_pt_middle_end *middle)
 {
-   /* nothing to do */
+   llvm_finish_segments(llvm_middle_end(middle));
 }
 
 
@@ -607,6 +821,20 @@ llvm_middle_end_destroy(struct draw_pt_middle_end *middle)
 {
    struct llvm_middle_end *fpme = llvm_middle_end(middle);
 
+   if (fpme->segments) {
+      unsigned i;
+
+      llvm_finish_segments(fpme);
+      util_queue_destroy(&fpme->queue);
+
+      for (i = 0; i < fpme->max_segments; i++) {
+         util_queue_fence_destroy(&fpme->segments[i].fence);
+         FREE(fpme->segments[i].fetch_elts);
+         FREE(fpme->segments[i].draw_elts);
+      }
+      FREE(fpme->segments);
+   }
+
    if (fpme->fetch)
       draw_pt_fetch_destroy( fpme->fetch );
 
@@ -623,6 +851,43 @@ llvm_middle_end_destroy(struct draw_pt_middle_end *middle)
 }
 
 
+/**
+ * Start the vertex shading threads, unless DRAW_THREADS says otherwise or
+ * there is just one CPU.  Without them everything runs on the draw thread.
+ */
+static void
+llvm_middle_end_init_threads(struct llvm_middle_end *fpme)
+{
+   unsigned num_threads, i;
+
+   num_threads = debug_get_num_option("DRAW_THREADS",
+                                      MIN2(util_cpu_caps.nr_cpus,
+                                           DRAW_LLVM_MAX_THREADS));
+   num_threads = MIN2(num_threads, DRAW_LLVM_MAX_THREADS);
+   if (num_threads < 2)
+      return;
+
+   /* enough segments in flight to keep all threads busy while emitting */
+   fpme->max_segments = 2 * num_threads;
+   fpme->segments = CALLOC(fpme->max_segments, sizeof *fpme->segments);
+   if (!fpme->segments) {
+      fpme->max_segments = 0;
+      return;
+   }
+
+   if (!util_queue_init(&fpme->queue, "draw_vs", fpme->max_segments,
+                        num_threads, 0)) {
+      FREE(fpme->segments);
+      fpme->segments = NULL;
+      fpme->max_segments = 0;
+      return;
+   }
+
+   for (i = 0; i < fpme->max_segments; i++)
+      util_queue_fence_init(&fpme->segments[i].fence);
+}
+
+
 struct draw_pt_middle_end *
 draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
 {
@@ -640,6 +905,7 @@ draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
    fpme->base.run             = llvm_middle_end_run;
    fpme->base.run_linear      = llvm_middle_end_linear_run;
    fpme->base.run_linear_elts = llvm_middle_end_linear_run_elts;
+   fpme->base.flush           = llvm_middle_end_flush;
    fpme->base.finish          = llvm_middle_end_finish;
    fpme->base.destroy         = llvm_middle_end_destroy;
 
@@ -667,6 +933,8 @@ draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
 
    fpme->current_variant = NULL;
 
+   llvm_middle_end_init_threads(fpme);
+
    return &fpme->base;
 
  fail:
@@ -33,6 +33,7 @@
 #include "util/u_memory.h"
 #include "util/simple_list.h"
 #include "util/os_time.h"
+#include "tgsi/tgsi_parse.h"
 #include "lp_bld.h"
 #include "lp_bld_debug.h"
 #include "lp_bld_misc.h"
@@ -104,8 +105,8 @@ enum LLVM_CodeGenOpt_Level {
 
 
 /**
- * Create the LLVM (optimization) pass manager and install
- * relevant optimization passes.
+ * Create the LLVM (optimization) pass manager.  The passes are only added
+ * by add_optimization_passes(), once the tier is known.
  * \return  TRUE for success, FALSE for failure
  */
 static boolean
@@ -136,7 +137,18 @@ create_pass_manager(struct gallivm_state *gallivm)
       free(td_str);
    }
 
-   if ((gallivm_debug & GALLIVM_DEBUG_NO_OPT) == 0) {
+   return TRUE;
+}
+
+
+/**
+ * Install the optimization passes for the module's tier.
+ */
+static void
+add_optimization_passes(struct gallivm_state *gallivm)
+{
+   if ((gallivm_debug & GALLIVM_DEBUG_NO_OPT) == 0 &&
+       gallivm->tier == GALLIVM_TIER_FULL) {
       /*
        * TODO: Evaluate passes some more - keeping in mind
        * both quality of generated code and compile times.
@@ -168,9 +180,11 @@ create_pass_manager(struct gallivm_state *gallivm)
        * unexpected ways.
        */
       LLVMAddPromoteMemoryToRegisterPass(gallivm->passmgr);
-   }
 
-   return TRUE;
+      /* Cheap, and it removes much of the redundancy of the generated IR. */
+      if ((gallivm_debug & GALLIVM_DEBUG_NO_OPT) == 0)
+         LLVMAddEarlyCSEPass(gallivm->passmgr);
+   }
 }
 
 
@@ -192,6 +206,11 @@ gallivm_free_ir(struct gallivm_state *gallivm)
       LLVMDisposeModule(gallivm->module);
    }
 
+   if (gallivm->cache) {
+      lp_free_objcache(gallivm->cache->jit_obj_cache);
+      gallivm->cache->jit_obj_cache = NULL;
+   }
+
    FREE(gallivm->module_name);
 
    if (!use_mcjit) {
@@ -214,6 +233,7 @@ gallivm_free_ir(struct gallivm_state *gallivm)
    gallivm->passmgr = NULL;
    gallivm->context = NULL;
    gallivm->builder = NULL;
+   gallivm->cache = NULL;
 }
 
 
@@ -243,6 +263,9 @@ init_gallivm_engine(struct gallivm_state *gallivm)
       if (gallivm_debug & GALLIVM_DEBUG_NO_OPT) {
          optlevel = None;
       }
+      else if (gallivm->tier == GALLIVM_TIER_FAST) {
+         optlevel = Less;
+      }
       else {
          optlevel = Default;
       }
@@ -253,6 +276,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
                                                     gallivm->memorymgr,
                                                     (unsigned) optlevel,
                                                     use_mcjit,
+                                                    gallivm->cache,
                                                     &error);
       if (ret) {
          _debug_printf("%s\n", error);
@@ -301,7 +325,7 @@ fail:
  */
 static boolean
 init_gallivm_state(struct gallivm_state *gallivm, const char *name,
-                   LLVMContextRef context)
+                   LLVMContextRef context, struct lp_cached_code *cache)
 {
    assert(!gallivm->context);
    assert(!gallivm->module);
@@ -310,6 +334,7 @@ init_gallivm_state(struct gallivm_state *gallivm, const char *name,
       return FALSE;
 
    gallivm->context = context;
+   gallivm->cache = cache;
 
    if (!gallivm->context)
       goto fail;
@@ -393,6 +418,55 @@ fail:
 }
 
 
+/**
+ * Start computing the disk cache key of a shader variant.
+ *
+ * Hashes what all generated code depends on (LLVM version, CPU features,
+ * vector width and debug flags), followed by the stage name, the shader
+ * tokens (if any) and the variant key.  Callers may add anything else the
+ * code depends on before calling _mesa_sha1_final().
+ */
+void
+lp_build_cache_key_init(struct mesa_sha1 *ctx, const char *stage,
+                        const struct tgsi_token *tokens,
+                        const void *key, size_t key_size)
+{
+   unsigned flags[3];
+
+   flags[0] = HAVE_LLVM;
+   flags[1] = lp_native_vector_width;
+   flags[2] = gallivm_debug;
+
+   _mesa_sha1_init(ctx);
+   _mesa_sha1_update(ctx, flags, sizeof flags);
+   _mesa_sha1_update(ctx, &util_cpu_caps, sizeof util_cpu_caps);
+   _mesa_sha1_update(ctx, stage, strlen(stage));
+   if (tokens)
+      _mesa_sha1_update(ctx, tokens,
+                        tgsi_num_tokens(tokens) * sizeof(struct tgsi_token));
+   _mesa_sha1_update(ctx, key, key_size);
+}
+
+
+/**
+ * Whether generated code may use AVX-512F.
+ *
+ * Older LLVM versions are known to miscompile AVX-512 code in the JIT, so
+ * the avx512 target attributes are only taken from util_cpu_caps with
+ * LLVM 6.0 or later (see lp_build_create_jit_compiler_for_module()).
+ */
+boolean
+lp_build_has_avx512(void)
+{
+#if (defined(PIPE_ARCH_X86) || defined(PIPE_ARCH_X86_64)) && \
+    HAVE_LLVM >= 0x0600
+   return util_cpu_caps.has_avx512f;
+#else
+   return FALSE;
+#endif
+}
+
+
 boolean
 lp_build_init(void)
 {
@@ -509,15 +583,18 @@ lp_build_init(void)
 
 /**
  * Create a new gallivm_state object.
+ * \param cache  optional cached object code for the module, must stay valid
+ *               until gallivm_free_ir() is called
  */
 struct gallivm_state *
-gallivm_create(const char *name, LLVMContextRef context)
+gallivm_create(const char *name, LLVMContextRef context,
+               struct lp_cached_code *cache)
 {
    struct gallivm_state *gallivm;
 
    gallivm = CALLOC_STRUCT(gallivm_state);
    if (gallivm) {
-      if (!init_gallivm_state(gallivm, name, context)) {
+      if (!init_gallivm_state(gallivm, name, context, cache)) {
          FREE(gallivm);
          gallivm = NULL;
       }
@@ -590,9 +667,11 @@ gallivm_compile_module(struct gallivm_state *gallivm)
       debug_printf("%s written\n", filename);
       debug_printf("Invoke as \"opt %s %s | llc -O%d %s%s\"\n",
                    gallivm_debug & GALLIVM_DEBUG_NO_OPT ? "-mem2reg" :
+                   gallivm->tier == GALLIVM_TIER_FAST ? "-mem2reg -early-cse" :
                    "-sroa -early-cse -simplifycfg -reassociate "
                    "-mem2reg -constprop -instcombine -gvn",
-                   filename, gallivm_debug & GALLIVM_DEBUG_NO_OPT ? 0 : 2,
+                   filename, gallivm_debug & GALLIVM_DEBUG_NO_OPT ? 0 :
+                   gallivm->tier == GALLIVM_TIER_FAST ? 1 : 2,
                    (HAVE_LLVM >= 0x0305) ? "[-mcpu=<-mcpu option>] " : "",
                    "[-mattr=<-mattr option(s)>]");
    }
@@ -600,27 +679,33 @@ gallivm_compile_module(struct gallivm_state *gallivm)
    if (gallivm_debug & GALLIVM_DEBUG_PERF)
       time_begin = os_time_get();
 
-   /* Run optimization passes */
-   LLVMInitializeFunctionPassManager(gallivm->passmgr);
-   func = LLVMGetFirstFunction(gallivm->module);
-   while (func) {
-      if (0) {
-         debug_printf("optimizing func %s...\n", LLVMGetValueName(func));
-      }
+   /*
+    * Run optimization passes, unless the object code comes from the cache,
+    * in which case the IR is only needed to look up the functions.
+    */
+   if (!gallivm->cache || !gallivm->cache->data_size) {
+      add_optimization_passes(gallivm);
+      LLVMInitializeFunctionPassManager(gallivm->passmgr);
+      func = LLVMGetFirstFunction(gallivm->module);
+      while (func) {
+         if (0) {
+            debug_printf("optimizing func %s...\n", LLVMGetValueName(func));
+         }
 
-   /* Disable frame pointer omission on debug/profile builds */
-   /* XXX: And workaround http://llvm.org/PR21435 */
+      /* Disable frame pointer omission on debug/profile builds */
+      /* XXX: And workaround http://llvm.org/PR21435 */
 #if HAVE_LLVM >= 0x0307 && \
     (defined(DEBUG) || defined(PROFILE) || \
      defined(PIPE_ARCH_X86) || defined(PIPE_ARCH_X86_64))
-      LLVMAddTargetDependentFunctionAttr(func, "no-frame-pointer-elim", "true");
-      LLVMAddTargetDependentFunctionAttr(func, "no-frame-pointer-elim-non-leaf", "true");
+         LLVMAddTargetDependentFunctionAttr(func, "no-frame-pointer-elim", "true");
+         LLVMAddTargetDependentFunctionAttr(func, "no-frame-pointer-elim-non-leaf", "true");
 #endif
 
-      LLVMRunFunctionPassManager(gallivm->passmgr, func);
-      func = LLVMGetNextFunction(func);
+         LLVMRunFunctionPassManager(gallivm->passmgr, func);
+         func = LLVMGetNextFunction(func);
+      }
+      LLVMFinalizeFunctionPassManager(gallivm->passmgr);
    }
-   LLVMFinalizeFunctionPassManager(gallivm->passmgr);
 
    if (gallivm_debug & GALLIVM_DEBUG_PERF) {
       int64_t time_end = os_time_get();
@@ -32,6 +32,7 @@
 
 #include "pipe/p_compiler.h"
 #include "util/u_pointer.h" // for func_pointer
+#include "util/mesa-sha1.h"
 #include "lp_bld.h"
 #include <llvm-c/ExecutionEngine.h>
 
@@ -39,6 +40,33 @@
 extern "C" {
 #endif
 
+/**
+ * Machine code of a compiled module, as stored in / loaded from an
+ * on-disk shader cache.
+ *
+ * If data_size is non-zero when the module is compiled, the optimization
+ * passes and code generation are skipped and the object code in data is
+ * loaded instead.  Otherwise the freshly generated object code is returned
+ * in data, unless dont_cache got set because the module references
+ * process-specific addresses (see lp_build_const_int_pointer).
+ */
+struct lp_cached_code {
+   void *data;
+   size_t data_size;
+   boolean dont_cache;
+   void *jit_obj_cache;
+};
+
+/**
+ * How hard to optimize a module.  Modules which are needed right away can
+ * be compiled at the fast tier first, and again at the full tier once it
+ * is clear that they are worth it.
+ */
+enum gallivm_tier {
+   GALLIVM_TIER_FULL = 0,  /**< all IR passes, -O2 code generation */
+   GALLIVM_TIER_FAST       /**< minimal IR passes, -O1 code generation */
+};
+
 struct gallivm_state
 {
    char *module_name;
@@ -50,6 +78,8 @@ struct gallivm_state
    LLVMBuilderRef builder;
    LLVMMCJITMemoryManagerRef memorymgr;
    struct lp_generated_code *code;
+   struct lp_cached_code *cache;
+   enum gallivm_tier tier;  /**< may be changed until the module is compiled */
    unsigned compiled;
 };
 
@@ -58,8 +88,21 @@ boolean
 lp_build_init(void);
 
 
+boolean
+lp_build_has_avx512(void);
+
+
+struct tgsi_token;
+
+void
+lp_build_cache_key_init(struct mesa_sha1 *ctx, const char *stage,
+                        const struct tgsi_token *tokens,
+                        const void *key, size_t key_size);
+
+
 struct gallivm_state *
-gallivm_create(const char *name, LLVMContextRef context);
+gallivm_create(const char *name, LLVMContextRef context,
+               struct lp_cached_code *cache);
 
 void
 gallivm_destroy(struct gallivm_state *gallivm);
@@ -1325,7 +1325,8 @@ lp_build_mipmap_level_sizes(struct lp_build_sample_context *bld,
                                                       bld->row_stride_array,
                                                       ilevel);
    }
-   if (dims == 3 || has_layer_coord(bld->static_texture_state->target)) {
+   if (dims == 3 || has_layer_coord(bld->static_texture_state->target) ||
+       bld->static_texture_state->num_samples > 1) {
       *img_stride_vec = lp_build_get_level_stride_vec(bld,
                                                       bld->img_stride_array,
                                                       ilevel);
@@ -2023,16 +2024,70 @@ lp_build_sample_partial_offset(struct lp_build_context *bld,
 }
 
 
+/**
+ * Compute the partial offset of a texel along the x or y axis of an image
+ * stored in the tiled layout (see LP_TEXTURE_TILE_SIZE).
+ *
+ * Only formats with 1x1 pixel blocks can be tiled, so there are no
+ * sub-block coordinates.
+ *
+ * @param axis        0 for x, 1 for y
+ * @param coord       coordinate in texels
+ * @param row_stride  row stride of the image, only used for the y axis
+ * @param out_offset  resulting relative offset of the texel in bytes
+ */
+void
+lp_build_sample_tiled_partial_offset(struct lp_build_context *bld,
+                                     const struct util_format_description *format_desc,
+                                     unsigned axis,
+                                     LLVMValueRef coord,
+                                     LLVMValueRef row_stride,
+                                     LLVMValueRef *out_offset)
+{
+   const unsigned tile_shift = util_logbase2(LP_TEXTURE_TILE_SIZE);
+   const unsigned texel_size = format_desc->block.bits / 8;
+   LLVMValueRef stride, tile_stride;
+   LLVMValueRef tile, subcoord;
+
+   assert(format_desc->block.width == 1);
+   assert(format_desc->block.height == 1);
+
+   if (axis == 0) {
+      stride = lp_build_const_int_vec(bld->gallivm, bld->type, texel_size);
+      tile_stride = lp_build_const_int_vec(bld->gallivm, bld->type,
+                                           texel_size * LP_TEXTURE_TILE_SIZE *
+                                           LP_TEXTURE_TILE_SIZE);
+   }
+   else {
+      stride = lp_build_const_int_vec(bld->gallivm, bld->type,
+                                      texel_size * LP_TEXTURE_TILE_SIZE);
+      tile_stride = lp_build_shl_imm(bld, row_stride, tile_shift);
+   }
+
+   tile = lp_build_shr_imm(bld, coord, tile_shift);
+   subcoord = lp_build_and(bld, coord,
+                           lp_build_const_int_vec(bld->gallivm, bld->type,
+                                                  LP_TEXTURE_TILE_SIZE - 1));
+
+   *out_offset = lp_build_add(bld,
+                              lp_build_mul(bld, tile, tile_stride),
+                              lp_build_mul(bld, subcoord, stride));
+}
+
+
 /**
  * Compute the offset of a pixel block.
  *
  * x, y, z, y_stride, z_stride are vectors, and they refer to pixels.
+ * If tiled is set the image is stored in the tiled layout, which only
+ * affects the x and y offsets.
  *
  * Returns the relative offset and i,j sub-block coordinates
  */
 void
 lp_build_sample_offset(struct lp_build_context *bld,
                        const struct util_format_description *format_desc,
+                       boolean tiled,
                        LLVMValueRef x,
                        LLVMValueRef y,
                        LLVMValueRef z,
@@ -2045,20 +2100,35 @@ lp_build_sample_offset(struct lp_build_context *bld,
    LLVMValueRef x_stride;
    LLVMValueRef offset;
 
-   x_stride = lp_build_const_vec(bld->gallivm, bld->type,
-                                 format_desc->block.bits/8);
+   if (tiled) {
+      assert(y && y_stride);
+      lp_build_sample_tiled_partial_offset(bld, format_desc, 0,
+                                           x, NULL, &offset);
+      *out_i = bld->zero;
+   }
+   else {
+      x_stride = lp_build_const_vec(bld->gallivm, bld->type,
+                                    format_desc->block.bits/8);
 
-   lp_build_sample_partial_offset(bld,
-                                  format_desc->block.width,
-                                  x, x_stride,
-                                  &offset, out_i);
+      lp_build_sample_partial_offset(bld,
+                                     format_desc->block.width,
+                                     x, x_stride,
+                                     &offset, out_i);
+   }
 
    if (y && y_stride) {
       LLVMValueRef y_offset;
-      lp_build_sample_partial_offset(bld,
-                                     format_desc->block.height,
-                                     y, y_stride,
-                                     &y_offset, out_j);
+      if (tiled) {
+         lp_build_sample_tiled_partial_offset(bld, format_desc, 1,
+                                              y, y_stride, &y_offset);
+         *out_j = bld->zero;
+      }
+      else {
+         lp_build_sample_partial_offset(bld,
+                                        format_desc->block.height,
+                                        y, y_stride,
+                                        &y_offset, out_j);
+      }
       offset = lp_build_add(bld, offset, y_offset);
    }
    else {
@@ -122,6 +122,17 @@ struct lp_sampler_size_query_params
    LLVMValueRef explicit_lod;
    LLVMValueRef *sizes_out;
 };
+
+
+/**
+ * Width and height, in texels, of the tiles of images stored in the tiled
+ * layout (see lp_static_texture_state::tiled).  The texels of a tile are
+ * stored contiguously in row-major order, the tiles of a tile row follow
+ * each other, and tile rows are LP_TEXTURE_TILE_SIZE row strides apart.
+ */
+#define LP_TEXTURE_TILE_SIZE 4
+
+
 /**
  * Texture static state.
  *
@@ -143,6 +154,8 @@ struct lp_static_texture_state
    unsigned pot_height:1;
    unsigned pot_depth:1;
    unsigned level_zero_only:1;
+   unsigned num_samples:5;   /**< 0 or 1 if not multisampled, set by driver */
+   unsigned tiled:1;         /**< tiled storage layout, set by driver */
 };
 
 
@@ -590,9 +603,19 @@ lp_build_sample_partial_offset(struct lp_build_context *bld,
                                LLVMValueRef *out_i);
 
 
+void
+lp_build_sample_tiled_partial_offset(struct lp_build_context *bld,
+                                     const struct util_format_description *format_desc,
+                                     unsigned axis,
+                                     LLVMValueRef coord,
+                                     LLVMValueRef row_stride,
+                                     LLVMValueRef *out_offset);
+
+
 void
 lp_build_sample_offset(struct lp_build_context *bld,
                        const struct util_format_description *format_desc,
+                       boolean tiled,
                        LLVMValueRef x,
                        LLVMValueRef y,
                        LLVMValueRef z,
@@ -139,6 +139,7 @@ lp_build_sample_texel_soa(struct lp_build_sample_context *bld,
    /* convert x,y,z coords to linear offset from start of texture, in bytes */
    lp_build_sample_offset(&bld->int_coord_bld,
                           bld->format_desc,
+                          bld->static_texture_state->tiled,
                           x, y, z, y_stride, z_stride,
                           &offset, &i, &j);
    if (mipoffsets) {
@@ -2638,6 +2639,30 @@ lp_build_fetch_texel(struct lp_build_sample_context *bld,
       }
    }
 
+   if (bld->static_texture_state->num_samples > 1) {
+      /*
+       * Samples are stored as consecutive images of each layer, so the
+       * sample index (coords[3]) just selects a slice.
+       */
+      LLVMValueRef num_samples =
+         lp_build_const_int_vec(bld->gallivm, int_coord_bld->type,
+                                bld->static_texture_state->num_samples);
+      LLVMValueRef sample = coords[3];
+
+      out1 = lp_build_cmp(int_coord_bld, PIPE_FUNC_LESS, sample, int_coord_bld->zero);
+      out_of_bounds = lp_build_or(int_coord_bld, out_of_bounds, out1);
+      out1 = lp_build_cmp(int_coord_bld, PIPE_FUNC_GEQUAL, sample, num_samples);
+      out_of_bounds = lp_build_or(int_coord_bld, out_of_bounds, out1);
+
+      if (target == PIPE_TEXTURE_2D_ARRAY) {
+         z = lp_build_mul(int_coord_bld, z, num_samples);
+         z = lp_build_add(int_coord_bld, z, sample);
+      }
+      else {
+         z = sample;
+      }
+   }
+
    /* This is a lot like border sampling */
    if (offsets[0]) {
       /*
@@ -2673,6 +2698,7 @@ lp_build_fetch_texel(struct lp_build_sample_context *bld,
 
    lp_build_sample_offset(int_coord_bld,
                           bld->format_desc,
+                          bld->static_texture_state->tiled,
                           x, y, z, row_stride_vec, img_stride_vec,
                           &offset, &i, &j);
 
@@ -170,6 +170,10 @@ struct lp_bld_tgsi_system_values {
    LLVMValueRef prim_id;
    LLVMValueRef basevertex;
    LLVMValueRef invocation_id;
+   LLVMValueRef thread_id[3];   /**< per-lane invocation id within the block */
+   LLVMValueRef block_id[3];
+   LLVMValueRef grid_size[3];
+   LLVMValueRef block_size[3];
 };
 
 
@@ -198,6 +202,76 @@ struct lp_build_sampler_soa
 };
 
 
+/**
+ * Image load/store/atomic/size query parameters.
+ */
+struct lp_img_params
+{
+   struct lp_type type;
+   LLVMValueRef image_index;     /**< per-lane image unit (uint vector) */
+   unsigned target;              /**< TGSI_TEXTURE_x */
+   unsigned img_op;              /**< TGSI_OPCODE_LOAD/STORE/ATOMx/RESQ */
+   LLVMValueRef context_ptr;
+   LLVMValueRef exec_mask;
+   LLVMValueRef coords[3];       /**< int vectors, unused ones are NULL */
+   LLVMValueRef indata[4];       /**< store data or atomic operand */
+   LLVMValueRef indata2[4];      /**< atomic compare-and-swap value */
+   LLVMValueRef *outdata;        /**< 4 int vectors, for all but STORE */
+};
+
+
+/**
+ * Image code generation interface.
+ *
+ * Like the sampler interface, this leaves the actual image access strategy
+ * to the driver.
+ */
+struct lp_build_image_soa
+{
+   void
+   (*destroy)( struct lp_build_image_soa *image );
+
+   void
+   (*emit_op)(const struct lp_build_image_soa *image,
+              struct gallivm_state *gallivm,
+              const struct lp_img_params *params);
+};
+
+
+/**
+ * Shader storage buffers, shared memory and images.
+ *
+ * ssbo_ptr and ssbo_sizes_ptr point to arrays of LP_MAX_TGSI_SHADER_BUFFERS
+ * int32 base pointers and sizes in bytes.  Unbound buffers must have a size
+ * of zero; accesses outside a buffer are discarded and read as zero.
+ *
+ * The barrier fields are only used by compute shaders.  A TGSI BARRIER
+ * splits the shader into phases, one returning where the next one starts.
+ * The caller runs phase 0 for all the invocations of a block, then phase 1,
+ * and so on.  Temporaries live in barrier_spill_ptr so that they survive
+ * from one phase to the next.  That only works for barriers in the main
+ * program's top-level control flow.  Barriers anywhere else need
+ * barrier_func instead, which a BARRIER calls with barrier_arg; the caller
+ * suspends the invocations there until all of them have reached it.
+ */
+struct lp_build_tgsi_mem_iface
+{
+   LLVMValueRef ssbo_ptr;
+   LLVMValueRef ssbo_sizes_ptr;
+
+   LLVMValueRef shared_ptr;      /**< shared memory, as an int32 pointer */
+   LLVMValueRef shared_size;     /**< its size in bytes (int32) */
+
+   const struct lp_build_image_soa *image;
+
+   LLVMValueRef barrier_phase;      /**< int32 phase to run, or NULL */
+   LLVMValueRef barrier_spill_ptr;  /**< per-invocation-vector temps */
+
+   LLVMValueRef barrier_func;       /**< void (*)(barrier_arg), or NULL */
+   LLVMValueRef barrier_arg;
+};
+
+
 struct lp_build_sampler_aos
 {
    LLVMValueRef
@@ -230,7 +304,8 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
                   LLVMValueRef thread_data_ptr,
                   const struct lp_build_sampler_soa *sampler,
                   const struct tgsi_shader_info *info,
-                  const struct lp_build_tgsi_gs_iface *gs_iface);
+                  const struct lp_build_tgsi_gs_iface *gs_iface,
+                  const struct lp_build_tgsi_mem_iface *mem_iface);
 
 
 void
@@ -398,6 +473,12 @@ struct lp_build_tgsi_context
      */
    void (*emit_prologue)(struct lp_build_tgsi_context*);
 
+   /** Like emit_prologue, but called once all declarations and immediates
+     * have been processed, right before the first instruction is emitted.
+     * Optional.
+     */
+   void (*emit_prologue_post_decl)(struct lp_build_tgsi_context*);
+
    /** This function allows the user to insert some instructions at the end of
      * the program.  This callback is intended to be used for emitting
      * instructions to handle the export for the output registers, but it can
@@ -456,6 +537,11 @@ struct lp_build_tgsi_soa_context
 
    struct tgsi_declaration_sampler_view sv[PIPE_MAX_SHADER_SAMPLER_VIEWS];
 
+   const struct lp_build_tgsi_mem_iface *mem_iface;
+   LLVMValueRef dummy_mem;        /**< target of masked memory accesses */
+   LLVMValueRef barrier_switch;
+   unsigned num_barrier_phases;
+
    LLVMValueRef immediates[LP_MAX_INLINED_IMMEDIATES][TGSI_NUM_CHANNELS];
    LLVMValueRef temps[LP_MAX_INLINED_TEMPS][TGSI_NUM_CHANNELS];
    LLVMValueRef addr[LP_MAX_TGSI_ADDRS][TGSI_NUM_CHANNELS];
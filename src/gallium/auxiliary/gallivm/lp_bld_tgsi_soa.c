@@ -1658,6 +1658,36 @@ emit_fetch_system_value(
       atype = TGSI_TYPE_UNSIGNED;
       break;
 
+   case TGSI_SEMANTIC_THREAD_ID:
+      res = swizzle < 3 ? bld->system_values.thread_id[swizzle] :
+                          bld_base->uint_bld.zero;
+      atype = TGSI_TYPE_UNSIGNED;
+      break;
+
+   case TGSI_SEMANTIC_BLOCK_ID:
+      res = swizzle < 3 ?
+         lp_build_broadcast_scalar(&bld_base->uint_bld,
+                                   bld->system_values.block_id[swizzle]) :
+         bld_base->uint_bld.zero;
+      atype = TGSI_TYPE_UNSIGNED;
+      break;
+
+   case TGSI_SEMANTIC_GRID_SIZE:
+      res = swizzle < 3 ?
+         lp_build_broadcast_scalar(&bld_base->uint_bld,
+                                   bld->system_values.grid_size[swizzle]) :
+         bld_base->uint_bld.zero;
+      atype = TGSI_TYPE_UNSIGNED;
+      break;
+
+   case TGSI_SEMANTIC_BLOCK_SIZE:
+      res = swizzle < 3 ?
+         lp_build_broadcast_scalar(&bld_base->uint_bld,
+                                   bld->system_values.block_size[swizzle]) :
+         bld_base->uint_bld.zero;
+      atype = TGSI_TYPE_UNSIGNED;
+      break;
+
    default:
       assert(!"unexpected semantic in emit_fetch_system_value");
       res = bld_base->base.zero;
@@ -2490,10 +2520,6 @@ emit_fetch_texels( struct lp_build_tgsi_soa_context *bld,
       explicit_lod = lp_build_emit_fetch(&bld->bld_base, inst, 0, 3);
       lod_property = lp_build_lod_property(&bld->bld_base, inst, 0);
    }
-   /*
-    * XXX: for real msaa support, the w component (or src2.x for sample_i_ms)
-    * would be the sample index.
-    */
 
    for (i = 0; i < dims; i++) {
       coords[i] = lp_build_emit_fetch(&bld->bld_base, inst, 0, i);
@@ -2504,6 +2530,15 @@ emit_fetch_texels( struct lp_build_tgsi_soa_context *bld,
    }
    if (layer_coord)
       coords[2] = lp_build_emit_fetch(&bld->bld_base, inst, 0, layer_coord);
+   /*
+    * For msaa targets the w component (or src2.x for sample_i_ms) is the
+    * sample index.
+    */
+   if (inst->Instruction.Opcode == TGSI_OPCODE_SAMPLE_I_MS)
+      coords[3] = lp_build_emit_fetch(&bld->bld_base, inst, 2, 0);
+   else if (target == TGSI_TEXTURE_2D_MSAA ||
+            target == TGSI_TEXTURE_2D_ARRAY_MSAA)
+      coords[3] = lp_build_emit_fetch(&bld->bld_base, inst, 0, 3);
 
    if (inst->Texture.NumOffsets == 1) {
       unsigned dim;
@@ -3652,6 +3687,558 @@ cont_emit(
    lp_exec_continue(&bld->exec_mask);
 }
 
+/**
+ * Execution mask for memory accesses: the control flow mask combined with
+ * the shader's kill/coverage mask.
+ */
+static LLVMValueRef
+get_memory_exec_mask(struct lp_build_tgsi_soa_context *bld)
+{
+   if (bld->mask)
+      return mask_vec(&bld->bld_base);
+   if (bld->exec_mask.has_mask)
+      return bld->exec_mask.exec_mask;
+   return LLVMConstAllOnes(bld->bld_base.int_bld.vec_type);
+}
+
+/**
+ * Dword which masked or out of bounds memory accesses are redirected to.
+ */
+static LLVMValueRef
+get_dummy_mem(struct lp_build_tgsi_soa_context *bld)
+{
+   struct gallivm_state *gallivm = bld->bld_base.base.gallivm;
+
+   if (!bld->dummy_mem) {
+      bld->dummy_mem =
+         lp_build_alloca_undef(gallivm,
+                               LLVMInt32TypeInContext(gallivm->context),
+                               "dummy_mem");
+   }
+   return bld->dummy_mem;
+}
+
+/**
+ * Per-lane resource unit of a memory instruction operand.
+ */
+static LLVMValueRef
+get_resource_index(struct lp_build_tgsi_soa_context *bld,
+                   unsigned file, unsigned index, boolean indirect,
+                   const struct tgsi_ind_register *indirect_reg)
+{
+   if (indirect)
+      return get_indirect_index(bld, file, index, indirect_reg);
+
+   return lp_build_const_int_vec(bld->bld_base.base.gallivm,
+                                 bld->bld_base.uint_bld.type, index);
+}
+
+/**
+ * Get the base pointer and size in bytes of the buffer (or shared memory)
+ * accessed by each lane.
+ */
+static void
+get_memory_lanes(struct lp_build_tgsi_soa_context *bld,
+                 unsigned file, LLVMValueRef index_vec,
+                 LLVMValueRef *base, LLVMValueRef *size)
+{
+   struct gallivm_state *gallivm = bld->bld_base.base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   const struct lp_build_tgsi_mem_iface *mem_iface = bld->mem_iface;
+   unsigned i;
+
+   for (i = 0; i < bld->bld_base.base.type.length; i++) {
+      if (file == TGSI_FILE_MEMORY) {
+         base[i] = mem_iface->shared_ptr;
+         size[i] = mem_iface->shared_size;
+      }
+      else {
+         LLVMValueRef index =
+            LLVMBuildExtractElement(builder, index_vec,
+                                    lp_build_const_int32(gallivm, i), "");
+         base[i] = lp_build_array_get(gallivm, mem_iface->ssbo_ptr, index);
+         size[i] = lp_build_array_get(gallivm, mem_iface->ssbo_sizes_ptr,
+                                      index);
+      }
+   }
+}
+
+/**
+ * Return a pointer to the dword at byte offset 'offset' of a buffer, or to
+ * a dummy location if the access is out of bounds or the lane is inactive.
+ * Whether the access is valid is returned in 'valid'.
+ */
+static LLVMValueRef
+get_memory_dword_ptr(struct lp_build_tgsi_soa_context *bld,
+                     LLVMValueRef base, LLVMValueRef size,
+                     LLVMValueRef offset, LLVMValueRef active,
+                     LLVMValueRef *valid)
+{
+   struct gallivm_state *gallivm = bld->bld_base.base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef in_bounds, remaining, ptr;
+
+   in_bounds = LLVMBuildICmp(builder, LLVMIntULT, offset, size, "");
+   remaining = LLVMBuildSub(builder, size, offset, "");
+   in_bounds = LLVMBuildAnd(builder, in_bounds,
+                            LLVMBuildICmp(builder, LLVMIntUGE, remaining,
+                                          lp_build_const_int32(gallivm, 4),
+                                          ""), "");
+   if (active)
+      in_bounds = LLVMBuildAnd(builder, in_bounds, active, "");
+
+   offset = LLVMBuildLShr(builder, offset, lp_build_const_int32(gallivm, 2),
+                          "");
+   ptr = LLVMBuildGEP(builder, base, &offset, 1, "");
+   ptr = LLVMBuildSelect(builder, in_bounds, ptr, get_dummy_mem(bld), "");
+
+   *valid = in_bounds;
+   return ptr;
+}
+
+static LLVMValueRef
+lane_active(struct lp_build_tgsi_soa_context *bld,
+            LLVMValueRef mask, unsigned lane)
+{
+   struct gallivm_state *gallivm = bld->bld_base.base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef m;
+
+   m = LLVMBuildExtractElement(builder, mask,
+                               lp_build_const_int32(gallivm, lane), "");
+   return LLVMBuildICmp(builder, LLVMIntNE, m,
+                        LLVMConstNull(LLVMTypeOf(m)), "");
+}
+
+/**
+ * Common part of image instructions: fill in the image parameters and
+ * let the driver emit the access.
+ */
+static void
+emit_image_op(struct lp_build_tgsi_soa_context *bld,
+              const struct tgsi_full_instruction *inst,
+              LLVMValueRef image_index,
+              unsigned coord_src,
+              LLVMValueRef *outdata)
+{
+   struct lp_build_tgsi_context *bld_base = &bld->bld_base;
+   struct lp_img_params params;
+   unsigned opcode = inst->Instruction.Opcode;
+   unsigned i, dims;
+
+   memset(&params, 0, sizeof params);
+   params.type = bld_base->base.type;
+   params.image_index = image_index;
+   params.target = inst->Memory.Texture;
+   params.img_op = opcode;
+   params.context_ptr = bld->context_ptr;
+   params.exec_mask = get_memory_exec_mask(bld);
+   params.outdata = outdata;
+
+   if (opcode != TGSI_OPCODE_RESQ) {
+      dims = tgsi_util_get_texture_coord_dim(inst->Memory.Texture);
+      for (i = 0; i < MIN2(dims, 3); i++) {
+         params.coords[i] = lp_build_emit_fetch_src(bld_base,
+                                                    &inst->Src[coord_src],
+                                                    TGSI_TYPE_SIGNED, i);
+      }
+   }
+
+   if (opcode == TGSI_OPCODE_STORE) {
+      for (i = 0; i < 4; i++) {
+         params.indata[i] = lp_build_emit_fetch_src(bld_base, &inst->Src[1],
+                                                    TGSI_TYPE_UNSIGNED, i);
+      }
+   }
+   else if (opcode != TGSI_OPCODE_LOAD && opcode != TGSI_OPCODE_RESQ) {
+      for (i = 0; i < 4; i++) {
+         params.indata[i] = lp_build_emit_fetch_src(bld_base, &inst->Src[2],
+                                                    TGSI_TYPE_UNSIGNED, i);
+         if (opcode == TGSI_OPCODE_ATOMCAS)
+            params.indata2[i] = lp_build_emit_fetch_src(bld_base,
+                                                        &inst->Src[3],
+                                                        TGSI_TYPE_UNSIGNED,
+                                                        i);
+      }
+   }
+
+   bld->mem_iface->image->emit_op(bld->mem_iface->image,
+                                  bld_base->base.gallivm, &params);
+}
+
+/**
+ * LOAD from a shader buffer, shared memory or an image.
+ *
+ * Buffer and shared memory loads are done one lane at a time; channel c
+ * of the destination reads the dword at byte offset src1.x + 4 * c.
+ */
+static void
+load_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   const struct tgsi_full_src_register *res = &inst->Src[0];
+   unsigned length = bld_base->base.type.length;
+   LLVMValueRef base[LP_MAX_VECTOR_LENGTH], size[LP_MAX_VECTOR_LENGTH];
+   LLVMValueRef index_vec, offset_vec;
+   unsigned chan, i;
+
+   if (!bld->mem_iface) {
+      assert(0);
+      return;
+   }
+
+   index_vec = get_resource_index(bld, res->Register.File,
+                                  res->Register.Index,
+                                  res->Register.Indirect, &res->Indirect);
+
+   if (res->Register.File == TGSI_FILE_IMAGE) {
+      emit_image_op(bld, inst, index_vec, 1, emit_data->output);
+      return;
+   }
+
+   offset_vec = lp_build_emit_fetch_src(bld_base, &inst->Src[1],
+                                        TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+   get_memory_lanes(bld, res->Register.File, index_vec, base, size);
+
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+      LLVMValueRef result = uint_bld->undef;
+
+      for (i = 0; i < length; i++) {
+         LLVMValueRef lane = lp_build_const_int32(gallivm, i);
+         LLVMValueRef offset, ptr, valid, value;
+
+         offset = LLVMBuildExtractElement(builder, offset_vec, lane, "");
+         offset = LLVMBuildAdd(builder, offset,
+                               lp_build_const_int32(gallivm, 4 * chan), "");
+         ptr = get_memory_dword_ptr(bld, base[i], size[i], offset, NULL,
+                                    &valid);
+         value = LLVMBuildLoad(builder, ptr, "");
+         value = LLVMBuildSelect(builder, valid, value,
+                                 lp_build_const_int32(gallivm, 0), "");
+         result = LLVMBuildInsertElement(builder, result, value, lane, "");
+      }
+      emit_data->output[chan] = result;
+   }
+}
+
+/**
+ * STORE to a shader buffer, shared memory or an image.
+ */
+static void
+store_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   const struct tgsi_full_dst_register *res = &inst->Dst[0];
+   unsigned length = bld_base->base.type.length;
+   LLVMValueRef base[LP_MAX_VECTOR_LENGTH], size[LP_MAX_VECTOR_LENGTH];
+   LLVMValueRef index_vec, offset_vec, exec_mask;
+   unsigned chan, i;
+
+   if (!bld->mem_iface) {
+      assert(0);
+      return;
+   }
+
+   index_vec = get_resource_index(bld, res->Register.File,
+                                  res->Register.Index,
+                                  res->Register.Indirect, &res->Indirect);
+
+   if (res->Register.File == TGSI_FILE_IMAGE) {
+      emit_image_op(bld, inst, index_vec, 0, NULL);
+      return;
+   }
+
+   exec_mask = get_memory_exec_mask(bld);
+   offset_vec = lp_build_emit_fetch_src(bld_base, &inst->Src[0],
+                                        TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+   get_memory_lanes(bld, res->Register.File, index_vec, base, size);
+
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+      LLVMValueRef value_vec = lp_build_emit_fetch_src(bld_base,
+                                                       &inst->Src[1],
+                                                       TGSI_TYPE_UNSIGNED,
+                                                       chan);
+
+      for (i = 0; i < length; i++) {
+         LLVMValueRef lane = lp_build_const_int32(gallivm, i);
+         LLVMValueRef offset, ptr, valid, value;
+
+         offset = LLVMBuildExtractElement(builder, offset_vec, lane, "");
+         offset = LLVMBuildAdd(builder, offset,
+                               lp_build_const_int32(gallivm, 4 * chan), "");
+         ptr = get_memory_dword_ptr(bld, base[i], size[i], offset,
+                                    lane_active(bld, exec_mask, i), &valid);
+         value = LLVMBuildExtractElement(builder, value_vec, lane, "");
+         LLVMBuildStore(builder, value, ptr);
+      }
+   }
+}
+
+/**
+ * Atomic operations on a shader buffer, shared memory or an image.
+ * For buffers and shared memory, channel c operates on the dword at byte
+ * offset src1.x + 4 * c with operand src2.c, and returns its previous value.
+ */
+static void
+atomic_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   const struct tgsi_full_src_register *res = &inst->Src[0];
+   unsigned opcode = inst->Instruction.Opcode;
+   unsigned length = bld_base->base.type.length;
+   LLVMValueRef base[LP_MAX_VECTOR_LENGTH], size[LP_MAX_VECTOR_LENGTH];
+   LLVMValueRef index_vec, offset_vec, exec_mask;
+   LLVMAtomicRMWBinOp op = LLVMAtomicRMWBinOpAdd;
+   unsigned chan, i;
+
+   if (!bld->mem_iface) {
+      assert(0);
+      return;
+   }
+
+   index_vec = get_resource_index(bld, res->Register.File,
+                                  res->Register.Index,
+                                  res->Register.Indirect, &res->Indirect);
+
+   if (res->Register.File == TGSI_FILE_IMAGE) {
+      emit_image_op(bld, inst, index_vec, 1, emit_data->output);
+      return;
+   }
+
+   switch (opcode) {
+   case TGSI_OPCODE_ATOMUADD:
+      op = LLVMAtomicRMWBinOpAdd;
+      break;
+   case TGSI_OPCODE_ATOMXCHG:
+      op = LLVMAtomicRMWBinOpXchg;
+      break;
+   case TGSI_OPCODE_ATOMAND:
+      op = LLVMAtomicRMWBinOpAnd;
+      break;
+   case TGSI_OPCODE_ATOMOR:
+      op = LLVMAtomicRMWBinOpOr;
+      break;
+   case TGSI_OPCODE_ATOMXOR:
+      op = LLVMAtomicRMWBinOpXor;
+      break;
+   case TGSI_OPCODE_ATOMUMIN:
+      op = LLVMAtomicRMWBinOpUMin;
+      break;
+   case TGSI_OPCODE_ATOMUMAX:
+      op = LLVMAtomicRMWBinOpUMax;
+      break;
+   case TGSI_OPCODE_ATOMIMIN:
+      op = LLVMAtomicRMWBinOpMin;
+      break;
+   case TGSI_OPCODE_ATOMIMAX:
+      op = LLVMAtomicRMWBinOpMax;
+      break;
+   case TGSI_OPCODE_ATOMCAS:
+      break;
+   default:
+      assert(0);
+      break;
+   }
+
+   exec_mask = get_memory_exec_mask(bld);
+   offset_vec = lp_build_emit_fetch_src(bld_base, &inst->Src[1],
+                                        TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+   get_memory_lanes(bld, res->Register.File, index_vec, base, size);
+
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+      LLVMValueRef value_vec, value2_vec = NULL;
+      LLVMValueRef result = uint_bld->undef;
+
+      value_vec = lp_build_emit_fetch_src(bld_base, &inst->Src[2],
+                                          TGSI_TYPE_UNSIGNED, chan);
+      if (opcode == TGSI_OPCODE_ATOMCAS)
+         value2_vec = lp_build_emit_fetch_src(bld_base, &inst->Src[3],
+                                              TGSI_TYPE_UNSIGNED, chan);
+
+      for (i = 0; i < length; i++) {
+         LLVMValueRef lane = lp_build_const_int32(gallivm, i);
+         LLVMValueRef offset, ptr, valid, value, old;
+
+         offset = LLVMBuildExtractElement(builder, offset_vec, lane, "");
+         offset = LLVMBuildAdd(builder, offset,
+                               lp_build_const_int32(gallivm, 4 * chan), "");
+         ptr = get_memory_dword_ptr(bld, base[i], size[i], offset,
+                                    lane_active(bld, exec_mask, i), &valid);
+         value = LLVMBuildExtractElement(builder, value_vec, lane, "");
+
+         if (opcode == TGSI_OPCODE_ATOMCAS) {
+            LLVMValueRef value2 =
+               LLVMBuildExtractElement(builder, value2_vec, lane, "");
+#if HAVE_LLVM >= 0x0306
+            old = LLVMBuildAtomicCmpXchg(builder, ptr, value, value2,
+                                         LLVMAtomicOrderingSequentiallyConsistent,
+                                         LLVMAtomicOrderingSequentiallyConsistent,
+                                         FALSE);
+            old = LLVMBuildExtractValue(builder, old, 0, "");
+#else
+            /* Not atomic, but compute isn't exposed with such old LLVM. */
+            LLVMValueRef equal;
+            old = LLVMBuildLoad(builder, ptr, "");
+            equal = LLVMBuildICmp(builder, LLVMIntEQ, old, value, "");
+            LLVMBuildStore(builder,
+                           LLVMBuildSelect(builder, equal, value2, old, ""),
+                           ptr);
+#endif
+         }
+         else {
+            old = LLVMBuildAtomicRMW(builder, op, ptr, value,
+                                     LLVMAtomicOrderingSequentiallyConsistent,
+                                     FALSE);
+         }
+
+         old = LLVMBuildSelect(builder, valid, old,
+                               lp_build_const_int32(gallivm, 0), "");
+         result = LLVMBuildInsertElement(builder, result, old, lane, "");
+      }
+      emit_data->output[chan] = result;
+   }
+}
+
+/**
+ * Size of a shader buffer in bytes, or of an image.
+ */
+static void
+resq_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   const struct tgsi_full_src_register *res = &inst->Src[0];
+   LLVMValueRef base[LP_MAX_VECTOR_LENGTH], size[LP_MAX_VECTOR_LENGTH];
+   LLVMValueRef index_vec, result = uint_bld->undef;
+   unsigned chan, i;
+
+   if (!bld->mem_iface) {
+      assert(0);
+      return;
+   }
+
+   index_vec = get_resource_index(bld, res->Register.File,
+                                  res->Register.Index,
+                                  res->Register.Indirect, &res->Indirect);
+
+   if (res->Register.File == TGSI_FILE_IMAGE) {
+      emit_image_op(bld, inst, index_vec, 0, emit_data->output);
+      return;
+   }
+
+   get_memory_lanes(bld, res->Register.File, index_vec, base, size);
+   for (i = 0; i < bld_base->base.type.length; i++) {
+      result = LLVMBuildInsertElement(builder, result, size[i],
+                                      lp_build_const_int32(gallivm, i), "");
+   }
+
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+      emit_data->output[chan] = result;
+   }
+}
+
+/**
+ * Memory barrier: a full fence orders this invocation's buffer and shared
+ * memory accesses with respect to other threads.
+ */
+static void
+membar_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+#if HAVE_LLVM >= 0x0306
+   LLVMBuildFence(bld_base->base.gallivm->builder,
+                  LLVMAtomicOrderingSequentiallyConsistent, FALSE, "");
+#endif
+}
+
+/**
+ * Workgroup barrier: call the caller's barrier function, or end the current
+ * phase of the shader.
+ *
+ * All invocations of the block run a phase before any of them starts the
+ * next one (see lp_build_tgsi_mem_iface), so returning here is all that is
+ * needed.  Only barriers in the main program's top-level control flow can
+ * be handled this way; anywhere else needs a barrier function.
+ */
+static void
+barrier_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_exec_mask *mask = &bld->exec_mask;
+   struct function_ctx *ctx = func_ctx(mask);
+   LLVMBasicBlockRef resume;
+
+   if (bld->mem_iface && bld->mem_iface->barrier_func) {
+      LLVMValueRef arg = bld->mem_iface->barrier_arg;
+      LLVMBuildCall(builder, bld->mem_iface->barrier_func, &arg, 1, "");
+      return;
+   }
+
+   /* A single invocation vector per block doesn't need to be split. */
+   if (!bld->barrier_switch)
+      return;
+
+   if (mask->function_stack_size > 1 ||
+       ctx->cond_stack_size ||
+       ctx->loop_stack_size ||
+       ctx->switch_stack_size) {
+      assert(!"BARRIER inside control flow");
+      return;
+   }
+
+   LLVMBuildRetVoid(builder);
+
+   resume = lp_build_insert_new_block(gallivm, "barrier_resume");
+   LLVMAddCase(bld->barrier_switch,
+               lp_build_const_int32(gallivm, bld->num_barrier_phases++),
+               resume);
+   LLVMPositionBuilderAtEnd(builder, resume);
+
+   /*
+    * Nothing defined before the barrier is available here, but at the top
+    * level the masks are all trivial.  (A return from main before a barrier
+    * isn't allowed.)
+    */
+   mask->ret_in_main = FALSE;
+   mask->exec_mask = mask->ret_mask = mask->break_mask = mask->cont_mask =
+         mask->cond_mask = mask->switch_mask =
+         LLVMConstAllOnes(mask->int_vec_type);
+   lp_exec_mask_update(mask);
+}
+
 static void emit_prologue(struct lp_build_tgsi_context * bld_base)
 {
    struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
@@ -3659,9 +4246,16 @@ static void emit_prologue(struct lp_build_tgsi_context * bld_base)
 
    if (bld->indirect_files & (1 << TGSI_FILE_TEMPORARY)) {
       unsigned array_size = bld_base->info->file_max[TGSI_FILE_TEMPORARY] * 4 + 4;
-      bld->temps_array = lp_build_alloca_undef(gallivm,
-                                               LLVMArrayType(bld_base->base.vec_type, array_size),
-                                               "temp_array");
+      LLVMTypeRef array_type = LLVMArrayType(bld_base->base.vec_type, array_size);
+      if (bld->mem_iface && bld->mem_iface->barrier_spill_ptr) {
+         bld->temps_array = LLVMBuildBitCast(gallivm->builder,
+                                             bld->mem_iface->barrier_spill_ptr,
+                                             LLVMPointerType(array_type, 0),
+                                             "temp_array");
+      } else {
+         bld->temps_array = lp_build_alloca_undef(gallivm, array_type,
+                                                  "temp_array");
+      }
    }
 
    if (bld->indirect_files & (1 << TGSI_FILE_OUTPUT)) {
@@ -3739,6 +4333,35 @@ static void emit_prologue(struct lp_build_tgsi_context * bld_base)
    }
 }
 
+/**
+ * Dispatch to the requested phase of a shader split by barriers.
+ */
+static void emit_prologue_post_decl(struct lp_build_tgsi_context * bld_base)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state * gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMBasicBlockRef phase0_block, done_block;
+
+   if (!bld->mem_iface || !bld->mem_iface->barrier_phase)
+      return;
+
+   phase0_block = lp_build_insert_new_block(gallivm, "phase0");
+   done_block = lp_build_insert_new_block(gallivm, "phase_done");
+
+   bld->barrier_switch =
+      LLVMBuildSwitch(builder, bld->mem_iface->barrier_phase, done_block,
+                      bld_base->info->opcode_count[TGSI_OPCODE_BARRIER] + 1);
+   LLVMAddCase(bld->barrier_switch, lp_build_const_int32(gallivm, 0),
+               phase0_block);
+   bld->num_barrier_phases = 1;
+
+   LLVMPositionBuilderAtEnd(builder, done_block);
+   LLVMBuildRetVoid(builder);
+
+   LLVMPositionBuilderAtEnd(builder, phase0_block);
+}
+
 static void emit_epilogue(struct lp_build_tgsi_context * bld_base)
 {
    struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
@@ -3791,7 +4414,8 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
                   LLVMValueRef thread_data_ptr,
                   const struct lp_build_sampler_soa *sampler,
                   const struct tgsi_shader_info *info,
-                  const struct lp_build_tgsi_gs_iface *gs_iface)
+                  const struct lp_build_tgsi_gs_iface *gs_iface,
+                  const struct lp_build_tgsi_mem_iface *mem_iface)
 {
    struct lp_build_tgsi_soa_context bld;
 
@@ -3837,6 +4461,7 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
    bld.indirect_files = info->indirect_files;
    bld.context_ptr = context_ptr;
    bld.thread_data_ptr = thread_data_ptr;
+   bld.mem_iface = mem_iface;
 
    /*
     * If the number of temporaries is rather large then we just
@@ -3846,6 +4471,13 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
    if (info->file_max[TGSI_FILE_TEMPORARY] >= LP_MAX_INLINED_TEMPS) {
       bld.indirect_files |= (1 << TGSI_FILE_TEMPORARY);
    }
+   /*
+    * Temporaries must survive barriers, so keep them in the caller's
+    * spill memory.
+    */
+   if (mem_iface && mem_iface->barrier_spill_ptr) {
+      bld.indirect_files |= (1 << TGSI_FILE_TEMPORARY);
+   }
    /*
     * For performance reason immediates are always backed in a static
     * array, but if their number is too great, we have to use just
@@ -3871,6 +4503,7 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
    bld.bld_base.emit_immediate = lp_emit_immediate_soa;
 
    bld.bld_base.emit_prologue = emit_prologue;
+   bld.bld_base.emit_prologue_post_decl = emit_prologue_post_decl;
    bld.bld_base.emit_epilogue = emit_epilogue;
 
    /* Set opcode actions */
@@ -3921,6 +4554,22 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
    bld.bld_base.op_actions[TGSI_OPCODE_SVIEWINFO].emit = sviewinfo_emit;
    bld.bld_base.op_actions[TGSI_OPCODE_LOD].emit = lod_emit;
 
+   bld.bld_base.op_actions[TGSI_OPCODE_LOAD].emit = load_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_STORE].emit = store_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_RESQ].emit = resq_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMUADD].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMXCHG].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMCAS].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMAND].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMOR].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMXOR].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMUMIN].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMUMAX].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMIMIN].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMIMAX].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_MEMBAR].emit = membar_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_BARRIER].emit = barrier_emit;
+
 
    if (gs_iface) {
       /* There's no specific value for this because it should always
@@ -69,6 +69,9 @@
 
 #define FAST_MATH 0
 
+/** Execute the common ALU instructions from a pre-decoded form */
+#define FAST_PATH 1
+
 #define TILE_TOP_LEFT     0
 #define TILE_TOP_RIGHT    1
 #define TILE_BOTTOM_LEFT  2
@@ -1016,6 +1019,16 @@ print_temp(const struct tgsi_exec_machine *mach, uint index)
 #endif
 
 
+static void
+translate_fast_instructions(struct tgsi_exec_machine *mach);
+
+static void
+update_fast_constants(struct tgsi_exec_machine *mach);
+
+static void
+free_fast_instructions(struct tgsi_exec_machine *mach);
+
+
 void
 tgsi_exec_set_constant_buffers(struct tgsi_exec_machine *mach,
                                unsigned num_bufs,
@@ -1028,6 +1041,8 @@ tgsi_exec_set_constant_buffers(struct tgsi_exec_machine *mach,
       mach->Consts[i] = bufs[i];
       mach->ConstsSize[i] = buf_sizes[i];
    }
+
+   update_fast_constants(mach);
 }
 
 
@@ -1127,6 +1142,8 @@ tgsi_exec_machine_bind_shader(
       mach->Instructions = NULL;
       mach->NumInstructions = 0;
 
+      free_fast_instructions(mach);
+
       return;
    }
 
@@ -1273,6 +1290,8 @@ tgsi_exec_machine_bind_shader(
    FREE(mach->Instructions);
    mach->Instructions = instructions;
    mach->NumInstructions = numInstructions;
+
+   translate_fast_instructions(mach);
 }
 
 
@@ -1337,6 +1356,7 @@ tgsi_exec_machine_destroy(struct tgsi_exec_machine *mach)
    if (mach) {
       FREE(mach->Instructions);
       FREE(mach->Declarations);
+      free_fast_instructions(mach);
 
       align_free(mach->Inputs);
       align_free(mach->Outputs);
@@ -6050,6 +6070,463 @@ exec_instruction(
    return FALSE;
 }
 
+/*
+ * Fast path for the common ALU instructions.
+ *
+ * Most of the time spent in exec_instruction() on straight-line arithmetic
+ * goes into decoding the full instruction again for every quad: the opcode
+ * switch, and for every source channel the swizzle lookup, the index setup
+ * and the switch over the register file in fetch_src_file_channel().  When
+ * a shader is bound, instructions whose operands only use direct addressing
+ * are translated into a tgsi_exec_fast_inst that points straight at the
+ * channels to read and write, with the swizzle already applied.  Immediates
+ * and constants are broadcast into tgsi_exec_fast_const slots so that they
+ * can be read like any other register; constants are refreshed whenever the
+ * constant buffers are set.
+ *
+ * The same micro_* functions are used, in the same order, as in
+ * exec_instruction(), so results are bit-identical.  Anything else, (control
+ * flow, texturing, indirect addressing, geometry shaders...), still goes
+ * through exec_instruction().
+ */
+
+enum fast_op {
+   FAST_OP_NONE = 0,       /**< use exec_instruction() */
+   FAST_OP_UNARY,
+   FAST_OP_BINARY,
+   FAST_OP_TRINARY,
+   FAST_OP_SCALAR_UNARY,   /**< src.x, replicated to all channels */
+   FAST_OP_DOT             /**< DP2/DP3/DP4 */
+};
+
+struct fast_src {
+   const union tgsi_exec_channel *chan[TGSI_NUM_CHANNELS];
+   boolean abs;
+   boolean neg;
+};
+
+struct tgsi_exec_fast_inst {
+   enum fast_op op;
+   union {
+      micro_unary_op unary;
+      micro_binary_op binary;
+      micro_trinary_op trinary;
+   } func;
+   uint num_chans;         /**< for FAST_OP_DOT */
+   uint writemask;
+   boolean saturate;
+   union tgsi_exec_channel *dst[TGSI_NUM_CHANNELS];
+   struct fast_src src[3];
+};
+
+struct tgsi_exec_fast_const {
+   union tgsi_exec_channel value;
+   int buf;                /**< constant buffer, or -1 for an immediate */
+   int pos;                /**< uint offset within the constant buffer */
+};
+
+static void
+free_fast_instructions(struct tgsi_exec_machine *mach)
+{
+   FREE(mach->FastInstructions);
+   mach->FastInstructions = NULL;
+
+   FREE(mach->FastConsts);
+   mach->FastConsts = NULL;
+   mach->NumFastConsts = 0;
+}
+
+static void
+update_fast_constant(const struct tgsi_exec_machine *mach,
+                     struct tgsi_exec_fast_const *c)
+{
+   const uint *buf = (const uint *) mach->Consts[c->buf];
+   uint val = 0;
+   uint i;
+
+   /* same bounds check as fetch_src_file_channel() */
+   if (buf && c->pos < (int) mach->ConstsSize[c->buf])
+      val = buf[c->pos];
+
+   for (i = 0; i < TGSI_QUAD_SIZE; i++)
+      c->value.u[i] = val;
+}
+
+static void
+update_fast_constants(struct tgsi_exec_machine *mach)
+{
+   uint i;
+
+   for (i = 0; i < mach->NumFastConsts; i++) {
+      if (mach->FastConsts[i].buf >= 0)
+         update_fast_constant(mach, &mach->FastConsts[i]);
+   }
+}
+
+static boolean
+translate_fast_src(struct tgsi_exec_machine *mach,
+                   const struct tgsi_full_src_register *reg,
+                   struct fast_src *src)
+{
+   const uint file = reg->Register.File;
+   const int index = reg->Register.Index;
+   int buf = 0;
+   uint chan;
+
+   if (reg->Register.Indirect || index < 0)
+      return FALSE;
+
+   if (reg->Register.Dimension) {
+      if (file != TGSI_FILE_CONSTANT || reg->Dimension.Indirect)
+         return FALSE;
+      buf = reg->Dimension.Index;
+      if (buf < 0 || buf >= PIPE_MAX_CONSTANT_BUFFERS)
+         return FALSE;
+   }
+
+   src->abs = reg->Register.Absolute;
+   src->neg = reg->Register.Negate;
+
+   for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++) {
+      const uint swizzle = tgsi_util_get_full_src_register_swizzle(reg, chan);
+      struct tgsi_exec_fast_const *c;
+      uint i;
+
+      switch (file) {
+      case TGSI_FILE_TEMPORARY:
+         if (index >= TGSI_EXEC_NUM_TEMPS)
+            return FALSE;
+         src->chan[chan] = &mach->Temps[index].xyzw[swizzle];
+         break;
+
+      case TGSI_FILE_INPUT:
+         if (!mach->Inputs || index >= PIPE_MAX_SHADER_INPUTS)
+            return FALSE;
+         src->chan[chan] = &mach->Inputs[index].xyzw[swizzle];
+         break;
+
+      case TGSI_FILE_OUTPUT:
+         if (!mach->Outputs || index >= PIPE_MAX_SHADER_OUTPUTS)
+            return FALSE;
+         src->chan[chan] = &mach->Outputs[index].xyzw[swizzle];
+         break;
+
+      case TGSI_FILE_SYSTEM_VALUE:
+         if (index >= TGSI_MAX_MISC_INPUTS)
+            return FALSE;
+         src->chan[chan] = &mach->SystemValue[index].xyzw[swizzle];
+         break;
+
+      case TGSI_FILE_IMMEDIATE:
+         if (index >= (int) mach->ImmLimit)
+            return FALSE;
+         c = &mach->FastConsts[mach->NumFastConsts++];
+         c->buf = -1;
+         c->pos = 0;
+         for (i = 0; i < TGSI_QUAD_SIZE; i++)
+            c->value.f[i] = mach->Imms[index][swizzle];
+         src->chan[chan] = &c->value;
+         break;
+
+      case TGSI_FILE_CONSTANT:
+         c = &mach->FastConsts[mach->NumFastConsts++];
+         c->buf = buf;
+         c->pos = index * 4 + swizzle;
+         update_fast_constant(mach, c);
+         src->chan[chan] = &c->value;
+         break;
+
+      default:
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+static boolean
+translate_fast_dst(struct tgsi_exec_machine *mach,
+                   const struct tgsi_full_dst_register *reg,
+                   struct tgsi_exec_fast_inst *fi)
+{
+   const int index = reg->Register.Index;
+   uint chan;
+
+   if (reg->Register.Indirect || reg->Register.Dimension || index < 0)
+      return FALSE;
+
+   for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++) {
+      switch (reg->Register.File) {
+      case TGSI_FILE_TEMPORARY:
+         if (index >= TGSI_EXEC_NUM_TEMPS)
+            return FALSE;
+         fi->dst[chan] = &mach->Temps[index].xyzw[chan];
+         break;
+
+      case TGSI_FILE_OUTPUT:
+         /* The output offset in TEMP_OUTPUT is only non-zero for GS */
+         if (!mach->Outputs || index >= PIPE_MAX_SHADER_OUTPUTS)
+            return FALSE;
+         fi->dst[chan] = &mach->Outputs[index].xyzw[chan];
+         break;
+
+      default:
+         return FALSE;
+      }
+   }
+
+   fi->writemask = reg->Register.WriteMask;
+   return TRUE;
+}
+
+static boolean
+translate_fast_instruction(struct tgsi_exec_machine *mach,
+                           const struct tgsi_full_instruction *inst,
+                           struct tgsi_exec_fast_inst *fi)
+{
+   uint i;
+
+   switch (inst->Instruction.Opcode) {
+   case TGSI_OPCODE_MOV:
+      fi->op = FAST_OP_UNARY;
+      fi->func.unary = micro_mov;
+      break;
+   case TGSI_OPCODE_FRC:
+      fi->op = FAST_OP_UNARY;
+      fi->func.unary = micro_frc;
+      break;
+   case TGSI_OPCODE_FLR:
+      fi->op = FAST_OP_UNARY;
+      fi->func.unary = micro_flr;
+      break;
+   case TGSI_OPCODE_ADD:
+      fi->op = FAST_OP_BINARY;
+      fi->func.binary = micro_add;
+      break;
+   case TGSI_OPCODE_MUL:
+      fi->op = FAST_OP_BINARY;
+      fi->func.binary = micro_mul;
+      break;
+   case TGSI_OPCODE_MIN:
+      fi->op = FAST_OP_BINARY;
+      fi->func.binary = micro_min;
+      break;
+   case TGSI_OPCODE_MAX:
+      fi->op = FAST_OP_BINARY;
+      fi->func.binary = micro_max;
+      break;
+   case TGSI_OPCODE_SLT:
+      fi->op = FAST_OP_BINARY;
+      fi->func.binary = micro_slt;
+      break;
+   case TGSI_OPCODE_SGE:
+      fi->op = FAST_OP_BINARY;
+      fi->func.binary = micro_sge;
+      break;
+   case TGSI_OPCODE_SEQ:
+      fi->op = FAST_OP_BINARY;
+      fi->func.binary = micro_seq;
+      break;
+   case TGSI_OPCODE_SNE:
+      fi->op = FAST_OP_BINARY;
+      fi->func.binary = micro_sne;
+      break;
+   case TGSI_OPCODE_MAD:
+      fi->op = FAST_OP_TRINARY;
+      fi->func.trinary = micro_mad;
+      break;
+   case TGSI_OPCODE_LRP:
+      fi->op = FAST_OP_TRINARY;
+      fi->func.trinary = micro_lrp;
+      break;
+   case TGSI_OPCODE_RCP:
+      fi->op = FAST_OP_SCALAR_UNARY;
+      fi->func.unary = micro_rcp;
+      break;
+   case TGSI_OPCODE_RSQ:
+      fi->op = FAST_OP_SCALAR_UNARY;
+      fi->func.unary = micro_rsq;
+      break;
+   case TGSI_OPCODE_DP2:
+      fi->op = FAST_OP_DOT;
+      fi->num_chans = 2;
+      break;
+   case TGSI_OPCODE_DP3:
+      fi->op = FAST_OP_DOT;
+      fi->num_chans = 3;
+      break;
+   case TGSI_OPCODE_DP4:
+      fi->op = FAST_OP_DOT;
+      fi->num_chans = 4;
+      break;
+   default:
+      return FALSE;
+   }
+
+   if (inst->Instruction.NumDstRegs != 1 ||
+       inst->Instruction.NumSrcRegs > ARRAY_SIZE(fi->src))
+      return FALSE;
+
+   if (!translate_fast_dst(mach, &inst->Dst[0], fi))
+      return FALSE;
+
+   for (i = 0; i < inst->Instruction.NumSrcRegs; i++) {
+      if (!translate_fast_src(mach, &inst->Src[i], &fi->src[i]))
+         return FALSE;
+   }
+
+   fi->saturate = inst->Instruction.Saturate;
+   return TRUE;
+}
+
+static void
+translate_fast_instructions(struct tgsi_exec_machine *mach)
+{
+   uint i;
+
+   free_fast_instructions(mach);
+
+   /* Outputs are offset per emitted vertex and inputs are two-dimensional,
+    * leave geometry shaders to exec_instruction().
+    */
+   if (!FAST_PATH || mach->ShaderType == PIPE_SHADER_GEOMETRY ||
+       !mach->NumInstructions)
+      return;
+
+   mach->FastInstructions = CALLOC(mach->NumInstructions,
+                                   sizeof(struct tgsi_exec_fast_inst));
+   /* worst case, every channel of every source is an immediate/constant */
+   mach->FastConsts = MALLOC(mach->NumInstructions * 3 * TGSI_NUM_CHANNELS *
+                             sizeof(struct tgsi_exec_fast_const));
+   if (!mach->FastInstructions || !mach->FastConsts) {
+      free_fast_instructions(mach);
+      return;
+   }
+
+   for (i = 0; i < mach->NumInstructions; i++) {
+      struct tgsi_exec_fast_inst *fi = &mach->FastInstructions[i];
+      const uint num_consts = mach->NumFastConsts;
+
+      if (!translate_fast_instruction(mach, &mach->Instructions[i], fi)) {
+         memset(fi, 0, sizeof(*fi));
+         mach->NumFastConsts = num_consts;
+      }
+   }
+}
+
+static inline void
+fetch_fast_src(union tgsi_exec_channel *chan,
+               const struct fast_src *src,
+               uint chan_index)
+{
+   *chan = *src->chan[chan_index];
+
+   if (src->abs)
+      micro_abs(chan, chan);
+   if (src->neg)
+      micro_neg(chan, chan);
+}
+
+static void
+exec_fast_instruction(struct tgsi_exec_machine *mach,
+                      const struct tgsi_exec_fast_inst *fi)
+{
+   const uint execmask = mach->ExecMask;
+   struct tgsi_exec_vector result;
+   union tgsi_exec_channel src[3];
+   boolean scalar = FALSE;
+   uint chan, i;
+
+   switch (fi->op) {
+   case FAST_OP_UNARY:
+      for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++) {
+         if (fi->writemask & (1 << chan)) {
+            fetch_fast_src(&src[0], &fi->src[0], chan);
+            fi->func.unary(&result.xyzw[chan], &src[0]);
+         }
+      }
+      break;
+
+   case FAST_OP_BINARY:
+      for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++) {
+         if (fi->writemask & (1 << chan)) {
+            fetch_fast_src(&src[0], &fi->src[0], chan);
+            fetch_fast_src(&src[1], &fi->src[1], chan);
+            fi->func.binary(&result.xyzw[chan], &src[0], &src[1]);
+         }
+      }
+      break;
+
+   case FAST_OP_TRINARY:
+      for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++) {
+         if (fi->writemask & (1 << chan)) {
+            fetch_fast_src(&src[0], &fi->src[0], chan);
+            fetch_fast_src(&src[1], &fi->src[1], chan);
+            fetch_fast_src(&src[2], &fi->src[2], chan);
+            fi->func.trinary(&result.xyzw[chan], &src[0], &src[1], &src[2]);
+         }
+      }
+      break;
+
+   case FAST_OP_SCALAR_UNARY:
+      fetch_fast_src(&src[0], &fi->src[0], TGSI_CHAN_X);
+      fi->func.unary(&result.xyzw[0], &src[0]);
+      scalar = TRUE;
+      break;
+
+   case FAST_OP_DOT:
+      fetch_fast_src(&src[0], &fi->src[0], TGSI_CHAN_X);
+      fetch_fast_src(&src[1], &fi->src[1], TGSI_CHAN_X);
+      micro_mul(&result.xyzw[0], &src[0], &src[1]);
+
+      for (chan = TGSI_CHAN_Y; chan < fi->num_chans; chan++) {
+         fetch_fast_src(&src[0], &fi->src[0], chan);
+         fetch_fast_src(&src[1], &fi->src[1], chan);
+         micro_mad(&result.xyzw[0], &src[0], &src[1], &result.xyzw[0]);
+      }
+      scalar = TRUE;
+      break;
+
+   default:
+      assert(0);
+      return;
+   }
+
+   /* same as store_dest() */
+   for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++) {
+      const union tgsi_exec_channel *val;
+      union tgsi_exec_channel *dst;
+
+      if (!(fi->writemask & (1 << chan)))
+         continue;
+
+      val = &result.xyzw[scalar ? 0 : chan];
+      dst = fi->dst[chan];
+
+      if (!fi->saturate) {
+         if (execmask == 0xf) {
+            *dst = *val;
+         }
+         else {
+            for (i = 0; i < TGSI_QUAD_SIZE; i++)
+               if (execmask & (1 << i))
+                  dst->i[i] = val->i[i];
+         }
+      }
+      else {
+         for (i = 0; i < TGSI_QUAD_SIZE; i++)
+            if (execmask & (1 << i)) {
+               if (val->f[i] < 0.0f)
+                  dst->f[i] = 0.0f;
+               else if (val->f[i] > 1.0f)
+                  dst->f[i] = 1.0f;
+               else
+                  dst->i[i] = val->i[i];
+            }
+      }
+   }
+}
+
 static void
 tgsi_exec_machine_setup_masks(struct tgsi_exec_machine *mach)
 {
@@ -6128,7 +6605,15 @@ tgsi_exec_machine_run( struct tgsi_exec_machine *mach, int start_pc )
 #endif
 
          assert(mach->pc < (int) mach->NumInstructions);
-         barrier_hit = exec_instruction(mach, mach->Instructions + mach->pc, &mach->pc);
+         if (mach->FastInstructions &&
+             mach->FastInstructions[mach->pc].op != FAST_OP_NONE) {
+            exec_fast_instruction(mach, mach->FastInstructions + mach->pc);
+            mach->pc++;
+            barrier_hit = FALSE;
+         }
+         else {
+            barrier_hit = exec_instruction(mach, mach->Instructions + mach->pc, &mach->pc);
+         }
 
          /* for compute shaders if we hit a barrier return now for later rescheduling */
          if (barrier_hit && mach->ShaderType == PIPE_SHADER_COMPUTE)
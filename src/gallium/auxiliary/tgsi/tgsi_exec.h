@@ -342,6 +342,9 @@ enum tgsi_break_type {
 #define TGSI_EXEC_MAX_BREAK_STACK (TGSI_EXEC_MAX_LOOP_NESTING + TGSI_EXEC_MAX_SWITCH_NESTING)
 
 
+struct tgsi_exec_fast_inst;
+struct tgsi_exec_fast_const;
+
 /**
  * Run-time virtual machine state for executing TGSI shader.
  */
@@ -445,6 +448,12 @@ struct tgsi_exec_machine
    struct tgsi_full_declaration *Declarations;
    uint NumDeclarations;
 
+   /** Pre-decoded form of Instructions, NULL if the fast path isn't used */
+   struct tgsi_exec_fast_inst *FastInstructions;
+   /** Immediates/constants read by FastInstructions, broadcast to a quad */
+   struct tgsi_exec_fast_const *FastConsts;
+   uint NumFastConsts;
+
    struct tgsi_declaration_sampler_view
       SamplerViews[PIPE_MAX_SHADER_SAMPLER_VIEWS];
 
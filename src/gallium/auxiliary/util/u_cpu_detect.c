@@ -37,6 +37,10 @@
 #include "u_debug.h"
 #include "u_cpu_detect.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #if defined(PIPE_ARCH_PPC)
 #if defined(PIPE_OS_APPLE)
 #include <sys/sysctl.h>
@@ -61,6 +65,7 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <elf.h>
+#include <dirent.h>
 #endif
 
 #ifdef PIPE_OS_UNIX
@@ -355,6 +360,134 @@ check_os_arm_support(void)
 }
 #endif /* PIPE_ARCH_ARM */
 
+#if defined(PIPE_OS_LINUX)
+static boolean
+read_sysfs_uint(const char *path, unsigned *value)
+{
+   FILE *f = fopen(path, "r");
+   boolean ret;
+
+   if (!f)
+      return FALSE;
+   ret = fscanf(f, "%u", value) == 1;
+   fclose(f);
+   return ret;
+}
+
+
+/**
+ * Find the NUMA node of a CPU by looking for the nodeN link in its
+ * sysfs directory.  Kernels built without NUMA have no such link, in
+ * which case everything is on node 0.
+ */
+static unsigned
+get_cpu_node(const char *cpu_dir)
+{
+   DIR *dir = opendir(cpu_dir);
+   struct dirent *entry;
+   unsigned node = 0;
+
+   if (!dir)
+      return 0;
+
+   while ((entry = readdir(dir)) != NULL) {
+      if (strncmp(entry->d_name, "node", 4) == 0 &&
+          entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+         node = strtoul(entry->d_name + 4, NULL, 10);
+         break;
+      }
+   }
+
+   closedir(dir);
+   return node;
+}
+
+static int
+compare_cpu_location(const void *a, const void *b)
+{
+   const struct util_cpu_location *la = a;
+   const struct util_cpu_location *lb = b;
+
+   if (la->smt != lb->smt)
+      return la->smt < lb->smt ? -1 : 1;
+   if (la->node != lb->node)
+      return la->node < lb->node ? -1 : 1;
+   if (la->package != lb->package)
+      return la->package < lb->package ? -1 : 1;
+   if (la->core != lb->core)
+      return la->core < lb->core ? -1 : 1;
+   return la->cpu < lb->cpu ? -1 : la->cpu > lb->cpu;
+}
+#endif /* PIPE_OS_LINUX */
+
+
+/**
+ * Query the location of each online logical CPU.
+ *
+ * The returned list is ordered so that consecutive entries fill
+ * distinct physical cores of one NUMA node before moving on to the next
+ * node, and only then to the SMT siblings.  Assigning worker threads to
+ * the list in order therefore keeps them on separate cores and close to
+ * each other for as long as possible.
+ *
+ * Returns the number of entries written, which is zero if the topology
+ * can't be determined on this platform.
+ */
+unsigned
+util_cpu_get_topology(struct util_cpu_location *cpus, unsigned max_cpus)
+{
+   unsigned count = 0;
+
+#if defined(PIPE_OS_LINUX)
+   unsigned i, j, cpu;
+   unsigned missing = 0;
+
+   /* CPU numbers may be sparse when some are offline; give up after a run
+    * of missing entries rather than trusting nr_cpus.
+    */
+   for (cpu = 0; count < max_cpus && missing < 64; cpu++) {
+      char path[128];
+      struct util_cpu_location *loc = &cpus[count];
+
+      snprintf(path, sizeof path,
+               "/sys/devices/system/cpu/cpu%u/topology/core_id", cpu);
+      if (!read_sysfs_uint(path, &loc->core)) {
+         missing++;
+         continue;
+      }
+      missing = 0;
+
+      snprintf(path, sizeof path,
+               "/sys/devices/system/cpu/cpu%u/topology/physical_package_id",
+               cpu);
+      if (!read_sysfs_uint(path, &loc->package))
+         loc->package = 0;
+
+      snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%u", cpu);
+      loc->node = get_cpu_node(path);
+      loc->cpu = cpu;
+      loc->smt = 0;
+      count++;
+   }
+
+   for (i = 0; i < count; i++) {
+      for (j = 0; j < i; j++) {
+         if (cpus[j].package == cpus[i].package &&
+             cpus[j].core == cpus[i].core)
+            cpus[i].smt++;
+      }
+   }
+
+   qsort(cpus, count, sizeof cpus[0], compare_cpu_location);
+#else
+   (void)cpus;
+   (void)max_cpus;
+#endif
+
+   return count;
+}
+
+
 void
 util_cpu_detect(void)
 {
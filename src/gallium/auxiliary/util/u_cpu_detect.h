@@ -91,6 +91,21 @@ util_cpu_caps;
 void util_cpu_detect(void);
 
 
+/**
+ * Location of one logical CPU in the machine topology.
+ */
+struct util_cpu_location {
+   unsigned cpu;      /**< logical CPU number, as used for affinity */
+   unsigned node;     /**< NUMA node */
+   unsigned package;  /**< physical package (socket) */
+   unsigned core;     /**< core id within the package */
+   unsigned smt;      /**< index of this hardware thread within its core */
+};
+
+unsigned
+util_cpu_get_topology(struct util_cpu_location *cpus, unsigned max_cpus);
+
+
 #ifdef	__cplusplus
 }
 #endif
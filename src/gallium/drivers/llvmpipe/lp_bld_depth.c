@@ -410,6 +410,38 @@ get_s_shift_and_mask(const struct util_format_description *format_desc,
 }
 
 
+/**
+ * Compute the depth of a multisample sample from the depth at the pixel
+ * centre.  Window z is linear in screen space, so this is exact.
+ *
+ * \param z  depth at the pixel centre
+ * \param dzdx, dzdy  scalar screen space depth derivatives
+ * \param x_offset, y_offset  sample position relative to the pixel centre
+ */
+LLVMValueRef
+lp_build_sample_depth(struct gallivm_state *gallivm,
+                      struct lp_type type,
+                      LLVMValueRef z,
+                      LLVMValueRef dzdx,
+                      LLVMValueRef dzdy,
+                      float x_offset,
+                      float y_offset)
+{
+   struct lp_build_context bld;
+
+   assert(type.floating);
+   lp_build_context_init(&bld, gallivm, type);
+
+   dzdx = lp_build_broadcast_scalar(&bld, dzdx);
+   dzdy = lp_build_broadcast_scalar(&bld, dzdy);
+
+   z = lp_build_mad(&bld, dzdx, lp_build_const_vec(gallivm, type, x_offset), z);
+   z = lp_build_mad(&bld, dzdy, lp_build_const_vec(gallivm, type, y_offset), z);
+
+   return z;
+}
+
+
 /**
  * Perform the occlusion test and increase the counter.
  * Test the depth mask. Add the number of channel which has none zero mask
@@ -457,6 +489,26 @@ lp_build_occlusion_count(struct gallivm_state *gallivm,
                                        LLVMInt32TypeInContext(context), bits);
       count = LLVMBuildZExt(builder, count, LLVMIntTypeInContext(context, 64), "");
    }
+   else if(util_cpu_caps.has_avx && type.length == 16) {
+      /* movmsk each half, rather than a 128-bit popcount */
+      const char *movmskintr = "llvm.x86.avx.movmsk.ps.256";
+      const char *popcntintr = "llvm.ctpop.i32";
+      LLVMValueRef bits, lo, hi;
+
+      bits = LLVMBuildBitCast(builder, maskvalue,
+                              lp_build_vec_type(gallivm, type), "");
+      lo = lp_build_extract_range(gallivm, bits, 0, 8);
+      hi = lp_build_extract_range(gallivm, bits, 8, 8);
+      lo = lp_build_intrinsic_unary(builder, movmskintr,
+                                    LLVMInt32TypeInContext(context), lo);
+      hi = lp_build_intrinsic_unary(builder, movmskintr,
+                                    LLVMInt32TypeInContext(context), hi);
+      hi = LLVMBuildShl(builder, hi, lp_build_const_int32(gallivm, 8), "");
+      bits = LLVMBuildOr(builder, lo, hi, "");
+      count = lp_build_intrinsic_unary(builder, popcntintr,
+                                       LLVMInt32TypeInContext(context), bits);
+      count = LLVMBuildZExt(builder, count, LLVMIntTypeInContext(context, 64), "");
+   }
    else {
       unsigned i;
       LLVMValueRef countv = LLVMBuildAnd(builder, maskvalue, countmask, "countv");
@@ -511,6 +563,124 @@ lp_build_occlusion_count(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Position of the pixels of a 4x4 block in the fragment shader's 16-wide
+ * vectors (four 2x2 quads), given their linear position in the block, and
+ * vice versa, as the permutation is its own inverse:
+ * 0,1,4,5,2,3,6,7,8,9,12,13,10,11,14,15.
+ */
+static inline unsigned
+swizzle_4x4(unsigned i)
+{
+   return (i & 1) + (i & 2) * 2 + (i & 4) / 2 + (i & 8);
+}
+
+
+/**
+ * Load the depth/stencil values of a whole 4x4 block, one row at a time,
+ * and swizzle them into quad order.
+ */
+static LLVMValueRef
+load_swizzled_4x4(struct gallivm_state *gallivm,
+                  struct lp_type zs_type,
+                  boolean is_1d,
+                  LLVMValueRef depth_ptr,
+                  LLVMValueRef depth_stride)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_type row_type = zs_type;
+   LLVMValueRef shuffles[16];
+   LLVMValueRef rows[4], halves[2];
+   LLVMTypeRef load_ptr_type;
+   unsigned i;
+
+   assert(zs_type.length == 16);
+   row_type.length = 4;
+   load_ptr_type = LLVMPointerType(lp_build_vec_type(gallivm, row_type), 0);
+
+   for (i = 0; i < 4; i++) {
+      if (i > 0 && is_1d) {
+         rows[i] = lp_build_undef(gallivm, row_type);
+      }
+      else {
+         LLVMValueRef offset, ptr;
+         offset = LLVMBuildMul(builder, depth_stride,
+                               lp_build_const_int32(gallivm, i), "");
+         ptr = LLVMBuildGEP(builder, depth_ptr, &offset, 1, "");
+         ptr = LLVMBuildBitCast(builder, ptr, load_ptr_type, "");
+         rows[i] = LLVMBuildLoad(builder, ptr, "");
+      }
+   }
+
+   halves[0] = lp_build_concat(gallivm, &rows[0], row_type, 2);
+   halves[1] = lp_build_concat(gallivm, &rows[2], row_type, 2);
+
+   for (i = 0; i < 16; i++) {
+      shuffles[i] = lp_build_const_int32(gallivm, swizzle_4x4(i));
+   }
+
+   return LLVMBuildShuffleVector(builder, halves[0], halves[1],
+                                 LLVMConstVector(shuffles, 16), "");
+}
+
+
+/**
+ * Unswizzle the depth (and, for formats wider than 32 bits, stencil)
+ * values of a whole 4x4 block and store them one row at a time.
+ */
+static void
+store_swizzled_4x4(struct gallivm_state *gallivm,
+                   struct lp_type zs_type,
+                   boolean is_1d,
+                   LLVMValueRef depth_ptr,
+                   LLVMValueRef depth_stride,
+                   LLVMValueRef z_value,
+                   LLVMValueRef s_value)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_type row_type = zs_type;
+   LLVMTypeRef store_ptr_type;
+   unsigned num_rows = is_1d ? 1 : 4;
+   unsigned row, i;
+
+   assert(zs_type.length == 16);
+   row_type.length = 4;
+   store_ptr_type = LLVMPointerType(lp_build_vec_type(gallivm, row_type), 0);
+
+   for (row = 0; row < num_rows; row++) {
+      LLVMValueRef shuffles[8];
+      LLVMValueRef offset, ptr, dst;
+
+      if (s_value) {
+         /* interleave z and s */
+         for (i = 0; i < 4; i++) {
+            unsigned j = swizzle_4x4(row * 4 + i);
+            shuffles[i * 2] = lp_build_const_int32(gallivm, j);
+            shuffles[i * 2 + 1] = lp_build_const_int32(gallivm, j + 16);
+         }
+         dst = LLVMBuildShuffleVector(builder, z_value, s_value,
+                                      LLVMConstVector(shuffles, 8), "");
+         dst = LLVMBuildBitCast(builder, dst,
+                                lp_build_vec_type(gallivm, row_type), "");
+      }
+      else {
+         for (i = 0; i < 4; i++) {
+            shuffles[i] = lp_build_const_int32(gallivm,
+                                               swizzle_4x4(row * 4 + i));
+         }
+         dst = LLVMBuildShuffleVector(builder, z_value, z_value,
+                                      LLVMConstVector(shuffles, 4), "");
+      }
+
+      offset = LLVMBuildMul(builder, depth_stride,
+                            lp_build_const_int32(gallivm, row), "");
+      ptr = LLVMBuildGEP(builder, depth_ptr, &offset, 1, "");
+      ptr = LLVMBuildBitCast(builder, ptr, store_ptr_type, "");
+      LLVMBuildStore(builder, dst, ptr);
+   }
+}
+
+
 /**
  * Load depth/stencil values.
  * The stored values are linear, swizzle them.
@@ -565,11 +735,10 @@ lp_build_depth_stencil_load_swizzled(struct gallivm_state *gallivm,
          shuffles[i] = lp_build_const_int32(gallivm, i);
       }
    }
-   else {
+   else if (z_src_type.length == 8) {
       unsigned i;
       LLVMValueRef loopx2 = LLVMBuildShl(builder, loop_counter,
                                          lp_build_const_int32(gallivm, 1), "");
-      assert(z_src_type.length == 8);
       depth_offset1 = LLVMBuildMul(builder, loopx2, depth_stride, "");
       /*
        * We load 2x4 values, and need to swizzle them (order
@@ -579,24 +748,35 @@ lp_build_depth_stencil_load_swizzled(struct gallivm_state *gallivm,
          shuffles[i] = lp_build_const_int32(gallivm, (i&1) + (i&2) * 2 + (i&4) / 2);
       }
    }
+   else {
+      /* 16-wide: the whole 4x4 block in one go, there's no loop */
+      assert(z_src_type.length == 16);
+      depth_offset1 = NULL;
+   }
 
-   depth_offset2 = LLVMBuildAdd(builder, depth_offset1, depth_stride, "");
+   if (depth_offset1) {
+      depth_offset2 = LLVMBuildAdd(builder, depth_offset1, depth_stride, "");
+
+      /* Load current z/stencil values from z/stencil buffer */
+      zs_dst_ptr = LLVMBuildGEP(builder, depth_ptr, &depth_offset1, 1, "");
+      zs_dst_ptr = LLVMBuildBitCast(builder, zs_dst_ptr, load_ptr_type, "");
+      zs_dst1 = LLVMBuildLoad(builder, zs_dst_ptr, "");
+      if (is_1d) {
+         zs_dst2 = lp_build_undef(gallivm, zs_load_type);
+      }
+      else {
+         zs_dst_ptr = LLVMBuildGEP(builder, depth_ptr, &depth_offset2, 1, "");
+         zs_dst_ptr = LLVMBuildBitCast(builder, zs_dst_ptr, load_ptr_type, "");
+         zs_dst2 = LLVMBuildLoad(builder, zs_dst_ptr, "");
+      }
 
-   /* Load current z/stencil values from z/stencil buffer */
-   zs_dst_ptr = LLVMBuildGEP(builder, depth_ptr, &depth_offset1, 1, "");
-   zs_dst_ptr = LLVMBuildBitCast(builder, zs_dst_ptr, load_ptr_type, "");
-   zs_dst1 = LLVMBuildLoad(builder, zs_dst_ptr, "");
-   if (is_1d) {
-      zs_dst2 = lp_build_undef(gallivm, zs_load_type);
+      *z_fb = LLVMBuildShuffleVector(builder, zs_dst1, zs_dst2,
+                                     LLVMConstVector(shuffles, zs_type.length), "");
    }
    else {
-      zs_dst_ptr = LLVMBuildGEP(builder, depth_ptr, &depth_offset2, 1, "");
-      zs_dst_ptr = LLVMBuildBitCast(builder, zs_dst_ptr, load_ptr_type, "");
-      zs_dst2 = LLVMBuildLoad(builder, zs_dst_ptr, "");
+      *z_fb = load_swizzled_4x4(gallivm, zs_type, is_1d,
+                                depth_ptr, depth_stride);
    }
-
-   *z_fb = LLVMBuildShuffleVector(builder, zs_dst1, zs_dst2,
-                                  LLVMConstVector(shuffles, zs_type.length), "");
    *s_fb = *z_fb;
 
    if (format_desc->block.bits < z_src_type.width) {
@@ -706,11 +886,10 @@ lp_build_depth_stencil_write_swizzled(struct gallivm_state *gallivm,
                                    lp_build_const_int32(gallivm, depth_bytes * 2), "");
       depth_offset1 = LLVMBuildAdd(builder, depth_offset1, offset2, "");
    }
-   else {
+   else if (z_src_type.length == 8) {
       unsigned i;
       LLVMValueRef loopx2 = LLVMBuildShl(builder, loop_counter,
                                          lp_build_const_int32(gallivm, 1), "");
-      assert(z_src_type.length == 8);
       depth_offset1 = LLVMBuildMul(builder, loopx2, depth_stride, "");
       /*
        * We load 2x4 values, and need to swizzle them (order
@@ -720,6 +899,11 @@ lp_build_depth_stencil_write_swizzled(struct gallivm_state *gallivm,
          shuffles[i] = lp_build_const_int32(gallivm, (i&1) + (i&2) * 2 + (i&4) / 2);
       }
    }
+   else {
+      /* 16-wide: the whole 4x4 block is stored by store_swizzled_4x4() */
+      assert(z_src_type.length == 16);
+      depth_offset1 = lp_build_const_int32(gallivm, 0);
+   }
 
    depth_offset2 = LLVMBuildAdd(builder, depth_offset1, depth_stride, "");
 
@@ -747,6 +931,13 @@ lp_build_depth_stencil_write_swizzled(struct gallivm_state *gallivm,
                                lp_build_int_vec_type(gallivm, zs_type), "");
    }
 
+   if (z_src_type.length == 16) {
+      store_swizzled_4x4(gallivm, zs_type, is_1d, depth_ptr, depth_stride,
+                         z_value,
+                         format_desc->block.bits > 32 ? s_value : NULL);
+      return;
+   }
+
    if (format_desc->block.bits <= 32) {
       if (z_src_type.length == 4) {
          zs_dst1 = lp_build_extract_range(gallivm, z_value, 0, 2);
@@ -96,6 +96,15 @@ lp_build_depth_stencil_write_swizzled(struct gallivm_state *gallivm,
                                       LLVMValueRef s_value);
 
 
+LLVMValueRef
+lp_build_sample_depth(struct gallivm_state *gallivm,
+                      struct lp_type type,
+                      LLVMValueRef z,
+                      LLVMValueRef dzdx,
+                      LLVMValueRef dzdy,
+                      float x_offset,
+                      float y_offset);
+
 void
 lp_build_occlusion_count(struct gallivm_state *gallivm,
                          struct lp_type type,
@@ -63,7 +63,7 @@
  * #################
  *
  * If we iterate over multiple quads at once, quads 01 and 23 are processed
- * together.
+ * together, or all four of them with 16-wide vectors.
  *
  * Within each quad, we have four pixels which are represented in SOA
  * order:
@@ -79,7 +79,13 @@
  * The order stays the same even with multiple quads:
  * 0 1 4 5
  * 2 3 6 7
- * is stored as g0..g7
+ * is stored as g0..g7, and the whole block
+ *  0  1  4  5
+ *  2  3  6  7
+ *  8  9 12 13
+ * 10 11 14 15
+ * as g0..g15.  The simple interpolation below just evaluates the plane
+ * equations at these pixel offsets, so it works for any of the widths.
  */
 
 
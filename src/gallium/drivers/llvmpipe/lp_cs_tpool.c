@@ -0,0 +1,252 @@
+/**************************************************************************
+ * 
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ **************************************************************************/
+
+/**
+ * Compute shader thread pool.
+ *
+ * Tasks are queued in FIFO order; each worker grabs the next unstarted
+ * iteration of the oldest task, so a big grid keeps every thread busy while
+ * small grids queued from other contexts still make progress.
+ */
+
+#include "util/u_memory.h"
+#include "util/u_thread.h"
+#include "util/u_math.h"
+#include "gallivm/lp_bld_format.h"
+#include "lp_cs_tpool.h"
+
+
+/**
+ * Return at least size bytes of thread local scratch memory.  The contents
+ * are not preserved when the memory is grown.
+ */
+void *
+lp_cs_local_mem_get(struct lp_cs_local_mem *lmem, unsigned size)
+{
+   if (size > lmem->size) {
+      align_free(lmem->ptr);
+      lmem->size = 0;
+      lmem->ptr = align_malloc(size, 64);
+      if (lmem->ptr)
+         lmem->size = size;
+   }
+   return lmem->ptr;
+}
+
+
+static void
+lp_cs_local_mem_init(struct lp_cs_local_mem *lmem)
+{
+   memset(lmem, 0, sizeof *lmem);
+   lmem->cache = align_malloc(sizeof(struct lp_build_format_cache), 16);
+   if (lmem->cache)
+      memset(lmem->cache, 0, sizeof *lmem->cache);
+}
+
+
+static void
+lp_cs_local_mem_fini(struct lp_cs_local_mem *lmem)
+{
+   align_free(lmem->ptr);
+   align_free(lmem->cache);
+}
+
+
+static int
+lp_cs_tpool_worker(void *data)
+{
+   struct lp_cs_tpool *pool = data;
+   struct lp_cs_local_mem lmem;
+   unsigned fpstate;
+
+   u_thread_setname("llvmpipe-cs");
+
+   /* Same denorm behaviour as the rasterizer threads */
+   fpstate = util_fpstate_get();
+   util_fpstate_set_denorms_to_zero(fpstate);
+
+   lp_cs_local_mem_init(&lmem);
+
+   mtx_lock(&pool->m);
+
+   while (!pool->shutdown) {
+      struct lp_cs_tpool_task *task;
+      unsigned iter;
+
+      while (list_empty(&pool->workqueue) && !pool->shutdown)
+         cnd_wait(&pool->new_work, &pool->m);
+
+      if (pool->shutdown)
+         break;
+
+      task = list_first_entry(&pool->workqueue, struct lp_cs_tpool_task,
+                              list);
+      iter = task->iter_start++;
+
+      /* All iterations are handed out, stop advertising the task */
+      if (task->iter_start == task->iter_total)
+         list_del(&task->list);
+
+      mtx_unlock(&pool->m);
+      task->work(task->data, iter, &lmem);
+      mtx_lock(&pool->m);
+
+      task->iter_finished++;
+      if (task->iter_finished == task->iter_total)
+         cnd_broadcast(&task->finish);
+   }
+
+   mtx_unlock(&pool->m);
+
+   lp_cs_local_mem_fini(&lmem);
+   return 0;
+}
+
+
+/**
+ * Create a pool of num_threads workers.  With zero threads, tasks are run
+ * by the thread that queues them.
+ */
+struct lp_cs_tpool *
+lp_cs_tpool_create(unsigned num_threads)
+{
+   struct lp_cs_tpool *pool = CALLOC_STRUCT(lp_cs_tpool);
+   unsigned i;
+
+   if (!pool)
+      return NULL;
+
+   (void) mtx_init(&pool->m, mtx_plain);
+   cnd_init(&pool->new_work);
+
+   list_inithead(&pool->workqueue);
+   if (num_threads) {
+      pool->threads = CALLOC(num_threads, sizeof *pool->threads);
+      if (!pool->threads) {
+         cnd_destroy(&pool->new_work);
+         mtx_destroy(&pool->m);
+         FREE(pool);
+         return NULL;
+      }
+   }
+   for (i = 0; i < num_threads; i++) {
+      pool->threads[i] = u_thread_create(lp_cs_tpool_worker, pool);
+      if (!pool->threads[i])
+         break;
+   }
+   pool->num_threads = i;
+   return pool;
+}
+
+
+void
+lp_cs_tpool_destroy(struct lp_cs_tpool *pool)
+{
+   unsigned i;
+
+   if (!pool)
+      return;
+
+   mtx_lock(&pool->m);
+   pool->shutdown = TRUE;
+   cnd_broadcast(&pool->new_work);
+   mtx_unlock(&pool->m);
+
+   for (i = 0; i < pool->num_threads; i++)
+      thrd_join(pool->threads[i], NULL);
+
+   cnd_destroy(&pool->new_work);
+   mtx_destroy(&pool->m);
+   FREE(pool->threads);
+   FREE(pool);
+}
+
+
+/**
+ * Queue num_iters invocations of func.  The returned task must be passed
+ * to lp_cs_tpool_wait_for_task(), which frees it.
+ */
+struct lp_cs_tpool_task *
+lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
+                       lp_cs_tpool_task_func func,
+                       void *data, unsigned num_iters)
+{
+   struct lp_cs_tpool_task *task;
+
+   task = CALLOC_STRUCT(lp_cs_tpool_task);
+   if (!task)
+      return NULL;
+
+   task->work = func;
+   task->data = data;
+   task->iter_total = num_iters;
+
+   if (pool->num_threads == 0 || num_iters == 0) {
+      struct lp_cs_local_mem lmem;
+      unsigned i;
+
+      lp_cs_local_mem_init(&lmem);
+      for (i = 0; i < num_iters; i++)
+         func(data, i, &lmem);
+      lp_cs_local_mem_fini(&lmem);
+
+      task->iter_start = task->iter_finished = num_iters;
+      return task;
+   }
+
+   cnd_init(&task->finish);
+
+   mtx_lock(&pool->m);
+   list_addtail(&task->list, &pool->workqueue);
+   cnd_broadcast(&pool->new_work);
+   mtx_unlock(&pool->m);
+
+   return task;
+}
+
+
+void
+lp_cs_tpool_wait_for_task(struct lp_cs_tpool *pool,
+                          struct lp_cs_tpool_task **task_handle)
+{
+   struct lp_cs_tpool_task *task = *task_handle;
+
+   if (!pool || !task)
+      return;
+
+   if (pool->num_threads && task->iter_total) {
+      mtx_lock(&pool->m);
+      while (task->iter_finished < task->iter_total)
+         cnd_wait(&task->finish, &pool->m);
+      mtx_unlock(&pool->m);
+
+      cnd_destroy(&task->finish);
+   }
+
+   FREE(task);
+   *task_handle = NULL;
+}
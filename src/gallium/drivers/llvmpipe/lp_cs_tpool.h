@@ -0,0 +1,101 @@
+/**************************************************************************
+ * 
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ **************************************************************************/
+
+/**
+ * Compute shader thread pool.
+ *
+ * The workgroups of a grid are independent of each other, so they are
+ * simply handed out one at a time to a pool of worker threads; each thread
+ * keeps its own scratch memory for the shared variables and barrier spills
+ * of the workgroup it is running.
+ */
+
+#ifndef LP_CS_TPOOL_H
+#define LP_CS_TPOOL_H
+
+#include "os/os_thread.h"
+#include "util/list.h"
+#include "lp_limits.h"
+
+
+struct lp_build_format_cache;
+
+
+/** Per worker thread scratch memory, grown on demand */
+struct lp_cs_local_mem {
+   unsigned size;
+   void *ptr;
+   struct lp_build_format_cache *cache;
+};
+
+
+typedef void (*lp_cs_tpool_task_func)(void *data, unsigned iter,
+                                      struct lp_cs_local_mem *lmem);
+
+
+struct lp_cs_tpool_task {
+   lp_cs_tpool_task_func work;
+   void *data;
+   struct list_head list;
+   cnd_t finish;
+   unsigned iter_total;
+   unsigned iter_start;
+   unsigned iter_finished;
+};
+
+
+struct lp_cs_tpool {
+   mtx_t m;
+   cnd_t new_work;
+
+   thrd_t *threads;
+   unsigned num_threads;
+   struct list_head workqueue;
+   boolean shutdown;
+};
+
+
+struct lp_cs_tpool *
+lp_cs_tpool_create(unsigned num_threads);
+
+void
+lp_cs_tpool_destroy(struct lp_cs_tpool *pool);
+
+struct lp_cs_tpool_task *
+lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
+                       lp_cs_tpool_task_func func,
+                       void *data, unsigned num_iters);
+
+void
+lp_cs_tpool_wait_for_task(struct lp_cs_tpool *pool,
+                          struct lp_cs_tpool_task **task);
+
+void *
+lp_cs_local_mem_get(struct lp_cs_local_mem *lmem, unsigned size);
+
+
+#endif /* LP_CS_TPOOL_H */
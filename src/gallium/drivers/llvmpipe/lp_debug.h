@@ -48,6 +48,7 @@ st_print_current(void);
 #define DEBUG_FENCE         0x2000
 #define DEBUG_MEM           0x4000
 #define DEBUG_FS            0x8000
+#define DEBUG_CS            0x10000
 
 /* Performance flags.  These are active even on release builds.
  */
@@ -59,6 +60,10 @@ st_print_current(void);
 #define PERF_NO_BLEND       0x20  	/* disable blending */
 #define PERF_NO_DEPTH       0x40  	/* disable depth buffering entirely */
 #define PERF_NO_ALPHATEST   0x80  	/* disable alpha testing */
+#define PERF_NO_FS16        0x100  	/* no 16-wide fragment shading */
+#define PERF_NO_HIZ         0x200  	/* no hierarchical depth rejection */
+#define PERF_NO_RECT        0x400  	/* no rectangle detection */
+#define PERF_NO_TEX_TILING  0x800  	/* store all textures linearly */
 
 
 extern int LP_PERF;
@@ -37,6 +37,7 @@
 #include "util/u_prim.h"
 
 #include "lp_context.h"
+#include "lp_flush.h"
 #include "lp_state.h"
 #include "lp_query.h"
 
@@ -44,6 +45,54 @@
 
 
 
+/**
+ * Wait for pending readbacks into the buffers bound to the graphics
+ * shaders and stream output.  Constant buffers are copied when binning,
+ * vertex/geometry shader resources and stream output targets are accessed
+ * by draw right away, so none of them may still be written by a readback
+ * scene.  Checked at draw time, as a readback may be queued after binding.
+ */
+static void
+finish_bound_readbacks(struct llvmpipe_context *lp)
+{
+   struct pipe_context *pipe = &lp->pipe;
+   enum pipe_shader_type sh;
+   unsigned i;
+
+   for (sh = 0; sh < PIPE_SHADER_TYPES; sh++) {
+      if (sh == PIPE_SHADER_COMPUTE)
+         continue;
+
+      for (i = 0; i < ARRAY_SIZE(lp->constants[sh]); i++) {
+         if (lp->constants[sh][i].buffer)
+            llvmpipe_finish_readback(pipe, lp->constants[sh][i].buffer,
+                                     FALSE, __FUNCTION__);
+      }
+      for (i = 0; i < lp->num_sampler_views[sh]; i++) {
+         if (lp->sampler_views[sh][i])
+            llvmpipe_finish_readback(pipe, lp->sampler_views[sh][i]->texture,
+                                     FALSE, __FUNCTION__);
+      }
+      for (i = 0; i < ARRAY_SIZE(lp->ssbos[sh]); i++) {
+         if (lp->ssbos[sh][i].buffer)
+            llvmpipe_finish_readback(pipe, lp->ssbos[sh][i].buffer,
+                                     FALSE, __FUNCTION__);
+      }
+      for (i = 0; i < ARRAY_SIZE(lp->images[sh]); i++) {
+         if (lp->images[sh][i].resource)
+            llvmpipe_finish_readback(pipe, lp->images[sh][i].resource,
+                                     FALSE, __FUNCTION__);
+      }
+   }
+
+   for (i = 0; i < lp->num_so_targets; i++) {
+      if (lp->so_targets[i] && lp->so_targets[i]->target.buffer)
+         llvmpipe_finish_readback(pipe, lp->so_targets[i]->target.buffer,
+                                  FALSE, __FUNCTION__);
+   }
+}
+
+
 /**
  * Draw vertex arrays, with optional indexing, optional instancing.
  * All the other drawing functions are implemented in terms of this function.
@@ -69,6 +118,8 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info)
    if (lp->dirty)
       llvmpipe_update_derived( lp );
 
+   finish_bound_readbacks(lp);
+
    /*
     * Map vertex buffers
     */
@@ -80,6 +131,9 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info)
          if (!lp->vertex_buffer[i].buffer.resource) {
             continue;
          }
+         /* vertices are fetched right away, not in the rasterizer */
+         llvmpipe_finish_readback(pipe, lp->vertex_buffer[i].buffer.resource,
+                                  FALSE, __FUNCTION__);
          buf = llvmpipe_resource_data(lp->vertex_buffer[i].buffer.resource);
          size = lp->vertex_buffer[i].buffer.resource->width0;
       }
@@ -91,6 +145,8 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info)
       unsigned available_space = ~0;
       mapped_indices = info->has_user_indices ? info->index.user : NULL;
       if (!mapped_indices) {
+         llvmpipe_finish_readback(pipe, info->index.resource,
+                                  FALSE, __FUNCTION__);
          mapped_indices = llvmpipe_resource_data(info->index.resource);
          available_space = info->index.resource->width0;
       }
@@ -37,7 +37,10 @@
 #include "draw/draw_context.h"
 #include "lp_flush.h"
 #include "lp_context.h"
+#include "lp_fence.h"
 #include "lp_setup.h"
+#include "lp_state_fs.h"
+#include "lp_texture.h"
 
 
 /**
@@ -55,6 +58,8 @@ llvmpipe_flush( struct pipe_context *pipe,
    /* ask the setup module to flush */
    lp_setup_flush(llvmpipe->setup, fence, reason);
 
+   llvmpipe_promote_hot_shader_variants(llvmpipe);
+
    /* Enable to dump BMPs of the color/depth buffers each frame */
    if (0) {
       static unsigned frame_no = 1;
@@ -88,6 +93,39 @@ llvmpipe_finish( struct pipe_context *pipe,
    }
 }
 
+/**
+ * Wait for a pending lp_setup_readback() into the resource, if any.
+ * Only the scene doing the readback is waited for, not any later ones.
+ *
+ * Returns FALSE if do_not_block is set and we would have to wait.
+ */
+boolean
+llvmpipe_finish_readback(struct pipe_context *pipe,
+                         struct pipe_resource *resource,
+                         boolean do_not_block,
+                         const char *reason)
+{
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+
+   if (!lpr->readback_fence)
+      return TRUE;
+
+   if (!lp_fence_signalled(lpr->readback_fence)) {
+      if (do_not_block)
+         return FALSE;
+
+      if (!lp_fence_issued(lpr->readback_fence))
+         llvmpipe_flush(pipe, NULL, reason);
+
+      lp_fence_wait(lpr->readback_fence);
+   }
+
+   lp_fence_reference(&lpr->readback_fence, NULL);
+
+   return TRUE;
+}
+
+
 /**
  * Flush context if necessary.
  *
@@ -107,6 +145,10 @@ llvmpipe_flush_resource(struct pipe_context *pipe,
 {
    unsigned referenced;
 
+   if (cpu_access &&
+       !llvmpipe_finish_readback(pipe, resource, do_not_block, reason))
+      return FALSE;
+
    referenced = llvmpipe_is_resource_referenced(pipe, resource, level);
 
    if ((referenced & LP_REFERENCED_FOR_WRITE) ||
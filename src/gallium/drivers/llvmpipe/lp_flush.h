@@ -43,6 +43,12 @@ void
 llvmpipe_finish( struct pipe_context *pipe,
                  const char *reason );
 
+boolean
+llvmpipe_finish_readback(struct pipe_context *pipe,
+                         struct pipe_resource *resource,
+                         boolean do_not_block,
+                         const char *reason);
+
 boolean
 llvmpipe_flush_resource(struct pipe_context *pipe,
                         struct pipe_resource *resource,
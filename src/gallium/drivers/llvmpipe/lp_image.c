@@ -0,0 +1,429 @@
+/**************************************************************************
+ * 
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ **************************************************************************/
+
+/**
+ * Shader image access.
+ *
+ * The generated code calls lp_image_op() once per active lane; this is
+ * slow but keeps the (rarely performance critical) image paths simple and
+ * supports every format u_format can pack and unpack.
+ */
+
+#include "pipe/p_defines.h"
+#include "pipe/p_shader_tokens.h"
+#include "util/u_atomic.h"
+#include "util/u_format.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "gallivm/lp_bld_const.h"
+#include "gallivm/lp_bld_flow.h"
+#include "gallivm/lp_bld_tgsi.h"
+#include "gallivm/lp_bld_type.h"
+#include "lp_texture.h"
+#include "lp_image.h"
+
+
+/*
+ * Does this texture target have a single non-array coordinate?
+ */
+static inline boolean
+has_1coord(unsigned target)
+{
+   return (target == TGSI_TEXTURE_BUFFER ||
+           target == TGSI_TEXTURE_1D ||
+           target == TGSI_TEXTURE_1D_ARRAY);
+}
+
+
+/*
+ * Does this texture target have a layer or depth coordinate?
+ */
+static inline boolean
+has_layer_or_depth(unsigned target)
+{
+   return (target == TGSI_TEXTURE_3D ||
+           target == TGSI_TEXTURE_CUBE ||
+           target == TGSI_TEXTURE_1D_ARRAY ||
+           target == TGSI_TEXTURE_2D_ARRAY ||
+           target == TGSI_TEXTURE_CUBE_ARRAY ||
+           target == TGSI_TEXTURE_2D_ARRAY_MSAA);
+}
+
+
+/*
+ * What out of bounds or unbound loads return: zero, with a one in the
+ * components missing from the format.
+ */
+static void
+fill_zero(enum pipe_format format, uint32_t *data)
+{
+   unsigned nc = format == PIPE_FORMAT_NONE ?
+      4 : util_format_get_nr_components(format);
+   unsigned c;
+
+   for (c = 0; c < 4; c++)
+      data[c] = 0;
+
+   if (nc < 4) {
+      if (util_format_is_pure_integer(format))
+         data[3] = 1;
+      else
+         data[3] = fui(1.0f);
+   }
+}
+
+
+static void
+get_dims(const struct lp_jit_image *image, unsigned target, uint32_t *data)
+{
+   data[0] = image->width;
+   data[1] = data[2] = data[3] = 0;
+
+   switch (target) {
+   case TGSI_TEXTURE_1D_ARRAY:
+      data[1] = image->depth;
+      break;
+   case TGSI_TEXTURE_2D_ARRAY:
+   case TGSI_TEXTURE_3D:
+      data[1] = image->height;
+      data[2] = image->depth;
+      break;
+   case TGSI_TEXTURE_CUBE_ARRAY:
+      data[1] = image->height;
+      data[2] = image->depth / 6;
+      break;
+   case TGSI_TEXTURE_2D:
+   case TGSI_TEXTURE_CUBE:
+   case TGSI_TEXTURE_RECT:
+      data[1] = image->height;
+      break;
+   default:
+      break;
+   }
+}
+
+
+/*
+ * Compute the value an atomic operation writes, from the one in memory.
+ */
+static uint32_t
+atomic_result(unsigned op, uint32_t old, uint32_t src, uint32_t src2)
+{
+   switch (op) {
+   case TGSI_OPCODE_ATOMUADD:
+      return old + src;
+   case TGSI_OPCODE_ATOMXCHG:
+      return src;
+   case TGSI_OPCODE_ATOMCAS:
+      return old == src ? src2 : old;
+   case TGSI_OPCODE_ATOMAND:
+      return old & src;
+   case TGSI_OPCODE_ATOMOR:
+      return old | src;
+   case TGSI_OPCODE_ATOMXOR:
+      return old ^ src;
+   case TGSI_OPCODE_ATOMUMIN:
+      return MIN2(old, src);
+   case TGSI_OPCODE_ATOMUMAX:
+      return MAX2(old, src);
+   case TGSI_OPCODE_ATOMIMIN:
+      return MIN2((int32_t)old, (int32_t)src);
+   case TGSI_OPCODE_ATOMIMAX:
+      return MAX2((int32_t)old, (int32_t)src);
+   default:
+      assert(!"unexpected atomic opcode");
+      return old;
+   }
+}
+
+
+/**
+ * Execute an image operation for a single invocation.
+ *
+ * Accesses outside the image are discarded, and read as zero.  Atomics are
+ * only supported on R32_UINT/R32_SINT images, plus exchange on R32_FLOAT,
+ * which is all GL allows; these are done with compare-and-swap as blocks
+ * of the same grid run concurrently.
+ */
+void
+lp_image_op(const struct lp_jit_image *image,
+            uint32_t op,
+            uint32_t target,
+            const int32_t *coords,
+            uint32_t *data)
+{
+   enum pipe_format format = image->format;
+   int x, y, z;
+   uint8_t *base;
+
+   if (op == TGSI_OPCODE_RESQ) {
+      get_dims(image, target, data);
+      return;
+   }
+
+   x = coords[0];
+   y = has_1coord(target) ? 0 : coords[1];
+   z = !has_layer_or_depth(target) ? 0 :
+      (target == TGSI_TEXTURE_1D_ARRAY ? coords[1] : coords[2]);
+
+   if (format == PIPE_FORMAT_NONE ||
+       x < 0 || x >= (int)image->width ||
+       y < 0 || y >= (int)image->height ||
+       z < 0 || z >= (int)image->depth) {
+      if (op != TGSI_OPCODE_STORE)
+         fill_zero(format, data);
+      return;
+   }
+
+   base = image->base + z * image->img_stride;
+
+   switch (op) {
+   case TGSI_OPCODE_LOAD:
+      if (util_format_is_pure_sint(format))
+         util_format_read_4i(format, (int32_t *)data, 0, base,
+                             image->row_stride, x, y, 1, 1);
+      else if (util_format_is_pure_uint(format))
+         util_format_read_4ui(format, data, 0, base,
+                              image->row_stride, x, y, 1, 1);
+      else
+         util_format_read_4f(format, (float *)data, 0, base,
+                             image->row_stride, x, y, 1, 1);
+      break;
+
+   case TGSI_OPCODE_STORE:
+      if (util_format_is_pure_sint(format))
+         util_format_write_4i(format, (const int32_t *)data, 0, base,
+                              image->row_stride, x, y, 1, 1);
+      else if (util_format_is_pure_uint(format))
+         util_format_write_4ui(format, data, 0, base,
+                               image->row_stride, x, y, 1, 1);
+      else
+         util_format_write_4f(format, (const float *)data, 0, base,
+                              image->row_stride, x, y, 1, 1);
+      break;
+
+   default:
+      if (format == PIPE_FORMAT_R32_UINT ||
+          format == PIPE_FORMAT_R32_SINT ||
+          (format == PIPE_FORMAT_R32_FLOAT && op == TGSI_OPCODE_ATOMXCHG)) {
+         uint32_t *ptr = (uint32_t *)(base + y * image->row_stride) + x;
+         uint32_t old, val;
+
+         do {
+            old = p_atomic_read(ptr);
+            val = atomic_result(op, old, data[0], data[4]);
+         } while (p_atomic_cmpxchg(ptr, old, val) != old);
+
+         data[0] = old;
+         data[1] = data[2] = data[3] = 0;
+      }
+      else {
+         fill_zero(format, data);
+      }
+      break;
+   }
+}
+
+
+/**
+ * Fill in the jit description of a shader image view.
+ * The caller must hold a reference to the view's resource.
+ */
+void
+lp_jit_image_from_view(struct lp_jit_image *jit_img,
+                       const struct pipe_image_view *view)
+{
+   struct pipe_resource *res = view->resource;
+   struct llvmpipe_resource *lp_res;
+
+   memset(jit_img, 0, sizeof *jit_img);
+
+   if (!res) {
+      jit_img->format = PIPE_FORMAT_NONE;
+      return;
+   }
+
+   lp_res = llvmpipe_resource(res);
+   jit_img->format = view->format;
+
+   if (llvmpipe_resource_is_texture(res)) {
+      unsigned level = view->u.tex.level;
+
+      jit_img->width = u_minify(res->width0, level);
+      jit_img->height = u_minify(res->height0, level);
+      jit_img->depth = view->u.tex.last_layer - view->u.tex.first_layer + 1;
+      jit_img->row_stride = lp_res->row_stride[level];
+      jit_img->img_stride = lp_res->img_stride[level];
+      jit_img->base = llvmpipe_resource_map(res, level, view->u.tex.first_layer,
+                                            LP_TEX_USAGE_READ_WRITE);
+   }
+   else {
+      unsigned blocksize = util_format_get_blocksize(view->format);
+
+      assert(view->u.buf.offset + view->u.buf.size <= res->width0);
+
+      /* everything specified in number of elements here. */
+      jit_img->width = view->u.buf.size / blocksize;
+      jit_img->height = 1;
+      jit_img->depth = 1;
+      jit_img->row_stride = 0;
+      jit_img->img_stride = 0;
+      jit_img->base = (uint8_t *)lp_res->data + view->u.buf.offset;
+   }
+}
+
+
+/**
+ * This is the bridge between our images and the TGSI translator.
+ */
+struct lp_llvm_image_soa
+{
+   struct lp_build_image_soa base;
+};
+
+
+static void
+lp_llvm_image_soa_destroy(struct lp_build_image_soa *image)
+{
+   FREE(image);
+}
+
+
+/**
+ * Emit a call to the context's image_op function for each active lane.
+ */
+static void
+lp_llvm_image_soa_emit_op(const struct lp_build_image_soa *base,
+                          struct gallivm_state *gallivm,
+                          const struct lp_img_params *params)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef int32_type = LLVMInt32TypeInContext(gallivm->context);
+   LLVMValueRef zero = lp_build_const_int32(gallivm, 0);
+   LLVMValueRef images_ptr, image_op, coords_ptr, data_ptr;
+   LLVMValueRef results[4];
+   unsigned length = params->type.length;
+   unsigned i, c;
+
+   images_ptr = lp_jit_context_images(gallivm, params->context_ptr);
+   image_op = lp_jit_context_image_op(gallivm, params->context_ptr);
+
+   coords_ptr = lp_build_array_alloca(gallivm, int32_type,
+                                      lp_build_const_int32(gallivm, 3),
+                                      "image_coords");
+   data_ptr = lp_build_array_alloca(gallivm, int32_type,
+                                    lp_build_const_int32(gallivm, 8),
+                                    "image_data");
+
+   for (c = 0; c < 4; c++)
+      results[c] = LLVMGetUndef(LLVMVectorType(int32_type, length));
+
+   for (i = 0; i < length; i++) {
+      LLVMValueRef lane = lp_build_const_int32(gallivm, i);
+      LLVMValueRef active, index, indices[2], args[5];
+      struct lp_build_if_state ifthen;
+
+      active = LLVMBuildExtractElement(builder, params->exec_mask, lane, "");
+      active = LLVMBuildICmp(builder, LLVMIntNE, active,
+                             LLVMConstNull(LLVMTypeOf(active)), "");
+
+      for (c = 0; c < 8; c++) {
+         LLVMValueRef value = c < 4 ? params->indata[c] : params->indata2[c - 4];
+         LLVMValueRef idx = lp_build_const_int32(gallivm, c);
+         value = value ? LLVMBuildExtractElement(builder, value, lane, "") : zero;
+         value = LLVMBuildBitCast(builder, value, int32_type, "");
+         LLVMBuildStore(builder, value,
+                        LLVMBuildGEP(builder, data_ptr, &idx, 1, ""));
+      }
+
+      lp_build_if(&ifthen, gallivm, active);
+      {
+         for (c = 0; c < 3; c++) {
+            LLVMValueRef idx = lp_build_const_int32(gallivm, c);
+            LLVMValueRef value = params->coords[c] ?
+               LLVMBuildExtractElement(builder, params->coords[c], lane, "") :
+               zero;
+            LLVMBuildStore(builder, value,
+                           LLVMBuildGEP(builder, coords_ptr, &idx, 1, ""));
+         }
+
+         /* out of range image units access the first one */
+         index = LLVMBuildExtractElement(builder, params->image_index, lane, "");
+         index = LLVMBuildSelect(builder,
+                                 LLVMBuildICmp(builder, LLVMIntULT, index,
+                                               lp_build_const_int32(gallivm,
+                                                  LP_MAX_TGSI_SHADER_IMAGES),
+                                               ""),
+                                 index, zero, "");
+         indices[0] = zero;
+         indices[1] = index;
+
+         args[0] = LLVMBuildGEP(builder, images_ptr, indices, 2, "");
+         args[1] = lp_build_const_int32(gallivm, params->img_op);
+         args[2] = lp_build_const_int32(gallivm, params->target);
+         args[3] = coords_ptr;
+         args[4] = data_ptr;
+         LLVMBuildCall(builder, image_op, args, ARRAY_SIZE(args), "");
+      }
+      lp_build_endif(&ifthen);
+
+      if (params->outdata) {
+         for (c = 0; c < 4; c++) {
+            LLVMValueRef idx = lp_build_const_int32(gallivm, c);
+            LLVMValueRef value;
+
+            value = LLVMBuildLoad(builder,
+                                  LLVMBuildGEP(builder, data_ptr, &idx, 1, ""),
+                                  "");
+            value = LLVMBuildSelect(builder, active, value, zero, "");
+            results[c] = LLVMBuildInsertElement(builder, results[c], value,
+                                                lane, "");
+         }
+      }
+   }
+
+   if (params->outdata) {
+      for (c = 0; c < 4; c++)
+         params->outdata[c] = results[c];
+   }
+}
+
+
+struct lp_build_image_soa *
+lp_llvm_image_soa_create(void)
+{
+   struct lp_llvm_image_soa *image;
+
+   image = CALLOC_STRUCT(lp_llvm_image_soa);
+   if (!image)
+      return NULL;
+
+   image->base.destroy = lp_llvm_image_soa_destroy;
+   image->base.emit_op = lp_llvm_image_soa_emit_op;
+
+   return &image->base;
+}
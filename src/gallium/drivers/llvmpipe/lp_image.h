@@ -0,0 +1,66 @@
+/**************************************************************************
+ * 
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ **************************************************************************/
+
+/**
+ * Shader image access.
+ *
+ * Image loads, stores and atomics are not inlined in the generated code:
+ * the formats images may be bound with are numerous and only known at
+ * draw time, so each active lane calls lp_image_op(), which goes through
+ * the u_format pack/unpack routines.
+ */
+
+#ifndef LP_IMAGE_H
+#define LP_IMAGE_H
+
+
+#include "pipe/p_compiler.h"
+#include "lp_jit.h"
+
+
+struct pipe_image_view;
+struct lp_build_image_soa;
+
+
+void
+lp_image_op(const struct lp_jit_image *image,
+            uint32_t op,
+            uint32_t target,
+            const int32_t *coords,
+            uint32_t *data);
+
+
+void
+lp_jit_image_from_view(struct lp_jit_image *jit_img,
+                       const struct pipe_image_view *view);
+
+
+struct lp_build_image_soa *
+lp_llvm_image_soa_create(void);
+
+
+#endif /* LP_IMAGE_H */
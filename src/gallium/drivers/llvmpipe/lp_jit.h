@@ -45,6 +45,7 @@
 
 struct lp_build_format_cache;
 struct lp_fragment_shader_variant;
+struct lp_compute_shader_variant;
 struct llvmpipe_screen;
 
 
@@ -78,6 +79,23 @@ struct lp_jit_viewport
 };
 
 
+/**
+ * A single mip level of a shader image.  Image accesses are done by the
+ * lp_image_op() helper, so only the pipe_format is needed, not the whole
+ * static texture state.
+ */
+struct lp_jit_image
+{
+   uint32_t width;        /* same as number of elements */
+   uint32_t height;
+   uint32_t depth;        /* doubles as array size */
+   uint32_t format;       /* enum pipe_format, PIPE_FORMAT_NONE if unbound */
+   uint8_t *base;
+   uint32_t row_stride;
+   uint32_t img_stride;
+};
+
+
 enum {
    LP_JIT_TEXTURE_WIDTH = 0,
    LP_JIT_TEXTURE_HEIGHT,
@@ -108,6 +126,37 @@ enum {
 };
 
 
+enum {
+   LP_JIT_IMAGE_WIDTH = 0,
+   LP_JIT_IMAGE_HEIGHT,
+   LP_JIT_IMAGE_DEPTH,
+   LP_JIT_IMAGE_FORMAT,
+   LP_JIT_IMAGE_BASE,
+   LP_JIT_IMAGE_ROW_STRIDE,
+   LP_JIT_IMAGE_IMG_STRIDE,
+   LP_JIT_IMAGE_NUM_FIELDS  /* number of fields above */
+};
+
+
+/**
+ * Out-of-line image access helper, called by the generated code once per
+ * active lane.
+ *
+ * @param image    image to access
+ * @param op       TGSI opcode (LOAD, STORE, RESQ or ATOM*)
+ * @param target   TGSI texture target
+ * @param coords   x, y, z integer coordinates
+ * @param data     8 dwords: the STORE/ATOM operands (the second four only
+ *                 for ATOMCAS), overwritten with the four result dwords
+ */
+typedef void
+(*lp_jit_image_op_func)(const struct lp_jit_image *image,
+                        uint32_t op,
+                        uint32_t target,
+                        const int32_t *coords,
+                        uint32_t *data);
+
+
 /**
  * This structure is passed directly to the generated fragment shader.
  *
@@ -135,6 +184,12 @@ struct lp_jit_context
 
    struct lp_jit_texture textures[PIPE_MAX_SHADER_SAMPLER_VIEWS];
    struct lp_jit_sampler samplers[PIPE_MAX_SAMPLERS];
+
+   const uint32_t *ssbos[LP_MAX_TGSI_SHADER_BUFFERS];
+   int num_ssbos[LP_MAX_TGSI_SHADER_BUFFERS];
+
+   struct lp_jit_image images[LP_MAX_TGSI_SHADER_IMAGES];
+   lp_jit_image_op_func image_op;
 };
 
 
@@ -153,6 +208,10 @@ enum {
    LP_JIT_CTX_VIEWPORTS,
    LP_JIT_CTX_TEXTURES,
    LP_JIT_CTX_SAMPLERS,
+   LP_JIT_CTX_SSBOS,
+   LP_JIT_CTX_NUM_SSBOS,
+   LP_JIT_CTX_IMAGES,
+   LP_JIT_CTX_IMAGE_OP,
    LP_JIT_CTX_COUNT
 };
 
@@ -187,6 +246,18 @@ enum {
 #define lp_jit_context_samplers(_gallivm, _ptr) \
    lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CTX_SAMPLERS, "samplers")
 
+#define lp_jit_context_ssbos(_gallivm, _ptr) \
+   lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CTX_SSBOS, "ssbos")
+
+#define lp_jit_context_num_ssbos(_gallivm, _ptr) \
+   lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CTX_NUM_SSBOS, "num_ssbos")
+
+#define lp_jit_context_images(_gallivm, _ptr) \
+   lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CTX_IMAGES, "images")
+
+#define lp_jit_context_image_op(_gallivm, _ptr) \
+   lp_build_struct_get(_gallivm, _ptr, LP_JIT_CTX_IMAGE_OP, "image_op")
+
 
 struct lp_jit_thread_data
 {
@@ -200,6 +271,12 @@ struct lp_jit_thread_data
    struct {
       uint32_t viewport_index;
    } raster_state;
+
+   /*
+    * Compute shaders with a BARRIER inside control flow call this to
+    * suspend the calling vector of invocations, see lp_state_cs.c.
+    */
+   void (*barrier)(struct lp_jit_thread_data *thread_data);
 };
 
 
@@ -208,6 +285,7 @@ enum {
    LP_JIT_THREAD_DATA_COUNTER,
    LP_JIT_THREAD_DATA_INVOCATIONS,
    LP_JIT_THREAD_DATA_RASTER_STATE_VIEWPORT_INDEX,
+   LP_JIT_THREAD_DATA_BARRIER,
    LP_JIT_THREAD_DATA_COUNT
 };
 
@@ -225,6 +303,9 @@ enum {
    lp_build_struct_get(_gallivm, _ptr, \
                        LP_JIT_THREAD_DATA_RASTER_STATE_VIEWPORT_INDEX, \
                        "raster_state.viewport_index")
+
+#define lp_jit_thread_data_barrier(_gallivm, _ptr) \
+   lp_build_struct_get(_gallivm, _ptr, LP_JIT_THREAD_DATA_BARRIER, "barrier")
  
 /**
  * typedef for fragment shader function
@@ -238,10 +319,13 @@ enum {
  * @param dady          shader input dady
  * @param color         color buffer
  * @param depth         depth buffer
- * @param mask          mask of visible pixels in block
+ * @param mask          mask of visible pixels in block (16 bits per sample
+ *                      for multisample variants)
  * @param thread_data   task thread data
  * @param stride        color buffer row stride in bytes
  * @param depth_stride  depth buffer row stride in bytes
+ * @param sample_stride color buffer sample stride in bytes
+ * @param depth_sample_stride  depth buffer sample stride in bytes
  */
 typedef void
 (*lp_jit_frag_func)(const struct lp_jit_context *context,
@@ -253,10 +337,45 @@ typedef void
                     const void *dady,
                     uint8_t **color,
                     uint8_t *depth,
-                    uint32_t mask,
+                    uint64_t mask,
                     struct lp_jit_thread_data *thread_data,
                     unsigned *stride,
-                    unsigned depth_stride);
+                    unsigned depth_stride,
+                    unsigned *sample_stride,
+                    unsigned depth_sample_stride);
+
+
+/**
+ * typedef for compute shader function
+ *
+ * Invoked once per vector of invocations of a block, and per barrier phase.
+ *
+ * @param context           jit context
+ * @param block_x           block id x
+ * @param block_y           block id y
+ * @param block_z           block id z
+ * @param grid_x            grid size x
+ * @param grid_y            grid size y
+ * @param grid_z            grid size z
+ * @param first_invocation  linear index in the block of the first lane
+ * @param shared            block shared memory
+ * @param spill             temporaries saved across barriers
+ * @param phase             barrier phase to resume at
+ * @param thread_data       task thread data
+ */
+typedef void
+(*lp_jit_cs_func)(const struct lp_jit_context *context,
+                  uint32_t block_x,
+                  uint32_t block_y,
+                  uint32_t block_z,
+                  uint32_t grid_x,
+                  uint32_t grid_y,
+                  uint32_t grid_z,
+                  uint32_t first_invocation,
+                  void *shared,
+                  void *spill,
+                  uint32_t phase,
+                  struct lp_jit_thread_data *thread_data);
 
 
 void
@@ -271,4 +390,8 @@ void
 lp_jit_init_types(struct lp_fragment_shader_variant *lp);
 
 
+void
+lp_jit_init_cs_types(struct lp_compute_shader_variant *lp);
+
+
 #endif /* LP_JIT_H */
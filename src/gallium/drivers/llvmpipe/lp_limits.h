@@ -61,9 +61,6 @@
 #define LP_MAX_WIDTH  (1 << (LP_MAX_TEXTURE_LEVELS - 1))
 
 
-#define LP_MAX_THREADS 16
-
-
 /**
  * Max bytes per scene.  This may be replaced by a runtime parameter.
  */
@@ -72,12 +69,15 @@
 /**
  * Max number of shader variants (for all shaders combined,
  * per context) that will be kept around.
+ * The LP_MAX_SHADER_VARIANTS environment variable overrides it for
+ * fragment shaders.
  */
 #define LP_MAX_SHADER_VARIANTS 1024
 
 /**
  * Max number of instructions (for all fragment shaders combined per context)
  * that will be kept around (counted in terms of llvm ir).
+ * The LP_MAX_SHADER_INSTRUCTIONS environment variable overrides it.
  */
 #define LP_MAX_SHADER_INSTRUCTIONS (2048 * LP_MAX_SHADER_VARIANTS)
 
@@ -42,6 +42,8 @@ struct lp_counters
 {
    unsigned nr_tris;
    unsigned nr_culled_tris;
+   unsigned nr_rects;
+   unsigned nr_blit_rects;
    unsigned nr_empty_64;
    unsigned nr_fully_covered_64;
    unsigned nr_partially_covered_64;
@@ -56,8 +58,18 @@ struct lp_counters
    unsigned nr_fully_covered_4;
    unsigned nr_partially_covered_4;
    unsigned nr_non_empty_4;
+   unsigned nr_hiz_rejected_64;
+   unsigned nr_hiz_rejected_16;
+   unsigned nr_hiz_rejected_4;
    unsigned nr_llvm_compiles;
    int64_t llvm_compile_time;  /**< total, in microseconds */
+   unsigned nr_fs_variant_evictions;
+
+   unsigned nr_scenes;
+   unsigned nr_full_scenes;        /**< rasterized early for lack of space */
+   unsigned max_scene_size;        /**< in bytes */
+   unsigned nr_data_blocks_allocated;
+   unsigned nr_data_blocks_recycled;
 
    unsigned nr_color_tile_clear;
    unsigned nr_color_tile_load;
@@ -54,13 +54,21 @@ llvmpipe_create_query(struct pipe_context *pipe,
                       unsigned index)
 {
    struct llvmpipe_query *pq;
+   unsigned num_threads;
 
-   assert(type < PIPE_QUERY_TYPES);
+   assert(type < PIPE_QUERY_TYPES ||
+          (type >= LP_QUERY_FS_VARIANTS &&
+           type <= LP_QUERY_FS_VARIANT_PROMOTIONS));
 
-   pq = CALLOC_STRUCT( llvmpipe_query );
+   /* the per-thread counters are allocated along with the query */
+   num_threads = MAX2(1, llvmpipe_screen(pipe->screen)->num_threads);
+   pq = CALLOC(1, sizeof *pq + 2 * num_threads * sizeof(uint64_t));
 
    if (pq) {
       pq->type = type;
+      pq->num_threads = num_threads;
+      pq->start = (uint64_t *)(pq + 1);
+      pq->end = pq->start + num_threads;
    }
 
    return (struct pipe_query *) pq;
@@ -89,6 +97,39 @@ llvmpipe_destroy_query(struct pipe_context *pipe, struct pipe_query *q)
 }
 
 
+/**
+ * Current value of a driver specific query counter.
+ */
+static uint64_t
+llvmpipe_driver_query_value(const struct llvmpipe_context *llvmpipe,
+                            unsigned type)
+{
+   const struct lp_fs_variant_stats *stats = &llvmpipe->fs_variant_stats;
+
+   switch (type) {
+   case LP_QUERY_FS_VARIANTS:
+      return llvmpipe->nr_fs_variants;
+   case LP_QUERY_FS_VARIANT_INSTRS:
+      return llvmpipe->nr_fs_instrs;
+   case LP_QUERY_FS_VARIANTS_RETIRED:
+      return llvmpipe->nr_fs_variants_retired;
+   case LP_QUERY_FS_VARIANT_HITS:
+      return stats->hits;
+   case LP_QUERY_FS_VARIANT_COMPILES:
+      return stats->compiles;
+   case LP_QUERY_FS_VARIANT_EVICTIONS:
+      return stats->evictions;
+   case LP_QUERY_FS_VARIANT_COMPILE_TIME:
+      return stats->compile_time;
+   case LP_QUERY_FS_VARIANT_PROMOTIONS:
+      return stats->promotions;
+   default:
+      assert(0);
+      return 0;
+   }
+}
+
+
 static boolean
 llvmpipe_get_query_result(struct pipe_context *pipe, 
                           struct pipe_query *q,
@@ -177,6 +218,19 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
       *stats = pq->stats;
    }
       break;
+   case LP_QUERY_FS_VARIANTS:
+   case LP_QUERY_FS_VARIANT_INSTRS:
+   case LP_QUERY_FS_VARIANTS_RETIRED:
+      /* current totals */
+      *result = pq->end[0];
+      break;
+   case LP_QUERY_FS_VARIANT_HITS:
+   case LP_QUERY_FS_VARIANT_COMPILES:
+   case LP_QUERY_FS_VARIANT_EVICTIONS:
+   case LP_QUERY_FS_VARIANT_COMPILE_TIME:
+   case LP_QUERY_FS_VARIANT_PROMOTIONS:
+      *result = pq->end[0] - pq->start[0];
+      break;
    default:
       assert(0);
       break;
@@ -192,6 +246,12 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
    struct llvmpipe_context *llvmpipe = llvmpipe_context( pipe );
    struct llvmpipe_query *pq = llvmpipe_query(q);
 
+   /* Driver queries are sampled on the CPU and never binned. */
+   if (pq->type >= PIPE_QUERY_DRIVER_SPECIFIC) {
+      pq->start[0] = llvmpipe_driver_query_value(llvmpipe, pq->type);
+      return true;
+   }
+
    /* Check if the query is already in the scene.  If so, we need to
     * flush the scene now.  Real apps shouldn't re-use a query in a
     * frame of rendering.
@@ -201,8 +261,8 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
    }
 
 
-   memset(pq->start, 0, sizeof(pq->start));
-   memset(pq->end, 0, sizeof(pq->end));
+   memset(pq->start, 0, pq->num_threads * sizeof(*pq->start));
+   memset(pq->end, 0, pq->num_threads * sizeof(*pq->end));
    lp_setup_begin_query(llvmpipe->setup, pq);
 
    switch (pq->type) {
@@ -249,6 +309,11 @@ llvmpipe_end_query(struct pipe_context *pipe, struct pipe_query *q)
    struct llvmpipe_context *llvmpipe = llvmpipe_context( pipe );
    struct llvmpipe_query *pq = llvmpipe_query(q);
 
+   if (pq->type >= PIPE_QUERY_DRIVER_SPECIFIC) {
+      pq->end[0] = llvmpipe_driver_query_value(llvmpipe, pq->type);
+      return true;
+   }
+
    lp_setup_end_query(llvmpipe->setup, pq);
 
    switch (pq->type) {
@@ -333,6 +398,55 @@ llvmpipe_set_active_query_state(struct pipe_context *pipe, boolean enable)
 {
 }
 
+int
+llvmpipe_get_driver_query_info(struct pipe_screen *screen,
+                               unsigned index,
+                               struct pipe_driver_query_info *info)
+{
+#define QUERY(NAME, ENUM, UNITS, RESULT) \
+   {NAME, ENUM, {0}, UNITS, RESULT, 0, 0x0}
+
+   static const struct pipe_driver_query_info queries[] = {
+      /* running totals */
+      QUERY("fs-variants", LP_QUERY_FS_VARIANTS,
+            PIPE_DRIVER_QUERY_TYPE_UINT64,
+            PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE),
+      QUERY("fs-variant-instrs", LP_QUERY_FS_VARIANT_INSTRS,
+            PIPE_DRIVER_QUERY_TYPE_UINT64,
+            PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE),
+      QUERY("fs-variants-retired", LP_QUERY_FS_VARIANTS_RETIRED,
+            PIPE_DRIVER_QUERY_TYPE_UINT64,
+            PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE),
+
+      /* per-frame counters */
+      QUERY("fs-variant-hits", LP_QUERY_FS_VARIANT_HITS,
+            PIPE_DRIVER_QUERY_TYPE_UINT64,
+            PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE),
+      QUERY("fs-variant-compiles", LP_QUERY_FS_VARIANT_COMPILES,
+            PIPE_DRIVER_QUERY_TYPE_UINT64,
+            PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE),
+      QUERY("fs-variant-evictions", LP_QUERY_FS_VARIANT_EVICTIONS,
+            PIPE_DRIVER_QUERY_TYPE_UINT64,
+            PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE),
+      QUERY("fs-variant-compile-time", LP_QUERY_FS_VARIANT_COMPILE_TIME,
+            PIPE_DRIVER_QUERY_TYPE_MICROSECONDS,
+            PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE),
+      QUERY("fs-variant-promotions", LP_QUERY_FS_VARIANT_PROMOTIONS,
+            PIPE_DRIVER_QUERY_TYPE_UINT64,
+            PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE),
+   };
+#undef QUERY
+
+   if (!info)
+      return ARRAY_SIZE(queries);
+
+   if (index >= ARRAY_SIZE(queries))
+      return 0;
+
+   *info = queries[index];
+   return 1;
+}
+
 void llvmpipe_init_query_funcs(struct llvmpipe_context *llvmpipe )
 {
    llvmpipe->pipe.create_query = llvmpipe_create_query;
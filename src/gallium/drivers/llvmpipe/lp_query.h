@@ -39,11 +39,25 @@
 
 
 struct llvmpipe_context;
+struct pipe_screen;
+struct pipe_driver_query_info;
+
+
+/** Driver specific queries, see llvmpipe_get_driver_query_info() */
+#define LP_QUERY_FS_VARIANTS             (PIPE_QUERY_DRIVER_SPECIFIC + 0)
+#define LP_QUERY_FS_VARIANT_INSTRS       (PIPE_QUERY_DRIVER_SPECIFIC + 1)
+#define LP_QUERY_FS_VARIANTS_RETIRED     (PIPE_QUERY_DRIVER_SPECIFIC + 2)
+#define LP_QUERY_FS_VARIANT_HITS         (PIPE_QUERY_DRIVER_SPECIFIC + 3)
+#define LP_QUERY_FS_VARIANT_COMPILES     (PIPE_QUERY_DRIVER_SPECIFIC + 4)
+#define LP_QUERY_FS_VARIANT_EVICTIONS    (PIPE_QUERY_DRIVER_SPECIFIC + 5)
+#define LP_QUERY_FS_VARIANT_COMPILE_TIME (PIPE_QUERY_DRIVER_SPECIFIC + 6)
+#define LP_QUERY_FS_VARIANT_PROMOTIONS   (PIPE_QUERY_DRIVER_SPECIFIC + 7)
 
 
 struct llvmpipe_query {
-   uint64_t start[LP_MAX_THREADS];  /* start count value for each thread */
-   uint64_t end[LP_MAX_THREADS];    /* end count value for each thread */
+   uint64_t *start;                 /* start count value for each thread */
+   uint64_t *end;                   /* end count value for each thread */
+   unsigned num_threads;            /* entries in start and end */
    struct lp_fence *fence;          /* fence from last scene this was binned in */
    unsigned type;                   /* PIPE_QUERY_* */
    unsigned num_primitives_generated;
@@ -55,6 +69,11 @@ struct llvmpipe_query {
 
 extern void llvmpipe_init_query_funcs(struct llvmpipe_context * );
 
+extern int
+llvmpipe_get_driver_query_info(struct pipe_screen *screen,
+                               unsigned index,
+                               struct pipe_driver_query_info *info);
+
 extern boolean llvmpipe_check_render_cond(struct llvmpipe_context *);
 
 #endif /* LP_QUERY_H */
@@ -26,6 +26,7 @@
  **************************************************************************/
 
 #include <limits.h>
+#include "util/u_cpu_detect.h"
 #include "util/u_memory.h"
 #include "util/u_math.h"
 #include "util/u_rect.h"
@@ -47,9 +48,22 @@
 #include "gallivm/lp_bld_format.h"
 #include "gallivm/lp_bld_debug.h"
 #include "lp_scene.h"
+#include "lp_screen.h"
 #include "lp_tex_sample.h"
 
 
+/**
+ * The standard 4x pattern: a rotated grid, so that near-horizontal and
+ * near-vertical edges still get four distinct coverage levels.
+ */
+const int32_t lp_sample_pos_4x[LP_MAX_SAMPLES][2] = {
+   { -32, -96 },
+   {  96, -32 },
+   { -96,  32 },
+   {  32,  96 },
+};
+
+
 #ifdef DEBUG
 int jit_line = 0;
 const struct lp_rast_state *jit_state = NULL;
@@ -70,16 +84,29 @@ lp_rast_begin( struct lp_rasterizer *rast,
    LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
 
    lp_scene_begin_rasterization( scene );
-   lp_scene_bin_iter_begin( scene );
+   lp_scene_bin_iter_begin( scene, MAX2(1, rast->num_threads) );
 }
 
 
+/**
+ * Finish rasterizing a scene.
+ * Called once per scene by one thread, after all threads are done with
+ * the scene's bins.  The rest of the scene is released by the setup
+ * module when it next reuses it.
+ */
 static void
 lp_rast_end( struct lp_rasterizer *rast )
 {
-   lp_scene_end_rasterization( rast->curr_scene );
+   struct lp_scene *scene = rast->curr_scene;
+
+   lp_scene_unmap_buffers( scene );
 
    rast->curr_scene = NULL;
+
+   /* Must be last: once signalled, setup may recycle the scene. */
+   if (scene->fence) {
+      lp_fence_signal(scene->fence);
+   }
 }
 
 
@@ -109,6 +136,9 @@ lp_rast_tile_begin(struct lp_rasterizer_task *task,
    task->thread_data.vis_counter = 0;
    task->thread_data.ps_invocations = 0;
 
+   task->hiz = 0;
+   lp_rast_hiz_invalidate(task);
+
    for (i = 0; i < task->scene->fb.nr_cbufs; i++) {
       if (task->scene->fb.cbufs[i]) {
          task->color_tiles[i] = scene->cbufs[i].map +
@@ -153,16 +183,20 @@ lp_rast_clear_color(struct lp_rasterizer_task *task,
           __FUNCTION__, format, uc.ui[0], uc.ui[1], uc.ui[2], uc.ui[3]);
 
 
+   /*
+    * The samples of multisampled buffers are stored as consecutive slices,
+    * so clearing all samples of all layers is just a deeper box.
+    */
    util_fill_box(scene->cbufs[cbuf].map,
                  format,
                  scene->cbufs[cbuf].stride,
-                 scene->cbufs[cbuf].layer_stride,
+                 scene->cbufs[cbuf].sample_stride,
                  task->x,
                  task->y,
                  0,
                  task->width,
                  task->height,
-                 scene->fb_max_layer + 1,
+                 (scene->fb_max_layer + 1) * scene->fb_samples,
                  &uc);
 
    /* this will increase for each rb which probably doesn't mean much */
@@ -190,10 +224,16 @@ lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
    uint8_t *dst;
    unsigned i, j;
    unsigned block_size;
+   float z;
 
    LP_DBG(DEBUG_RAST, "%s: value=0x%08x, mask=0x%08x\n",
            __FUNCTION__, clear_value, clear_mask);
 
+   if (lp_scene_hiz_clear_value(scene, clear_value64, clear_mask64, &z)) {
+      for (i = 0; i < ARRAY_SIZE(task->hiz_zmax); i++)
+         task->hiz_zmax[i] = z;
+   }
+
    /*
     * Clear the area of the depth/depth buffer matching this tile.
     */
@@ -201,11 +241,13 @@ lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
    if (scene->fb.zsbuf) {
       unsigned layer;
       uint8_t *dst_layer = task->depth_tile;
+      /* all samples of all layers, see lp_rast_clear_color() */
+      const unsigned num_slices = (scene->fb_max_layer + 1) * scene->fb_samples;
       block_size = util_format_get_blocksize(scene->fb.zsbuf->format);
 
       clear_value &= clear_mask;
 
-      for (layer = 0; layer <= scene->fb_max_layer; layer++) {
+      for (layer = 0; layer < num_slices; layer++) {
          dst = dst_layer;
 
          switch (block_size) {
@@ -279,7 +321,7 @@ lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
             assert(0);
             break;
          }
-         dst_layer += scene->zsbuf.layer_stride;
+         dst_layer += scene->zsbuf.sample_stride;
       }
    }
 }
@@ -295,12 +337,9 @@ static void
 lp_rast_shade_tile(struct lp_rasterizer_task *task,
                    const union lp_rast_cmd_arg arg)
 {
-   const struct lp_scene *scene = task->scene;
    const struct lp_rast_shader_inputs *inputs = arg.shade_tile;
-   const struct lp_rast_state *state;
-   struct lp_fragment_shader_variant *variant;
    const unsigned tile_x = task->x, tile_y = task->y;
-   unsigned x, y;
+   unsigned bx, by, x, y;
 
    if (inputs->disable) {
       /* This command was partially binned and has been disabled */
@@ -309,60 +348,29 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
 
    LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
 
-   state = task->state;
-   assert(state);
-   if (!state) {
+   assert(task->state);
+   if (!task->state) {
       return;
    }
-   variant = state->variant;
-
-   /* render the whole 64x64 tile in 4x4 chunks */
-   for (y = 0; y < task->height; y += 4){
-      for (x = 0; x < task->width; x += 4) {
-         uint8_t *color[PIPE_MAX_COLOR_BUFS];
-         unsigned stride[PIPE_MAX_COLOR_BUFS];
-         uint8_t *depth = NULL;
-         unsigned depth_stride = 0;
-         unsigned i;
-
-         /* color buffer */
-         for (i = 0; i < scene->fb.nr_cbufs; i++){
-            if (scene->fb.cbufs[i]) {
-               stride[i] = scene->cbufs[i].stride;
-               color[i] = lp_rast_get_color_block_pointer(task, i, tile_x + x,
-                                                          tile_y + y, inputs->layer);
-            }
-            else {
-               stride[i] = 0;
-               color[i] = NULL;
-            }
-         }
 
-         /* depth buffer */
-         if (scene->zsbuf.map) {
-            depth = lp_rast_get_depth_block_pointer(task, tile_x + x,
-                                                    tile_y + y, inputs->layer);
-            depth_stride = scene->zsbuf.stride;
+   if (lp_rast_hiz_reject(task, inputs, tile_x, tile_y, TILE_SIZE)) {
+      LP_COUNT(nr_hiz_rejected_64);
+      return;
+   }
+
+   /* render the whole 64x64 tile in 4x4 chunks, one 16x16 block at a time */
+   for (by = 0; by < task->height; by += 16) {
+      for (bx = 0; bx < task->width; bx += 16) {
+         if (lp_rast_hiz_reject(task, inputs, tile_x + bx, tile_y + by, 16)) {
+            LP_COUNT(nr_hiz_rejected_16);
+            continue;
          }
 
-         /* Propagate non-interpolated raster state. */
-         task->thread_data.raster_state.viewport_index = inputs->viewport_index;
+         for (y = by; y < MIN2(by + 16, task->height); y += 4)
+            for (x = bx; x < MIN2(bx + 16, task->width); x += 4)
+               lp_rast_shade_quads_all(task, inputs, tile_x + x, tile_y + y);
 
-         /* run shader on 4x4 block */
-         BEGIN_JIT_CALL(state, task);
-         variant->jit_function[RAST_WHOLE]( &state->jit_context,
-                                            tile_x + x, tile_y + y,
-                                            inputs->frontfacing,
-                                            GET_A0(inputs),
-                                            GET_DADX(inputs),
-                                            GET_DADY(inputs),
-                                            color,
-                                            depth,
-                                            0xffff,
-                                            &task->thread_data,
-                                            stride,
-                                            depth_stride);
-         END_JIT_CALL();
+         lp_rast_hiz_update(task, inputs, tile_x + bx, tile_y + by);
       }
    }
 }
@@ -393,20 +401,23 @@ lp_rast_shade_tile_opaque(struct lp_rasterizer_task *task,
  * This is a bin command called during bin processing.
  * \param x  X position of quad in window coords
  * \param y  Y position of quad in window coords
+ * \param mask  coverage mask, 16 bits per sample if inputs->multisample
  */
 void
 lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
                          const struct lp_rast_shader_inputs *inputs,
                          unsigned x, unsigned y,
-                         unsigned mask)
+                         uint64_t mask)
 {
    const struct lp_rast_state *state = task->state;
    struct lp_fragment_shader_variant *variant = state->variant;
    const struct lp_scene *scene = task->scene;
    uint8_t *color[PIPE_MAX_COLOR_BUFS];
    unsigned stride[PIPE_MAX_COLOR_BUFS];
+   unsigned sample_stride[PIPE_MAX_COLOR_BUFS];
    uint8_t *depth = NULL;
    unsigned depth_stride = 0;
+   unsigned depth_sample_stride = 0;
    unsigned i;
 
    assert(state);
@@ -424,11 +435,13 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
       if (scene->fb.cbufs[i]) {
          stride[i] = scene->cbufs[i].stride;
+         sample_stride[i] = scene->cbufs[i].sample_stride;
          color[i] = lp_rast_get_color_block_pointer(task, i, x, y,
                                                     inputs->layer);
       }
       else {
          stride[i] = 0;
+         sample_stride[i] = 0;
          color[i] = NULL;
       }
    }
@@ -436,11 +449,20 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
    /* depth buffer */
    if (scene->zsbuf.map) {
       depth_stride = scene->zsbuf.stride;
+      depth_sample_stride = scene->zsbuf.sample_stride;
       depth = lp_rast_get_depth_block_pointer(task, x, y, inputs->layer);
    }
 
    assert(lp_check_alignment(state->jit_context.u8_blend_color, 16));
 
+   /*
+    * Primitives rasterized without per-sample coverage (points, or anything
+    * with multisample rasterization disabled) cover either all or none of
+    * the samples of a pixel.
+    */
+   if (variant->key.multisample && !inputs->multisample)
+      mask *= 0x0001000100010001ULL;
+
    /*
     * The rasterizer may produce fragments outside our
     * allocated 4x4 blocks hence need to filter them out here.
@@ -462,7 +484,9 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
                                             mask,
                                             &task->thread_data,
                                             stride,
-                                            depth_stride);
+                                            depth_stride,
+                                            sample_stride,
+                                            depth_sample_stride);
       END_JIT_CALL();
    }
 }
@@ -530,11 +554,77 @@ lp_rast_end_query(struct lp_rasterizer_task *task,
 }
 
 
+/**
+ * Copy this tile's part of a color buffer region into a buffer, once
+ * everything binned before it has been rendered.
+ * This is a bin command put in all bins covering the region.
+ * Called per thread.
+ */
+static void
+lp_rast_readback(struct lp_rasterizer_task *task,
+                 const union lp_rast_cmd_arg arg)
+{
+   const struct lp_rast_readback *rb = arg.readback;
+   const struct lp_scene *scene = task->scene;
+   const unsigned src_stride = scene->cbufs[rb->cbuf].stride;
+   const unsigned src_bpp = scene->cbufs[rb->cbuf].format_bytes;
+   const unsigned dst_bpp = util_format_get_blocksize(rb->dst_format);
+   const int x0 = MAX2(rb->rect.x0, task->x);
+   const int y0 = MAX2(rb->rect.y0, task->y);
+   const int x1 = MIN2(rb->rect.x1, task->x + TILE_SIZE - 1);
+   const int y1 = MIN2(rb->rect.y1, task->y + TILE_SIZE - 1);
+   const uint8_t *src;
+   uint8_t *dst;
+   int y;
+
+   if (x0 > x1 || y0 > y1)
+      return;
+
+   src = scene->cbufs[rb->cbuf].map + y0 * src_stride + x0 * src_bpp;
+   dst = rb->dst + (y0 - rb->rect.y0) * rb->dst_stride +
+         (x0 - rb->rect.x0) * dst_bpp;
+
+   if (rb->dst_stride >= 0) {
+      util_format_translate(rb->dst_format, dst, rb->dst_stride, 0, 0,
+                            rb->src_format, src, src_stride, 0, 0,
+                            x1 - x0 + 1, y1 - y0 + 1);
+      return;
+   }
+
+   /* flipped, one row at a time */
+   for (y = y0; y <= y1; y++) {
+      util_format_translate(rb->dst_format, dst, 0, 0, 0,
+                            rb->src_format, src, 0, 0, 0,
+                            x1 - x0 + 1, 1);
+      src += src_stride;
+      dst += rb->dst_stride;
+   }
+}
+
+
 void
 lp_rast_set_state(struct lp_rasterizer_task *task,
                   const union lp_rast_cmd_arg arg)
 {
    task->state = arg.state;
+
+   /* The variant may still be compiling in the background.  Binning went
+    * ahead with it; only the bins which actually use it have to wait.
+    */
+   lp_fs_variant_wait(llvmpipe_screen(task->scene->pipe->screen),
+                      task->state->variant);
+
+   task->hiz = 0;
+   if (task->scene->hiz && task->state->variant) {
+      task->hiz = task->state->variant->hiz;
+      if (task->hiz & LP_HIZ_INVALIDATE)
+         lp_rast_hiz_invalidate(task);
+   }
+
+   /* Count the uses of fast tier code, see promote_hot_variant() */
+   if (task->state->variant &&
+       task->state->variant->tier == GALLIVM_TIER_FAST)
+      p_atomic_inc(&task->state->variant->invocations);
 }
 
 
@@ -588,7 +678,9 @@ static lp_rast_cmd_func dispatch[LP_RAST_OP_MAX] =
    lp_rast_triangle_32_8,
    lp_rast_triangle_32_3_4,
    lp_rast_triangle_32_3_16,
-   lp_rast_triangle_32_4_16
+   lp_rast_triangle_32_4_16,
+   lp_rast_readback,
+   lp_rast_rectangle
 };
 
 
@@ -607,6 +699,7 @@ do_rasterize_bin(struct lp_rasterizer_task *task,
       for (k = 0; k < block->count; k++) {
          dispatch[block->cmd[k]]( task, block->arg[k] );
       }
+      task->stats.cmds += block->count;
    }
 }
 
@@ -640,20 +733,6 @@ rasterize_bin(struct lp_rasterizer_task *task,
 }
 
 
-/* An empty bin is one that just loads the contents of the tile and
- * stores them again unchanged.  This typically happens when bins have
- * been flushed for some reason in the middle of a frame, or when
- * incremental updates are being made to a render target.
- * 
- * Try to avoid doing pointless work in this case.
- */
-static boolean
-is_empty_bin( const struct cmd_bin *bin )
-{
-   return bin->head == NULL;
-}
-
-
 /**
  * Rasterize/execute all bins within a scene.
  * Called per thread.
@@ -676,15 +755,22 @@ rasterize_scene(struct lp_rasterizer_task *task,
 #endif
 
    if (!task->rast->no_rast) {
-      /* loop over scene bins, rasterize each */
+      /* loop over scene bins, rasterize each.
+       * Empty bins (which would just load and store the tile unchanged)
+       * are not scheduled at all.
+       */
       {
          struct cmd_bin *bin;
+         boolean stolen;
          int i, j;
 
          assert(scene);
-         while ((bin = lp_scene_bin_iter_next(scene, &i, &j))) {
-            if (!is_empty_bin( bin ))
-               rasterize_bin(task, bin, i, j);
+         while ((bin = lp_scene_bin_iter_next(scene, task->thread_index,
+                                              &i, &j, &stolen))) {
+            rasterize_bin(task, bin, i, j);
+            task->stats.bins++;
+            if (stolen)
+               task->stats.bins_stolen++;
          }
       }
    }
@@ -704,10 +790,6 @@ rasterize_scene(struct lp_rasterizer_task *task,
    }
 #endif
 
-   if (scene->fence) {
-      lp_fence_signal(scene->fence);
-   }
-
    task->scene = NULL;
 }
 
@@ -756,29 +838,15 @@ lp_rast_queue_scene( struct lp_rasterizer *rast,
 }
 
 
-void
-lp_rast_finish( struct lp_rasterizer *rast )
-{
-   if (rast->num_threads == 0) {
-      /* nothing to do */
-   }
-   else {
-      int i;
-
-      /* wait for work to complete */
-      for (i = 0; i < rast->num_threads; i++) {
-         pipe_semaphore_wait(&rast->tasks[i].work_done);
-      }
-   }
-}
-
-
 /**
  * This is the thread's main entrypoint.
  * It's a simple loop:
  *   1. wait for work
  *   2. do work
- *   3. signal that we're done
+ *   3. thread[0] signals the scene's fence
+ *
+ * Nobody waits for the threads to go idle; each queued scene posts
+ * work_ready once, so the threads move straight on to the next scene.
  */
 static int
 thread_function(void *init_data)
@@ -792,6 +860,20 @@ thread_function(void *init_data)
    util_snprintf(thread_name, sizeof thread_name, "llvmpipe-%u", task->thread_index);
    u_thread_setname(thread_name);
 
+   if (task->cpu >= 0 && u_thread_pin_to_cpu(task->cpu)) {
+      /* Now that we're running on our own core, reallocate the per-thread
+       * scratch memory from here so that first touch places it on the
+       * local NUMA node.
+       */
+      struct lp_build_format_cache *cache =
+         align_malloc(sizeof(struct lp_build_format_cache), 16);
+      if (cache) {
+         memset(cache, 0, sizeof *cache);
+         align_free(task->thread_data.cache);
+         task->thread_data.cache = cache;
+      }
+   }
+
    /* Make sure that denorms are treated like zeros. This is 
     * the behavior required by D3D10. OpenGL doesn't care.
     */
@@ -837,11 +919,8 @@ thread_function(void *init_data)
          lp_rast_end( rast );
       }
 
-      /* signal done with work */
       if (debug)
          debug_printf("thread %d done working\n", task->thread_index);
-
-      pipe_semaphore_signal(&task->work_done);
    }
 
 #ifdef _WIN32
@@ -858,15 +937,31 @@ thread_function(void *init_data)
 static void
 create_rast_threads(struct lp_rasterizer *rast)
 {
+   struct util_cpu_location *cpus = NULL;
+   unsigned num_cpus = 0;
    unsigned i;
 
+   /* Optionally pin the threads, spreading them over physical cores
+    * one NUMA node at a time before doubling up on SMT siblings.
+    */
+   if (rast->num_threads > 0 &&
+       debug_get_bool_option("LP_PIN_THREADS", FALSE)) {
+      unsigned max_cpus = MAX2(1, util_cpu_caps.nr_cpus);
+      cpus = MALLOC(max_cpus * sizeof *cpus);
+      if (cpus)
+         num_cpus = util_cpu_get_topology(cpus, max_cpus);
+   }
+
    /* NOTE: if num_threads is zero, we won't use any threads */
    for (i = 0; i < rast->num_threads; i++) {
+      rast->tasks[i].cpu = num_cpus ? (int) cpus[i % num_cpus].cpu : -1;
       pipe_semaphore_init(&rast->tasks[i].work_ready, 0);
       pipe_semaphore_init(&rast->tasks[i].work_done, 0);
       rast->threads[i] = u_thread_create(thread_function,
                                             (void *) &rast->tasks[i]);
    }
+
+   FREE(cpus);
 }
 
 
@@ -892,10 +987,17 @@ lp_rast_create( unsigned num_threads )
       goto no_full_scenes;
    }
 
+   rast->tasks = CALLOC(MAX2(1, num_threads), sizeof *rast->tasks);
+   rast->threads = CALLOC(MAX2(1, num_threads), sizeof *rast->threads);
+   if (!rast->tasks || !rast->threads) {
+      goto no_tasks;
+   }
+
    for (i = 0; i < MAX2(1, num_threads); i++) {
       struct lp_rasterizer_task *task = &rast->tasks[i];
       task->rast = rast;
       task->thread_index = i;
+      task->cpu = -1;
       task->thread_data.cache = align_malloc(sizeof(struct lp_build_format_cache),
                                              16);
       if (!task->thread_data.cache) {
@@ -919,11 +1021,14 @@ lp_rast_create( unsigned num_threads )
    return rast;
 
 no_thread_data_cache:
-   for (i = 0; i < MAX2(1, rast->num_threads); i++) {
+   for (i = 0; i < MAX2(1, num_threads); i++) {
       if (rast->tasks[i].thread_data.cache) {
          align_free(rast->tasks[i].thread_data.cache);
       }
    }
+no_tasks:
+   FREE(rast->tasks);
+   FREE(rast->threads);
 
    lp_scene_queue_destroy(rast->full_scenes);
 no_full_scenes:
@@ -959,6 +1064,15 @@ void lp_rast_destroy( struct lp_rasterizer *rast )
 #endif
    }
 
+   if (LP_DEBUG & DEBUG_COUNTERS) {
+      for (i = 0; i < MAX2(1, rast->num_threads); i++) {
+         const struct lp_rasterizer_task *task = &rast->tasks[i];
+         debug_printf("llvmpipe: thread %u: %u bins (%u stolen), %llu cmds\n",
+                      i, task->stats.bins, task->stats.bins_stolen,
+                      (unsigned long long) task->stats.cmds);
+      }
+   }
+
    /* Clean up per-thread data */
    for (i = 0; i < rast->num_threads; i++) {
       pipe_semaphore_destroy(&rast->tasks[i].work_ready);
@@ -975,6 +1089,8 @@ void lp_rast_destroy( struct lp_rasterizer *rast )
 
    lp_scene_queue_destroy(rast->full_scenes);
 
+   FREE(rast->tasks);
+   FREE(rast->threads);
    FREE(rast);
 }
 
@@ -37,8 +37,11 @@
 #ifndef LP_RAST_H
 #define LP_RAST_H
 
+#include <float.h>
+#include <math.h>
 #include "pipe/p_compiler.h"
 #include "util/u_pack_color.h"
+#include "util/u_rect.h"
 #include "lp_jit.h"
 
 
@@ -70,6 +73,15 @@ struct cmd_bin;
 
 #define IMUL64(a, b) (((int64_t)(a)) * ((int64_t)(b)))
 
+/** Number of samples per pixel of multisampled framebuffers */
+#define LP_MAX_SAMPLES 4
+
+/**
+ * Sample positions for 4x multisampling, as offsets from the pixel
+ * centre in FIXED_ONE units.
+ */
+extern const int32_t lp_sample_pos_4x[LP_MAX_SAMPLES][2];
+
 struct lp_rasterizer_task;
 
 
@@ -100,7 +112,8 @@ struct lp_rast_shader_inputs {
    unsigned frontfacing:1;      /** True for front-facing */
    unsigned disable:1;          /** Partially binned, disable this command */
    unsigned opaque:1;           /** Is opaque */
-   unsigned pad0:29;            /* wasted space */
+   unsigned multisample:1;      /** Rasterize with per-sample coverage */
+   unsigned pad0:28;            /* wasted space */
    unsigned stride;             /* how much to advance data between a0, dadx, dady */
    unsigned layer;              /* the layer to render to (from gs, already clamped) */
    unsigned viewport_index;     /* the active viewport index (from gs, already clamped) */
@@ -116,14 +129,31 @@ struct lp_rast_plane {
 
    /* one-pixel sized trivial reject offsets for each plane */
    uint32_t eo;
+
    /*
-    * We rely on this struct being 64bit aligned (ideally it would be 128bit
-    * but that's quite the waste) and therefore on 32bit we need padding
-    * since otherwise (even with the 64bit number in there) it wouldn't be.
+    * Spread of the edge function across the sample positions of a pixel
+    * (a multiple of FIXED_ONE, zero unless multisampling).  Trivial accept
+    * tests subtract it so a block only counts as covered when all its
+    * samples are.
+    * This also keeps the struct 64bit aligned, which we rely on (ideally it
+    * would be 128bit but that's quite the waste) as on 32bit it otherwise
+    * wouldn't be (even with the 64bit number in there).
     */
-   uint32_t pad;
+   uint32_t spread;
 };
 
+
+/**
+ * Offset of the edge function value at sample \p s relative to the value at
+ * the pixel centre, in the same units as lp_rast_plane::c.
+ */
+static inline int64_t
+lp_rast_plane_sample_offset(const struct lp_rast_plane *plane, unsigned s)
+{
+   return IMUL64(-plane->dcdx >> FIXED_ORDER, lp_sample_pos_4x[s][0]) +
+          IMUL64(plane->dcdy >> FIXED_ORDER, lp_sample_pos_4x[s][1]);
+}
+
 /**
  * Rasterization information for a triangle known to be in this bin,
  * plus inputs to run the shader:
@@ -143,18 +173,124 @@ struct lp_rast_triangle {
 };
 
 
+/**
+ * An axis-aligned rectangle, drawn as a pair of triangles.  As for
+ * triangles, objects of this type are put into the scene data and are
+ * tile- and bin-independent.
+ */
+struct lp_rast_rectangle {
+   /** The covered pixels, inclusive, already clipped to the draw region */
+   struct u_rect box;
+
+   /** Straight copy from a texture, see lp_setup_rect_blit() */
+   struct {
+      unsigned mode;          /**< LP_BLIT_x */
+      const uint8_t *src;     /**< texel of the pixel at box.x0/y0 */
+      int src_stride;         /**< negative if the texture is upside down */
+   } blit;
+
+   /* inputs for the shader */
+   struct lp_rast_shader_inputs inputs;
+   /* followed by a0, dadx, dady */
+};
+
+
 struct lp_rast_clear_rb {
    union util_color color_val;
    unsigned cbuf;
 };
 
 
+/**
+ * Copy of a color buffer region into a buffer, see lp_setup_readback().
+ */
+struct lp_rast_readback {
+   unsigned cbuf;
+   enum pipe_format src_format;
+   enum pipe_format dst_format;
+   struct u_rect rect;        /**< framebuffer region, inclusive */
+   ubyte *dst;                /**< where the pixel at rect.x0/y0 goes */
+   int dst_stride;
+};
+
+
 #define GET_A0(inputs) ((float (*)[4])((inputs)+1))
 #define GET_DADX(inputs) ((float (*)[4])((char *)((inputs) + 1) + (inputs)->stride))
 #define GET_DADY(inputs) ((float (*)[4])((char *)((inputs) + 1) + 2 * (inputs)->stride))
 #define GET_PLANES(tri) ((struct lp_rast_plane *)((char *)(&(tri)->inputs + 1) + 3 * (tri)->inputs.stride))
 
 
+/**
+ * Hierarchical depth rejection.
+ *
+ * Both the binner (per tile) and the rasterizer (per 16x16 block of the
+ * tile being rasterized) keep an upper bound of the depth buffer values,
+ * which starts out unknown at the beginning of each scene and is set by
+ * depth clears.  Primitives drawn with a LESS/LEQUAL depth test whose
+ * depth over a region is above that bound can't pass the test anywhere in
+ * the region, and are skipped there.
+ *
+ * These flags of lp_fragment_shader_variant::hiz say how a variant
+ * interacts with the bounds.
+ */
+#define LP_HIZ_TEST       0x1  /**< failing the depth test has no effect */
+#define LP_HIZ_WRITE      0x2  /**< full coverage sets depth to at most z */
+#define LP_HIZ_INVALIDATE 0x4  /**< may raise depth buffer values */
+
+/** Depth bound meaning nothing is known about a region */
+#define LP_HIZ_UNKNOWN FLT_MAX
+
+/**
+ * Relative error allowed for the interpolation of depth in the fragment
+ * shader, compared to the plane evaluation here.
+ */
+#define LP_HIZ_EPSILON (1.0f / (1 << 18))
+
+
+/**
+ * Compute conservative bounds of the depth of a primitive's fragments
+ * within the pixels [x0, x1] x [y0, y1].
+ *
+ * The depth plane is evaluated over the rectangle grown by one pixel,
+ * which takes care of the sample positions and of both pixel centre
+ * conventions.  The lower bound accounts for the clamp of fragment depth
+ * to 1.0, so it is only valid without depth clamping.
+ */
+static inline void
+lp_rast_depth_bounds(const struct lp_rast_shader_inputs *inputs,
+                     int x0, int y0, int x1, int y1,
+                     float *zmin, float *zmax)
+{
+   const float a0 = GET_A0(inputs)[0][2];
+   const float dzdx = GET_DADX(inputs)[0][2];
+   const float dzdy = GET_DADY(inputs)[0][2];
+   const float cx = 0.5f * (x0 + x1);
+   const float cy = 0.5f * (y0 + y1);
+   const float hx = 0.5f * (x1 - x0) + 1.0f;
+   const float hy = 0.5f * (y1 - y0) + 1.0f;
+   const float z = a0 + dzdx * cx + dzdy * cy;
+   const float dz = fabsf(dzdx) * hx + fabsf(dzdy) * hy;
+   const float err = (fabsf(a0) +
+                      fabsf(dzdx) * (fabsf(cx) + hx) +
+                      fabsf(dzdy) * (fabsf(cy) + hy)) * LP_HIZ_EPSILON;
+
+   *zmin = MIN2(z - dz - err, 1.0f);
+   *zmax = z + dz + err;
+}
+
+
+/**
+ * Texture copies.
+ *
+ * Variants whose shader just outputs a texture lookup, as for blits and 2D
+ * compositing, have lp_fragment_shader_variant::blit set to one of these.
+ * Rectangles drawn with them whose pixels map onto texel centres are
+ * rasterized with plain copies rather than the generated code.
+ */
+#define LP_BLIT_NONE 0
+#define LP_BLIT_COPY 1  /**< texels replace the color buffer */
+#define LP_BLIT_OVER 2  /**< premultiplied alpha blend over the color buffer */
+
 
 struct lp_rasterizer *
 lp_rast_create( unsigned num_threads );
@@ -166,9 +302,6 @@ void
 lp_rast_queue_scene( struct lp_rasterizer *rast,
                      struct lp_scene *scene );
 
-void
-lp_rast_finish( struct lp_rasterizer *rast );
-
 
 union lp_rast_cmd_arg {
    const struct lp_rast_shader_inputs *shade_tile;
@@ -185,6 +318,8 @@ union lp_rast_cmd_arg {
    const struct lp_rast_state *state;
    struct lp_fence *fence;
    struct llvmpipe_query *query_obj;
+   const struct lp_rast_readback *readback;
+   const struct lp_rast_rectangle *rectangle;
 };
 
 
@@ -259,6 +394,22 @@ lp_rast_arg_query( struct llvmpipe_query *pq )
    return arg;
 }
 
+static inline union lp_rast_cmd_arg
+lp_rast_arg_readback( const struct lp_rast_readback *readback )
+{
+   union lp_rast_cmd_arg arg;
+   arg.readback = readback;
+   return arg;
+}
+
+static inline union lp_rast_cmd_arg
+lp_rast_arg_rectangle( const struct lp_rast_rectangle *rectangle )
+{
+   union lp_rast_cmd_arg arg;
+   arg.rectangle = rectangle;
+   return arg;
+}
+
 static inline union lp_rast_cmd_arg
 lp_rast_arg_null( void )
 {
@@ -302,8 +453,10 @@ lp_rast_arg_null( void )
 #define LP_RAST_OP_TRIANGLE_32_3_4   0x1a
 #define LP_RAST_OP_TRIANGLE_32_3_16  0x1b
 #define LP_RAST_OP_TRIANGLE_32_4_16  0x1c
+#define LP_RAST_OP_READBACK          0x1d
+#define LP_RAST_OP_RECTANGLE         0x1e
 
-#define LP_RAST_OP_MAX               0x1d
+#define LP_RAST_OP_MAX               0x1f
 #define LP_RAST_OP_MASK              0xff
 
 void
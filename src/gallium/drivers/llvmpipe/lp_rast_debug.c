@@ -54,6 +54,8 @@ static const char *cmd_names[LP_RAST_OP_MAX] =
    "triangle_32_3_4",
    "triangle_32_3_16",
    "triangle_32_4_16",
+   "readback",
+   "rectangle",
 };
 
 static const char *cmd_name(unsigned cmd)
@@ -78,7 +80,8 @@ get_variant( const struct lp_rast_state *state,
        block->cmd[k] == LP_RAST_OP_TRIANGLE_4 ||
        block->cmd[k] == LP_RAST_OP_TRIANGLE_5 ||
        block->cmd[k] == LP_RAST_OP_TRIANGLE_6 ||
-       block->cmd[k] == LP_RAST_OP_TRIANGLE_7)
+       block->cmd[k] == LP_RAST_OP_TRIANGLE_7 ||
+       block->cmd[k] == LP_RAST_OP_RECTANGLE)
       return state->variant;
 
    return NULL;
@@ -237,6 +240,32 @@ debug_triangle(int tilex, int tiley,
 
 
 
+static int
+debug_rectangle(int tilex, int tiley,
+                const union lp_rast_cmd_arg arg,
+                struct tile *tile,
+                char val)
+{
+   const struct lp_rast_rectangle *rect = arg.rectangle;
+   boolean blend = tile->state->variant->key.blend.rt[0].blend_enable;
+   int x0 = MAX2(rect->box.x0 - tilex, 0);
+   int y0 = MAX2(rect->box.y0 - tiley, 0);
+   int x1 = MIN2(rect->box.x1 - tilex, TILE_SIZE - 1);
+   int y1 = MIN2(rect->box.y1 - tiley, TILE_SIZE - 1);
+   int x, y;
+   int count = 0;
+
+   if (rect->inputs.disable)
+      return 0;
+
+   for (y = y0; y <= y1; y++) {
+      for (x = x0; x <= x1; x++) {
+         plot(tile, x, y, val, blend);
+         count++;
+      }
+   }
+   return count;
+}
 
 
 static void
@@ -285,6 +314,9 @@ do_debug_bin( struct tile *tile,
              block->cmd[k] == LP_RAST_OP_TRIANGLE_7)
             count = debug_triangle(tx, ty, block->arg[k], tile, val);
 
+         if (block->cmd[k] == LP_RAST_OP_RECTANGLE)
+            count = debug_rectangle(tx, ty, block->arg[k], tile, val);
+
          if (print_cmds) {
             debug_printf(" % 5d", count);
 
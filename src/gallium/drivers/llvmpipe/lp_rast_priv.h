@@ -97,9 +97,24 @@ struct lp_rasterizer_task
    /** "my" index */
    unsigned thread_index;
 
+   /** Logical CPU this thread is pinned to, or -1 if unpinned */
+   int cpu;
+
    /** Non-interpolated passthru state and occlude counter for visible pixels */
    struct lp_jit_thread_data thread_data;
 
+   /** LP_HIZ_x flags of the current state, if the scene does hiz */
+   unsigned hiz;
+   /** Depth bounds of the 16x16 blocks of the tile, see lp_rast.h */
+   float hiz_zmax[16];
+
+   /** Bin scheduling statistics, reported with LP_DEBUG=counters */
+   struct {
+      unsigned bins;          /**< bins rasterized */
+      unsigned bins_stolen;   /**< bins taken from other threads' queues */
+      uint64_t cmds;          /**< commands executed */
+   } stats;
+
    pipe_semaphore work_ready;
    pipe_semaphore work_done;
 };
@@ -121,11 +136,11 @@ struct lp_rasterizer
    /** The scene currently being rasterized by the threads */
    struct lp_scene *curr_scene;
 
-   /** A task object for each rasterization thread */
-   struct lp_rasterizer_task tasks[LP_MAX_THREADS];
+   /** A task object for each rasterization thread, MAX2(1, num_threads) */
+   struct lp_rasterizer_task *tasks;
 
    unsigned num_threads;
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
 
    /** For synchronizing the rasterization threads */
    util_barrier barrier;
@@ -136,7 +151,77 @@ void
 lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
                          const struct lp_rast_shader_inputs *inputs,
                          unsigned x, unsigned y,
-                         unsigned mask);
+                         uint64_t mask);
+
+
+/**
+ * Forget the depth bounds of all blocks of the current tile.
+ */
+static inline void
+lp_rast_hiz_invalidate(struct lp_rasterizer_task *task)
+{
+   unsigned i;
+
+   for (i = 0; i < ARRAY_SIZE(task->hiz_zmax); i++)
+      task->hiz_zmax[i] = LP_HIZ_UNKNOWN;
+}
+
+
+/**
+ * Test a primitive against the depth bounds of the blocks of the current
+ * tile overlapping a size x size region.
+ * \param x, y  location of the region in window coords, inside the tile
+ * \return TRUE if the primitive can't pass the depth test in the region
+ */
+static inline boolean
+lp_rast_hiz_reject(const struct lp_rasterizer_task *task,
+                   const struct lp_rast_shader_inputs *inputs,
+                   int x, int y, unsigned size)
+{
+   const unsigned bx0 = (x - task->x) / 16;
+   const unsigned by0 = (y - task->y) / 16;
+   const unsigned bx1 = MIN2((x - task->x + size - 1) / 16, 3);
+   const unsigned by1 = MIN2((y - task->y + size - 1) / 16, 3);
+   float bound = -LP_HIZ_UNKNOWN;
+   float zmin, zmax;
+   unsigned bx, by;
+
+   if (!(task->hiz & LP_HIZ_TEST))
+      return FALSE;
+
+   for (by = by0; by <= by1; by++)
+      for (bx = bx0; bx <= bx1; bx++)
+         bound = MAX2(bound, task->hiz_zmax[by * 4 + bx]);
+
+   if (bound == LP_HIZ_UNKNOWN)
+      return FALSE;
+
+   lp_rast_depth_bounds(inputs, x, y, x + size - 1, y + size - 1,
+                        &zmin, &zmax);
+
+   return zmin > bound + task->scene->hiz_bias;
+}
+
+
+/**
+ * Tighten the depth bound of a 16x16 block of the current tile after a
+ * primitive was shaded on all of it.
+ * \param x, y  location of the block in window coords
+ */
+static inline void
+lp_rast_hiz_update(struct lp_rasterizer_task *task,
+                   const struct lp_rast_shader_inputs *inputs,
+                   int x, int y)
+{
+   if (task->hiz & LP_HIZ_WRITE) {
+      float *bound = &task->hiz_zmax[((y - task->y) / 16) * 4 +
+                                     (x - task->x) / 16];
+      float zmin, zmax;
+
+      lp_rast_depth_bounds(inputs, x, y, x + 15, y + 15, &zmin, &zmax);
+      *bound = MIN2(*bound, zmax);
+   }
+}
 
 
 /**
@@ -230,19 +315,23 @@ lp_rast_shade_quads_all( struct lp_rasterizer_task *task,
    struct lp_fragment_shader_variant *variant = state->variant;
    uint8_t *color[PIPE_MAX_COLOR_BUFS];
    unsigned stride[PIPE_MAX_COLOR_BUFS];
+   unsigned sample_stride[PIPE_MAX_COLOR_BUFS];
    uint8_t *depth = NULL;
    unsigned depth_stride = 0;
+   unsigned depth_sample_stride = 0;
    unsigned i;
 
    /* color buffer */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
       if (scene->fb.cbufs[i]) {
          stride[i] = scene->cbufs[i].stride;
+         sample_stride[i] = scene->cbufs[i].sample_stride;
          color[i] = lp_rast_get_color_block_pointer(task, i, x, y,
                                                     inputs->layer);
       }
       else {
          stride[i] = 0;
+         sample_stride[i] = 0;
          color[i] = NULL;
       }
    }
@@ -250,6 +339,7 @@ lp_rast_shade_quads_all( struct lp_rasterizer_task *task,
    if (scene->zsbuf.map) {
       depth = lp_rast_get_depth_block_pointer(task, x, y, inputs->layer);
       depth_stride = scene->zsbuf.stride;
+      depth_sample_stride = scene->zsbuf.sample_stride;
    }
 
    /*
@@ -273,7 +363,9 @@ lp_rast_shade_quads_all( struct lp_rasterizer_task *task,
                                          0xffff,
                                          &task->thread_data,
                                          stride,
-                                         depth_stride);
+                                         depth_stride,
+                                         sample_stride,
+                                         depth_sample_stride);
       END_JIT_CALL();
    }
 }
@@ -331,6 +423,9 @@ void lp_rast_triangle_32_3_16( struct lp_rasterizer_task *,
 void lp_rast_triangle_32_4_16( struct lp_rasterizer_task *, 
                             const union lp_rast_cmd_arg );
 
+void lp_rast_rectangle( struct lp_rasterizer_task *,
+                        const union lp_rast_cmd_arg );
+
 void
 lp_rast_set_state(struct lp_rasterizer_task *task,
                   const union lp_rast_cmd_arg arg);
@@ -0,0 +1,199 @@
+/**************************************************************************
+ *
+ * Copyright 2007-2009 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Rasterization for binned rectangles within a tile
+ */
+
+#include <string.h>
+#include "util/u_math.h"
+#include "lp_debug.h"
+#include "lp_perf.h"
+#include "lp_rast_priv.h"
+
+
+/**
+ * Coverage of the 4 pixels starting at p by the span [p0, p1], one bit
+ * per pixel.
+ */
+static inline unsigned
+span_mask_4(int p, int p0, int p1)
+{
+   unsigned mask = 0xf;
+
+   if (p < p0)
+      mask &= 0xf << (p0 - p);
+   if (p + 3 > p1)
+      mask &= 0xf >> (p + 3 - p1);
+   return mask;
+}
+
+
+/**
+ * Multiply two unorm8 values, rounding like the generated blend code.
+ */
+static inline unsigned
+mul_unorm8(unsigned a, unsigned b)
+{
+   unsigned t = a * b + 0x80;
+   return (t + (t >> 8)) >> 8;
+}
+
+
+/**
+ * Blend a row of premultiplied texels over the color buffer.
+ * Only for the four byte formats of lp_fs_variant_blit(), with alpha in
+ * the last byte.
+ */
+static void
+blend_over_row(uint8_t *dst, const uint8_t *src, unsigned width)
+{
+   unsigned i, c;
+
+   for (i = 0; i < width; i++, dst += 4, src += 4) {
+      const unsigned inv_alpha = 255 - src[3];
+
+      if (inv_alpha == 0) {
+         memcpy(dst, src, 4);
+         continue;
+      }
+
+      for (c = 0; c < 4; c++)
+         dst[c] = MIN2(src[c] + mul_unorm8(dst[c], inv_alpha), 255);
+   }
+}
+
+
+/**
+ * Draw the part of a rectangle within the current tile by copying the
+ * texels, see lp_setup_rect_blit().
+ * \param box  the pixels to draw, inside the tile
+ */
+static void
+lp_rast_blit_rectangle(struct lp_rasterizer_task *task,
+                       const struct lp_rast_rectangle *rect,
+                       const struct u_rect *box)
+{
+   const struct lp_scene *scene = task->scene;
+   const unsigned dst_stride = scene->cbufs[0].stride;
+   const unsigned width = box->x1 - box->x0 + 1;
+   const uint8_t *src;
+   uint8_t *dst;
+   int y;
+
+   src = rect->blit.src +
+         (box->y0 - rect->box.y0) * rect->blit.src_stride +
+         (box->x0 - rect->box.x0) * 4;
+   dst = task->color_tiles[0] +
+         (box->y0 - task->y) * dst_stride +
+         (box->x0 - task->x) * 4;
+
+   for (y = box->y0; y <= box->y1; y++) {
+      if (rect->blit.mode == LP_BLIT_COPY)
+         memcpy(dst, src, width * 4);
+      else
+         blend_over_row(dst, src, width);
+
+      src += rect->blit.src_stride;
+      dst += dst_stride;
+   }
+}
+
+
+/**
+ * Rasterize the part of a rectangle within the current tile.
+ * The coverage of each 4x4 block is the product of a row and a column
+ * span, so unlike with triangles there are no edge functions to evaluate.
+ * This is a bin command called during bin processing.
+ */
+void
+lp_rast_rectangle(struct lp_rasterizer_task *task,
+                  const union lp_rast_cmd_arg arg)
+{
+   const struct lp_rast_rectangle *rect = arg.rectangle;
+   const struct lp_rast_shader_inputs *inputs = &rect->inputs;
+   struct u_rect box;
+   int bx, by, x, y;
+
+   if (inputs->disable) {
+      /* This rectangle was partially binned and has been disabled */
+      return;
+   }
+
+   LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
+
+   box.x0 = MAX2(rect->box.x0, (int)task->x);
+   box.y0 = MAX2(rect->box.y0, (int)task->y);
+   box.x1 = MIN2(rect->box.x1, (int)(task->x + task->width) - 1);
+   box.y1 = MIN2(rect->box.y1, (int)(task->y + task->height) - 1);
+
+   if (box.x1 < box.x0 || box.y1 < box.y0)
+      return;
+
+   if (rect->blit.mode != LP_BLIT_NONE) {
+      lp_rast_blit_rectangle(task, rect, &box);
+      return;
+   }
+
+   if (lp_rast_hiz_reject(task, inputs, task->x, task->y, TILE_SIZE)) {
+      LP_COUNT(nr_hiz_rejected_64);
+      return;
+   }
+
+   for (by = box.y0 & ~15; by <= box.y1; by += 16) {
+      for (bx = box.x0 & ~15; bx <= box.x1; bx += 16) {
+         if (lp_rast_hiz_reject(task, inputs, bx, by, 16)) {
+            LP_COUNT(nr_hiz_rejected_16);
+            continue;
+         }
+
+         for (y = MAX2(by, box.y0 & ~3); y < by + 16 && y <= box.y1; y += 4) {
+            const unsigned rows = span_mask_4(y, box.y0, box.y1);
+
+            for (x = MAX2(bx, box.x0 & ~3); x < bx + 16 && x <= box.x1; x += 4) {
+               const unsigned cols = span_mask_4(x, box.x0, box.x1);
+               uint64_t mask = 0;
+               unsigned i;
+
+               for (i = 0; i < 4; i++) {
+                  if (rows & (1 << i))
+                     mask |= cols << (i * 4);
+               }
+
+               if (mask == 0xffff)
+                  lp_rast_shade_quads_all(task, inputs, x, y);
+               else
+                  lp_rast_shade_quads_mask(task, inputs, x, y, mask);
+            }
+         }
+
+         if (bx >= box.x0 && bx + 15 <= box.x1 &&
+             by >= box.y0 && by + 15 <= box.y1)
+            lp_rast_hiz_update(task, inputs, bx, by);
+      }
+   }
+}
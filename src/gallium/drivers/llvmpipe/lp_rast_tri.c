@@ -106,11 +106,39 @@ build_masks(int32_t c,
    *partmask |= build_mask_linear(c + cdiff, dcdx, dcdy);
 }
 
+
+/**
+ * Hierarchical depth test of a triangle binned with
+ * lp_rast_arg_triangle_contained(), in a size x size block.
+ */
+static inline boolean
+contained_hiz_reject(const struct lp_rasterizer_task *task,
+                     const union lp_rast_cmd_arg arg,
+                     unsigned size)
+{
+   const int x = (arg.triangle.plane_mask & 0xff) + task->x;
+   const int y = (arg.triangle.plane_mask >> 8) + task->y;
+
+   if (lp_rast_hiz_reject(task, &arg.triangle.tri->inputs, x, y, size)) {
+      if (size == 16)
+         LP_COUNT(nr_hiz_rejected_16);
+      else
+         LP_COUNT(nr_hiz_rejected_4);
+      return TRUE;
+   }
+
+   return FALSE;
+}
+
 void
 lp_rast_triangle_3_16(struct lp_rasterizer_task *task,
                       const union lp_rast_cmd_arg arg)
 {
    union lp_rast_cmd_arg arg2;
+
+   if (contained_hiz_reject(task, arg, 16))
+      return;
+
    arg2.triangle.tri = arg.triangle.tri;
    arg2.triangle.plane_mask = (1<<3)-1;
    lp_rast_triangle_3(task, arg2);
@@ -128,6 +156,10 @@ lp_rast_triangle_4_16(struct lp_rasterizer_task *task,
                       const union lp_rast_cmd_arg arg)
 {
    union lp_rast_cmd_arg arg2;
+
+   if (contained_hiz_reject(task, arg, 16))
+      return;
+
    arg2.triangle.tri = arg.triangle.tri;
    arg2.triangle.plane_mask = (1<<4)-1;
    lp_rast_triangle_4(task, arg2);
@@ -265,6 +297,9 @@ lp_rast_triangle_32_3_16(struct lp_rasterizer_task *task,
    __m128i span_2;                /* 0,dcdx,2dcdx,3dcdx for plane 2 */
    __m128i unused;
 
+   if (contained_hiz_reject(task, arg, 16))
+      return;
+
    transpose4_epi32(&p0, &p1, &p2, &zero,
                     &c, &unused, &dcdx, &dcdy);
 
@@ -373,6 +408,9 @@ lp_rast_triangle_32_3_4(struct lp_rasterizer_task *task,
    __m128i span_2;                /* 0,dcdx,2dcdx,3dcdx for plane 2 */
    __m128i unused;
 
+   if (contained_hiz_reject(task, arg, 4))
+      return;
+
    transpose4_epi32(&p0, &p1, &p2, &zero,
                     &c, &unused, &dcdx, &dcdy);
 
@@ -566,6 +604,9 @@ lp_rast_triangle_32_3_16(struct lp_rasterizer_task *task,
    vshuf_mask2 = (__m128i) vec_splats((unsigned int) 0x04050607);
 #endif
 
+   if (contained_hiz_reject(task, arg, 16))
+      return;
+
    transpose4_epi32(&p0, &p1, &p2, &zero,
                     &c, &dcdx, &dcdy, &rej4);
 
@@ -657,6 +698,10 @@ lp_rast_triangle_32_3_16(struct lp_rasterizer_task *task,
                          const union lp_rast_cmd_arg arg)
 {
    union lp_rast_cmd_arg arg2;
+
+   if (contained_hiz_reject(task, arg, 16))
+      return;
+
    arg2.triangle.tri = arg.triangle.tri;
    arg2.triangle.plane_mask = (1<<3)-1;
    lp_rast_triangle_32_3(task, arg2);
@@ -669,6 +714,10 @@ lp_rast_triangle_32_4_16(struct lp_rasterizer_task *task,
                          const union lp_rast_cmd_arg arg)
 {
    union lp_rast_cmd_arg arg2;
+
+   if (contained_hiz_reject(task, arg, 16))
+      return;
+
    arg2.triangle.tri = arg.triangle.tri;
    arg2.triangle.plane_mask = (1<<4)-1;
    lp_rast_triangle_32_4(task, arg2);
@@ -695,6 +744,56 @@ lp_rast_triangle_32_3_4(struct lp_rasterizer_task *task,
 #define BUILD_MASK_LINEAR(c, dcdx, dcdy) build_mask_linear(c, dcdx, dcdy)
 #endif
 
+
+/**
+ * Multisample version of the 4x4 leaf: evaluate the planes at each
+ * sample position and shade the block with a 16-bit coverage mask per
+ * sample.  The plane c values were biased by setup towards the sample
+ * furthest inside (see lp_setup_multisample_planes()) which gets undone
+ * here.  Only used with the 64bit rasterizer.
+ */
+static void
+do_block_4_multisample(struct lp_rasterizer_task *task,
+                       const struct lp_rast_triangle *tri,
+                       const struct lp_rast_plane *plane,
+                       unsigned nr_planes,
+                       int x, int y,
+                       const int64_t *c)
+{
+   int64_t offset[8][LP_MAX_SAMPLES];
+   uint64_t mask = 0;
+   unsigned s, j;
+
+   assert(nr_planes <= ARRAY_SIZE(offset));
+
+   for (j = 0; j < nr_planes; j++) {
+      int64_t max_offset = INT64_MIN;
+      for (s = 0; s < LP_MAX_SAMPLES; s++) {
+         offset[j][s] = lp_rast_plane_sample_offset(&plane[j], s);
+         max_offset = MAX2(max_offset, offset[j][s]);
+      }
+      for (s = 0; s < LP_MAX_SAMPLES; s++)
+         offset[j][s] -= max_offset;
+   }
+
+   for (s = 0; s < LP_MAX_SAMPLES; s++) {
+      unsigned sample_mask = 0xffff;
+
+      for (j = 0; j < nr_planes; j++) {
+         const int64_t cs = c[j] + offset[j][s];
+         sample_mask &= ~BUILD_MASK_LINEAR(((cs - 1) >> (int64_t)FIXED_ORDER),
+                                           -plane[j].dcdx >> FIXED_ORDER,
+                                           plane[j].dcdy >> FIXED_ORDER);
+      }
+
+      mask |= (uint64_t)sample_mask << (16 * s);
+   }
+
+   if (mask)
+      lp_rast_shade_quads_mask(task, &tri->inputs, x, y, mask);
+}
+
+
 #define RASTER_64 1
 
 #define TAG(x) x##_1
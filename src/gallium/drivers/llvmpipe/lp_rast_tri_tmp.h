@@ -49,6 +49,13 @@ TAG(do_block_4)(struct lp_rasterizer_task *task,
    unsigned mask = 0xffff;
    int j;
 
+#ifdef RASTER_64
+   if (tri->inputs.multisample) {
+      do_block_4_multisample(task, tri, plane, NR_PLANES, x, y, c);
+      return;
+   }
+#endif
+
    for (j = 0; j < NR_PLANES; j++) {
 #ifdef RASTER_64
       mask &= ~BUILD_MASK_LINEAR(((c[j] - 1) >> (int64_t)FIXED_ORDER),
@@ -94,7 +101,8 @@ TAG(do_block_16)(struct lp_rasterizer_task *task,
       const int32_t co = (int32_t)(c[j] >> (int64_t)FIXED_ORDER) + cox_s;
       int32_t cdiff;
       cdiff = ei - cox_s + ((int32_t)((c[j] - 1) >> (int64_t)FIXED_ORDER) -
-                            (int32_t)(c[j] >> (int64_t)FIXED_ORDER));
+                            (int32_t)(c[j] >> (int64_t)FIXED_ORDER)) -
+              (int32_t)(plane[j].spread >> FIXED_ORDER);
       dcdx <<= 2;
       dcdy <<= 2;
 #else
@@ -191,6 +199,11 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
       return;
    }
 
+   if (lp_rast_hiz_reject(task, &tri->inputs, x, y, TILE_SIZE)) {
+      LP_COUNT(nr_hiz_rejected_64);
+      return;
+   }
+
    outmask = 0;                 /* outside one or more trivial reject planes */
    partmask = 0;                /* outside one or more trivial accept planes */
 
@@ -246,7 +259,8 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
           * downscaling in setup in any case...
           */
          cdiff = ei - cox_s + ((int32_t)((c[j] - 1) >> (int64_t)FIXED_ORDER) -
-                               (int32_t)(c[j] >> (int64_t)FIXED_ORDER));
+                               (int32_t)(c[j] >> (int64_t)FIXED_ORDER)) -
+                 (int32_t)(plane[j].spread >> FIXED_ORDER);
          dcdx <<= 4;
          dcdy <<= 4;
 #else
@@ -294,13 +308,18 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
       int py = y + iy;
       int64_t cx[NR_PLANES];
 
+      partial_mask &= ~(1 << i);
+
+      if (lp_rast_hiz_reject(task, &tri->inputs, px, py, 16)) {
+         LP_COUNT(nr_hiz_rejected_16);
+         continue;
+      }
+
       for (j = 0; j < NR_PLANES; j++)
          cx[j] = (c[j]
                   - IMUL64(plane[j].dcdx, ix)
                   + IMUL64(plane[j].dcdy, iy));
 
-      partial_mask &= ~(1 << i);
-
       LP_COUNT(nr_partially_covered_16);
       TAG(do_block_16)(task, tri, plane, px, py, cx);
    }
@@ -316,8 +335,14 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
 
       inmask &= ~(1 << i);
 
+      if (lp_rast_hiz_reject(task, &tri->inputs, px, py, 16)) {
+         LP_COUNT(nr_hiz_rejected_16);
+         continue;
+      }
+
       LP_COUNT(nr_fully_covered_16);
       block_full_16(task, tri, px, py);
+      lp_rast_hiz_update(task, &tri->inputs, px, py);
    }
 }
 
@@ -345,6 +370,11 @@ TRI_16(struct lp_rasterizer_task *task,
    x += task->x;
    y += task->y;
 
+   if (lp_rast_hiz_reject(task, &tri->inputs, x, y, 16)) {
+      LP_COUNT(nr_hiz_rejected_16);
+      return;
+   }
+
    for (j = 0; j < NR_PLANES; j++) {
       const int dcdx = -plane[j].dcdx * 4;
       const int dcdy = plane[j].dcdy * 4;
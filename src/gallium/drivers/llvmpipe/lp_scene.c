@@ -27,13 +27,18 @@
 
 #include "util/u_framebuffer.h"
 #include "util/u_math.h"
+#include <stdlib.h>
+#include "util/u_atomic.h"
 #include "util/u_memory.h"
 #include "util/u_inlines.h"
 #include "util/simple_list.h"
 #include "util/u_format.h"
+#include "util/u_pack_color.h"
 #include "lp_scene.h"
 #include "lp_fence.h"
 #include "lp_debug.h"
+#include "lp_perf.h"
+#include "lp_screen.h"
 
 
 #define RESOURCE_REF_SZ 32
@@ -58,11 +63,18 @@ lp_scene_create( struct pipe_context *pipe )
       return NULL;
 
    scene->pipe = pipe;
+   scene->max_size = LP_SCENE_MAX_SIZE;
 
+   scene->bin_queue = CALLOC(MAX2(1, llvmpipe_screen(pipe->screen)->num_threads),
+                             sizeof *scene->bin_queue);
    scene->data.head =
       CALLOC_STRUCT(data_block);
-
-   (void) mtx_init(&scene->mutex, mtx_plain);
+   if (!scene->bin_queue || !scene->data.head) {
+      FREE(scene->bin_queue);
+      FREE(scene->data.head);
+      FREE(scene);
+      return NULL;
+   }
 
 #ifdef DEBUG
    /* Do some scene limit sanity checks here */
@@ -89,10 +101,18 @@ lp_scene_create( struct pipe_context *pipe )
 void
 lp_scene_destroy(struct lp_scene *scene)
 {
+   struct data_block *block, *tmp;
+
    lp_fence_reference(&scene->fence, NULL);
-   mtx_destroy(&scene->mutex);
    assert(scene->data.head->next == NULL);
    FREE(scene->data.head);
+
+   for (block = scene->data.free; block; block = tmp) {
+      tmp = block->next;
+      FREE(block);
+   }
+
+   FREE(scene->bin_queue);
    FREE(scene);
 }
 
@@ -160,6 +180,7 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
       if (!cbuf) {
          scene->cbufs[i].stride = 0;
          scene->cbufs[i].layer_stride = 0;
+         scene->cbufs[i].sample_stride = 0;
          scene->cbufs[i].map = NULL;
          continue;
       }
@@ -169,6 +190,8 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
                                                            cbuf->u.tex.level);
          scene->cbufs[i].layer_stride = llvmpipe_layer_stride(cbuf->texture,
                                                               cbuf->u.tex.level);
+         scene->cbufs[i].sample_stride = llvmpipe_sample_stride(cbuf->texture,
+                                                                cbuf->u.tex.level);
 
          scene->cbufs[i].map = llvmpipe_resource_map(cbuf->texture,
                                                      cbuf->u.tex.level,
@@ -181,6 +204,7 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
          unsigned pixstride = util_format_get_blocksize(cbuf->format);
          scene->cbufs[i].stride = cbuf->texture->width0;
          scene->cbufs[i].layer_stride = 0;
+         scene->cbufs[i].sample_stride = 0;
          scene->cbufs[i].map = lpr->data;
          scene->cbufs[i].map += cbuf->u.buf.first_element * pixstride;
          scene->cbufs[i].format_bytes = util_format_get_blocksize(cbuf->format);
@@ -191,6 +215,7 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
       struct pipe_surface *zsbuf = scene->fb.zsbuf;
       scene->zsbuf.stride = llvmpipe_resource_stride(zsbuf->texture, zsbuf->u.tex.level);
       scene->zsbuf.layer_stride = llvmpipe_layer_stride(zsbuf->texture, zsbuf->u.tex.level);
+      scene->zsbuf.sample_stride = llvmpipe_sample_stride(zsbuf->texture, zsbuf->u.tex.level);
 
       scene->zsbuf.map = llvmpipe_resource_map(zsbuf->texture,
                                                zsbuf->u.tex.level,
@@ -204,12 +229,13 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
 
 
 /**
- * Free all the temporary data in a scene.
+ * Unmap the framebuffer surfaces mapped by lp_scene_begin_rasterization().
+ * Called by the rasterizer as soon as it is done with the scene.
  */
 void
-lp_scene_end_rasterization(struct lp_scene *scene )
+lp_scene_unmap_buffers(struct lp_scene *scene)
 {
-   int i, j;
+   int i;
 
    /* Unmap color buffers */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
@@ -232,6 +258,19 @@ lp_scene_end_rasterization(struct lp_scene *scene )
                               zsbuf->u.tex.first_layer);
       scene->zsbuf.map = NULL;
    }
+}
+
+
+/**
+ * Free all the temporary data in a scene.
+ * Must not be called while the scene is being rasterized.
+ */
+void
+lp_scene_end_rasterization(struct lp_scene *scene )
+{
+   int i, j;
+
+   lp_scene_unmap_buffers(scene);
 
    /* Reset all command lists:
     */
@@ -274,19 +313,32 @@ lp_scene_end_rasterization(struct lp_scene *scene )
                       j, scene->resource_reference_size);
    }
 
-   /* Free all scene data blocks:
+   /* Put all scene data blocks but the first one in the pool, and free
+    * those the next scenes are unlikely to need:
     */
    {
       struct data_block_list *list = &scene->data;
       struct data_block *block, *tmp;
 
-      for (block = list->head->next; block; block = tmp) {
+      list->pool_size = MAX2(list->num_blocks,
+                             list->pool_size - list->pool_size / 8);
+
+      for (block = list->head; block->next; block = tmp) {
          tmp = block->next;
-	 FREE(block);
+         block->next = list->free;
+         list->free = block;
+         list->num_free++;
       }
-
-      list->head->next = NULL;
+      list->head = block;
       list->head->used = 0;
+      list->num_blocks = 0;
+
+      while (list->num_free > list->pool_size) {
+         block = list->free;
+         list->free = block->next;
+         list->num_free--;
+         FREE(block);
+      }
    }
 
    lp_fence_reference(&scene->fence, NULL);
@@ -330,21 +382,33 @@ lp_scene_new_cmd_block( struct lp_scene *scene,
 struct data_block *
 lp_scene_new_data_block( struct lp_scene *scene )
 {
-   if (scene->scene_size + DATA_BLOCK_SIZE > LP_SCENE_MAX_SIZE) {
+   if (scene->scene_size + DATA_BLOCK_SIZE > scene->max_size) {
       if (0) debug_printf("%s: failed\n", __FUNCTION__);
       scene->alloc_failed = TRUE;
       return NULL;
    }
    else {
-      struct data_block *block = MALLOC_STRUCT(data_block);
-      if (!block)
-         return NULL;
-      
+      struct data_block_list *list = &scene->data;
+      struct data_block *block = list->free;
+
+      if (block) {
+         list->free = block->next;
+         list->num_free--;
+         LP_COUNT(nr_data_blocks_recycled);
+      }
+      else {
+         block = MALLOC_STRUCT(data_block);
+         if (!block)
+            return NULL;
+         LP_COUNT(nr_data_blocks_allocated);
+      }
+
       scene->scene_size += sizeof *block;
 
       block->used = 0;
-      block->next = scene->data.head;
-      scene->data.head = block;
+      block->next = list->head;
+      list->head = block;
+      list->num_blocks++;
 
       return block;
    }
@@ -449,72 +513,144 @@ lp_scene_is_resource_referenced(const struct lp_scene *scene,
 
 
 
-/** advance curr_x,y to the next bin */
-static boolean
-next_bin(struct lp_scene *scene)
+static int
+compare_bin_cost(const void *a, const void *b)
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
-   }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return FALSE;
+   const struct lp_scene_bin_ref *ba = a;
+   const struct lp_scene_bin_ref *bb = b;
+
+   if (ba->cost != bb->cost)
+      return ba->cost < bb->cost ? 1 : -1;
+
+   /* keep the order deterministic */
+   if (ba->y != bb->y)
+      return ba->y < bb->y ? -1 : 1;
+   return ba->x < bb->x ? -1 : (ba->x > bb->x);
+}
+
+
+/**
+ * Build the list of bins to rasterize, most expensive first, so that the
+ * long running bins get started early instead of ending up as the tail
+ * which a single thread grinds through while the others idle.
+ */
+static void
+lp_scene_schedule_bins(struct lp_scene *scene)
+{
+   unsigned x, y, n = 0;
+
+   for (y = 0; y < scene->tiles_y; y++) {
+      for (x = 0; x < scene->tiles_x; x++) {
+         const struct cmd_bin *bin = lp_scene_get_bin(scene, x, y);
+         const struct cmd_block *block;
+         unsigned cost = 0;
+
+         for (block = bin->head; block; block = block->next)
+            cost += block->count;
+
+         if (cost) {
+            scene->bin_order[n].cost = cost;
+            scene->bin_order[n].x = x;
+            scene->bin_order[n].y = y;
+            n++;
+         }
+      }
    }
-   return TRUE;
+
+   qsort(scene->bin_order, n, sizeof scene->bin_order[0], compare_bin_cost);
+
+   scene->num_active_bins = n;
 }
 
 
+/**
+ * Prepare for iterating over the scene's bins with the given number of
+ * (per-thread) queues.
+ */
 void
-lp_scene_bin_iter_begin( struct lp_scene *scene )
+lp_scene_bin_iter_begin( struct lp_scene *scene, unsigned num_queues )
 {
-   scene->curr_x = scene->curr_y = -1;
+   unsigned i;
+
+   assert(num_queues >= 1 &&
+          num_queues <= MAX2(1, llvmpipe_screen(scene->pipe->screen)->num_threads));
+
+   scene->num_bin_queues = num_queues;
+   for (i = 0; i < num_queues; i++) {
+      scene->bin_queue[i].next = 0;
+   }
 }
 
 
 /**
- * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
- * Multiple rendering threads will call this function to get a chunk
- * of work (a bin) to work on.
+ * Pop the next bin from the given queue.
+ * \return index into bin_order, or -1 if the queue is exhausted
+ */
+static inline int
+pop_bin(struct lp_scene *scene, unsigned queue)
+{
+   struct lp_scene_bin_queue *q = &scene->bin_queue[queue];
+   unsigned idx;
+
+   /* cheap check first to avoid pointless atomics on drained queues */
+   if (queue + (unsigned) q->next * scene->num_bin_queues >=
+       scene->num_active_bins)
+      return -1;
+
+   idx = queue + (p_atomic_inc_return(&q->next) - 1) * scene->num_bin_queues;
+   if (idx >= scene->num_active_bins)
+      return -1;
+
+   return idx;
+}
+
+
+/**
+ * Return pointer to next bin to be rendered by the thread owning the
+ * given queue.
+ * Bins are taken from the thread's own queue, in order of decreasing cost,
+ * and once that is empty stolen from the other threads' queues.
+ * This is lock-free, multiple rendering threads call it concurrently.
+ * \param stolen  returns whether the bin came from another thread's queue
  */
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene , int *x, int *y)
+lp_scene_bin_iter_next( struct lp_scene *scene, unsigned queue,
+                        int *x, int *y, boolean *stolen )
 {
-   struct cmd_bin *bin = NULL;
+   unsigned num_queues = scene->num_bin_queues;
+   unsigned i;
+   int idx;
 
-   mtx_lock(&scene->mutex);
+   assert(queue < num_queues);
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
-   }
-   else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
+   idx = pop_bin(scene, queue);
+   *stolen = FALSE;
+
+   for (i = 1; idx < 0 && i < num_queues; i++) {
+      idx = pop_bin(scene, (queue + i) % num_queues);
+      *stolen = TRUE;
    }
 
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
-   *x = scene->curr_x;
-   *y = scene->curr_y;
+   if (idx < 0)
+      return NULL;
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   mtx_unlock(&scene->mutex);
-   return bin;
+   *x = scene->bin_order[idx].x;
+   *y = scene->bin_order[idx].y;
+   return lp_scene_get_bin(scene, *x, *y);
 }
 
 
 void lp_scene_begin_binning(struct lp_scene *scene,
-                            struct pipe_framebuffer_state *fb)
+                            struct pipe_framebuffer_state *fb,
+                            unsigned max_size)
 {
    int i;
    unsigned max_layer = ~0;
 
    assert(lp_scene_is_empty(scene));
 
+   scene->max_size = max_size;
+
    util_copy_framebuffer_state(&scene->fb, fb);
 
    scene->tiles_x = align(fb->width, TILE_SIZE) / TILE_SIZE;
@@ -545,17 +681,127 @@ void lp_scene_begin_binning(struct lp_scene *scene,
       max_layer = MIN2(max_layer, zsbuf->u.tex.last_layer - zsbuf->u.tex.first_layer);
    }
    scene->fb_max_layer = max_layer;
+   scene->fb_samples = MAX2(util_framebuffer_get_num_samples(fb), 1);
+
+   /*
+    * The depth bounds aren't per layer, and start out unknown in each scene
+    * as the depth buffer may have been written by other means in between.
+    */
+   scene->hiz = FALSE;
+   scene->hiz_bias = 0.0f;
+   scene->hiz_zmask = 0;
+   if (fb->zsbuf && max_layer == 0 && !(LP_PERF & PERF_NO_HIZ)) {
+      const struct util_format_description *desc =
+         util_format_description(fb->zsbuf->format);
+
+      if (util_format_has_depth(desc)) {
+         const struct util_format_channel_description *chan =
+            &desc->channel[desc->swizzle[0]];
+
+         scene->hiz = TRUE;
+         if (chan->type != UTIL_FORMAT_TYPE_FLOAT)
+            scene->hiz_bias = 1.0f / (float) ((1ULL << chan->size) - 1);
+         scene->hiz_zmask = util_pack64_mask_z_stencil(fb->zsbuf->format,
+                                                       ~0, 0);
+      }
+   }
+
+   for (i = 0; i < scene->tiles_x; i++) {
+      unsigned j;
+      for (j = 0; j < scene->tiles_y; j++)
+         scene->tile[i][j].hiz_zmax = LP_HIZ_UNKNOWN;
+   }
+}
+
+
+/**
+ * Compute the depth bound after a z/stencil clear with the given packed
+ * value and mask.
+ * \return FALSE if the clear doesn't touch depth
+ */
+boolean
+lp_scene_hiz_clear_value(const struct lp_scene *scene,
+                         uint64_t value, uint64_t mask, float *z)
+{
+   const struct util_format_description *desc;
+
+   if (!(mask & scene->hiz_zmask))
+      return FALSE;
+
+   if ((mask & scene->hiz_zmask) != scene->hiz_zmask) {
+      *z = LP_HIZ_UNKNOWN;
+      return TRUE;
+   }
+
+   desc = util_format_description(scene->fb.zsbuf->format);
+   desc->unpack_z_float(z, 0, (const uint8_t *) &value, 0, 1, 1);
+   return TRUE;
+}
+
+
+/**
+ * Update the binning time depth bounds for a z/stencil clear binned
+ * everywhere.
+ */
+void
+lp_scene_hiz_clear(struct lp_scene *scene, uint64_t value, uint64_t mask)
+{
+   unsigned i, j;
+   float z;
+
+   if (!lp_scene_hiz_clear_value(scene, value, mask, &z))
+      return;
+
+   for (i = 0; i < scene->tiles_x; i++)
+      for (j = 0; j < scene->tiles_y; j++)
+         scene->tile[i][j].hiz_zmax = z;
+}
+
+
+/**
+ * Storage limit for the scenes following this one, adapted to the observed
+ * workload.  Scenes which run out of space have to be rasterized before the
+ * frame is complete, so the limit doubles whenever that happens.  It slowly
+ * decays back while scenes use little of it, so that a single heavy frame
+ * doesn't pin the memory for good.
+ */
+unsigned
+lp_scene_next_max_size(const struct lp_scene *scene)
+{
+   unsigned max_size = scene->max_size;
+
+   if (scene->alloc_failed)
+      max_size = MIN2(max_size * 2, LP_SCENE_MAX_SIZE_LIMIT);
+   else if (scene->scene_size < max_size / 4)
+      max_size = MAX2(max_size - max_size / 16, LP_SCENE_MAX_SIZE);
+
+   return max_size;
 }
 
 
 void lp_scene_end_binning( struct lp_scene *scene )
 {
+   lp_scene_schedule_bins(scene);
+
+   LP_COUNT(nr_scenes);
+   if (scene->alloc_failed)
+      LP_COUNT(nr_full_scenes);
+#ifdef DEBUG
+   lp_count.max_scene_size = MAX2(lp_count.max_scene_size,
+                                  scene->scene_size);
+#endif
+
    if (LP_DEBUG & DEBUG_SCENE) {
       debug_printf("rasterize scene:\n");
-      debug_printf("  scene_size: %u\n",
-                   scene->scene_size);
+      debug_printf("  scene_size: %u/%u%s\n",
+                   scene->scene_size, scene->max_size,
+                   scene->alloc_failed ? " (full)" : "");
       debug_printf("  data size: %u\n",
                    lp_scene_data_size(scene));
+      debug_printf("  data blocks: %u, %u pooled\n",
+                   scene->data.num_blocks + 1, scene->data.num_free);
+      debug_printf("  active bins: %u/%u\n",
+                   scene->num_active_bins, lp_scene_get_num_bins(scene));
 
       if (0)
          lp_debug_bins( scene );
@@ -38,6 +38,7 @@
 #include "os/os_thread.h"
 #include "lp_rast.h"
 #include "lp_debug.h"
+#include "lp_limits.h"
 
 struct lp_scene_queue;
 struct lp_rast_state;
@@ -58,10 +59,15 @@ struct lp_rast_state;
  */
 #define DATA_BLOCK_SIZE (64 * 1024)
 
-/* Scene temporary storage is clamped to this size:
+/* Scene temporary storage is initially clamped to this size, see
+ * lp_scene::max_size:
  */
 #define LP_SCENE_MAX_SIZE (9*1024*1024)
 
+/* Scenes which keep running out of storage may grow up to this size:
+ */
+#define LP_SCENE_MAX_SIZE_LIMIT (8*LP_SCENE_MAX_SIZE)
+
 /* The maximum amount of texture storage referenced by a scene is
  * clamped to this size:
  */
@@ -97,6 +103,7 @@ struct cmd_bin {
    const struct lp_rast_state *last_state;       /* most recent state set in bin */
    struct cmd_block *head;
    struct cmd_block *tail;
+   float hiz_zmax;   /* depth bound after the binned commands, see lp_rast.h */
 };
    
 
@@ -113,10 +120,41 @@ struct cmd_bin {
 struct data_block_list {
    struct data_block first;
    struct data_block *head;
+
+   /** Number of blocks in use besides the last one of the list */
+   unsigned num_blocks;
+
+   /**
+    * Blocks of earlier uses of the scene, recycled before allocating new
+    * ones.  At most pool_size blocks are kept, a decaying high-water mark
+    * of the blocks used by recent scenes.
+    */
+   struct data_block *free;
+   unsigned num_free;
+   unsigned pool_size;
 };
 
 struct resource_ref;
 
+/**
+ * A non-empty bin, as scheduled for rasterization.
+ */
+struct lp_scene_bin_ref {
+   unsigned cost;          /**< number of commands in the bin */
+   uint16_t x, y;
+};
+
+/**
+ * Per-thread queue of bins.
+ *
+ * The scheduled bins are dealt out round-robin, so queue i holds the bins
+ * bin_order[i], bin_order[i + num_bin_queues], ...  Both the owning thread
+ * and threads stealing work pop bins by atomically incrementing 'next'.
+ */
+struct lp_scene_bin_queue {
+   int next;
+};
+
 /**
  * All bins and bin data are contained here.
  * Per-bin data goes into the 'tile' bins.
@@ -142,12 +180,25 @@ struct lp_scene {
       uint8_t *map;
       unsigned stride;
       unsigned layer_stride;
+      unsigned sample_stride;
       unsigned format_bytes;
    } zsbuf, cbufs[PIPE_MAX_COLOR_BUFS];
 
    /* The amount of layers in the fb (minimum of all attachments) */
    unsigned fb_max_layer;
 
+   /* Number of samples per pixel in the fb (1 if not multisampled) */
+   unsigned fb_samples;
+
+   /* Whether hierarchical depth rejection is done, see lp_rast.h */
+   boolean hiz;
+   /* Depth difference sure to compare different after conversion to the
+    * depth buffer format
+    */
+   float hiz_bias;
+   /* The depth bits of the packed z/stencil clear value */
+   uint64_t hiz_zmask;
+
    /** the framebuffer to render the scene into */
    struct pipe_framebuffer_state fb;
 
@@ -165,6 +216,9 @@ struct lp_scene {
     */
    unsigned resource_reference_size;
 
+   /** Limit for scene_size, see lp_scene_next_max_size() */
+   unsigned max_size;
+
    boolean alloc_failed;
    /**
     * Number of active tiles in each dimension.
@@ -172,8 +226,12 @@ struct lp_scene {
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
-   mtx_t mutex;
+   /** Non-empty bins, sorted by decreasing cost, for iterating over bins */
+   unsigned num_active_bins;
+   struct lp_scene_bin_ref bin_order[TILES_X * TILES_Y];
+
+   unsigned num_bin_queues;
+   struct lp_scene_bin_queue *bin_queue;   /**< MAX2(1, num_threads) queues */
 
    struct cmd_bin tile[TILES_X][TILES_Y];
    struct data_block_list data;
@@ -218,7 +276,7 @@ lp_scene_alloc( struct lp_scene *scene, unsigned size)
    if (LP_DEBUG & DEBUG_MEM)
       debug_printf("alloc %u block %u/%u tot %u/%u\n",
 		   size, block->used, DATA_BLOCK_SIZE,
-		   scene->scene_size, LP_SCENE_MAX_SIZE);
+		   scene->scene_size, scene->max_size);
 
    if (block->used + size > DATA_BLOCK_SIZE) {
       block = lp_scene_new_data_block( scene );
@@ -252,7 +310,7 @@ lp_scene_alloc_aligned( struct lp_scene *scene, unsigned size,
       debug_printf("alloc %u block %u/%u tot %u/%u\n",
 		   size + alignment - 1,
 		   block->used, DATA_BLOCK_SIZE,
-		   scene->scene_size, LP_SCENE_MAX_SIZE);
+		   scene->scene_size, scene->max_size);
        
    if (block->used + size + alignment - 1 > DATA_BLOCK_SIZE) {
       block = lp_scene_new_data_block( scene );
@@ -378,28 +436,44 @@ lp_scene_get_num_bins( const struct lp_scene *scene )
 
 
 void
-lp_scene_bin_iter_begin( struct lp_scene *scene );
+lp_scene_bin_iter_begin( struct lp_scene *scene, unsigned num_queues );
 
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene, int *x, int *y );
+lp_scene_bin_iter_next( struct lp_scene *scene, unsigned queue,
+                        int *x, int *y, boolean *stolen );
+
 
 
+boolean
+lp_scene_hiz_clear_value(const struct lp_scene *scene,
+                         uint64_t value, uint64_t mask, float *z);
+
+void
+lp_scene_hiz_clear(struct lp_scene *scene, uint64_t value, uint64_t mask);
+
 
 /* Begin/end binning of a scene
  */
 void
 lp_scene_begin_binning(struct lp_scene *scene,
-                       struct pipe_framebuffer_state *fb);
+                       struct pipe_framebuffer_state *fb,
+                       unsigned max_size);
 
 void
 lp_scene_end_binning(struct lp_scene *scene);
 
+unsigned
+lp_scene_next_max_size(const struct lp_scene *scene);
+
 
 /* Begin/end rasterization of a scene
  */
 void
 lp_scene_begin_rasterization(struct lp_scene *scene);
 
+void
+lp_scene_unmap_buffers(struct lp_scene *scene);
+
 void
 lp_scene_end_rasterization(struct lp_scene *scene);
 
@@ -37,10 +37,14 @@
 #include "pipe/p_screen.h"
 #include "pipe/p_defines.h"
 #include "os/os_thread.h"
+#include "util/u_queue.h"
 #include "gallivm/lp_bld.h"
 
 
 struct sw_winsys;
+struct disk_cache;
+struct lp_cached_code;
+struct lp_cs_tpool;
 
 
 struct llvmpipe_screen
@@ -57,6 +61,20 @@ struct llvmpipe_screen
 
    struct lp_rasterizer *rast;
    mtx_t rast_mutex;
+
+   /** Fence of the last scene queued by any context, under rast_mutex */
+   struct lp_fence *last_fence;
+
+   /** Workers for compute shader dispatch, separate from the rasterizer */
+   struct lp_cs_tpool *cs_tpool;
+
+   /** Background fragment shader compilation, see LP_ASYNC_COMPILE */
+   struct util_queue compile_queue;
+
+   /** Uses after which fast tier variants are recompiled, 0 to disable */
+   unsigned tier_threshold;
+
+   struct disk_cache *disk_shader_cache;
 };
 
 
@@ -69,5 +87,15 @@ llvmpipe_screen( struct pipe_screen *pipe )
 }
 
 
+void
+lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
+                          struct lp_cached_code *cache,
+                          const unsigned char ir_sha1_cache_key[20]);
+
+void
+lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
+                            struct lp_cached_code *cache,
+                            const unsigned char ir_sha1_cache_key[20]);
+
 
 #endif /* LP_SCREEN_H */
@@ -44,8 +44,10 @@ struct lp_fragment_shader_variant;
 struct lp_jit_context;
 struct llvmpipe_query;
 struct pipe_fence_handle;
+struct lp_fence;
 struct lp_setup_variant;
 struct lp_setup_context;
+struct lp_rast_readback;
 
 void lp_setup_reset( struct lp_setup_context *setup );
 
@@ -67,6 +69,10 @@ lp_setup_flush( struct lp_setup_context *setup,
                 struct pipe_fence_handle **fence,
                 const char *reason);
 
+void
+lp_setup_get_newest_fence(struct lp_setup_context *setup,
+                          struct lp_fence **fence);
+
 
 void
 lp_setup_bind_framebuffer( struct lp_setup_context *setup,
@@ -104,6 +110,11 @@ lp_setup_set_fs_constants(struct lp_setup_context *setup,
                           unsigned num,
                           struct pipe_constant_buffer *buffers);
 
+void
+lp_setup_set_fs_ssbos(struct lp_setup_context *setup,
+                      unsigned num,
+                      struct pipe_shader_buffer *buffers);
+
 void
 lp_setup_set_alpha_ref_value( struct lp_setup_context *setup,
                               float alpha_ref_value );
@@ -125,6 +136,10 @@ lp_setup_set_viewports(struct lp_setup_context *setup,
                        unsigned num_viewports,
                        const struct pipe_viewport_state *viewports);
 
+void
+lp_jit_texture_from_view(struct lp_jit_texture *jit_tex,
+                         const struct pipe_sampler_view *view);
+
 void
 lp_setup_set_fragment_sampler_views(struct lp_setup_context *setup,
                                     unsigned num,
@@ -143,6 +158,10 @@ void
 lp_setup_set_flatshade_first( struct lp_setup_context *setup, 
                               boolean flatshade_first );
 
+void
+lp_setup_set_multisample( struct lp_setup_context *setup,
+                          boolean multisample );
+
 void
 lp_setup_set_rasterizer_discard( struct lp_setup_context *setup, 
                                  boolean rasterizer_discard );
@@ -159,6 +178,11 @@ void
 lp_setup_end_query(struct lp_setup_context *setup,
                    struct llvmpipe_query *pq);
 
+boolean
+lp_setup_readback(struct lp_setup_context *setup,
+                  const struct lp_rast_readback *readback,
+                  struct pipe_resource *dst);
+
 static inline unsigned
 lp_clamp_viewport_idx(int idx)
 {
@@ -49,14 +49,18 @@
 #define LP_SETUP_NEW_BLEND_COLOR 0x04
 #define LP_SETUP_NEW_SCISSOR     0x08
 #define LP_SETUP_NEW_VIEWPORTS   0x10
+#define LP_SETUP_NEW_SSBOS       0x20
 
 
 struct lp_setup_variant;
 
 
-/** Max number of scenes */
-/* XXX: make multiple scenes per context work, see lp_setup_rasterize_scene */
-#define MAX_SCENES 1
+/**
+ * Max number of scenes per context.  Scenes are created on demand; while
+ * one is being binned, the others may be queued for or undergoing
+ * rasterization.
+ */
+#define MAX_SCENES 4
 
 
 
@@ -87,9 +91,10 @@ struct lp_setup_context
     */
    struct draw_stage *vbuf;
    unsigned num_threads;
-   unsigned scene_idx;
+   unsigned num_scenes;
    struct lp_scene *scenes[MAX_SCENES];  /**< all the scenes */
    struct lp_scene *scene;               /**< current scene being built */
+   unsigned scene_max_size;  /**< storage limit of the next scene */
 
    struct lp_fence *last_fence;
    struct llvmpipe_query *active_queries[LP_MAX_ACTIVE_BINNED_QUERIES];
@@ -100,6 +105,8 @@ struct lp_setup_context
    boolean scissor_test;
    boolean point_size_per_vertex;
    boolean rasterizer_discard;
+   boolean multisample;        /**< rasterize with per-sample coverage */
+   boolean multisample_enable; /**< rasterizer multisample state */
    unsigned cullmode;
    unsigned bottom_edge_rule;
    float pixel_offset;
@@ -143,6 +150,11 @@ struct lp_setup_context
       const void *stored_data;
    } constants[LP_MAX_TGSI_CONST_BUFFERS];
 
+   /** fragment shader storage buffers */
+   struct {
+      struct pipe_shader_buffer current;
+   } ssbos[LP_MAX_TGSI_SHADER_BUFFERS];
+
    struct {
       struct pipe_blend_color current;
       uint8_t *stored;
@@ -214,6 +226,11 @@ lp_setup_alloc_triangle(struct lp_scene *scene,
                         unsigned nr_planes,
                         unsigned *tri_size);
 
+void
+lp_setup_multisample_planes(struct lp_rast_plane *plane,
+                            unsigned nr_planes,
+                            unsigned nr_edges);
+
 boolean
 lp_setup_bin_triangle(struct lp_setup_context *setup,
                       struct lp_rast_triangle *tri,
@@ -222,4 +239,26 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                       int nr_planes,
                       unsigned scissor_index);
 
+boolean
+lp_setup_whole_tile(struct lp_setup_context *setup,
+                    const struct lp_rast_shader_inputs *inputs,
+                    int tx, int ty);
+
+boolean
+lp_setup_hiz_reject_tile(struct lp_setup_context *setup,
+                         unsigned hiz,
+                         const struct lp_rast_shader_inputs *inputs,
+                         int tx, int ty,
+                         const struct u_rect *box,
+                         boolean full);
+
+boolean
+lp_setup_rect(struct lp_setup_context *setup,
+              const float (*v0)[4],
+              const float (*v1)[4],
+              const float (*v2)[4],
+              const float (*v3)[4],
+              const float (*v4)[4],
+              const float (*v5)[4]);
+
 #endif
@@ -485,6 +485,8 @@ try_setup_point( struct lp_setup_context *setup,
 
    point->inputs.disable = FALSE;
    point->inputs.opaque = FALSE;
+   /* points cover whole pixels, see lp_rast_shade_quads_mask() */
+   point->inputs.multisample = FALSE;
    point->inputs.layer = layer;
    point->inputs.viewport_index = viewport_index;
 
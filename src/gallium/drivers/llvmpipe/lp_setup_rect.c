@@ -0,0 +1,522 @@
+/**************************************************************************
+ *
+ * Copyright 2007 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Binning code for screen-aligned rectangles.
+ *
+ * 2D workloads (blits, compositors, UI toolkits) draw almost everything
+ * as pairs of triangles making up axis-aligned rectangles.  Those are
+ * detected here and binned as a single rectangle command, whose coverage
+ * within a tile is just a span of rows and columns, see lp_rast_rect.c.
+ */
+
+#include <float.h>
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_rect.h"
+#include "lp_debug.h"
+#include "lp_perf.h"
+#include "lp_setup_context.h"
+#include "lp_rast.h"
+#include "lp_state_fs.h"
+#include "lp_state_setup.h"
+#include "lp_context.h"
+
+#define NUM_CHANNELS 4
+
+/** Larger coordinates would overflow the fixed point conversion */
+#define MAX_RECT_COORD ((float)(1 << (30 - FIXED_ORDER)))
+
+
+/**
+ * Alloc space for a new rectangle plus the input.a0/dadx/dady arrays
+ * immediately after it.
+ * The memory is allocated from the per-scene pool, not per-tile.
+ */
+static struct lp_rast_rectangle *
+lp_setup_alloc_rectangle(struct lp_scene *scene,
+                         unsigned nr_inputs)
+{
+   unsigned input_array_sz = NUM_CHANNELS * (nr_inputs + 1) * sizeof(float);
+   struct lp_rast_rectangle *rect;
+
+   rect = lp_scene_alloc_aligned(scene,
+                                 sizeof(struct lp_rast_rectangle) +
+                                 3 * input_array_sz,
+                                 16);
+   if (!rect)
+      return NULL;
+
+   rect->inputs.stride = input_array_sz;
+
+   return rect;
+}
+
+
+/**
+ * Whether the current state allows drawing triangles as rectangles.
+ * Anything which could tell the two triangles apart rules it out.
+ */
+static boolean
+lp_setup_rect_allowed(struct lp_setup_context *setup)
+{
+   const struct lp_setup_variant_key *key = &setup->setup.variant->key;
+   struct llvmpipe_context *lp_context = (struct llvmpipe_context *)setup->pipe;
+   unsigned i;
+
+   if ((LP_PERF & PERF_NO_RECT) ||
+       setup->rasterizer_discard ||
+       setup->multisample ||
+       setup->layer_slot > 0 ||
+       setup->viewport_index_slot > 0 ||
+       lp_context->active_statistics_queries ||
+       key->twoside ||
+       key->pgon_offset_units != 0.0f ||
+       key->pgon_offset_scale != 0.0f)
+      return FALSE;
+
+   for (i = 0; i < key->num_inputs; i++) {
+      if (key->inputs[i].interp == LP_INTERP_CONSTANT ||
+          key->inputs[i].cyl_wrap)
+         return FALSE;
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Which corner of the rectangle [x0, x1] x [y0, y1] a vertex is at, as
+ * bit 0 for the right and bit 1 for the bottom edge, or -1 if it is not
+ * at any.
+ */
+static inline int
+rect_corner(const float (*v)[4], float x0, float y0, float x1, float y1)
+{
+   int corner = 0;
+
+   if (v[0][0] == x1)
+      corner |= 1;
+   else if (v[0][0] != x0)
+      return -1;
+
+   if (v[0][1] == y1)
+      corner |= 2;
+   else if (v[0][1] != y0)
+      return -1;
+
+   return corner;
+}
+
+
+/**
+ * Whether two vertices at the same corner have the same attributes.
+ */
+static boolean
+rect_vertex_equal(const struct lp_setup_variant_key *key,
+                  const float (*a)[4],
+                  const float (*b)[4])
+{
+   unsigned i, chan;
+
+   if (a == b)
+      return TRUE;
+
+   if (a[0][2] != b[0][2] || a[0][3] != b[0][3])
+      return FALSE;
+
+   for (i = 0; i < key->num_inputs; i++) {
+      const unsigned slot = key->inputs[i].src_index;
+
+      for (chan = 0; chan < NUM_CHANNELS; chan++) {
+         if ((key->inputs[i].usage_mask & (1 << chan)) &&
+             a[slot][chan] != b[slot][chan])
+            return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Whether an attribute varies linearly over the rectangle, so that the
+ * plane of either triangle fits the other one too.
+ */
+static inline boolean
+rect_attrib_linear(const float (*corner[4])[4], unsigned slot, unsigned chan)
+{
+   const float a = corner[0][slot][chan];
+   const float b = corner[1][slot][chan];
+   const float c = corner[2][slot][chan];
+   const float d = corner[3][slot][chan];
+
+   return fabsf(a + d - b - c) <=
+          (fabsf(a) + fabsf(b) + fabsf(c) + fabsf(d)) * (4 * FLT_EPSILON);
+}
+
+
+static boolean
+rect_attribs_linear(const struct lp_setup_variant_key *key,
+                    const float (*corner[4])[4])
+{
+   unsigned i, chan;
+
+   if (!rect_attrib_linear(corner, 0, 2))
+      return FALSE;
+
+   for (i = 0; i < key->num_inputs; i++) {
+      const unsigned slot = key->inputs[i].src_index;
+
+      if (key->inputs[i].interp != LP_INTERP_LINEAR &&
+          key->inputs[i].interp != LP_INTERP_PERSPECTIVE)
+         continue;
+
+      /* Perspective correction must be a no-op */
+      if (key->inputs[i].interp == LP_INTERP_PERSPECTIVE &&
+          (corner[1][0][3] != corner[0][0][3] ||
+           corner[2][0][3] != corner[0][0][3] ||
+           corner[3][0][3] != corner[0][0][3]))
+         return FALSE;
+
+      for (chan = 0; chan < NUM_CHANNELS; chan++) {
+         if ((key->inputs[i].usage_mask & (1 << chan)) &&
+             !rect_attrib_linear(corner, slot, chan))
+            return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Check whether the rectangle can be drawn by copying texels, that is
+ * whether the variant is a blit and the texture coordinates map the pixel
+ * centres onto texel centres one to one, and set up rect->blit.
+ */
+static void
+lp_setup_rect_blit(struct lp_setup_context *setup,
+                   struct lp_rast_rectangle *rect)
+{
+   const struct lp_rast_state *state = setup->fs.stored;
+   const struct lp_fragment_shader_variant *variant = state->variant;
+   const struct lp_fragment_shader *shader = variant->shader;
+   const struct lp_tgsi_texture_info *tex = &shader->info.tex[0];
+   const struct lp_static_sampler_state *sampler;
+   const struct lp_jit_texture *jit_tex;
+   const unsigned slot = shader->blit_input + 1;
+   const float (*a0)[4] = (const float (*)[4])GET_A0(&rect->inputs);
+   const float (*dadx)[4] = (const float (*)[4])GET_DADX(&rect->inputs);
+   const float (*dady)[4] = (const float (*)[4])GET_DADY(&rect->inputs);
+   const int w = rect->box.x1 - rect->box.x0;
+   const int h = rect->box.y1 - rect->box.y0;
+   float oow = 1.0f;
+   float tolerance, scale_x, scale_y;
+   float u0, dudx, dudy, v0, dvdx, dvdy;
+   unsigned level, width, height;
+   int tx, ty, dir;
+
+   rect->blit.mode = LP_BLIT_NONE;
+
+   if (variant->blit == LP_BLIT_NONE)
+      return;
+
+   sampler = &variant->key.state[tex->sampler_unit].sampler_state;
+   jit_tex = &state->jit_context.textures[tex->texture_unit];
+   level = jit_tex->first_level;
+   width = u_minify(jit_tex->width, level);
+   height = u_minify(jit_tex->height, level);
+
+   if (setup->setup.variant->key.inputs[shader->blit_input].interp ==
+       LP_INTERP_PERSPECTIVE) {
+      if (a0[0][3] == 0.0f)
+         return;
+      oow = 1.0f / a0[0][3];
+   }
+
+   scale_x = sampler->normalized_coords ? oow * width : oow;
+   scale_y = sampler->normalized_coords ? oow * height : oow;
+
+   u0 = (a0[slot][0] +
+         dadx[slot][0] * rect->box.x0 +
+         dady[slot][0] * rect->box.y0) * scale_x;
+   dudx = dadx[slot][0] * scale_x;
+   dudy = dady[slot][0] * scale_x;
+   v0 = (a0[slot][1] +
+         dadx[slot][1] * rect->box.x0 +
+         dady[slot][1] * rect->box.y0) * scale_y;
+   dvdx = dadx[slot][1] * scale_y;
+   dvdy = dady[slot][1] * scale_y;
+
+   if (!(u0 >= 0.0f && u0 < width && v0 >= 0.0f && v0 < height))
+      return;
+
+   /*
+    * Every sample has to land close enough to the centre of its texel
+    * for the filter not to see the neighbours: anywhere in the middle
+    * half with nearest filtering, and within rounding of the 8 bit
+    * weights with linear filtering.
+    */
+   tolerance = sampler->mag_img_filter == PIPE_TEX_FILTER_NEAREST ?
+               0.25f : 1.0f / 1024;
+
+   dir = dvdy < 0.0f ? -1 : 1;
+   tx = util_ifloor(u0);
+   ty = util_ifloor(v0);
+
+   if (fabsf(u0 - tx - 0.5f) + fabsf(dudx - 1.0f) * w + fabsf(dudy) * h >
+       tolerance ||
+       fabsf(v0 - ty - 0.5f) + fabsf(dvdx) * w + fabsf(dvdy - dir) * h >
+       tolerance)
+      return;
+
+   /* Stay clear of the wrap modes */
+   if (tx + w >= (int)width ||
+       ty + dir * h < 0 ||
+       ty + dir * h >= (int)height)
+      return;
+
+   rect->blit.src_stride = dir * (int)jit_tex->row_stride[level];
+   rect->blit.src = (const uint8_t *)jit_tex->base +
+                    jit_tex->mip_offsets[level] +
+                    ty * jit_tex->row_stride[level] +
+                    tx * 4;
+   rect->blit.mode = variant->blit;
+
+   LP_COUNT(nr_blit_rects);
+}
+
+
+/**
+ * Put the rectangle in the scene's bins for the tiles which it overlaps.
+ * \param v0, v1, v2  one of the two triangles, for the interpolants
+ * \param box  the covered pixels, inclusive, within the draw region
+ */
+static boolean
+do_rect(struct lp_setup_context *setup,
+        const float (*v0)[4],
+        const float (*v1)[4],
+        const float (*v2)[4],
+        const struct u_rect *box,
+        boolean frontfacing)
+{
+   struct lp_scene *scene = setup->scene;
+   const struct lp_setup_variant_key *key = &setup->setup.variant->key;
+   unsigned hiz = scene->hiz ? setup->fs.stored->variant->hiz : 0;
+   struct lp_rast_rectangle *rect;
+   int ix0, iy0, ix1, iy1, x, y;
+
+   rect = lp_setup_alloc_rectangle(scene, key->num_inputs);
+   if (!rect)
+      return FALSE;
+
+   LP_COUNT(nr_rects);
+
+   /* Setup parameter interpolants, the same for both triangles:
+    */
+   setup->setup.variant->jit_function(v0, v1, v2,
+                                      frontfacing,
+                                      GET_A0(&rect->inputs),
+                                      GET_DADX(&rect->inputs),
+                                      GET_DADY(&rect->inputs));
+
+   rect->box = *box;
+   rect->inputs.frontfacing = frontfacing;
+   rect->inputs.disable = FALSE;
+   rect->inputs.opaque = setup->fs.current.variant->opaque;
+   rect->inputs.multisample = FALSE;
+   rect->inputs.layer = 0;
+   rect->inputs.viewport_index = 0;
+
+   lp_setup_rect_blit(setup, rect);
+
+   ix0 = box->x0 / TILE_SIZE;
+   iy0 = box->y0 / TILE_SIZE;
+   ix1 = box->x1 / TILE_SIZE;
+   iy1 = box->y1 / TILE_SIZE;
+
+   for (y = iy0; y <= iy1; y++) {
+      for (x = ix0; x <= ix1; x++) {
+         /* Tiles are covered when they are up to the framebuffer edge */
+         boolean full =
+            box->x0 <= x * TILE_SIZE &&
+            box->y0 <= y * TILE_SIZE &&
+            box->x1 >= MIN2(x * TILE_SIZE + TILE_SIZE, (int)setup->fb.width) - 1 &&
+            box->y1 >= MIN2(y * TILE_SIZE + TILE_SIZE, (int)setup->fb.height) - 1;
+
+         if (lp_setup_hiz_reject_tile(setup, hiz, &rect->inputs, x, y,
+                                      box, full))
+            continue;
+
+         if (full && rect->blit.mode == LP_BLIT_NONE) {
+            if (!lp_setup_whole_tile(setup, &rect->inputs, x, y))
+               goto fail;
+         }
+         else {
+            if (!lp_scene_bin_cmd_with_state(scene, x, y,
+                                             setup->fs.stored,
+                                             LP_RAST_OP_RECTANGLE,
+                                             lp_rast_arg_rectangle(rect)))
+               goto fail;
+         }
+      }
+   }
+
+   return TRUE;
+
+fail:
+   /* Need to disable any partially binned rectangle, as for triangles */
+   rect->inputs.disable = TRUE;
+   return FALSE;
+}
+
+
+/**
+ * Try to draw two triangles as a rectangle.  They must exactly cover an
+ * axis-aligned rectangle, that is split it along a diagonal, and agree
+ * on everything the fragment shader could see.
+ * \return FALSE if the triangles need to be drawn as triangles
+ */
+boolean
+lp_setup_rect(struct lp_setup_context *setup,
+              const float (*v0)[4],
+              const float (*v1)[4],
+              const float (*v2)[4],
+              const float (*v3)[4],
+              const float (*v4)[4],
+              const float (*v5)[4])
+{
+   const float (*v[6])[4] = { v0, v1, v2, v3, v4, v5 };
+   const float (*corner[4])[4] = { NULL, NULL, NULL, NULL };
+   const struct lp_setup_variant_key *key;
+   unsigned missing[2] = { 0xf, 0xf };
+   float x0, y0, x1, y1;
+   float area[2];
+   boolean frontfacing;
+   struct u_rect box;
+   unsigned i;
+
+   if (!lp_setup_rect_allowed(setup))
+      return FALSE;
+
+   key = &setup->setup.variant->key;
+
+   x0 = x1 = v0[0][0];
+   y0 = y1 = v0[0][1];
+   for (i = 1; i < 6; i++) {
+      x0 = MIN2(x0, v[i][0][0]);
+      x1 = MAX2(x1, v[i][0][0]);
+      y0 = MIN2(y0, v[i][0][1]);
+      y1 = MAX2(y1, v[i][0][1]);
+   }
+
+   /* This also rejects NaNs */
+   if (!(x0 < x1 && y0 < y1 &&
+         x0 > -MAX_RECT_COORD && y0 > -MAX_RECT_COORD &&
+         x1 < MAX_RECT_COORD && y1 < MAX_RECT_COORD))
+      return FALSE;
+
+   /*
+    * Each triangle takes three different corners, and the two must leave
+    * out opposite corners to meet along a diagonal without overlapping.
+    */
+   for (i = 0; i < 6; i++) {
+      int c = rect_corner(v[i], x0, y0, x1, y1);
+
+      if (c < 0 || !(missing[i / 3] & (1 << c)))
+         return FALSE;
+
+      missing[i / 3] &= ~(1 << c);
+
+      if (!corner[c])
+         corner[c] = v[i];
+      else if (!rect_vertex_equal(key, corner[c], v[i]))
+         return FALSE;
+   }
+
+   if ((missing[0] | missing[1]) != 0x9 &&
+       (missing[0] | missing[1]) != 0x6)
+      return FALSE;
+
+   if (!rect_attribs_linear(key, corner))
+      return FALSE;
+
+   /* Both triangles need to face the same way */
+   for (i = 0; i < 2; i++) {
+      const float (*a)[4] = v[i * 3];
+      const float (*b)[4] = v[i * 3 + 1];
+      const float (*c)[4] = v[i * 3 + 2];
+
+      area[i] = (a[0][0] - b[0][0]) * (c[0][1] - a[0][1]) -
+                (c[0][0] - a[0][0]) * (a[0][1] - b[0][1]);
+   }
+
+   if ((area[0] > 0.0f) != (area[1] > 0.0f))
+      return FALSE;
+
+   frontfacing = (area[0] > 0.0f) == setup->ccw_is_frontface;
+
+   if (((setup->cullmode & PIPE_FACE_FRONT) && frontfacing) ||
+       ((setup->cullmode & PIPE_FACE_BACK) && !frontfacing))
+      return TRUE;
+
+   /*
+    * The pixels whose centres are inside, with the same fill convention as
+    * for triangles: left edge in, right edge out, and the top edge in and
+    * the bottom edge out unless it's the other way around.
+    */
+   {
+      int adj = (setup->bottom_edge_rule != 0) ? 1 : 0;
+      int fx0 = util_iround(FIXED_ONE * (x0 - setup->pixel_offset));
+      int fy0 = util_iround(FIXED_ONE * (y0 - setup->pixel_offset));
+      int fx1 = util_iround(FIXED_ONE * (x1 - setup->pixel_offset));
+      int fy1 = util_iround(FIXED_ONE * (y1 - setup->pixel_offset));
+
+      box.x0 = (fx0 + FIXED_ONE - 1) >> FIXED_ORDER;
+      box.x1 = (fx1 - 1) >> FIXED_ORDER;
+      box.y0 = (fy0 + FIXED_ONE - 1 + adj) >> FIXED_ORDER;
+      box.y1 = (fy1 - 1 + adj) >> FIXED_ORDER;
+   }
+
+   if (box.x1 < box.x0 || box.y1 < box.y0 ||
+       !u_rect_test_intersection(&setup->draw_regions[0], &box)) {
+      LP_COUNT(nr_culled_tris);
+      return TRUE;
+   }
+
+   u_rect_find_intersection(&setup->draw_regions[0], &box);
+
+   if (!do_rect(setup, v0, v1, v2, &box, frontfacing)) {
+      if (!lp_setup_flush_and_restart(setup))
+         return TRUE;
+
+      do_rect(setup, v0, v1, v2, &box, frontfacing);
+   }
+
+   return TRUE;
+}
@@ -211,7 +211,7 @@ lp_rast_32_tri_tab[MAX_PLANES+1] = {
  *
  * \param tx, ty  the tile position in tiles, not pixels
  */
-static boolean
+boolean
 lp_setup_whole_tile(struct lp_setup_context *setup,
                     const struct lp_rast_shader_inputs *inputs,
                     int tx, int ty)
@@ -256,6 +256,57 @@ lp_setup_whole_tile(struct lp_setup_context *setup,
 }
 
 
+/**
+ * Test a primitive against the binning time depth bound of a tile, see
+ * lp_rast.h, and keep the bound up to date for the primitive.
+ *
+ * \param tx, ty  the tile position in tiles, not pixels
+ * \param box  bounding box of the primitive, in pixels
+ * \param full  whether the primitive covers the whole tile
+ * \return TRUE if the primitive can't pass the depth test in the tile
+ */
+boolean
+lp_setup_hiz_reject_tile(struct lp_setup_context *setup,
+                         unsigned hiz,
+                         const struct lp_rast_shader_inputs *inputs,
+                         int tx, int ty,
+                         const struct u_rect *box,
+                         boolean full)
+{
+   struct lp_scene *scene = setup->scene;
+   struct cmd_bin *bin = lp_scene_get_bin(scene, tx, ty);
+   float zmin, zmax;
+
+   if (!hiz)
+      return FALSE;
+
+   if (hiz & LP_HIZ_INVALIDATE) {
+      bin->hiz_zmax = LP_HIZ_UNKNOWN;
+      return FALSE;
+   }
+
+   if (bin->hiz_zmax == LP_HIZ_UNKNOWN && !(full && (hiz & LP_HIZ_WRITE)))
+      return FALSE;
+
+   lp_rast_depth_bounds(inputs,
+                        MAX2(box->x0, tx * TILE_SIZE),
+                        MAX2(box->y0, ty * TILE_SIZE),
+                        MIN2(box->x1, tx * TILE_SIZE + TILE_SIZE - 1),
+                        MIN2(box->y1, ty * TILE_SIZE + TILE_SIZE - 1),
+                        &zmin, &zmax);
+
+   if (zmin > bin->hiz_zmax + scene->hiz_bias) {
+      LP_COUNT(nr_hiz_rejected_64);
+      return TRUE;
+   }
+
+   if (full && (hiz & LP_HIZ_WRITE))
+      bin->hiz_zmax = MIN2(bin->hiz_zmax, zmax);
+
+   return FALSE;
+}
+
+
 /**
  * Do basic setup for triangle rasterization and determine which
  * framebuffer tiles are touched.  Put the triangle in the scene's
@@ -311,14 +362,16 @@ do_triangle_ccw(struct lp_setup_context *setup,
        * slightly different rounding.
        */
       int adj = (setup->bottom_edge_rule != 0) ? 1 : 0;
+      /* Samples may lie up to half a pixel away from the pixel centre */
+      int ms = setup->multisample ? FIXED_ONE / 2 : 0;
 
       /* Inclusive x0, exclusive x1 */
-      bbox.x0 =  MIN3(position->x[0], position->x[1], position->x[2]) >> FIXED_ORDER;
-      bbox.x1 = (MAX3(position->x[0], position->x[1], position->x[2]) - 1) >> FIXED_ORDER;
+      bbox.x0 = (MIN3(position->x[0], position->x[1], position->x[2]) - ms) >> FIXED_ORDER;
+      bbox.x1 = (MAX3(position->x[0], position->x[1], position->x[2]) - 1 + ms) >> FIXED_ORDER;
 
       /* Inclusive / exclusive depending upon adj (bottom-left or top-right) */
-      bbox.y0 = (MIN3(position->y[0], position->y[1], position->y[2]) + adj) >> FIXED_ORDER;
-      bbox.y1 = (MAX3(position->y[0], position->y[1], position->y[2]) - 1 + adj) >> FIXED_ORDER;
+      bbox.y0 = (MIN3(position->y[0], position->y[1], position->y[2]) + adj - ms) >> FIXED_ORDER;
+      bbox.y1 = (MAX3(position->y[0], position->y[1], position->y[2]) - 1 + adj + ms) >> FIXED_ORDER;
    }
 
    if (bbox.x1 < bbox.x0 ||
@@ -384,6 +437,7 @@ do_triangle_ccw(struct lp_setup_context *setup,
    tri->inputs.frontfacing = frontfacing;
    tri->inputs.disable = FALSE;
    tri->inputs.opaque = setup->fs.current.variant->opaque;
+   tri->inputs.multisample = setup->multisample;
    tri->inputs.layer = layer;
    tri->inputs.viewport_index = viewport_index;
 
@@ -717,9 +771,53 @@ do_triangle_ccw(struct lp_setup_context *setup,
       assert(plane_s == &plane[nr_planes]);
    }
 
+   if (tri->inputs.multisample)
+      lp_setup_multisample_planes(plane, nr_planes, 3);
+
    return lp_setup_bin_triangle(setup, tri, &bbox, &bboxpos, nr_planes, viewport_index);
 }
 
+
+/**
+ * Prepare the planes of a primitive for multisample rasterization.
+ *
+ * The trivial reject/accept tests of the rasterizer only look at one
+ * edge function value per block corner, so bias c towards the sample
+ * lying furthest inside each plane and record the spread across the
+ * samples; a block is then rejected only when all its samples are outside
+ * and accepted only when all are inside.  The 4x4 leaf evaluates each
+ * sample separately.
+ *
+ * The planes after the first nr_edges are pixel-aligned scissor planes,
+ * which are defined with their zero at the centre of the first pixel
+ * outside.  Move that to the pixel border so samples on either side of
+ * the pixel centre agree.
+ */
+void
+lp_setup_multisample_planes(struct lp_rast_plane *plane,
+                            unsigned nr_planes,
+                            unsigned nr_edges)
+{
+   unsigned i, s;
+
+   for (i = 0; i < nr_planes; i++) {
+      int64_t min_offset, max_offset;
+
+      if (i >= nr_edges)
+         plane[i].c -= FIXED_ONE / 2;
+
+      min_offset = max_offset = lp_rast_plane_sample_offset(&plane[i], 0);
+      for (s = 1; s < LP_MAX_SAMPLES; s++) {
+         int64_t offset = lp_rast_plane_sample_offset(&plane[i], s);
+         min_offset = MIN2(min_offset, offset);
+         max_offset = MAX2(max_offset, offset);
+      }
+
+      plane[i].c += max_offset;
+      plane[i].spread = align((unsigned)(max_offset - min_offset), FIXED_ONE);
+   }
+}
+
 /*
  * Round to nearest less or equal power of two of the input.
  *
@@ -757,6 +855,7 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
 {
    struct lp_scene *scene = setup->scene;
    struct u_rect trimmed_box = *bbox;   
+   unsigned hiz = scene->hiz ? setup->fs.stored->variant->hiz : 0;
    int i;
    /* What is the largest power-of-two boundary this triangle crosses:
     */
@@ -780,6 +879,16 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                      (bboxorig->y1 - (bboxorig->y0 & ~3)));
    boolean use_32bits = max_szorig <= MAX_FIXED_LENGTH32;
 
+   if (tri->inputs.multisample) {
+      /* per-sample coverage is only done by the 64bit rasterizer */
+      use_32bits = FALSE;
+   }
+   else {
+      struct lp_rast_plane *plane = GET_PLANES(tri);
+      for (i = 0; i < nr_planes; i++)
+         plane[i].spread = 0;
+   }
+
    /* Now apply scissor, etc to the bounding box.  Could do this
     * earlier, but it confuses the logic for tri-16 and would force
     * the rasterizer to also respect scissor, etc, just for the rare
@@ -800,6 +909,10 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
       assert(iy0 == bbox->y1 / TILE_SIZE &&
 	     ix0 == bbox->x1 / TILE_SIZE);
 
+      if (lp_setup_hiz_reject_tile(setup, hiz, &tri->inputs, ix0, iy0,
+                                   &trimmed_box, FALSE))
+         return TRUE;
+
       if (nr_planes == 3) {
          if (sz < 4)
          {
@@ -884,9 +997,10 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                  IMUL64(plane[i].dcdy, iy0) * TILE_SIZE -
                  IMUL64(plane[i].dcdx, ix0) * TILE_SIZE);
 
-         ei[i] = (plane[i].dcdy - 
-                  plane[i].dcdx - 
-                  (int64_t)plane[i].eo) << TILE_ORDER;
+         ei[i] = ((plane[i].dcdy - 
+                   plane[i].dcdx - 
+                   (int64_t)plane[i].eo) << TILE_ORDER) -
+                 plane[i].spread;
 
          eo[i] = (int64_t)plane[i].eo << TILE_ORDER;
          xstep[i] = -(((int64_t)plane[i].dcdx) << TILE_ORDER);
@@ -932,8 +1046,10 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                 */
                int count = util_bitcount(partial);
                in = TRUE;
-               
-               if (!lp_scene_bin_cmd_with_state( scene, x, y,
+
+               if (!lp_setup_hiz_reject_tile(setup, hiz, &tri->inputs, x, y,
+                                             &trimmed_box, FALSE) &&
+                   !lp_scene_bin_cmd_with_state( scene, x, y,
                                                  setup->fs.stored,
                                                  use_32bits ?
                                                  lp_rast_32_tri_tab[count] :
@@ -947,7 +1063,9 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                /* triangle covers the whole tile- shade whole tile */
                LP_COUNT(nr_fully_covered_64);
                in = TRUE;
-               if (!lp_setup_whole_tile(setup, &tri->inputs, x, y))
+               if (!lp_setup_hiz_reject_tile(setup, hiz, &tri->inputs, x, y,
+                                             &trimmed_box, TRUE) &&
+                   !lp_setup_whole_tile(setup, &tri->inputs, x, y))
                   goto fail;
             }
 
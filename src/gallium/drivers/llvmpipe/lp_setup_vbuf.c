@@ -185,6 +185,18 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
 
    case PIPE_PRIM_TRIANGLES:
       for (i = 2; i < nr; i += 3) {
+         /* pairs of triangles may make up a rectangle */
+         if (i + 3 < nr &&
+             lp_setup_rect( setup,
+                            get_vert(vertex_buffer, indices[i-2], stride),
+                            get_vert(vertex_buffer, indices[i-1], stride),
+                            get_vert(vertex_buffer, indices[i-0], stride),
+                            get_vert(vertex_buffer, indices[i+1], stride),
+                            get_vert(vertex_buffer, indices[i+2], stride),
+                            get_vert(vertex_buffer, indices[i+3], stride) )) {
+            i += 3;
+            continue;
+         }
          setup->triangle( setup,
                           get_vert(vertex_buffer, indices[i-2], stride),
                           get_vert(vertex_buffer, indices[i-1], stride),
@@ -193,6 +205,16 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       break;
 
    case PIPE_PRIM_TRIANGLE_STRIP:
+      if (nr == 4 &&
+          lp_setup_rect( setup,
+                         get_vert(vertex_buffer, indices[0], stride),
+                         get_vert(vertex_buffer, indices[1], stride),
+                         get_vert(vertex_buffer, indices[2], stride),
+                         get_vert(vertex_buffer, indices[2], stride),
+                         get_vert(vertex_buffer, indices[1], stride),
+                         get_vert(vertex_buffer, indices[3], stride) ))
+         break;
+
       if (flatshade_first) {
          for (i = 2; i < nr; i += 1) {
             /* emit first triangle vertex as first triangle vertex */
@@ -215,6 +237,16 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       break;
 
    case PIPE_PRIM_TRIANGLE_FAN:
+      if (nr == 4 &&
+          lp_setup_rect( setup,
+                         get_vert(vertex_buffer, indices[0], stride),
+                         get_vert(vertex_buffer, indices[1], stride),
+                         get_vert(vertex_buffer, indices[2], stride),
+                         get_vert(vertex_buffer, indices[0], stride),
+                         get_vert(vertex_buffer, indices[2], stride),
+                         get_vert(vertex_buffer, indices[3], stride) ))
+         break;
+
       if (flatshade_first) {
          for (i = 2; i < nr; i += 1) {
             /* emit first non-spoke vertex as first vertex */
@@ -240,6 +272,15 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       if (flatshade_first) { 
          /* emit last quad vertex as first triangle vertex */
          for (i = 3; i < nr; i += 4) {
+            if (lp_setup_rect( setup,
+                               get_vert(vertex_buffer, indices[i-3], stride),
+                               get_vert(vertex_buffer, indices[i-2], stride),
+                               get_vert(vertex_buffer, indices[i-0], stride),
+                               get_vert(vertex_buffer, indices[i-2], stride),
+                               get_vert(vertex_buffer, indices[i-1], stride),
+                               get_vert(vertex_buffer, indices[i-0], stride) ))
+               continue;
+
             setup->triangle( setup,
                              get_vert(vertex_buffer, indices[i-0], stride),
                              get_vert(vertex_buffer, indices[i-3], stride),
@@ -254,6 +295,15 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
       else {
          /* emit last quad vertex as last triangle vertex */
          for (i = 3; i < nr; i += 4) {
+            if (lp_setup_rect( setup,
+                               get_vert(vertex_buffer, indices[i-3], stride),
+                               get_vert(vertex_buffer, indices[i-2], stride),
+                               get_vert(vertex_buffer, indices[i-0], stride),
+                               get_vert(vertex_buffer, indices[i-2], stride),
+                               get_vert(vertex_buffer, indices[i-1], stride),
+                               get_vert(vertex_buffer, indices[i-0], stride) ))
+               continue;
+
             setup->triangle( setup,
                           get_vert(vertex_buffer, indices[i-3], stride),
                           get_vert(vertex_buffer, indices[i-2], stride),
@@ -383,6 +433,18 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
 
    case PIPE_PRIM_TRIANGLES:
       for (i = 2; i < nr; i += 3) {
+         /* pairs of triangles may make up a rectangle */
+         if (i + 3 < nr &&
+             lp_setup_rect( setup,
+                            get_vert(vertex_buffer, i-2, stride),
+                            get_vert(vertex_buffer, i-1, stride),
+                            get_vert(vertex_buffer, i-0, stride),
+                            get_vert(vertex_buffer, i+1, stride),
+                            get_vert(vertex_buffer, i+2, stride),
+                            get_vert(vertex_buffer, i+3, stride) )) {
+            i += 3;
+            continue;
+         }
          setup->triangle( setup,
                           get_vert(vertex_buffer, i-2, stride),
                           get_vert(vertex_buffer, i-1, stride),
@@ -391,6 +453,16 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       break;
 
    case PIPE_PRIM_TRIANGLE_STRIP:
+      if (nr == 4 &&
+          lp_setup_rect( setup,
+                         get_vert(vertex_buffer, 0, stride),
+                         get_vert(vertex_buffer, 1, stride),
+                         get_vert(vertex_buffer, 2, stride),
+                         get_vert(vertex_buffer, 2, stride),
+                         get_vert(vertex_buffer, 1, stride),
+                         get_vert(vertex_buffer, 3, stride) ))
+         break;
+
       if (flatshade_first) {
          for (i = 2; i < nr; i++) {
             /* emit first triangle vertex as first triangle vertex */
@@ -412,6 +484,16 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       break;
 
    case PIPE_PRIM_TRIANGLE_FAN:
+      if (nr == 4 &&
+          lp_setup_rect( setup,
+                         get_vert(vertex_buffer, 0, stride),
+                         get_vert(vertex_buffer, 1, stride),
+                         get_vert(vertex_buffer, 2, stride),
+                         get_vert(vertex_buffer, 0, stride),
+                         get_vert(vertex_buffer, 2, stride),
+                         get_vert(vertex_buffer, 3, stride) ))
+         break;
+
       if (flatshade_first) {
          for (i = 2; i < nr; i += 1) {
             /* emit first non-spoke vertex as first vertex */
@@ -437,6 +519,15 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       if (flatshade_first) { 
          /* emit last quad vertex as first triangle vertex */
          for (i = 3; i < nr; i += 4) {
+            if (lp_setup_rect( setup,
+                               get_vert(vertex_buffer, i-3, stride),
+                               get_vert(vertex_buffer, i-2, stride),
+                               get_vert(vertex_buffer, i-0, stride),
+                               get_vert(vertex_buffer, i-2, stride),
+                               get_vert(vertex_buffer, i-1, stride),
+                               get_vert(vertex_buffer, i-0, stride) ))
+               continue;
+
             setup->triangle( setup,
                              get_vert(vertex_buffer, i-0, stride),
                              get_vert(vertex_buffer, i-3, stride),
@@ -450,6 +541,15 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
       else {
          /* emit last quad vertex as last triangle vertex */
          for (i = 3; i < nr; i += 4) {
+            if (lp_setup_rect( setup,
+                               get_vert(vertex_buffer, i-3, stride),
+                               get_vert(vertex_buffer, i-2, stride),
+                               get_vert(vertex_buffer, i-0, stride),
+                               get_vert(vertex_buffer, i-2, stride),
+                               get_vert(vertex_buffer, i-1, stride),
+                               get_vert(vertex_buffer, i-0, stride) ))
+               continue;
+
             setup->triangle( setup,
                              get_vert(vertex_buffer, i-3, stride),
                              get_vert(vertex_buffer, i-2, stride),
@@ -56,6 +56,7 @@
 #define LP_NEW_GS            0x10000
 #define LP_NEW_SO            0x20000
 #define LP_NEW_SO_BUFFERS    0x40000
+#define LP_NEW_FS_SSBOS      0x80000
 
 
 
@@ -123,6 +124,12 @@ llvmpipe_init_gs_funcs(struct llvmpipe_context *llvmpipe);
 void
 llvmpipe_init_rasterizer_funcs(struct llvmpipe_context *llvmpipe);
 
+void
+llvmpipe_init_compute_funcs(struct llvmpipe_context *llvmpipe);
+
+void
+llvmpipe_init_image_funcs(struct llvmpipe_context *llvmpipe);
+
 void
 llvmpipe_init_so_funcs(struct llvmpipe_context *llvmpipe);
 
@@ -136,4 +143,8 @@ llvmpipe_prepare_geometry_sampling(struct llvmpipe_context *ctx,
                                    unsigned num,
                                    struct pipe_sampler_view **views);
 
+void
+llvmpipe_static_texture_state(struct lp_static_texture_state *state,
+                              const struct pipe_sampler_view *view);
+
 #endif
@@ -0,0 +1,1165 @@
+/**************************************************************************
+ * 
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ **************************************************************************/
+
+/**
+ * Compute shaders.
+ *
+ * A variant is compiled for every block size and sampler state.  The
+ * generated function runs one vector of invocations of a block; blocks are
+ * distributed over the compute thread pool, and launch_grid waits for them
+ * all to finish.
+ */
+
+#include <limits.h>
+#include "util/u_atomic.h"
+#include "util/u_inlines.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_dump.h"
+#include "util/u_format.h"
+#include "util/u_string.h"
+#include "util/simple_list.h"
+#include "util/os_time.h"
+#include "util/mesa-sha1.h"
+#include "pipe/p_shader_tokens.h"
+#include "tgsi/tgsi_dump.h"
+#include "tgsi/tgsi_parse.h"
+#include "gallivm/lp_bld_const.h"
+#include "gallivm/lp_bld_debug.h"
+#include "gallivm/lp_bld_flow.h"
+#include "gallivm/lp_bld_init.h"
+#include "gallivm/lp_bld_intr.h"
+#include "gallivm/lp_bld_tgsi.h"
+#include "gallivm/lp_bld_type.h"
+#include "lp_context.h"
+#include "lp_cs_tpool.h"
+#include "lp_debug.h"
+#include "lp_flush.h"
+#include "lp_image.h"
+#include "lp_perf.h"
+#include "lp_screen.h"
+#include "lp_setup.h"
+#include "lp_state.h"
+#include "lp_state_cs.h"
+#include "lp_texture.h"
+#include "lp_tex_sample.h"
+
+#if LP_CS_COROUTINES
+#include <ucontext.h>
+#endif
+
+
+/** Compute shader number (for debugging) */
+static unsigned cs_no = 0;
+
+
+/**
+ * Per launch_grid state shared by all the blocks of a task.
+ */
+struct lp_cs_job_info {
+   unsigned grid_size[3];
+   unsigned first_z;
+   unsigned shared_size;
+   const struct lp_compute_shader_variant *variant;
+   const struct lp_jit_context *jit_context;
+
+   /** Set if a thread couldn't allocate a block's shared memory */
+   int out_of_memory;
+};
+
+
+#if LP_CS_COROUTINES
+
+/**
+ * Stack of a coroutine, on top of what its temporaries need.  The JIT code
+ * doesn't call out to anything deep, so this is plenty.
+ */
+#define LP_CS_COROUTINE_STACK_SIZE (64 * 1024)
+
+/** One vector of invocations of a block, at the start of its scratch */
+struct lp_cs_coroutine {
+   ucontext_t context;
+   boolean done;
+};
+
+#endif
+
+
+static void
+generate_compute(struct llvmpipe_context *lp,
+                 struct lp_compute_shader *shader,
+                 struct lp_compute_shader_variant *variant)
+{
+   struct gallivm_state *gallivm = variant->gallivm;
+   const struct lp_compute_shader_variant_key *key = &variant->key;
+   LLVMTypeRef int32_type = LLVMInt32TypeInContext(gallivm->context);
+   LLVMTypeRef int8_type = LLVMInt8TypeInContext(gallivm->context);
+   LLVMTypeRef arg_types[12];
+   LLVMTypeRef func_type;
+   LLVMValueRef function;
+   LLVMValueRef context_ptr, thread_data_ptr;
+   LLVMValueRef block_id[3], grid_size[3];
+   LLVMValueRef first_invocation, shared_ptr, spill_ptr, phase;
+   LLVMValueRef invocation, invocation_mask, tmp;
+   LLVMValueRef lanes[LP_MAX_VECTOR_LENGTH];
+   LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
+   LLVMBasicBlockRef block;
+   LLVMBuilderRef builder;
+   struct lp_build_sampler_soa *sampler;
+   struct lp_build_image_soa *image;
+   struct lp_build_mask_context mask;
+   struct lp_bld_tgsi_system_values system_values;
+   struct lp_build_tgsi_mem_iface mem_iface;
+   struct lp_type cs_type, int_type;
+   unsigned block_total;
+   unsigned i;
+
+   memset(&cs_type, 0, sizeof cs_type);
+   cs_type.floating = TRUE;      /* floating point values */
+   cs_type.sign = TRUE;          /* values are signed */
+   cs_type.norm = FALSE;         /* values are not limited to [0,1] or [-1,1] */
+   cs_type.width = 32;           /* 32-bit float */
+   cs_type.length = MIN2(lp_native_vector_width / 32, 16);
+   int_type = lp_int_type(cs_type);
+
+   block_total = key->block_size[0] * key->block_size[1] * key->block_size[2];
+
+   /*
+    * Generate the function prototype. Any change here must be reflected in
+    * lp_jit.h's lp_jit_cs_func function pointer type, and vice-versa.
+    *
+    * The name must not depend on the shader/variant numbering, as cached
+    * object code is looked up by function name.
+    */
+   arg_types[0] = variant->jit_context_ptr_type;       /* context */
+   arg_types[1] = int32_type;                          /* block_x */
+   arg_types[2] = int32_type;                          /* block_y */
+   arg_types[3] = int32_type;                          /* block_z */
+   arg_types[4] = int32_type;                          /* grid_x */
+   arg_types[5] = int32_type;                          /* grid_y */
+   arg_types[6] = int32_type;                          /* grid_z */
+   arg_types[7] = int32_type;                          /* first_invocation */
+   arg_types[8] = LLVMPointerType(int32_type, 0);      /* shared */
+   arg_types[9] = LLVMPointerType(int8_type, 0);       /* spill */
+   arg_types[10] = int32_type;                         /* phase */
+   arg_types[11] = variant->jit_thread_data_ptr_type;  /* per thread data */
+
+   func_type = LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context),
+                                arg_types, ARRAY_SIZE(arg_types), 0);
+
+   function = LLVMAddFunction(gallivm->module, "cs_variant", func_type);
+   LLVMSetFunctionCallConv(function, LLVMCCallConv);
+
+   variant->function = function;
+
+   for (i = 0; i < ARRAY_SIZE(arg_types); ++i)
+      if (LLVMGetTypeKind(arg_types[i]) == LLVMPointerTypeKind)
+         lp_add_function_attr(function, i + 1, LP_FUNC_ATTR_NOALIAS);
+
+   context_ptr      = LLVMGetParam(function, 0);
+   block_id[0]      = LLVMGetParam(function, 1);
+   block_id[1]      = LLVMGetParam(function, 2);
+   block_id[2]      = LLVMGetParam(function, 3);
+   grid_size[0]     = LLVMGetParam(function, 4);
+   grid_size[1]     = LLVMGetParam(function, 5);
+   grid_size[2]     = LLVMGetParam(function, 6);
+   first_invocation = LLVMGetParam(function, 7);
+   shared_ptr       = LLVMGetParam(function, 8);
+   spill_ptr        = LLVMGetParam(function, 9);
+   phase            = LLVMGetParam(function, 10);
+   thread_data_ptr  = LLVMGetParam(function, 11);
+
+   lp_build_name(context_ptr, "context");
+   lp_build_name(block_id[0], "block_x");
+   lp_build_name(block_id[1], "block_y");
+   lp_build_name(block_id[2], "block_z");
+   lp_build_name(grid_size[0], "grid_x");
+   lp_build_name(grid_size[1], "grid_y");
+   lp_build_name(grid_size[2], "grid_z");
+   lp_build_name(first_invocation, "first_invocation");
+   lp_build_name(shared_ptr, "shared");
+   lp_build_name(spill_ptr, "spill");
+   lp_build_name(phase, "phase");
+   lp_build_name(thread_data_ptr, "thread_data");
+
+   /*
+    * Function body
+    */
+
+   block = LLVMAppendBasicBlockInContext(gallivm->context, function, "entry");
+   builder = gallivm->builder;
+   assert(builder);
+   LLVMPositionBuilderAtEnd(builder, block);
+
+   sampler = lp_llvm_sampler_soa_create(key->state);
+   image = lp_llvm_image_soa_create();
+
+   /* linear invocation index of each lane within the block */
+   for (i = 0; i < cs_type.length; i++)
+      lanes[i] = lp_build_const_int32(gallivm, i);
+   invocation = lp_build_broadcast(gallivm, lp_build_vec_type(gallivm, int_type),
+                                   first_invocation);
+   invocation = LLVMBuildAdd(builder, invocation,
+                             LLVMConstVector(lanes, cs_type.length),
+                             "invocation");
+
+   memset(&system_values, 0, sizeof(system_values));
+
+   tmp = invocation;
+   for (i = 0; i < 3; i++) {
+      LLVMValueRef size = lp_build_const_int_vec(gallivm, int_type,
+                                                 key->block_size[i]);
+      system_values.thread_id[i] = LLVMBuildURem(builder, tmp, size, "");
+      tmp = LLVMBuildUDiv(builder, tmp, size, "");
+      system_values.block_id[i] = block_id[i];
+      system_values.grid_size[i] = grid_size[i];
+      system_values.block_size[i] = lp_build_const_int32(gallivm,
+                                                         key->block_size[i]);
+   }
+
+   /* the last vector of a block may be partially filled */
+   invocation_mask = LLVMBuildICmp(builder, LLVMIntULT, invocation,
+                                   lp_build_const_int_vec(gallivm, int_type,
+                                                          block_total), "");
+   invocation_mask = LLVMBuildSExt(builder, invocation_mask,
+                                   lp_build_vec_type(gallivm, int_type), "");
+
+   memset(&mem_iface, 0, sizeof(mem_iface));
+   mem_iface.ssbo_ptr = lp_jit_context_ssbos(gallivm, context_ptr);
+   mem_iface.ssbo_sizes_ptr = lp_jit_context_num_ssbos(gallivm, context_ptr);
+   mem_iface.shared_ptr = shared_ptr;
+   mem_iface.shared_size =
+      lp_build_const_int32(gallivm, shader->base.req_local_mem);
+   mem_iface.image = image;
+   if (variant->coroutines) {
+      LLVMTypeRef barrier_type =
+         LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context),
+                          &variant->jit_thread_data_ptr_type, 1, 0);
+      mem_iface.barrier_func =
+         LLVMBuildBitCast(builder,
+                          lp_jit_thread_data_barrier(gallivm, thread_data_ptr),
+                          LLVMPointerType(barrier_type, 0), "barrier");
+      mem_iface.barrier_arg = thread_data_ptr;
+   }
+   else if (variant->num_phases > 1) {
+      mem_iface.barrier_phase = phase;
+      mem_iface.barrier_spill_ptr = spill_ptr;
+   }
+
+   memset(outputs, 0, sizeof outputs);
+
+   lp_build_mask_begin(&mask, gallivm, cs_type, invocation_mask);
+
+   lp_build_tgsi_soa(gallivm, shader->tokens, cs_type, &mask,
+                     lp_jit_context_constants(gallivm, context_ptr),
+                     lp_jit_context_num_constants(gallivm, context_ptr),
+                     &system_values,
+                     NULL, outputs, context_ptr, thread_data_ptr,
+                     sampler, &shader->info.base, NULL, &mem_iface);
+
+   lp_build_mask_end(&mask);
+
+   LLVMBuildRetVoid(builder);
+
+   sampler->destroy(sampler);
+   image->destroy(image);
+
+   gallivm_verify_function(gallivm, function);
+}
+
+
+static void
+dump_cs_variant_key(const struct lp_compute_shader_variant_key *key)
+{
+   unsigned i;
+
+   debug_printf("cs variant %p:\n", (void *) key);
+   debug_printf("block_size = %u %u %u\n",
+                key->block_size[0], key->block_size[1], key->block_size[2]);
+
+   for (i = 0; i < key->nr_samplers; ++i) {
+      const struct lp_static_sampler_state *sampler = &key->state[i].sampler_state;
+      debug_printf("sampler[%u] = \n", i);
+      debug_printf("  .wrap = %s %s %s\n",
+                   util_str_tex_wrap(sampler->wrap_s, TRUE),
+                   util_str_tex_wrap(sampler->wrap_t, TRUE),
+                   util_str_tex_wrap(sampler->wrap_r, TRUE));
+      debug_printf("  .min_img_filter = %s\n",
+                   util_str_tex_filter(sampler->min_img_filter, TRUE));
+      debug_printf("  .mag_img_filter = %s\n",
+                   util_str_tex_filter(sampler->mag_img_filter, TRUE));
+   }
+   for (i = 0; i < key->nr_sampler_views; ++i) {
+      const struct lp_static_texture_state *texture = &key->state[i].texture_state;
+      debug_printf("texture[%u] = \n", i);
+      debug_printf("  .format = %s\n",
+                   util_format_name(texture->format));
+      debug_printf("  .target = %s\n",
+                   util_str_tex_target(texture->target, TRUE));
+   }
+}
+
+
+static void
+lp_debug_cs_variant(const struct lp_compute_shader_variant *variant)
+{
+   debug_printf("llvmpipe: Compute shader #%u variant #%u:\n",
+                variant->shader->no, variant->no);
+   tgsi_dump(variant->shader->tokens, 0);
+   dump_cs_variant_key(&variant->key);
+   debug_printf("phases = %u, vectors = %u%s\n",
+                variant->num_phases, variant->num_vectors,
+                variant->coroutines ? " (coroutines)" : "");
+   debug_printf("\n");
+}
+
+
+/**
+ * Compute the disk cache key of a compute shader variant.  The shared
+ * memory size is baked into the code, so it is part of the key too.
+ */
+static void
+lp_cs_get_ir_cache_key(const struct lp_compute_shader *shader,
+                       const struct lp_compute_shader_variant_key *key,
+                       unsigned char ir_sha1_cache_key[20])
+{
+   struct mesa_sha1 ctx;
+
+   lp_build_cache_key_init(&ctx, "cs", shader->tokens,
+                           key, shader->variant_key_size);
+   _mesa_sha1_update(&ctx, &shader->base.req_local_mem,
+                     sizeof(shader->base.req_local_mem));
+   _mesa_sha1_final(&ctx, ir_sha1_cache_key);
+}
+
+
+/**
+ * Generate a new compute shader variant from the shader code and
+ * other state indicated by the key.
+ */
+static struct lp_compute_shader_variant *
+generate_variant(struct llvmpipe_context *lp,
+                 struct lp_compute_shader *shader,
+                 const struct lp_compute_shader_variant_key *key)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_compute_shader_variant *variant;
+   char module_name[64];
+   struct lp_cached_code cached = { 0 };
+   unsigned char ir_sha1_cache_key[20];
+   boolean needs_caching = FALSE;
+   unsigned block_total, temps_size;
+
+   variant = CALLOC_STRUCT(lp_compute_shader_variant);
+   if (!variant)
+      return NULL;
+
+   util_snprintf(module_name, sizeof(module_name), "cs%u_variant%u",
+                 shader->no, shader->variants_created);
+
+   lp_cs_get_ir_cache_key(shader, key, ir_sha1_cache_key);
+   lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
+   if (!cached.data_size)
+      needs_caching = TRUE;
+
+   variant->gallivm = gallivm_create(module_name, lp->context, &cached);
+   if (!variant->gallivm) {
+      free(cached.data);
+      FREE(variant);
+      return NULL;
+   }
+
+   variant->shader = shader;
+   variant->list_item_global.base = variant;
+   variant->list_item_local.base = variant;
+   variant->no = shader->variants_created++;
+
+   memcpy(&variant->key, key, shader->variant_key_size);
+
+   /*
+    * Work out how the block maps onto calls of the generated function.
+    * A block that fits in a single vector needs no barrier handling at all.
+    */
+   variant->vector_length = MIN2(lp_native_vector_width / 32, 16);
+   block_total = key->block_size[0] * key->block_size[1] * key->block_size[2];
+   variant->num_vectors = DIV_ROUND_UP(block_total, variant->vector_length);
+   temps_size = (shader->info.base.file_max[TGSI_FILE_TEMPORARY] + 1) *
+                TGSI_NUM_CHANNELS * variant->vector_length * sizeof(float);
+   variant->num_phases = 1;
+   if (variant->num_vectors > 1 && shader->barrier_in_control_flow) {
+#if LP_CS_COROUTINES
+      /* the temporaries live on the coroutine's stack */
+      variant->coroutines = TRUE;
+      variant->scratch_size = align(sizeof(struct lp_cs_coroutine), 64) +
+                              align(LP_CS_COROUTINE_STACK_SIZE + 2 * temps_size,
+                                    4096);
+#endif
+   }
+   else if (variant->num_vectors > 1 && shader->num_barriers) {
+      variant->num_phases = shader->num_barriers + 1;
+      variant->scratch_size = temps_size;
+   }
+
+   if ((LP_DEBUG & DEBUG_CS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
+      lp_debug_cs_variant(variant);
+   }
+
+   lp_jit_init_cs_types(variant);
+
+   if (variant->jit_function == NULL)
+      generate_compute(lp, shader, variant);
+
+   gallivm_compile_module(variant->gallivm);
+
+   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+
+   variant->jit_function = (lp_jit_cs_func)
+         gallivm_jit_function(variant->gallivm, variant->function);
+
+   if (needs_caching)
+      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
+
+   gallivm_free_ir(variant->gallivm);
+
+   free(cached.data);
+
+   return variant;
+}
+
+
+/**
+ * Count the BARRIER instructions of a compute shader.
+ *
+ * A barrier splits the generated function into phases (see barrier_emit()),
+ * which only works in the main program's top-level control flow.  Returns
+ * -1 if the shader has a barrier anywhere else, in which case the block runs
+ * as coroutines instead.
+ */
+static int
+count_top_level_barriers(const struct tgsi_token *tokens)
+{
+   struct tgsi_parse_context parse;
+   unsigned depth = 0;
+   int num_barriers = 0;
+
+   tgsi_parse_init(&parse, tokens);
+
+   while (num_barriers >= 0 && !tgsi_parse_end_of_tokens(&parse)) {
+      tgsi_parse_token(&parse);
+      if (parse.FullToken.Token.Type != TGSI_TOKEN_TYPE_INSTRUCTION)
+         continue;
+
+      switch (parse.FullToken.FullInstruction.Instruction.Opcode) {
+      case TGSI_OPCODE_IF:
+      case TGSI_OPCODE_UIF:
+      case TGSI_OPCODE_BGNLOOP:
+      case TGSI_OPCODE_SWITCH:
+      case TGSI_OPCODE_BGNSUB:
+         depth++;
+         break;
+      case TGSI_OPCODE_ENDIF:
+      case TGSI_OPCODE_ENDLOOP:
+      case TGSI_OPCODE_ENDSWITCH:
+      case TGSI_OPCODE_ENDSUB:
+         depth--;
+         break;
+      case TGSI_OPCODE_BARRIER:
+         num_barriers = depth ? -1 : num_barriers + 1;
+         break;
+      default:
+         break;
+      }
+   }
+
+   tgsi_parse_free(&parse);
+
+   return num_barriers;
+}
+
+
+static void *
+llvmpipe_create_compute_state(struct pipe_context *pipe,
+                              const struct pipe_compute_state *templ)
+{
+   struct lp_compute_shader *shader;
+   int nr_samplers;
+   int nr_sampler_views;
+   int num_barriers;
+
+   if (templ->ir_type != PIPE_SHADER_IR_TGSI)
+      return NULL;
+
+   shader = CALLOC_STRUCT(lp_compute_shader);
+   if (!shader)
+      return NULL;
+
+   shader->base = *templ;
+   shader->no = cs_no++;
+   make_empty_list(&shader->variants);
+
+   /* we need to keep a local copy of the tokens */
+   shader->tokens = tgsi_dup_tokens(templ->prog);
+   if (!shader->tokens) {
+      FREE(shader);
+      return NULL;
+   }
+   shader->base.prog = shader->tokens;
+
+   /* get/save the summary info for this shader */
+   lp_build_tgsi_info(shader->tokens, &shader->info);
+
+   num_barriers = count_top_level_barriers(shader->tokens);
+   if (num_barriers < 0) {
+      /* PIPE_CAP_COMPUTE isn't advertised without coroutines */
+      if (!LP_CS_COROUTINES) {
+         FREE((void *) shader->tokens);
+         FREE(shader);
+         return NULL;
+      }
+      shader->barrier_in_control_flow = TRUE;
+      num_barriers = 0;
+   }
+   shader->num_barriers = num_barriers;
+
+   nr_samplers = shader->info.base.file_max[TGSI_FILE_SAMPLER] + 1;
+   nr_sampler_views = shader->info.base.file_max[TGSI_FILE_SAMPLER_VIEW] + 1;
+
+   shader->variant_key_size = Offset(struct lp_compute_shader_variant_key,
+                                     state[MAX2(nr_samplers, nr_sampler_views)]);
+
+   if (LP_DEBUG & DEBUG_TGSI) {
+      debug_printf("llvmpipe: Create compute shader #%u %p:\n",
+                   shader->no, (void *) shader);
+      tgsi_dump(shader->tokens, 0);
+      debug_printf("\n");
+   }
+
+   return shader;
+}
+
+
+static void
+llvmpipe_bind_compute_state(struct pipe_context *pipe, void *cs)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+
+   llvmpipe->cs = (struct lp_compute_shader *) cs;
+}
+
+
+/**
+ * Remove compute shader variant from two lists: the shader's variant list
+ * and the context's variant list.
+ */
+static void
+llvmpipe_remove_cs_shader_variant(struct llvmpipe_context *lp,
+                                  struct lp_compute_shader_variant *variant)
+{
+   if ((LP_DEBUG & DEBUG_CS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
+      debug_printf("llvmpipe: del cs #%u var %u v created %u v cached %u "
+                   "v total cached %u inst %u\n",
+                   variant->shader->no, variant->no,
+                   variant->shader->variants_created,
+                   variant->shader->variants_cached,
+                   lp->nr_cs_variants, variant->nr_instrs);
+   }
+
+   gallivm_destroy(variant->gallivm);
+
+   /* remove from shader's list */
+   remove_from_list(&variant->list_item_local);
+   variant->shader->variants_cached--;
+
+   /* remove from context's list */
+   remove_from_list(&variant->list_item_global);
+   lp->nr_cs_variants--;
+
+   FREE(variant);
+}
+
+
+static void
+llvmpipe_delete_compute_state(struct pipe_context *pipe, void *cs)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct lp_compute_shader *shader = cs;
+   struct lp_cs_variant_list_item *li;
+
+   /* Compute dispatch is synchronous, so nothing can still be running. */
+   assert(cs != llvmpipe->cs);
+
+   /* Delete all the variants */
+   li = first_elem(&shader->variants);
+   while (!at_end(&shader->variants, li)) {
+      struct lp_cs_variant_list_item *next = next_elem(li);
+      llvmpipe_remove_cs_shader_variant(llvmpipe, li->base);
+      li = next;
+   }
+
+   assert(shader->variants_cached == 0);
+   FREE((void *) shader->tokens);
+   FREE(shader);
+}
+
+
+/**
+ * Delete all the compute shader variants of a context.
+ */
+void
+lp_delete_cs_variants(struct llvmpipe_context *lp)
+{
+   struct lp_cs_variant_list_item *li;
+
+   li = first_elem(&lp->cs_variants_list);
+   while (!at_end(&lp->cs_variants_list, li)) {
+      struct lp_cs_variant_list_item *next = next_elem(li);
+      llvmpipe_remove_cs_shader_variant(lp, li->base);
+      li = next;
+   }
+}
+
+
+static void
+make_variant_key(struct llvmpipe_context *lp,
+                 struct lp_compute_shader *shader,
+                 const struct pipe_grid_info *info,
+                 struct lp_compute_shader_variant_key *key)
+{
+   const unsigned *props = shader->info.base.properties;
+   unsigned i;
+
+   memset(key, 0, shader->variant_key_size);
+
+   if (props[TGSI_PROPERTY_CS_FIXED_BLOCK_WIDTH]) {
+      key->block_size[0] = props[TGSI_PROPERTY_CS_FIXED_BLOCK_WIDTH];
+      key->block_size[1] = props[TGSI_PROPERTY_CS_FIXED_BLOCK_HEIGHT];
+      key->block_size[2] = props[TGSI_PROPERTY_CS_FIXED_BLOCK_DEPTH];
+   }
+   else {
+      key->block_size[0] = info->block[0];
+      key->block_size[1] = info->block[1];
+      key->block_size[2] = info->block[2];
+   }
+
+   /* This value will be the same for all the variants of a given shader:
+    */
+   key->nr_samplers = shader->info.base.file_max[TGSI_FILE_SAMPLER] + 1;
+
+   for (i = 0; i < key->nr_samplers; ++i) {
+      if (shader->info.base.file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
+         lp_sampler_static_sampler_state(&key->state[i].sampler_state,
+                                         lp->samplers[PIPE_SHADER_COMPUTE][i]);
+      }
+   }
+
+   /* See make_variant_key() in lp_state_fs.c. */
+   if (shader->info.base.file_max[TGSI_FILE_SAMPLER_VIEW] != -1) {
+      key->nr_sampler_views = shader->info.base.file_max[TGSI_FILE_SAMPLER_VIEW] + 1;
+      for (i = 0; i < key->nr_sampler_views; ++i) {
+         if (shader->info.base.file_mask[TGSI_FILE_SAMPLER_VIEW] & (1u << (i & 31))) {
+            llvmpipe_static_texture_state(&key->state[i].texture_state,
+                                          lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
+         }
+      }
+   }
+   else {
+      key->nr_sampler_views = key->nr_samplers;
+      for (i = 0; i < key->nr_sampler_views; ++i) {
+         if (shader->info.base.file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
+            llvmpipe_static_texture_state(&key->state[i].texture_state,
+                                          lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
+         }
+      }
+   }
+}
+
+
+/**
+ * Find or compile the variant of the bound compute shader for the
+ * current state.
+ */
+static struct lp_compute_shader_variant *
+llvmpipe_update_cs(struct llvmpipe_context *lp,
+                   const struct pipe_grid_info *info)
+{
+   struct lp_compute_shader *shader = lp->cs;
+   struct lp_compute_shader_variant_key key;
+   struct lp_compute_shader_variant *variant = NULL;
+   struct lp_cs_variant_list_item *li;
+
+   make_variant_key(lp, shader, info, &key);
+
+   /* Search the variants for one which matches the key */
+   li = first_elem(&shader->variants);
+   while (!at_end(&shader->variants, li)) {
+      if (memcmp(&li->base->key, &key, shader->variant_key_size) == 0) {
+         variant = li->base;
+         break;
+      }
+      li = next_elem(li);
+   }
+
+   if (variant) {
+      /* Move this variant to the head of the list to implement LRU
+       * deletion of shader's when we have too many.
+       */
+      move_to_head(&lp->cs_variants_list, &variant->list_item_global);
+   }
+   else {
+      /* variant not found, create it now */
+      int64_t t0, t1, dt;
+      unsigned i;
+      unsigned variants_to_cull;
+
+      /* First, check if we've exceeded the max number of shader variants.
+       * If so, free 6.25% of them (the least recently used ones).
+       */
+      variants_to_cull = lp->nr_cs_variants >= LP_MAX_SHADER_VARIANTS ?
+                         LP_MAX_SHADER_VARIANTS / 16 : 0;
+
+      for (i = 0; i < variants_to_cull; i++) {
+         struct lp_cs_variant_list_item *item;
+         if (is_empty_list(&lp->cs_variants_list)) {
+            break;
+         }
+         item = last_elem(&lp->cs_variants_list);
+         assert(item);
+         assert(item->base);
+         llvmpipe_remove_cs_shader_variant(lp, item->base);
+      }
+
+      /*
+       * Generate the new variant.
+       */
+      t0 = os_time_get();
+      variant = generate_variant(lp, shader, &key);
+      t1 = os_time_get();
+      dt = t1 - t0;
+      LP_COUNT_ADD(llvm_compile_time, dt);
+      LP_COUNT_ADD(nr_llvm_compiles, 1);
+
+      /* Put the new variant into the list */
+      if (variant) {
+         insert_at_head(&shader->variants, &variant->list_item_local);
+         insert_at_head(&lp->cs_variants_list, &variant->list_item_global);
+         lp->nr_cs_variants++;
+         shader->variants_cached++;
+      }
+   }
+
+   return variant;
+}
+
+
+/**
+ * Fill in the jit context from the compute shader bindings.
+ */
+static void
+update_cs_jit_context(struct llvmpipe_context *lp,
+                      struct lp_jit_context *jit_context)
+{
+   static const float fake_buf[4];
+   const enum pipe_shader_type sh = PIPE_SHADER_COMPUTE;
+   unsigned i;
+
+   memset(jit_context, 0, sizeof *jit_context);
+
+   for (i = 0; i < ARRAY_SIZE(lp->constants[sh]); i++) {
+      const struct pipe_constant_buffer *cb = &lp->constants[sh][i];
+      const ubyte *data = NULL;
+
+      if (cb->buffer)
+         data = (const ubyte *) llvmpipe_resource_data(cb->buffer);
+      else if (cb->user_buffer)
+         data = (const ubyte *) cb->user_buffer;
+
+      if (data) {
+         jit_context->constants[i] = (const float *) (data + cb->buffer_offset);
+         jit_context->num_constants[i] =
+            cb->buffer_size / (sizeof(float) * 4);
+      }
+      else {
+         jit_context->constants[i] = fake_buf;
+         jit_context->num_constants[i] = 0;
+      }
+   }
+
+   for (i = 0; i < lp->num_sampler_views[sh]; i++) {
+      const struct pipe_sampler_view *view = lp->sampler_views[sh][i];
+      if (view)
+         lp_jit_texture_from_view(&jit_context->textures[i], view);
+   }
+
+   for (i = 0; i < lp->num_samplers[sh]; i++) {
+      const struct pipe_sampler_state *sampler = lp->samplers[sh][i];
+      if (sampler) {
+         struct lp_jit_sampler *jit_sam = &jit_context->samplers[i];
+         jit_sam->min_lod = sampler->min_lod;
+         jit_sam->max_lod = sampler->max_lod;
+         jit_sam->lod_bias = sampler->lod_bias;
+         COPY_4V(jit_sam->border_color, sampler->border_color.f);
+      }
+   }
+
+   for (i = 0; i < ARRAY_SIZE(lp->ssbos[sh]); i++) {
+      const struct pipe_shader_buffer *sb = &lp->ssbos[sh][i];
+
+      if (sb->buffer) {
+         ubyte *data = (ubyte *) llvmpipe_resource_data(sb->buffer);
+         jit_context->ssbos[i] = (const uint32_t *) (data + sb->buffer_offset);
+         jit_context->num_ssbos[i] = sb->buffer_size;
+      }
+      else {
+         jit_context->ssbos[i] = (const uint32_t *) fake_buf;
+         jit_context->num_ssbos[i] = 0;
+      }
+   }
+
+   for (i = 0; i < ARRAY_SIZE(lp->images[sh]); i++)
+      lp_jit_image_from_view(&jit_context->images[i], &lp->images[sh][i]);
+
+   jit_context->image_op = lp_image_op;
+}
+
+
+/**
+ * Make sure no queued rendering still reads or writes the resources the
+ * compute shader is about to access.
+ */
+static void
+flush_cs_resources(struct llvmpipe_context *lp)
+{
+   struct pipe_context *pipe = &lp->pipe;
+   const enum pipe_shader_type sh = PIPE_SHADER_COMPUTE;
+   unsigned i;
+
+   for (i = 0; i < ARRAY_SIZE(lp->constants[sh]); i++) {
+      if (lp->constants[sh][i].buffer)
+         llvmpipe_flush_resource(pipe, lp->constants[sh][i].buffer,
+                                 0, TRUE, TRUE, FALSE, "compute");
+   }
+   for (i = 0; i < lp->num_sampler_views[sh]; i++) {
+      if (lp->sampler_views[sh][i])
+         llvmpipe_flush_resource(pipe, lp->sampler_views[sh][i]->texture,
+                                 0, TRUE, TRUE, FALSE, "compute");
+   }
+   for (i = 0; i < ARRAY_SIZE(lp->ssbos[sh]); i++) {
+      if (lp->ssbos[sh][i].buffer)
+         llvmpipe_flush_resource(pipe, lp->ssbos[sh][i].buffer,
+                                 0, FALSE, TRUE, FALSE, "compute");
+   }
+   for (i = 0; i < ARRAY_SIZE(lp->images[sh]); i++) {
+      if (lp->images[sh][i].resource)
+         llvmpipe_flush_resource(pipe, lp->images[sh][i].resource,
+                                 0, FALSE, TRUE, FALSE, "compute");
+   }
+}
+
+
+#if LP_CS_COROUTINES
+
+/**
+ * A block whose invocation vectors run as coroutines.
+ */
+struct lp_cs_coroutine_block {
+   /* first, so that the barrier callback can get at the rest */
+   struct lp_jit_thread_data thread_data;
+
+   const struct lp_cs_job_info *job_info;
+   unsigned block_id[3];
+   uint8_t *shared;
+   uint8_t *scratch;
+
+   /* the scheduler, and the vector it is running */
+   ucontext_t main;
+   unsigned current;
+};
+
+
+static struct lp_cs_coroutine *
+cs_coroutine(struct lp_cs_coroutine_block *block, unsigned v)
+{
+   return (struct lp_cs_coroutine *)
+      (block->scratch + v * block->job_info->variant->scratch_size);
+}
+
+
+/**
+ * Called by the JIT code at a BARRIER: go back to the scheduler, which
+ * resumes this vector once all the others have got here too.
+ */
+static void
+cs_coroutine_barrier(struct lp_jit_thread_data *thread_data)
+{
+   struct lp_cs_coroutine_block *block =
+      (struct lp_cs_coroutine_block *) thread_data;
+
+   swapcontext(&cs_coroutine(block, block->current)->context, &block->main);
+}
+
+
+/**
+ * Entry point of a coroutine.  makecontext() only passes ints, so the block
+ * pointer comes in two halves.
+ */
+static void
+cs_coroutine_main(unsigned block_hi, unsigned block_lo)
+{
+   struct lp_cs_coroutine_block *block = (struct lp_cs_coroutine_block *)
+      (uintptr_t) (((uint64_t) block_hi << 32) | block_lo);
+   const struct lp_cs_job_info *job_info = block->job_info;
+   const struct lp_compute_shader_variant *variant = job_info->variant;
+   unsigned v = block->current;
+
+   variant->jit_function(job_info->jit_context,
+                         block->block_id[0], block->block_id[1],
+                         block->block_id[2],
+                         job_info->grid_size[0], job_info->grid_size[1],
+                         job_info->grid_size[2],
+                         v * variant->vector_length,
+                         block->shared, NULL, 0, &block->thread_data);
+
+   /* returning switches back to the scheduler through uc_link */
+   cs_coroutine(block, v)->done = TRUE;
+}
+
+
+/**
+ * Run a block whose shader has barriers inside control flow.  Each round
+ * runs every vector up to its next barrier, or to its end.  Barriers must
+ * be in uniform control flow, so all the vectors reach the same barrier in
+ * the same round.
+ */
+static void
+cs_exec_coroutines(const struct lp_cs_job_info *job_info,
+                   const unsigned block_id[3],
+                   uint8_t *shared, uint8_t *scratch,
+                   struct lp_build_format_cache *cache)
+{
+   const struct lp_compute_shader_variant *variant = job_info->variant;
+   struct lp_cs_coroutine_block block;
+   uint64_t block_ptr = (uintptr_t) &block;
+   unsigned stack_offset = align(sizeof(struct lp_cs_coroutine), 64);
+   unsigned running, v;
+
+   memset(&block, 0, sizeof block);
+   block.thread_data.cache = cache;
+   block.thread_data.barrier = cs_coroutine_barrier;
+   block.job_info = job_info;
+   memcpy(block.block_id, block_id, sizeof block.block_id);
+   block.shared = shared;
+   block.scratch = scratch;
+
+   for (v = 0; v < variant->num_vectors; v++) {
+      struct lp_cs_coroutine *coroutine = cs_coroutine(&block, v);
+
+      getcontext(&coroutine->context);
+      coroutine->context.uc_stack.ss_sp = (uint8_t *) coroutine + stack_offset;
+      coroutine->context.uc_stack.ss_size =
+         variant->scratch_size - stack_offset;
+      coroutine->context.uc_link = &block.main;
+      coroutine->done = FALSE;
+      makecontext(&coroutine->context, (void (*)(void)) cs_coroutine_main, 2,
+                  (unsigned) (block_ptr >> 32), (unsigned) block_ptr);
+   }
+
+   do {
+      running = 0;
+      for (v = 0; v < variant->num_vectors; v++) {
+         struct lp_cs_coroutine *coroutine = cs_coroutine(&block, v);
+
+         if (coroutine->done)
+            continue;
+
+         block.current = v;
+         swapcontext(&block.main, &coroutine->context);
+         if (!coroutine->done)
+            running++;
+      }
+   } while (running);
+}
+
+#endif
+
+
+/**
+ * Run all the blocks of a task, one block per iteration.
+ */
+static void
+cs_exec_fn(void *init_data, unsigned iter, struct lp_cs_local_mem *lmem)
+{
+   struct lp_cs_job_info *job_info = init_data;
+   const struct lp_compute_shader_variant *variant = job_info->variant;
+   const unsigned *grid_size = job_info->grid_size;
+   struct lp_jit_thread_data thread_data;
+   unsigned block_id[3];
+   uint8_t *shared, *scratch;
+   unsigned phase, v;
+
+   block_id[0] = iter % grid_size[0];
+   block_id[1] = (iter / grid_size[0]) % grid_size[1];
+   block_id[2] = iter / (grid_size[0] * grid_size[1]) + job_info->first_z;
+
+   shared = lp_cs_local_mem_get(lmem, job_info->shared_size +
+                                variant->scratch_size * variant->num_vectors);
+   if (!shared) {
+      p_atomic_set(&job_info->out_of_memory, 1);
+      return;
+   }
+   scratch = shared + job_info->shared_size;
+
+#if LP_CS_COROUTINES
+   if (variant->coroutines) {
+      cs_exec_coroutines(job_info, block_id, shared, scratch, lmem->cache);
+      return;
+   }
+#endif
+
+   memset(&thread_data, 0, sizeof thread_data);
+   thread_data.cache = lmem->cache;
+
+   /* Every invocation must reach a barrier before any goes past it. */
+   for (phase = 0; phase < variant->num_phases; phase++) {
+      for (v = 0; v < variant->num_vectors; v++) {
+         variant->jit_function(job_info->jit_context,
+                               block_id[0], block_id[1], block_id[2],
+                               grid_size[0], grid_size[1], grid_size[2],
+                               v * variant->vector_length,
+                               shared, scratch + v * variant->scratch_size,
+                               phase, &thread_data);
+      }
+   }
+}
+
+
+static void
+fill_grid_size(struct pipe_context *pipe,
+               const struct pipe_grid_info *info,
+               uint32_t grid_size[3])
+{
+   struct pipe_transfer *transfer;
+   uint32_t *params;
+
+   if (!info->indirect) {
+      grid_size[0] = info->grid[0];
+      grid_size[1] = info->grid[1];
+      grid_size[2] = info->grid[2];
+      return;
+   }
+   params = pipe_buffer_map_range(pipe, info->indirect,
+                                  info->indirect_offset,
+                                  3 * sizeof(uint32_t),
+                                  PIPE_TRANSFER_READ,
+                                  &transfer);
+
+   if (!transfer) {
+      grid_size[0] = grid_size[1] = grid_size[2] = 0;
+      return;
+   }
+
+   grid_size[0] = params[0];
+   grid_size[1] = params[1];
+   grid_size[2] = params[2];
+   pipe_buffer_unmap(pipe, transfer);
+}
+
+
+static void
+llvmpipe_launch_grid(struct pipe_context *pipe,
+                     const struct pipe_grid_info *info)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   struct lp_compute_shader_variant *variant;
+   struct lp_jit_context jit_context;
+   struct lp_cs_job_info job_info;
+   unsigned blocks_per_layer;
+   unsigned z;
+
+   if (!llvmpipe->cs)
+      return;
+
+   fill_grid_size(pipe, info, job_info.grid_size);
+   if (!job_info.grid_size[0] || !job_info.grid_size[1] ||
+       !job_info.grid_size[2])
+      return;
+
+   variant = llvmpipe_update_cs(llvmpipe, info);
+   if (!variant)
+      return;
+
+   flush_cs_resources(llvmpipe);
+   update_cs_jit_context(llvmpipe, &jit_context);
+
+   job_info.shared_size = align(llvmpipe->cs->base.req_local_mem, 64);
+   job_info.variant = variant;
+   job_info.jit_context = &jit_context;
+   job_info.out_of_memory = 0;
+
+   /*
+    * The iteration count of a task is 32 bits wide, so huge grids are
+    * dispatched as several tasks of whole z layers.
+    */
+   blocks_per_layer = job_info.grid_size[0] * job_info.grid_size[1];
+   for (z = 0; z < job_info.grid_size[2]; ) {
+      struct lp_cs_tpool_task *task;
+      unsigned num_z = MIN2(job_info.grid_size[2] - z,
+                            UINT_MAX / blocks_per_layer);
+
+      job_info.first_z = z;
+      task = lp_cs_tpool_queue_task(screen->cs_tpool, cs_exec_fn, &job_info,
+                                    blocks_per_layer * num_z);
+      if (task)
+         lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
+      z += num_z;
+   }
+
+   if (job_info.out_of_memory) {
+      pipe_debug_message(&llvmpipe->debug, OUT_OF_MEMORY,
+                         "compute dispatch: couldn't allocate %u bytes of "
+                         "shared memory, blocks were skipped",
+                         job_info.shared_size +
+                         variant->scratch_size * variant->num_vectors);
+   }
+
+   if (llvmpipe->active_statistics_queries) {
+      llvmpipe->pipeline_statistics.cs_invocations +=
+         (uint64_t) blocks_per_layer * job_info.grid_size[2] *
+         variant->key.block_size[0] * variant->key.block_size[1] *
+         variant->key.block_size[2];
+   }
+}
+
+
+void
+llvmpipe_init_compute_funcs(struct llvmpipe_context *llvmpipe)
+{
+   llvmpipe->pipe.create_compute_state = llvmpipe_create_compute_state;
+   llvmpipe->pipe.bind_compute_state = llvmpipe_bind_compute_state;
+   llvmpipe->pipe.delete_compute_state = llvmpipe_delete_compute_state;
+   llvmpipe->pipe.launch_grid = llvmpipe_launch_grid;
+}
@@ -0,0 +1,140 @@
+/**************************************************************************
+ * 
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ **************************************************************************/
+
+#ifndef LP_STATE_CS_H
+#define LP_STATE_CS_H
+
+#include "pipe/p_state.h"
+#include "tgsi/tgsi_scan.h" /* for tgsi_shader_info */
+#include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
+#include "lp_jit.h"
+#include "lp_state_fs.h" /* for struct lp_sampler_static_state */
+
+
+struct lp_compute_shader;
+struct llvmpipe_context;
+
+
+/*
+ * Barriers inside control flow are handled by running the invocation
+ * vectors of a block as coroutines, which needs ucontext.
+ */
+#if defined(__GLIBC__)
+#define LP_CS_COROUTINES 1
+#else
+#define LP_CS_COROUTINES 0
+#endif
+
+
+struct lp_compute_shader_variant_key
+{
+   /* block size, unlike the grid size, is known when compiling */
+   unsigned block_size[3];
+   unsigned nr_samplers:8;
+   unsigned nr_sampler_views:8;
+
+   struct lp_sampler_static_state state[PIPE_MAX_SHADER_SAMPLER_VIEWS];
+};
+
+
+/** doubly-linked list item */
+struct lp_cs_variant_list_item
+{
+   struct lp_compute_shader_variant *base;
+   struct lp_cs_variant_list_item *next, *prev;
+};
+
+
+struct lp_compute_shader_variant
+{
+   struct lp_compute_shader_variant_key key;
+
+   struct gallivm_state *gallivm;
+
+   LLVMTypeRef jit_context_ptr_type;
+   LLVMTypeRef jit_thread_data_ptr_type;
+
+   LLVMValueRef function;
+   lp_jit_cs_func jit_function;
+
+   /* Invocations per call, i.e. the vector length */
+   unsigned vector_length;
+
+   /* Number of calls per block: vectors times barrier phases */
+   unsigned num_vectors;
+   unsigned num_phases;
+
+   /* Whether the vectors of a block run as coroutines, for barriers inside
+    * control flow, instead of being called once per phase.
+    */
+   boolean coroutines;
+
+   /* Bytes of scratch memory per vector: the temporaries spilled across
+    * barriers, or the context and stack of the vector's coroutine.
+    */
+   unsigned scratch_size;
+
+   /* Total number of LLVM instructions generated */
+   unsigned nr_instrs;
+
+   struct lp_cs_variant_list_item list_item_global, list_item_local;
+   struct lp_compute_shader *shader;
+
+   /* For debugging/profiling purposes */
+   unsigned no;
+};
+
+
+/** Subclass of pipe_compute_state */
+struct lp_compute_shader
+{
+   struct pipe_compute_state base;
+   const struct tgsi_token *tokens;
+
+   struct lp_tgsi_info info;
+
+   /** Number of BARRIERs, unless some are inside control flow */
+   unsigned num_barriers;
+
+   /** Whether there are BARRIERs anywhere else, see LP_CS_COROUTINES */
+   boolean barrier_in_control_flow;
+
+   struct lp_cs_variant_list_item variants;
+
+   /* For debugging/profiling purposes */
+   unsigned variant_key_size;
+   unsigned no;
+   unsigned variants_created;
+   unsigned variants_cached;
+};
+
+
+void
+lp_delete_cs_variants(struct llvmpipe_context *lp);
+
+
+#endif /* LP_STATE_CS_H */
@@ -67,7 +67,10 @@
 #include "util/u_string.h"
 #include "util/simple_list.h"
 #include "util/u_dual_blend.h"
+#include "util/u_framebuffer.h"
+#include "util/u_cpu_detect.h"
 #include "util/os_time.h"
+#include "util/mesa-sha1.h"
 #include "pipe/p_shader_tokens.h"
 #include "draw/draw_context.h"
 #include "tgsi/tgsi_dump.h"
@@ -99,9 +102,11 @@
 #include "lp_setup.h"
 #include "lp_state.h"
 #include "lp_tex_sample.h"
+#include "lp_fence.h"
 #include "lp_flush.h"
 #include "lp_state_fs.h"
 #include "lp_rast.h"
+#include "lp_screen.h"
 
 
 /** Fragment shader number (for debugging) */
@@ -287,8 +292,205 @@ lp_build_depth_clamp(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Number of pixels per fragment shader vector.
+ *
+ * When the JIT may use AVX-512 (see lp_build_has_avx512()) a single
+ * 16-wide vector covers the whole 4x4 stamp, i.e. all four quads, so the
+ * shader, interpolation and depth/stencil test run once per stamp instead
+ * of twice.  Otherwise this is the native vector width, 4 or 8; without the
+ * avx512 target attributes LLVM would just split 16-wide vectors in two.
+ */
+static unsigned
+fs_vector_length(const struct lp_fragment_shader_variant_key *key)
+{
+   unsigned length = MIN2(lp_native_vector_width / 32, 16);
+
+   if (length == 8 && lp_build_has_avx512() &&
+       !(LP_PERF & PERF_NO_FS16))
+      length = 16;
+
+   /* 1d resources only use the upper half of the stamp */
+   if (key->resource_1d)
+      length = MIN2(length, 8);
+
+   return length;
+}
+
+
+/**
+ * Pointer to the given sample of a multisampled block, the samples being
+ * sample_stride bytes apart.
+ */
+static LLVMValueRef
+generate_sample_ptr(struct gallivm_state *gallivm,
+                    LLVMValueRef base_ptr,
+                    LLVMValueRef sample_stride,
+                    unsigned sample)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef offset;
+
+   offset = LLVMBuildMul(builder, sample_stride,
+                         lp_build_const_int32(gallivm, sample), "");
+   return LLVMBuildGEP(builder, base_ptr, &offset, 1, "");
+}
+
+
+/**
+ * Multisample version of the depth/stencil test.
+ *
+ * The test is done once per sample against that sample's depth/stencil
+ * values, with z interpolated to the sample position unless the shader
+ * wrote it (dzdx == NULL).  The sample masks get narrowed by the results,
+ * and the pixel mask to the pixels which have any sample left.
+ * The fb and test values are returned per sample for a deferred write.
+ */
+static void
+generate_sample_depth_test(struct gallivm_state *gallivm,
+                           const struct lp_fragment_shader_variant_key *key,
+                           struct lp_type type,
+                           const struct util_format_description *zs_format_desc,
+                           struct lp_build_mask_context *mask,
+                           LLVMValueRef *sample_mask_ptr,
+                           LLVMValueRef stencil_refs[2],
+                           LLVMValueRef z,
+                           LLVMValueRef dzdx,
+                           LLVMValueRef dzdy,
+                           LLVMValueRef context_ptr,
+                           LLVMValueRef thread_data_ptr,
+                           LLVMValueRef facing,
+                           LLVMValueRef depth_ptr,
+                           LLVMValueRef depth_stride,
+                           LLVMValueRef depth_sample_stride,
+                           LLVMValueRef loop_counter,
+                           boolean do_write,
+                           LLVMValueRef *z_fb,
+                           LLVMValueRef *s_fb,
+                           LLVMValueRef *z_value,
+                           LLVMValueRef *s_value)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef pixel_mask = lp_build_mask_value(mask);
+   LLVMValueRef covered = NULL;
+   struct lp_build_context f32_bld;
+   unsigned s;
+
+   lp_build_context_init(&f32_bld, gallivm, type);
+
+   for (s = 0; s < LP_MAX_SAMPLES; s++) {
+      struct lp_build_mask_context sample_mask;
+      LLVMValueRef sample_depth_ptr;
+      LLVMValueRef z_sample = z;
+      LLVMValueRef smask;
+
+      if (dzdx) {
+         z_sample = lp_build_sample_depth(gallivm, type, z, dzdx, dzdy,
+                                          lp_sample_pos_4x[s][0] / (float)FIXED_ONE,
+                                          lp_sample_pos_4x[s][1] / (float)FIXED_ONE);
+         if (!key->depth_clamp) {
+            /* same as the clamp of the pixel centre depth in lp_bld_interp */
+            z_sample = lp_build_min(&f32_bld, z_sample, f32_bld.one);
+         }
+      }
+      if (key->depth_clamp) {
+         z_sample = lp_build_depth_clamp(gallivm, builder, type, context_ptr,
+                                         thread_data_ptr, z_sample);
+      }
+
+      sample_depth_ptr = generate_sample_ptr(gallivm, depth_ptr,
+                                             depth_sample_stride, s);
+
+      smask = LLVMBuildLoad(builder, sample_mask_ptr[s], "");
+      smask = LLVMBuildAnd(builder, smask, pixel_mask, "");
+      lp_build_mask_begin(&sample_mask, gallivm, type, smask);
+
+      lp_build_depth_stencil_load_swizzled(gallivm, type,
+                                           zs_format_desc, key->resource_1d,
+                                           sample_depth_ptr, depth_stride,
+                                           &z_fb[s], &s_fb[s], loop_counter);
+      lp_build_depth_stencil_test(gallivm,
+                                  &key->depth,
+                                  key->stencil,
+                                  type,
+                                  zs_format_desc,
+                                  &sample_mask,
+                                  stencil_refs,
+                                  z_sample, z_fb[s], s_fb[s],
+                                  facing,
+                                  &z_value[s], &s_value[s],
+                                  FALSE);
+      if (do_write) {
+         lp_build_depth_stencil_write_swizzled(gallivm, type,
+                                               zs_format_desc, key->resource_1d,
+                                               NULL, NULL, NULL, loop_counter,
+                                               sample_depth_ptr, depth_stride,
+                                               z_value[s], s_value[s]);
+      }
+
+      smask = lp_build_mask_end(&sample_mask);
+      LLVMBuildStore(builder, smask, sample_mask_ptr[s]);
+      covered = covered ? LLVMBuildOr(builder, covered, smask, "") : smask;
+   }
+
+   lp_build_mask_update(mask, covered);
+}
+
+
+/**
+ * Deferred depth/stencil write of generate_sample_depth_test(), with the
+ * final sample masks.
+ */
+static void
+generate_sample_depth_write(struct gallivm_state *gallivm,
+                            const struct lp_fragment_shader_variant_key *key,
+                            struct lp_type type,
+                            const struct util_format_description *zs_format_desc,
+                            struct lp_build_mask_context *mask,
+                            LLVMValueRef *sample_mask_ptr,
+                            LLVMValueRef depth_ptr,
+                            LLVMValueRef depth_stride,
+                            LLVMValueRef depth_sample_stride,
+                            LLVMValueRef loop_counter,
+                            LLVMValueRef *z_fb,
+                            LLVMValueRef *s_fb,
+                            LLVMValueRef *z_value,
+                            LLVMValueRef *s_value)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef pixel_mask = lp_build_mask_value(mask);
+   unsigned s;
+
+   for (s = 0; s < LP_MAX_SAMPLES; s++) {
+      struct lp_build_mask_context sample_mask;
+      LLVMValueRef smask;
+
+      smask = LLVMBuildLoad(builder, sample_mask_ptr[s], "");
+      smask = LLVMBuildAnd(builder, smask, pixel_mask, "");
+      lp_build_mask_begin(&sample_mask, gallivm, type, smask);
+
+      lp_build_depth_stencil_write_swizzled(gallivm, type,
+                                            zs_format_desc, key->resource_1d,
+                                            &sample_mask, z_fb[s], s_fb[s],
+                                            loop_counter,
+                                            generate_sample_ptr(gallivm,
+                                                                depth_ptr,
+                                                                depth_sample_stride,
+                                                                s),
+                                            depth_stride,
+                                            z_value[s], s_value[s]);
+
+      lp_build_mask_end(&sample_mask);
+   }
+}
+
+
 /**
  * Generate the fragment shader, depth/stencil test, and alpha tests.
+ *
+ * For multisample variants the shader runs once per pixel, while coverage,
+ * depth/stencil and the sample mask are handled per sample: sample_mask_store
+ * holds one mask per sample and loop iteration, mask_store their union.
  */
 static void
 generate_fs_loop(struct gallivm_state *gallivm,
@@ -301,9 +503,13 @@ generate_fs_loop(struct gallivm_state *gallivm,
                  struct lp_build_interp_soa_context *interp,
                  const struct lp_build_sampler_soa *sampler,
                  LLVMValueRef mask_store,
+                 LLVMValueRef sample_mask_store,
                  LLVMValueRef (*out_color)[4],
                  LLVMValueRef depth_ptr,
                  LLVMValueRef depth_stride,
+                 LLVMValueRef depth_sample_stride,
+                 LLVMValueRef dzdx,
+                 LLVMValueRef dzdy,
                  LLVMValueRef facing,
                  LLVMValueRef thread_data_ptr)
 {
@@ -316,6 +522,9 @@ generate_fs_loop(struct gallivm_state *gallivm,
    LLVMValueRef z;
    LLVMValueRef z_value, s_value;
    LLVMValueRef z_fb, s_fb;
+   LLVMValueRef sample_mask_ptr[LP_MAX_SAMPLES];
+   LLVMValueRef sample_z_value[LP_MAX_SAMPLES], sample_s_value[LP_MAX_SAMPLES];
+   LLVMValueRef sample_z_fb[LP_MAX_SAMPLES], sample_s_fb[LP_MAX_SAMPLES];
    LLVMValueRef stencil_refs[2];
    LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
    struct lp_build_for_loop_state loop_state;
@@ -334,10 +543,13 @@ generate_fs_loop(struct gallivm_state *gallivm,
    unsigned chan;
    unsigned cbuf;
    unsigned depth_mode;
+   unsigned s;
 
    struct lp_bld_tgsi_system_values system_values;
+   struct lp_build_tgsi_mem_iface mem_iface;
 
    memset(&system_values, 0, sizeof(system_values));
+   memset(&mem_iface, 0, sizeof(mem_iface));
 
    if (key->depth.enabled ||
        key->stencil[0].enabled) {
@@ -392,6 +604,11 @@ generate_fs_loop(struct gallivm_state *gallivm,
    consts_ptr = lp_jit_context_constants(gallivm, context_ptr);
    num_consts_ptr = lp_jit_context_num_constants(gallivm, context_ptr);
 
+   /* storage buffers only; fragment shaders have no shared memory */
+   mem_iface.ssbo_ptr = lp_jit_context_ssbos(gallivm, context_ptr);
+   mem_iface.ssbo_sizes_ptr = lp_jit_context_num_ssbos(gallivm, context_ptr);
+   mem_iface.shared_size = lp_build_const_int32(gallivm, 0);
+
    lp_build_for_loop_begin(&loop_state, gallivm,
                            lp_build_const_int32(gallivm, 0),
                            LLVMIntULT,
@@ -402,6 +619,17 @@ generate_fs_loop(struct gallivm_state *gallivm,
                            &loop_state.counter, 1, "mask_ptr");
    mask_val = LLVMBuildLoad(builder, mask_ptr, "");
 
+   if (key->multisample) {
+      for (s = 0; s < LP_MAX_SAMPLES; s++) {
+         LLVMValueRef index;
+         index = LLVMBuildMul(builder, num_loop,
+                              lp_build_const_int32(gallivm, s), "");
+         index = LLVMBuildAdd(builder, index, loop_state.counter, "");
+         sample_mask_ptr[s] = LLVMBuildGEP(builder, sample_mask_store,
+                                           &index, 1, "sample_mask_ptr");
+      }
+   }
+
    memset(outputs, 0, sizeof outputs);
 
    for(cbuf = 0; cbuf < key->nr_cbufs; cbuf++) {
@@ -433,35 +661,50 @@ generate_fs_loop(struct gallivm_state *gallivm,
    z = interp->pos[2];
 
    if (depth_mode & EARLY_DEPTH_TEST) {
-      /*
-       * Clamp according to ARB_depth_clamp semantics.
-       */
-      if (key->depth_clamp) {
-         z = lp_build_depth_clamp(gallivm, builder, type, context_ptr,
-                                  thread_data_ptr, z);
+      if (key->multisample) {
+         generate_sample_depth_test(gallivm, key, type, zs_format_desc,
+                                    &mask, sample_mask_ptr, stencil_refs,
+                                    z, dzdx, dzdy,
+                                    context_ptr, thread_data_ptr, facing,
+                                    depth_ptr, depth_stride,
+                                    depth_sample_stride, loop_state.counter,
+                                    (depth_mode & EARLY_DEPTH_WRITE) != 0,
+                                    sample_z_fb, sample_s_fb,
+                                    sample_z_value, sample_s_value);
+         if (!simple_shader)
+            lp_build_mask_check(&mask);
       }
-      lp_build_depth_stencil_load_swizzled(gallivm, type,
-                                           zs_format_desc, key->resource_1d,
-                                           depth_ptr, depth_stride,
-                                           &z_fb, &s_fb, loop_state.counter);
-      lp_build_depth_stencil_test(gallivm,
-                                  &key->depth,
-                                  key->stencil,
-                                  type,
-                                  zs_format_desc,
-                                  &mask,
-                                  stencil_refs,
-                                  z, z_fb, s_fb,
-                                  facing,
-                                  &z_value, &s_value,
-                                  !simple_shader);
-
-      if (depth_mode & EARLY_DEPTH_WRITE) {
-         lp_build_depth_stencil_write_swizzled(gallivm, type,
-                                               zs_format_desc, key->resource_1d,
-                                               NULL, NULL, NULL, loop_state.counter,
-                                               depth_ptr, depth_stride,
-                                               z_value, s_value);
+      else {
+         /*
+          * Clamp according to ARB_depth_clamp semantics.
+          */
+         if (key->depth_clamp) {
+            z = lp_build_depth_clamp(gallivm, builder, type, context_ptr,
+                                     thread_data_ptr, z);
+         }
+         lp_build_depth_stencil_load_swizzled(gallivm, type,
+                                              zs_format_desc, key->resource_1d,
+                                              depth_ptr, depth_stride,
+                                              &z_fb, &s_fb, loop_state.counter);
+         lp_build_depth_stencil_test(gallivm,
+                                     &key->depth,
+                                     key->stencil,
+                                     type,
+                                     zs_format_desc,
+                                     &mask,
+                                     stencil_refs,
+                                     z, z_fb, s_fb,
+                                     facing,
+                                     &z_value, &s_value,
+                                     !simple_shader);
+
+         if (depth_mode & EARLY_DEPTH_WRITE) {
+            lp_build_depth_stencil_write_swizzled(gallivm, type,
+                                                  zs_format_desc, key->resource_1d,
+                                                  NULL, NULL, NULL, loop_state.counter,
+                                                  depth_ptr, depth_stride,
+                                                  z_value, s_value);
+         }
       }
       /*
        * Note mask check if stencil is enabled must be after ds write not after
@@ -479,7 +722,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
                      consts_ptr, num_consts_ptr, &system_values,
                      interp->inputs,
                      outputs, context_ptr, thread_data_ptr,
-                     sampler, &shader->info.base, NULL);
+                     sampler, &shader->info.base, NULL, &mem_iface);
 
    /* Alpha test */
    if (key->alpha.enabled) {
@@ -512,9 +755,26 @@ generate_fs_loop(struct gallivm_state *gallivm,
       if (color0 != -1 && outputs[color0][3]) {
          LLVMValueRef alpha = LLVMBuildLoad(builder, outputs[color0][3], "alpha");
 
-         lp_build_alpha_to_coverage(gallivm, type,
-                                    &mask, alpha,
-                                    (depth_mode & LATE_DEPTH_TEST) != 0);
+         if (key->multisample) {
+            /* cover samples in proportion to alpha */
+            struct lp_build_context f32_bld;
+            lp_build_context_init(&f32_bld, gallivm, type);
+
+            for (s = 0; s < LP_MAX_SAMPLES; s++) {
+               LLVMValueRef ref, test, smask;
+               ref = lp_build_const_vec(gallivm, type,
+                                        (s + 0.5f) / LP_MAX_SAMPLES);
+               test = lp_build_cmp(&f32_bld, PIPE_FUNC_GREATER, alpha, ref);
+               smask = LLVMBuildLoad(builder, sample_mask_ptr[s], "");
+               smask = LLVMBuildAnd(builder, smask, test, "");
+               LLVMBuildStore(builder, smask, sample_mask_ptr[s]);
+            }
+         }
+         else {
+            lp_build_alpha_to_coverage(gallivm, type,
+                                       &mask, alpha,
+                                       (depth_mode & LATE_DEPTH_TEST) != 0);
+         }
       }
    }
 
@@ -528,13 +788,26 @@ generate_fs_loop(struct gallivm_state *gallivm,
 
       assert(smaski >= 0);
       smask = LLVMBuildLoad(builder, outputs[smaski][0], "smask");
-      /*
-       * Pixel is alive according to the first sample in the mask.
-       */
       smask = LLVMBuildBitCast(builder, smask, smask_bld.vec_type, "");
-      smask = lp_build_and(&smask_bld, smask, smask_bld.one);
-      smask = lp_build_cmp(&smask_bld, PIPE_FUNC_NOTEQUAL, smask, smask_bld.zero);
-      lp_build_mask_update(&mask, smask);
+      if (key->multisample) {
+         for (s = 0; s < LP_MAX_SAMPLES; s++) {
+            LLVMValueRef bit, sample_mask;
+            bit = lp_build_and(&smask_bld, smask,
+                               lp_build_const_int_vec(gallivm, int_type, 1 << s));
+            bit = lp_build_cmp(&smask_bld, PIPE_FUNC_NOTEQUAL, bit, smask_bld.zero);
+            sample_mask = LLVMBuildLoad(builder, sample_mask_ptr[s], "");
+            sample_mask = LLVMBuildAnd(builder, sample_mask, bit, "");
+            LLVMBuildStore(builder, sample_mask, sample_mask_ptr[s]);
+         }
+      }
+      else {
+         /*
+          * Pixel is alive according to the first sample in the mask.
+          */
+         smask = lp_build_and(&smask_bld, smask, smask_bld.one);
+         smask = lp_build_cmp(&smask_bld, PIPE_FUNC_NOTEQUAL, smask, smask_bld.zero);
+         lp_build_mask_update(&mask, smask);
+      }
    }
 
    /* Late Z test */
@@ -545,15 +818,12 @@ generate_fs_loop(struct gallivm_state *gallivm,
       int s_out = find_output_by_semantic(&shader->info.base,
                                           TGSI_SEMANTIC_STENCIL,
                                           0);
+      /* depth written by the shader applies to all samples */
+      LLVMValueRef sample_dzdx = dzdx;
+
       if (pos0 != -1 && outputs[pos0][2]) {
          z = LLVMBuildLoad(builder, outputs[pos0][2], "output.z");
-      }
-      /*
-       * Clamp according to ARB_depth_clamp semantics.
-       */
-      if (key->depth_clamp) {
-         z = lp_build_depth_clamp(gallivm, builder, type, context_ptr,
-                                  thread_data_ptr, z);
+         sample_dzdx = NULL;
       }
 
       if (s_out != -1 && outputs[s_out][1]) {
@@ -565,29 +835,50 @@ generate_fs_loop(struct gallivm_state *gallivm,
          stencil_refs[1] = stencil_refs[0];
       }
 
-      lp_build_depth_stencil_load_swizzled(gallivm, type,
-                                           zs_format_desc, key->resource_1d,
-                                           depth_ptr, depth_stride,
-                                           &z_fb, &s_fb, loop_state.counter);
+      if (key->multisample) {
+         generate_sample_depth_test(gallivm, key, type, zs_format_desc,
+                                    &mask, sample_mask_ptr, stencil_refs,
+                                    z, sample_dzdx, dzdy,
+                                    context_ptr, thread_data_ptr, facing,
+                                    depth_ptr, depth_stride,
+                                    depth_sample_stride, loop_state.counter,
+                                    (depth_mode & LATE_DEPTH_WRITE) != 0,
+                                    sample_z_fb, sample_s_fb,
+                                    sample_z_value, sample_s_value);
+      }
+      else {
+         /*
+          * Clamp according to ARB_depth_clamp semantics.
+          */
+         if (key->depth_clamp) {
+            z = lp_build_depth_clamp(gallivm, builder, type, context_ptr,
+                                     thread_data_ptr, z);
+         }
 
-      lp_build_depth_stencil_test(gallivm,
-                                  &key->depth,
-                                  key->stencil,
-                                  type,
-                                  zs_format_desc,
-                                  &mask,
-                                  stencil_refs,
-                                  z, z_fb, s_fb,
-                                  facing,
-                                  &z_value, &s_value,
-                                  !simple_shader);
-      /* Late Z write */
-      if (depth_mode & LATE_DEPTH_WRITE) {
-         lp_build_depth_stencil_write_swizzled(gallivm, type,
-                                               zs_format_desc, key->resource_1d,
-                                               NULL, NULL, NULL, loop_state.counter,
-                                               depth_ptr, depth_stride,
-                                               z_value, s_value);
+         lp_build_depth_stencil_load_swizzled(gallivm, type,
+                                              zs_format_desc, key->resource_1d,
+                                              depth_ptr, depth_stride,
+                                              &z_fb, &s_fb, loop_state.counter);
+
+         lp_build_depth_stencil_test(gallivm,
+                                     &key->depth,
+                                     key->stencil,
+                                     type,
+                                     zs_format_desc,
+                                     &mask,
+                                     stencil_refs,
+                                     z, z_fb, s_fb,
+                                     facing,
+                                     &z_value, &s_value,
+                                     !simple_shader);
+         /* Late Z write */
+         if (depth_mode & LATE_DEPTH_WRITE) {
+            lp_build_depth_stencil_write_swizzled(gallivm, type,
+                                                  zs_format_desc, key->resource_1d,
+                                                  NULL, NULL, NULL, loop_state.counter,
+                                                  depth_ptr, depth_stride,
+                                                  z_value, s_value);
+         }
       }
    }
    else if ((depth_mode & EARLY_DEPTH_TEST) &&
@@ -597,11 +888,21 @@ generate_fs_loop(struct gallivm_state *gallivm,
        * depth value, update from zs_value with the new mask value and
        * write that out.
        */
-      lp_build_depth_stencil_write_swizzled(gallivm, type,
-                                            zs_format_desc, key->resource_1d,
-                                            &mask, z_fb, s_fb, loop_state.counter,
-                                            depth_ptr, depth_stride,
-                                            z_value, s_value);
+      if (key->multisample) {
+         generate_sample_depth_write(gallivm, key, type, zs_format_desc,
+                                     &mask, sample_mask_ptr,
+                                     depth_ptr, depth_stride,
+                                     depth_sample_stride, loop_state.counter,
+                                     sample_z_fb, sample_s_fb,
+                                     sample_z_value, sample_s_value);
+      }
+      else {
+         lp_build_depth_stencil_write_swizzled(gallivm, type,
+                                               zs_format_desc, key->resource_1d,
+                                               &mask, z_fb, s_fb, loop_state.counter,
+                                               depth_ptr, depth_stride,
+                                               z_value, s_value);
+      }
    }
 
 
@@ -628,7 +929,29 @@ generate_fs_loop(struct gallivm_state *gallivm,
       }
    }
 
-   if (key->occlusion_count) {
+   if (key->multisample) {
+      /*
+       * Apply the final pixel mask to the samples, and drop pixels without
+       * any sample left.  Occlusion queries count samples.
+       */
+      LLVMValueRef pixel_mask = lp_build_mask_value(&mask);
+      LLVMValueRef covered = NULL;
+
+      for (s = 0; s < LP_MAX_SAMPLES; s++) {
+         LLVMValueRef smask = LLVMBuildLoad(builder, sample_mask_ptr[s], "");
+         smask = LLVMBuildAnd(builder, smask, pixel_mask, "");
+         LLVMBuildStore(builder, smask, sample_mask_ptr[s]);
+         covered = covered ? LLVMBuildOr(builder, covered, smask, "") : smask;
+
+         if (key->occlusion_count) {
+            LLVMValueRef counter = lp_jit_thread_data_counter(gallivm, thread_data_ptr);
+            lp_build_name(counter, "counter");
+            lp_build_occlusion_count(gallivm, type, smask, counter);
+         }
+      }
+      lp_build_mask_update(&mask, covered);
+   }
+   else if (key->occlusion_count) {
       LLVMValueRef counter = lp_jit_thread_data_counter(gallivm, thread_data_ptr);
       lp_build_name(counter, "counter");
       lp_build_occlusion_count(gallivm, type,
@@ -2397,8 +2720,7 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
  * 2x2 pixels.
  */
 static void
-generate_fragment(struct llvmpipe_context *lp,
-                  struct lp_fragment_shader *shader,
+generate_fragment(struct lp_fragment_shader *shader,
                   struct lp_fragment_shader_variant *variant,
                   unsigned partial_mask)
 {
@@ -2410,9 +2732,10 @@ generate_fragment(struct llvmpipe_context *lp,
    struct lp_type blend_type;
    LLVMTypeRef fs_elem_type;
    LLVMTypeRef blend_vec_type;
-   LLVMTypeRef arg_types[13];
+   LLVMTypeRef arg_types[15];
    LLVMTypeRef func_type;
    LLVMTypeRef int32_type = LLVMInt32TypeInContext(gallivm->context);
+   LLVMTypeRef int64_type = LLVMInt64TypeInContext(gallivm->context);
    LLVMTypeRef int8_type = LLVMInt8TypeInContext(gallivm->context);
    LLVMValueRef context_ptr;
    LLVMValueRef x;
@@ -2425,12 +2748,15 @@ generate_fragment(struct llvmpipe_context *lp,
    LLVMValueRef depth_ptr;
    LLVMValueRef depth_stride;
    LLVMValueRef mask_input;
+   LLVMValueRef sample_stride_ptr;
+   LLVMValueRef depth_sample_stride;
    LLVMValueRef thread_data_ptr;
    LLVMBasicBlockRef block;
    LLVMBuilderRef builder;
    struct lp_build_sampler_soa *sampler;
    struct lp_build_interp_soa_context interp;
    LLVMValueRef fs_mask[16 / 4];
+   LLVMValueRef fs_sample_mask[LP_MAX_SAMPLES][16 / 4];
    LLVMValueRef fs_out_color[PIPE_MAX_COLOR_BUFS][TGSI_NUM_CHANNELS][16 / 4];
    LLVMValueRef function;
    LLVMValueRef facing;
@@ -2468,7 +2794,7 @@ generate_fragment(struct llvmpipe_context *lp,
    fs_type.sign = TRUE;          /* values are signed */
    fs_type.norm = FALSE;         /* values are not limited to [0,1] or [-1,1] */
    fs_type.width = 32;           /* 32-bit float */
-   fs_type.length = MIN2(lp_native_vector_width / 32, 16); /* n*4 elements per vector */
+   fs_type.length = fs_vector_length(key); /* n*4 elements per vector */
 
    memset(&blend_type, 0, sizeof blend_type);
    blend_type.floating = FALSE; /* values are integers */
@@ -2486,8 +2812,12 @@ generate_fragment(struct llvmpipe_context *lp,
 
    blend_vec_type = lp_build_vec_type(gallivm, blend_type);
 
-   util_snprintf(func_name, sizeof(func_name), "fs%u_variant%u_%s",
-                 shader->no, variant->no, partial_mask ? "partial" : "whole");
+   /*
+    * The name must not depend on the shader/variant numbering, as cached
+    * object code is looked up by function name.
+    */
+   util_snprintf(func_name, sizeof(func_name), "fs_variant_%s",
+                 partial_mask ? "partial" : "whole");
 
    arg_types[0] = variant->jit_context_ptr_type;       /* context */
    arg_types[1] = int32_type;                          /* x */
@@ -2498,10 +2828,12 @@ generate_fragment(struct llvmpipe_context *lp,
    arg_types[6] = LLVMPointerType(fs_elem_type, 0);    /* dady */
    arg_types[7] = LLVMPointerType(LLVMPointerType(blend_vec_type, 0), 0);  /* color */
    arg_types[8] = LLVMPointerType(int8_type, 0);       /* depth */
-   arg_types[9] = int32_type;                          /* mask_input */
+   arg_types[9] = int64_type;                          /* mask_input */
    arg_types[10] = variant->jit_thread_data_ptr_type;  /* per thread data */
    arg_types[11] = LLVMPointerType(int32_type, 0);     /* stride */
    arg_types[12] = int32_type;                         /* depth_stride */
+   arg_types[13] = LLVMPointerType(int32_type, 0);     /* sample_stride */
+   arg_types[14] = int32_type;                         /* depth_sample_stride */
 
    func_type = LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context),
                                 arg_types, ARRAY_SIZE(arg_types), 0);
@@ -2531,6 +2863,8 @@ generate_fragment(struct llvmpipe_context *lp,
    thread_data_ptr  = LLVMGetParam(function, 10);
    stride_ptr   = LLVMGetParam(function, 11);
    depth_stride = LLVMGetParam(function, 12);
+   sample_stride_ptr = LLVMGetParam(function, 13);
+   depth_sample_stride = LLVMGetParam(function, 14);
 
    lp_build_name(context_ptr, "context");
    lp_build_name(x, "x");
@@ -2544,6 +2878,8 @@ generate_fragment(struct llvmpipe_context *lp,
    lp_build_name(thread_data_ptr, "thread_data");
    lp_build_name(stride_ptr, "stride_ptr");
    lp_build_name(depth_stride, "depth_stride");
+   lp_build_name(sample_stride_ptr, "sample_stride_ptr");
+   lp_build_name(depth_sample_stride, "depth_sample_stride");
 
    /*
     * Function body
@@ -2586,6 +2922,8 @@ generate_fragment(struct llvmpipe_context *lp,
       LLVMTypeRef mask_type = lp_build_int_vec_type(gallivm, fs_type);
       LLVMValueRef mask_store = lp_build_array_alloca(gallivm, mask_type,
                                                       num_loop, "mask_store");
+      LLVMValueRef sample_mask_store = NULL;
+      LLVMValueRef dzdx = NULL, dzdy = NULL;
       LLVMValueRef color_store[PIPE_MAX_COLOR_BUFS][TGSI_NUM_CHANNELS];
       boolean pixel_center_integer =
          shader->info.base.properties[TGSI_PROPERTY_FS_COORD_PIXEL_CENTER];
@@ -2605,20 +2943,87 @@ generate_fragment(struct llvmpipe_context *lp,
                                a0_ptr, dadx_ptr, dady_ptr,
                                x, y);
 
-      for (i = 0; i < num_fs; i++) {
-         LLVMValueRef mask;
-         LLVMValueRef indexi = lp_build_const_int32(gallivm, i);
-         LLVMValueRef mask_ptr = LLVMBuildGEP(builder, mask_store,
-                                              &indexi, 1, "mask_ptr");
+      if (key->multisample) {
+         /*
+          * The mask input holds 16 coverage bits per sample.  Keep one mask
+          * per sample and loop iteration; the pixel mask is their union.
+          */
+         LLVMValueRef index;
+         unsigned s;
+
+         sample_mask_store =
+            lp_build_array_alloca(gallivm, mask_type,
+                                  lp_build_const_int32(gallivm,
+                                                       num_fs * LP_MAX_SAMPLES),
+                                  "sample_mask_store");
+
+         for (i = 0; i < num_fs; i++) {
+            LLVMValueRef indexi = lp_build_const_int32(gallivm, i);
+            LLVMValueRef mask = NULL;
+
+            for (s = 0; s < LP_MAX_SAMPLES; s++) {
+               LLVMValueRef smask;
+
+               if (!(key->sample_mask & (1 << s))) {
+                  smask = lp_build_const_int_vec(gallivm, fs_type, 0);
+               }
+               else if (partial_mask) {
+                  smask = LLVMBuildLShr(builder, mask_input,
+                                        LLVMConstInt(int64_type, 16 * s, 0), "");
+                  smask = LLVMBuildTrunc(builder, smask, int32_type, "");
+                  smask = generate_quad_mask(gallivm, fs_type,
+                                             i*fs_type.length/4, smask);
+               }
+               else {
+                  smask = lp_build_const_int_vec(gallivm, fs_type, ~0);
+               }
+
+               index = lp_build_const_int32(gallivm, s * num_fs + i);
+               LLVMBuildStore(builder, smask,
+                              LLVMBuildGEP(builder, sample_mask_store,
+                                           &index, 1, ""));
+               mask = mask ? LLVMBuildOr(builder, mask, smask, "") : smask;
+            }
 
-         if (partial_mask) {
-            mask = generate_quad_mask(gallivm, fs_type,
-                                      i*fs_type.length/4, mask_input);
+            LLVMBuildStore(builder, mask,
+                           LLVMBuildGEP(builder, mask_store,
+                                        &indexi, 1, "mask_ptr"));
          }
-         else {
-            mask = lp_build_const_int_vec(gallivm, fs_type, ~0);
+
+         /*
+          * Per-sample depth needs the (constant) z gradients.  Without
+          * multisample rasterization the pixel centre depth applies to all
+          * samples (dzdx == NULL).
+          */
+         if (key->multisample_rast) {
+            index = lp_build_const_int32(gallivm, 2);
+            dzdx = LLVMBuildLoad(builder,
+                                 LLVMBuildGEP(builder, dadx_ptr, &index, 1, ""),
+                                 "dzdx");
+            dzdy = LLVMBuildLoad(builder,
+                                 LLVMBuildGEP(builder, dady_ptr, &index, 1, ""),
+                                 "dzdy");
+         }
+      }
+      else {
+         LLVMValueRef mask_input32 = LLVMBuildTrunc(builder, mask_input,
+                                                    int32_type, "");
+
+         for (i = 0; i < num_fs; i++) {
+            LLVMValueRef mask;
+            LLVMValueRef indexi = lp_build_const_int32(gallivm, i);
+            LLVMValueRef mask_ptr = LLVMBuildGEP(builder, mask_store,
+                                                 &indexi, 1, "mask_ptr");
+
+            if (partial_mask) {
+               mask = generate_quad_mask(gallivm, fs_type,
+                                         i*fs_type.length/4, mask_input32);
+            }
+            else {
+               mask = lp_build_const_int_vec(gallivm, fs_type, ~0);
+            }
+            LLVMBuildStore(builder, mask, mask_ptr);
          }
-         LLVMBuildStore(builder, mask, mask_ptr);
       }
 
       generate_fs_loop(gallivm,
@@ -2630,9 +3035,12 @@ generate_fragment(struct llvmpipe_context *lp,
                        &interp,
                        sampler,
                        mask_store, /* output */
+                       sample_mask_store, /* output */
                        color_store,
                        depth_ptr,
                        depth_stride,
+                       depth_sample_stride,
+                       dzdx, dzdy,
                        facing,
                        thread_data_ptr);
 
@@ -2641,6 +3049,15 @@ generate_fragment(struct llvmpipe_context *lp,
          LLVMValueRef ptr = LLVMBuildGEP(builder, mask_store,
                                          &indexi, 1, "");
          fs_mask[i] = LLVMBuildLoad(builder, ptr, "mask");
+         if (key->multisample) {
+            unsigned s;
+            for (s = 0; s < LP_MAX_SAMPLES; s++) {
+               LLVMValueRef index = lp_build_const_int32(gallivm,
+                                                         s * num_fs + i);
+               ptr = LLVMBuildGEP(builder, sample_mask_store, &index, 1, "");
+               fs_sample_mask[s][i] = LLVMBuildLoad(builder, ptr, "sample_mask");
+            }
+         }
          /* This is fucked up need to reorganize things */
          for (cbuf = 0; cbuf < key->nr_cbufs; cbuf++) {
             for (chan = 0; chan < TGSI_NUM_CHANNELS; ++chan) {
@@ -2664,6 +3081,47 @@ generate_fragment(struct llvmpipe_context *lp,
 
    sampler->destroy(sampler);
 
+   if (fs_type.length == 16) {
+      /*
+       * Blending works on at most 8 pixels per vector.  The two halves of
+       * a 16-wide vector are the upper and lower quad pairs of the stamp,
+       * laid out exactly like the two loops of the 8-wide path.
+       */
+      struct lp_type half_type = fs_type;
+      LLVMTypeRef half_ptr_type;
+
+      half_type.length = 8;
+      half_ptr_type = LLVMPointerType(lp_build_vec_type(gallivm, half_type), 0);
+
+      fs_mask[1] = lp_build_extract_range(gallivm, fs_mask[0], 8, 8);
+      fs_mask[0] = lp_build_extract_range(gallivm, fs_mask[0], 0, 8);
+      if (key->multisample) {
+         unsigned s;
+         for (s = 0; s < LP_MAX_SAMPLES; s++) {
+            LLVMValueRef smask = fs_sample_mask[s][0];
+            fs_sample_mask[s][1] = lp_build_extract_range(gallivm, smask, 8, 8);
+            fs_sample_mask[s][0] = lp_build_extract_range(gallivm, smask, 0, 8);
+         }
+      }
+
+      for (cbuf = 0; cbuf < PIPE_MAX_COLOR_BUFS; cbuf++) {
+         if (cbuf >= key->nr_cbufs && !(cbuf == 1 && dual_source_blend))
+            continue;
+         for (chan = 0; chan < TGSI_NUM_CHANNELS; ++chan) {
+            LLVMValueRef index1 = lp_build_const_int32(gallivm, 1);
+            LLVMValueRef ptr = LLVMBuildBitCast(builder,
+                                                fs_out_color[cbuf][chan][0],
+                                                half_ptr_type, "");
+            fs_out_color[cbuf][chan][0] = ptr;
+            fs_out_color[cbuf][chan][1] = LLVMBuildGEP(builder, ptr,
+                                                       &index1, 1, "");
+         }
+      }
+
+      fs_type = half_type;
+      num_fs = 2;
+   }
+
    /* Loop over color outputs / color buffers to do blending.
     */
    for(cbuf = 0; cbuf < key->nr_cbufs; cbuf++) {
@@ -2688,11 +3146,48 @@ generate_fragment(struct llvmpipe_context *lp,
                                 LLVMBuildGEP(builder, stride_ptr, &index, 1, ""),
                                 "");
 
-         generate_unswizzled_blend(gallivm, cbuf, variant,
-                                   key->cbuf_format[cbuf],
-                                   num_fs, fs_type, fs_mask, fs_out_color,
-                                   context_ptr, color_ptr, stride,
-                                   partial_mask, do_branch);
+         if (key->multisample) {
+            /*
+             * Blend each sample with its own coverage.  The color pointer
+             * is cast around the byte offset of the sample.
+             */
+            LLVMTypeRef color_ptr_type = LLVMTypeOf(color_ptr);
+            LLVMTypeRef i8_ptr_type = LLVMPointerType(int8_type, 0);
+            LLVMValueRef sample_stride =
+               LLVMBuildLoad(builder,
+                             LLVMBuildGEP(builder, sample_stride_ptr,
+                                          &index, 1, ""),
+                             "");
+            unsigned s;
+
+            for (s = 0; s < LP_MAX_SAMPLES; s++) {
+               LLVMValueRef sample_color_ptr;
+
+               if (!(key->sample_mask & (1 << s)))
+                  continue;
+
+               sample_color_ptr = LLVMBuildBitCast(builder, color_ptr,
+                                                   i8_ptr_type, "");
+               sample_color_ptr = generate_sample_ptr(gallivm, sample_color_ptr,
+                                                      sample_stride, s);
+               sample_color_ptr = LLVMBuildBitCast(builder, sample_color_ptr,
+                                                   color_ptr_type, "");
+
+               generate_unswizzled_blend(gallivm, cbuf, variant,
+                                         key->cbuf_format[cbuf],
+                                         num_fs, fs_type, fs_sample_mask[s],
+                                         fs_out_color,
+                                         context_ptr, sample_color_ptr, stride,
+                                         TRUE, do_branch);
+            }
+         }
+         else {
+            generate_unswizzled_blend(gallivm, cbuf, variant,
+                                      key->cbuf_format[cbuf],
+                                      num_fs, fs_type, fs_mask, fs_out_color,
+                                      context_ptr, color_ptr, stride,
+                                      partial_mask, do_branch);
+         }
       }
    }
 
@@ -2742,6 +3237,12 @@ dump_fs_variant_key(const struct lp_fragment_shader_variant_key *key)
       debug_printf("occlusion_count = 1\n");
    }
 
+   if (key->multisample) {
+      debug_printf("multisample = 1\n");
+      debug_printf("sample_mask = 0x%x\n", key->sample_mask);
+      debug_printf("multisample_rast = %u\n", key->multisample_rast);
+   }
+
    if (key->blend.logicop_enable) {
       debug_printf("blend.logicop_func = %s\n", util_str_logicop(key->blend.logicop_func, TRUE));
    }
@@ -2791,6 +3292,7 @@ dump_fs_variant_key(const struct lp_fragment_shader_variant_key *key)
                    texture->pot_width,
                    texture->pot_height,
                    texture->pot_depth);
+      debug_printf("  .tiled = %u\n", texture->tiled);
    }
 }
 
@@ -2803,41 +3305,508 @@ lp_debug_fs_variant(const struct lp_fragment_shader_variant *variant)
    tgsi_dump(variant->shader->base.tokens, 0);
    dump_fs_variant_key(&variant->key);
    debug_printf("variant->opaque = %u\n", variant->opaque);
+   debug_printf("variant->blit = %u\n", variant->blit);
    debug_printf("\n");
 }
 
 
 /**
- * Generate a new fragment shader variant from the shader code and
+ * Compute the disk cache key of a fragment shader variant, from the shader
+ * tokens and the variant key.
+ */
+static void
+lp_fs_get_ir_cache_key(const struct lp_fragment_shader *shader,
+                       const struct lp_fragment_shader_variant_key *key,
+                       unsigned char ir_sha1_cache_key[20])
+{
+   struct mesa_sha1 ctx;
+
+   lp_build_cache_key_init(&ctx, "fs", shader->base.tokens,
+                           key, shader->variant_key_size);
+   _mesa_sha1_final(&ctx, ir_sha1_cache_key);
+}
+
+
+/**
+ * Generate the code of a fragment shader variant, in the given LLVM
+ * context.  Returns FALSE on failure.
+ *
+ * This only reads the shader and the variant key, so it may run on a
+ * compiler thread.
+ */
+static boolean
+compile_variant(struct llvmpipe_screen *screen,
+                LLVMContextRef context,
+                struct lp_fragment_shader_variant *variant)
+{
+   struct lp_fragment_shader *shader = variant->shader;
+   char module_name[64];
+   struct lp_cached_code cached = { 0 };
+   unsigned char ir_sha1_cache_key[20];
+   boolean needs_caching = FALSE;
+   int64_t t0;
+
+   t0 = os_time_get();
+
+   util_snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
+                 shader->no, variant->no);
+
+   lp_fs_get_ir_cache_key(shader, &variant->key, ir_sha1_cache_key);
+   lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
+   if (!cached.data_size)
+      needs_caching = TRUE;
+   else
+      variant->tier = GALLIVM_TIER_FULL;  /* only full tier code is cached */
+
+   variant->gallivm = gallivm_create(module_name, context, &cached);
+   if (!variant->gallivm) {
+      free(cached.data);
+      return FALSE;
+   }
+
+   variant->gallivm->tier = variant->tier;
+
+   lp_jit_init_types(variant);
+   
+   if (variant->jit_function[RAST_EDGE_TEST] == NULL)
+      generate_fragment(shader, variant, RAST_EDGE_TEST);
+
+   if (variant->jit_function[RAST_WHOLE] == NULL) {
+      if (variant->opaque) {
+         /* Specialized shader, which doesn't need to read the color buffer. */
+         generate_fragment(shader, variant, RAST_WHOLE);
+      }
+   }
+
+   /*
+    * Compile everything
+    */
+
+   gallivm_compile_module(variant->gallivm);
+
+   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+
+   if (variant->function[RAST_EDGE_TEST]) {
+      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
+            gallivm_jit_function(variant->gallivm,
+                                 variant->function[RAST_EDGE_TEST]);
+   }
+
+   if (variant->function[RAST_WHOLE]) {
+         variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
+               gallivm_jit_function(variant->gallivm,
+                                    variant->function[RAST_WHOLE]);
+   } else if (!variant->jit_function[RAST_WHOLE]) {
+      variant->jit_function[RAST_WHOLE] = variant->jit_function[RAST_EDGE_TEST];
+   }
+
+   if (needs_caching && variant->tier == GALLIVM_TIER_FULL)
+      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
+
+   gallivm_free_ir(variant->gallivm);
+
+   free(cached.data);
+
+   variant->compile_time = os_time_get() - t0;
+
+   return TRUE;
+}
+
+
+/** Background compilation of a fragment shader variant */
+struct lp_fs_compile_job
+{
+   struct llvmpipe_screen *screen;
+   struct lp_fragment_shader_variant *variant;
+};
+
+
+/**
+ * Stand-in for the code of a variant which failed to compile.  The variant
+ * is already bound and binned by then, so if even the synchronous compile
+ * in lp_fs_variant_recompile() fails, the variant's fragments are dropped.
+ */
+static void
+skip_fragments(const struct lp_jit_context *context,
+               uint32_t x, uint32_t y, uint32_t facing,
+               const void *a0, const void *dadx, const void *dady,
+               uint8_t **color, uint8_t *depth, uint64_t mask,
+               struct lp_jit_thread_data *thread_data,
+               unsigned *stride, unsigned depth_stride,
+               unsigned *sample_stride, unsigned depth_sample_stride)
+{
+}
+
+
+static void
+compile_variant_job(void *data, int thread_index)
+{
+   struct lp_fs_compile_job *job = data;
+   struct lp_fragment_shader_variant *variant = job->variant;
+   LLVMContextRef context;
+   boolean ok = FALSE;
+
+   /* LLVM contexts can't be shared between threads. The code outlives
+    * the IR, so the context can go as soon as the module is compiled.
+    */
+   context = LLVMContextCreate();
+   if (context) {
+      ok = compile_variant(job->screen, context, variant);
+      LLVMContextDispose(context);
+   }
+
+   if (!ok) {
+      variant->jit_function[RAST_EDGE_TEST] = skip_fragments;
+      variant->jit_function[RAST_WHOLE] = skip_fragments;
+      variant->async_failed = TRUE;
+   }
+
+   FREE(job);
+}
+
+
+static mtx_t recompile_mutex = _MTX_INITIALIZER_NP;
+
+
+/**
+ * Compile a variant whose background compile failed, typically because
+ * the compiler thread ran out of memory.  Called by whichever of the
+ * context and the rasterizer threads uses the variant first; the others
+ * wait here until the code is in place.
+ */
+void
+lp_fs_variant_recompile(struct llvmpipe_screen *screen,
+                        struct lp_fragment_shader_variant *variant)
+{
+   mtx_lock(&recompile_mutex);
+
+   if (!variant->recompiled) {
+      LLVMContextRef context = LLVMContextCreate();
+      boolean ok = FALSE;
+
+      if (context) {
+         ok = compile_variant(screen, context, variant);
+         LLVMContextDispose(context);
+      }
+
+      variant->dropped = !ok;
+      variant->recompiled = TRUE;
+   }
+
+   mtx_unlock(&recompile_mutex);
+}
+
+
+/**
+ * Recompile a fast tier variant at the full tier, and swap in the new code.
+ */
+static void
+promote_variant_job(void *data, int thread_index)
+{
+   struct lp_fs_compile_job *job = data;
+   struct lp_fragment_shader_variant *variant = job->variant;
+   struct lp_fragment_shader_variant *full;
+   LLVMContextRef context;
+
+   full = CALLOC_STRUCT(lp_fragment_shader_variant);
+   context = LLVMContextCreate();
+
+   if (full && context) {
+      memcpy(&full->key, &variant->key, variant->shader->variant_key_size);
+      full->shader = variant->shader;
+      full->opaque = variant->opaque;
+      full->no = variant->no;
+      full->tier = GALLIVM_TIER_FULL;
+
+      if (compile_variant(job->screen, context, full)) {
+         if (gallivm_debug & GALLIVM_DEBUG_PERF) {
+            debug_printf("Promoted FS #%u variant %u after %u uses: "
+                         "%u us at the fast tier, %u us at the full tier\n",
+                         variant->shader->no, variant->no,
+                         variant->invocations,
+                         (unsigned) variant->compile_time,
+                         (unsigned) full->compile_time);
+         }
+
+         /* The rasterizer picks up the new code with the next bin. */
+         variant->gallivm_fast = variant->gallivm;
+         variant->gallivm = full->gallivm;
+         p_atomic_set(&variant->jit_function[RAST_WHOLE],
+                      full->jit_function[RAST_WHOLE]);
+         p_atomic_set(&variant->jit_function[RAST_EDGE_TEST],
+                      full->jit_function[RAST_EDGE_TEST]);
+         variant->tier = GALLIVM_TIER_FULL;
+      }
+   }
+
+   if (context)
+      LLVMContextDispose(context);
+   FREE(full);
+   FREE(job);
+}
+
+
+/**
+ * Determine how a variant interacts with hierarchical depth rejection,
+ * see the LP_HIZ_x flags.
+ */
+static unsigned
+lp_fs_variant_hiz_flags(const struct lp_fragment_shader *shader,
+                        const struct lp_fragment_shader_variant_key *key)
+{
+   const struct tgsi_shader_info *info = &shader->info.base;
+   unsigned flags = 0;
+
+   if (!key->depth.enabled)
+      return 0;
+
+   switch (key->depth.func) {
+   case PIPE_FUNC_NEVER:
+   case PIPE_FUNC_EQUAL:
+      /* Neither can raise the depth buffer, nor are they worth testing */
+      return 0;
+   case PIPE_FUNC_LESS:
+   case PIPE_FUNC_LEQUAL:
+      break;
+   default:
+      return key->depth.writemask ? LP_HIZ_INVALIDATE : 0;
+   }
+
+   /*
+    * Fragments failing the depth test may still update stencil or have
+    * written memory, and with depth clamping or computed depth we can't
+    * tell beforehand what they get tested with.
+    */
+   if (!key->stencil[0].enabled &&
+       !key->depth_clamp &&
+       !info->writes_z &&
+       !info->writes_memory)
+      flags |= LP_HIZ_TEST;
+
+   /*
+    * Every sample covered by the primitive ends up with a depth no greater
+    * than the fragment's, unless it can be discarded.
+    */
+   if ((flags & LP_HIZ_TEST) &&
+       key->depth.writemask &&
+       !key->alpha.enabled &&
+       !key->blend.alpha_to_coverage &&
+       !info->uses_kill &&
+       !info->writes_samplemask &&
+       (!key->multisample || key->sample_mask == 0xf))
+      flags |= LP_HIZ_WRITE;
+
+   return flags;
+}
+
+
+/**
+ * Detect shaders which just output a 2D texture lookup at an interpolated
+ * input, as used for blits and 2D compositing.
+ * \return the index of the input, or -1
+ */
+static int
+lp_fs_blit_input(const struct lp_fragment_shader *shader)
+{
+   const struct tgsi_shader_info *info = &shader->info.base;
+   const struct lp_tgsi_texture_info *tex = &shader->info.tex[0];
+   struct tgsi_parse_context parse;
+   int tex_temp = -1;
+   boolean written = FALSE;
+   boolean ok = TRUE;
+
+   /* The lookup itself was already analysed by lp_build_tgsi_info() */
+   if (info->num_outputs != 1 ||
+       info->output_semantic_name[0] != TGSI_SEMANTIC_COLOR ||
+       info->output_semantic_index[0] != 0 ||
+       shader->info.num_texs != 1 ||
+       shader->info.indirect_textures ||
+       (tex->target != TGSI_TEXTURE_2D &&
+        tex->target != TGSI_TEXTURE_RECT) ||
+       tex->coord[0].file != TGSI_FILE_INPUT ||
+       tex->coord[0].swizzle != PIPE_SWIZZLE_X ||
+       tex->coord[1].file != TGSI_FILE_INPUT ||
+       tex->coord[1].swizzle != PIPE_SWIZZLE_Y ||
+       tex->coord[1].u.index != tex->coord[0].u.index)
+      return -1;
+
+   if (shader->inputs[tex->coord[0].u.index].interp != LP_INTERP_LINEAR &&
+       shader->inputs[tex->coord[0].u.index].interp != LP_INTERP_PERSPECTIVE)
+      return -1;
+
+   /*
+    * Only allow the TEX writing the output, either directly or through
+    * a temporary and a plain MOV.
+    */
+   tgsi_parse_init(&parse, shader->base.tokens);
+
+   while (ok && !tgsi_parse_end_of_tokens(&parse)) {
+      const struct tgsi_full_instruction *inst;
+      const struct tgsi_dst_register *dst;
+      const struct tgsi_src_register *src;
+
+      tgsi_parse_token(&parse);
+      if (parse.FullToken.Token.Type != TGSI_TOKEN_TYPE_INSTRUCTION)
+         continue;
+
+      inst = &parse.FullToken.FullInstruction;
+      dst = &inst->Dst[0].Register;
+
+      switch (inst->Instruction.Opcode) {
+      case TGSI_OPCODE_TEX:
+         ok = tex_temp < 0 && !written &&
+              !inst->Instruction.Saturate &&
+              !inst->Texture.NumOffsets &&
+              !dst->Indirect &&
+              dst->WriteMask == TGSI_WRITEMASK_XYZW;
+         if (dst->File == TGSI_FILE_OUTPUT && dst->Index == 0)
+            written = TRUE;
+         else if (dst->File == TGSI_FILE_TEMPORARY)
+            tex_temp = dst->Index;
+         else
+            ok = FALSE;
+         break;
+      case TGSI_OPCODE_MOV:
+         src = &inst->Src[0].Register;
+         ok = tex_temp >= 0 && !written &&
+              !inst->Instruction.Saturate &&
+              dst->File == TGSI_FILE_OUTPUT && dst->Index == 0 &&
+              !dst->Indirect &&
+              dst->WriteMask == TGSI_WRITEMASK_XYZW &&
+              src->File == TGSI_FILE_TEMPORARY && src->Index == tex_temp &&
+              !src->Indirect && !src->Absolute && !src->Negate &&
+              src->SwizzleX == TGSI_SWIZZLE_X &&
+              src->SwizzleY == TGSI_SWIZZLE_Y &&
+              src->SwizzleZ == TGSI_SWIZZLE_Z &&
+              src->SwizzleW == TGSI_SWIZZLE_W;
+         written = TRUE;
+         break;
+      case TGSI_OPCODE_END:
+         break;
+      default:
+         ok = FALSE;
+         break;
+      }
+   }
+
+   tgsi_parse_free(&parse);
+
+   return ok && written ? (int)tex->coord[0].u.index : -1;
+}
+
+
+/**
+ * Whether rectangles drawn with the variant may be rasterized by copying
+ * texels, see lp_setup_rect_blit().  That takes a blit shader sampling a
+ * linear texture of the color buffer's format without filtering across
+ * texels, and no fragment operations other than premultiplied alpha
+ * blending.
+ * \return one of LP_BLIT_x
+ */
+static unsigned
+lp_fs_variant_blit(const struct lp_fragment_shader *shader,
+                   const struct lp_fragment_shader_variant_key *key)
+{
+   const struct lp_tgsi_texture_info *tex = &shader->info.tex[0];
+   const struct pipe_rt_blend_state *blend = &key->blend.rt[0];
+   const struct lp_static_sampler_state *sampler;
+   const struct lp_static_texture_state *texture;
+
+   if (shader->blit_input < 0 ||
+       key->nr_cbufs != 1 ||
+       key->multisample ||
+       key->depth.enabled ||
+       key->stencil[0].enabled ||
+       key->alpha.enabled ||
+       key->occlusion_count ||
+       key->blend.logicop_enable ||
+       key->blend.alpha_to_coverage ||
+       blend->colormask != PIPE_MASK_RGBA)
+      return LP_BLIT_NONE;
+
+   switch (key->cbuf_format[0]) {
+   case PIPE_FORMAT_B8G8R8A8_UNORM:
+   case PIPE_FORMAT_B8G8R8X8_UNORM:
+   case PIPE_FORMAT_R8G8B8A8_UNORM:
+   case PIPE_FORMAT_R8G8B8X8_UNORM:
+      break;
+   default:
+      return LP_BLIT_NONE;
+   }
+
+   sampler = &key->state[tex->sampler_unit].sampler_state;
+   texture = &key->state[tex->texture_unit].texture_state;
+
+   if (texture->format != key->cbuf_format[0] ||
+       texture->tiled ||
+       (texture->target != PIPE_TEXTURE_2D &&
+        texture->target != PIPE_TEXTURE_RECT) ||
+       texture->swizzle_r != PIPE_SWIZZLE_X ||
+       texture->swizzle_g != PIPE_SWIZZLE_Y ||
+       texture->swizzle_b != PIPE_SWIZZLE_Z ||
+       texture->swizzle_a != PIPE_SWIZZLE_W ||
+       sampler->min_img_filter != sampler->mag_img_filter ||
+       sampler->min_mip_filter != PIPE_TEX_MIPFILTER_NONE ||
+       sampler->compare_mode != PIPE_TEX_COMPARE_NONE)
+      return LP_BLIT_NONE;
+
+   if (!blend->blend_enable)
+      return LP_BLIT_COPY;
+
+   if (blend->rgb_func == PIPE_BLEND_ADD &&
+       blend->rgb_src_factor == PIPE_BLENDFACTOR_ONE &&
+       blend->rgb_dst_factor == PIPE_BLENDFACTOR_INV_SRC_ALPHA &&
+       blend->alpha_func == PIPE_BLEND_ADD &&
+       blend->alpha_src_factor == PIPE_BLENDFACTOR_ONE &&
+       blend->alpha_dst_factor == PIPE_BLENDFACTOR_INV_SRC_ALPHA) {
+      /* Without alpha in the texture that is a copy as well */
+      const struct util_format_description *desc =
+         util_format_description(texture->format);
+      return util_format_has_alpha(texture->format) &&
+             desc->swizzle[3] == PIPE_SWIZZLE_W ? LP_BLIT_OVER : LP_BLIT_COPY;
+   }
+
+   return LP_BLIT_NONE;
+}
+
+
+/**
+ * Create a new fragment shader variant from the shader code and
  * other state indicated by the key.
+ *
+ * With LP_ASYNC_COMPILE the code is generated on the screen's compiler
+ * threads, and the variant can be bound and binned right away; only the
+ * rasterizer waits for it, see lp_fs_variant_wait().
  */
 static struct lp_fragment_shader_variant *
 generate_variant(struct llvmpipe_context *lp,
                  struct lp_fragment_shader *shader,
                  const struct lp_fragment_shader_variant_key *key)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
    struct lp_fragment_shader_variant *variant;
    const struct util_format_description *cbuf0_format_desc = NULL;
    boolean fullcolormask;
-   char module_name[64];
 
    variant = CALLOC_STRUCT(lp_fragment_shader_variant);
    if (!variant)
       return NULL;
 
-   util_snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
-                 shader->no, shader->variants_created);
-
-   variant->gallivm = gallivm_create(module_name, lp->context);
-   if (!variant->gallivm) {
-      FREE(variant);
-      return NULL;
-   }
-
    variant->shader = shader;
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
    variant->no = shader->variants_created++;
+   util_queue_fence_init(&variant->ready);
+   util_queue_fence_init(&variant->promoted);
+
+   /* Tiering only pays off when the full tier can be compiled in the
+    * background.
+    */
+   if (screen->tier_threshold &&
+       util_queue_is_initialized(&screen->compile_queue))
+      variant->tier = GALLIVM_TIER_FAST;
+   else
+      variant->tier = GALLIVM_TIER_FULL;
 
    memcpy(&variant->key, key, shader->variant_key_size);
 
@@ -2859,49 +3828,35 @@ generate_variant(struct llvmpipe_context *lp,
          !key->blend.alpha_to_coverage &&
          !key->depth.enabled &&
          !shader->info.base.uses_kill &&
-         !shader->info.base.writes_samplemask
+         !shader->info.base.writes_samplemask &&
+         !key->multisample
       ? TRUE : FALSE;
 
+   variant->hiz = lp_fs_variant_hiz_flags(shader, key);
+   variant->blit = lp_fs_variant_blit(shader, key);
+
    if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
       lp_debug_fs_variant(variant);
    }
 
-   lp_jit_init_types(variant);
-   
-   if (variant->jit_function[RAST_EDGE_TEST] == NULL)
-      generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
-
-   if (variant->jit_function[RAST_WHOLE] == NULL) {
-      if (variant->opaque) {
-         /* Specialized shader, which doesn't need to read the color buffer. */
-         generate_fragment(lp, shader, variant, RAST_WHOLE);
+   if (util_queue_is_initialized(&screen->compile_queue)) {
+      struct lp_fs_compile_job *job = CALLOC_STRUCT(lp_fs_compile_job);
+      if (job) {
+         job->screen = screen;
+         job->variant = variant;
+         util_queue_add_job(&screen->compile_queue, job, &variant->ready,
+                            compile_variant_job, NULL);
+         return variant;
       }
    }
 
-   /*
-    * Compile everything
-    */
-
-   gallivm_compile_module(variant->gallivm);
-
-   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
-
-   if (variant->function[RAST_EDGE_TEST]) {
-      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
-            gallivm_jit_function(variant->gallivm,
-                                 variant->function[RAST_EDGE_TEST]);
-   }
-
-   if (variant->function[RAST_WHOLE]) {
-         variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
-               gallivm_jit_function(variant->gallivm,
-                                    variant->function[RAST_WHOLE]);
-   } else if (!variant->jit_function[RAST_WHOLE]) {
-      variant->jit_function[RAST_WHOLE] = variant->jit_function[RAST_EDGE_TEST];
+   if (!compile_variant(screen, lp->context, variant)) {
+      util_queue_fence_destroy(&variant->ready);
+      util_queue_fence_destroy(&variant->promoted);
+      FREE(variant);
+      return NULL;
    }
 
-   gallivm_free_ir(variant->gallivm);
-
    return variant;
 }
 
@@ -2980,6 +3935,8 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
       shader->inputs[i].src_index = i+1;
    }
 
+   shader->blit_input = lp_fs_blit_input(shader);
+
    if (LP_DEBUG & DEBUG_TGSI) {
       unsigned attrib;
       debug_printf("llvmpipe: Create fragment shader #%u %p:\n",
@@ -3022,6 +3979,10 @@ llvmpipe_bind_fs_state(struct pipe_context *pipe, void *fs)
 /**
  * Remove shader variant from two lists: the shader's variant list
  * and the context's variant list.
+ *
+ * Scenes which haven't been rasterized yet may still use the variant, so
+ * it is only put on the retired list here, along with the fence of the
+ * newest scene.  llvmpipe_reap_shader_variants() frees it later.
  */
 void
 llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
@@ -3036,8 +3997,6 @@ llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
                    lp->nr_fs_variants, variant->nr_instrs, lp->nr_fs_instrs);
    }
 
-   gallivm_destroy(variant->gallivm);
-
    /* remove from shader's list */
    remove_from_list(&variant->list_item_local);
    variant->shader->variants_cached--;
@@ -3045,9 +4004,55 @@ llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
    /* remove from context's list */
    remove_from_list(&variant->list_item_global);
    lp->nr_fs_variants--;
-   lp->nr_fs_instrs -= variant->nr_instrs;
+   if (variant->accounted)
+      lp->nr_fs_instrs -= variant->nr_instrs;
+
+   /* pending compile jobs still read the shader */
+   util_queue_fence_wait(&variant->ready);
+   util_queue_fence_wait(&variant->promoted);
+
+   /* the rasterizer can't recompile it once the shader is gone */
+   if (variant->async_failed)
+      lp_fs_variant_recompile(llvmpipe_screen(lp->pipe.screen), variant);
+
+   /* the shader may be deleted before the variant is freed */
+   variant->shader = NULL;
+
+   lp_setup_get_newest_fence(lp->setup, &variant->fence);
+   insert_at_tail(&lp->fs_variants_retired, &variant->list_item_global);
+   lp->nr_fs_variants_retired++;
+}
+
+
+/**
+ * Free the retired shader variants that no scene uses anymore, or all of
+ * them if force is set (when nothing can be rendering anymore).
+ */
+void
+llvmpipe_reap_shader_variants(struct llvmpipe_context *lp, boolean force)
+{
+   struct lp_fs_variant_list_item *li;
 
-   FREE(variant);
+   li = first_elem(&lp->fs_variants_retired);
+   while (!at_end(&lp->fs_variants_retired, li)) {
+      struct lp_fs_variant_list_item *next = next_elem(li);
+      struct lp_fragment_shader_variant *variant = li->base;
+
+      if (force || !variant->fence || lp_fence_signalled(variant->fence)) {
+         remove_from_list(&variant->list_item_global);
+         lp->nr_fs_variants_retired--;
+
+         lp_fence_reference(&variant->fence, NULL);
+         util_queue_fence_destroy(&variant->ready);
+         util_queue_fence_destroy(&variant->promoted);
+         if (variant->gallivm)
+            gallivm_destroy(variant->gallivm);
+         if (variant->gallivm_fast)
+            gallivm_destroy(variant->gallivm_fast);
+         FREE(variant);
+      }
+      li = next;
+   }
 }
 
 
@@ -3060,14 +4065,7 @@ llvmpipe_delete_fs_state(struct pipe_context *pipe, void *fs)
 
    assert(fs != llvmpipe->fs);
 
-   /*
-    * XXX: we need to flush the context until we have some sort of reference
-    * counting in fragment shaders as they may still be binned
-    * Flushing alone might not sufficient we need to wait on it too.
-    */
-   llvmpipe_finish(pipe, __FUNCTION__);
-
-   /* Delete all the variants */
+   /* Delete all the variants.  Scenes still using them keep them alive. */
    li = first_elem(&shader->variants);
    while(!at_end(&shader->variants, li)) {
       struct lp_fs_variant_list_item *next = next_elem(li);
@@ -3075,6 +4073,8 @@ llvmpipe_delete_fs_state(struct pipe_context *pipe, void *fs)
       li = next;
    }
 
+   llvmpipe_reap_shader_variants(llvmpipe, FALSE);
+
    /* Delete draw module's data */
    draw_delete_fragment_shader(llvmpipe->draw, shader->draw_data);
 
@@ -3226,6 +4226,19 @@ make_variant_key(struct llvmpipe_context *lp,
    /* alpha.ref_value is passed in jit_context */
 
    key->flatshade = lp->rasterizer->flatshade;
+
+   /*
+    * With a multisampled framebuffer the shader still runs once per pixel,
+    * but coverage, depth/stencil and blending are done per sample.  With
+    * multisample rasterization disabled coverage is computed at the pixel
+    * centre and replicated to all samples, and so is depth.
+    */
+   if (util_framebuffer_get_num_samples(&lp->framebuffer) > 1) {
+      key->multisample = 1;
+      key->multisample_rast = lp->rasterizer->multisample;
+      key->sample_mask = lp->sample_mask & 0xf;
+   }
+
    if (lp->active_occlusion_queries) {
       key->occlusion_count = TRUE;
    }
@@ -3341,8 +4354,8 @@ make_variant_key(struct llvmpipe_context *lp,
           * used views may be included in the shader key.
           */
          if(shader->info.base.file_mask[TGSI_FILE_SAMPLER_VIEW] & (1u << (i & 31))) {
-            lp_sampler_static_texture_state(&key->state[i].texture_state,
-                                            lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
+            llvmpipe_static_texture_state(&key->state[i].texture_state,
+                                          lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
          }
       }
    }
@@ -3350,8 +4363,8 @@ make_variant_key(struct llvmpipe_context *lp,
       key->nr_sampler_views = key->nr_samplers;
       for(i = 0; i < key->nr_sampler_views; ++i) {
          if(shader->info.base.file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
-            lp_sampler_static_texture_state(&key->state[i].texture_state,
-                                            lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
+            llvmpipe_static_texture_state(&key->state[i].texture_state,
+                                          lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
          }
       }
    }
@@ -3359,6 +4372,146 @@ make_variant_key(struct llvmpipe_context *lp,
 
 
 
+/**
+ * Value of keeping a variant in the cache: what it cost to compile, per
+ * instruction of the cache budget it takes up.
+ */
+static inline double
+variant_cost(const struct lp_fragment_shader_variant *variant)
+{
+   return (double) MAX2(variant->compile_time, 1) /
+          (double) MAX2(variant->nr_instrs, 1);
+}
+
+
+/**
+ * Add a variant to the context's totals once its code is ready.
+ * Returns whether it is.
+ */
+static boolean
+account_variant(struct llvmpipe_context *lp,
+                struct lp_fragment_shader_variant *variant)
+{
+   if (variant->accounted)
+      return TRUE;
+
+   if (!util_queue_fence_is_signalled(&variant->ready))
+      return FALSE;
+
+   variant->accounted = TRUE;
+   variant->priority = lp->fs_variant_age + variant_cost(variant);
+   lp->nr_fs_instrs += variant->nr_instrs;
+   lp->fs_variant_stats.compile_time += variant->compile_time;
+   LP_COUNT_ADD(llvm_compile_time, variant->compile_time);
+   return TRUE;
+}
+
+
+/**
+ * Evict variants until there is room for a new one.
+ *
+ * This is the greedy-dual-size policy: every variant has a priority of
+ * lp->fs_variant_age plus its cost, refreshed whenever it is used, and the
+ * variant with the lowest priority goes first.  The age then becomes that
+ * priority, so variants which haven't been used for a while eventually go
+ * even if they were expensive, while cheap variants can't push out costly
+ * ones that are still in use.
+ *
+ * Variants still being compiled or recompiled in the background can't be
+ * evicted.
+ */
+static void
+evict_shader_variants(struct llvmpipe_context *lp)
+{
+   while (lp->nr_fs_variants >= lp->max_fs_variants ||
+          lp->nr_fs_instrs >= lp->max_fs_instrs) {
+      struct lp_fragment_shader_variant *victim = NULL;
+      struct lp_fs_variant_list_item *li;
+
+      /* walk from the tail, so that ties go to the least recently used */
+      li = last_elem(&lp->fs_variants_list);
+      while (!at_end(&lp->fs_variants_list, li)) {
+         if (account_variant(lp, li->base) &&
+             util_queue_fence_is_signalled(&li->base->promoted) &&
+             (!victim || li->base->priority < victim->priority))
+            victim = li->base;
+         li = prev_elem(li);
+      }
+
+      if (!victim)
+         break;
+
+      if (gallivm_debug & GALLIVM_DEBUG_PERF) {
+         debug_printf("Evicting FS #%u variant %u: %u total variants,"
+                      "\t%u instrs,\tcompiled in %u us\n",
+                      victim->shader->no, victim->no,
+                      lp->nr_fs_variants, victim->nr_instrs,
+                      (unsigned) victim->compile_time);
+      }
+
+      lp->fs_variant_age = victim->priority;
+      llvmpipe_remove_shader_variant(lp, victim);
+      lp->fs_variant_stats.evictions++;
+      LP_COUNT(nr_fs_variant_evictions);
+   }
+}
+
+
+/**
+ * Queue the full tier recompile of a fast tier variant, once the
+ * rasterizer has used it more than LP_TIERED_COMPILE times.
+ */
+static void
+promote_hot_variant(struct llvmpipe_context *lp,
+                    struct lp_fragment_shader_variant *variant)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fs_compile_job *job;
+
+   /* The tier only stops changing once the first compile is done. */
+   if (variant->promoting ||
+       !util_queue_fence_is_signalled(&variant->ready) ||
+       variant->tier != GALLIVM_TIER_FAST)
+      return;
+
+   if (p_atomic_read(&variant->invocations) < screen->tier_threshold)
+      return;
+
+   job = CALLOC_STRUCT(lp_fs_compile_job);
+   if (!job)
+      return;
+
+   job->screen = screen;
+   job->variant = variant;
+   variant->promoting = TRUE;
+   util_queue_add_job(&screen->compile_queue, job, &variant->promoted,
+                      promote_variant_job, NULL);
+   lp->fs_variant_stats.promotions++;
+}
+
+
+/**
+ * Recompile the variants which turned out to be hot at the full tier.
+ * Called at flush time, which also catches the variants of draws that
+ * don't change any state.
+ */
+void
+llvmpipe_promote_hot_shader_variants(struct llvmpipe_context *lp)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_fs_variant_list_item *li;
+
+   if (!screen->tier_threshold)
+      return;
+
+   li = first_elem(&lp->fs_variants_list);
+   while (!at_end(&lp->fs_variants_list, li)) {
+      promote_hot_variant(lp, li->base);
+      li = next_elem(li);
+   }
+}
+
+
 /**
  * Update fragment shader state.  This is called just prior to drawing
  * something when some fragment-related state has changed.
@@ -3384,17 +4537,19 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
    }
 
    if (variant) {
-      /* Move this variant to the head of the list to implement LRU
-       * deletion of shader's when we have too many.
+      /* Move this variant to the head of the list, and make it as
+       * valuable as a newly compiled one.
        */
       move_to_head(&lp->fs_variants_list, &variant->list_item_global);
+      if (account_variant(lp, variant))
+         variant->priority = lp->fs_variant_age + variant_cost(variant);
+      lp->fs_variant_stats.hits++;
+
+      if (llvmpipe_screen(lp->pipe.screen)->tier_threshold)
+         promote_hot_variant(lp, variant);
    }
    else {
       /* variant not found, create it now */
-      int64_t t0, t1, dt;
-      unsigned i;
-      unsigned variants_to_cull;
-
       if (LP_DEBUG & DEBUG_FS) {
          debug_printf("%u variants,\t%u instrs,\t%u instrs/variant\n",
                       lp->nr_fs_variants,
@@ -3402,56 +4557,15 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
                       lp->nr_fs_variants ? lp->nr_fs_instrs / lp->nr_fs_variants : 0);
       }
 
-      /* First, check if we've exceeded the max number of shader variants.
-       * If so, free 6.25% of them (the least recently used ones).
-       */
-      variants_to_cull = lp->nr_fs_variants >= LP_MAX_SHADER_VARIANTS ? LP_MAX_SHADER_VARIANTS / 16 : 0;
-
-      if (variants_to_cull ||
-          lp->nr_fs_instrs >= LP_MAX_SHADER_INSTRUCTIONS) {
-         struct pipe_context *pipe = &lp->pipe;
-
-         if (gallivm_debug & GALLIVM_DEBUG_PERF) {
-            debug_printf("Evicting FS: %u fs variants,\t%u total variants,"
-                         "\t%u instrs,\t%u instrs/variant\n",
-                         shader->variants_cached,
-                         lp->nr_fs_variants, lp->nr_fs_instrs,
-                         lp->nr_fs_instrs / lp->nr_fs_variants);
-         }
-
-         /*
-          * XXX: we need to flush the context until we have some sort of
-          * reference counting in fragment shaders as they may still be binned
-          * Flushing alone might not be sufficient we need to wait on it too.
-          */
-         llvmpipe_finish(pipe, __FUNCTION__);
-
-         /*
-          * We need to re-check lp->nr_fs_variants because an arbitrarliy large
-          * number of shader variants (potentially all of them) could be
-          * pending for destruction on flush.
-          */
-
-         for (i = 0; i < variants_to_cull || lp->nr_fs_instrs >= LP_MAX_SHADER_INSTRUCTIONS; i++) {
-            struct lp_fs_variant_list_item *item;
-            if (is_empty_list(&lp->fs_variants_list)) {
-               break;
-            }
-            item = last_elem(&lp->fs_variants_list);
-            assert(item);
-            assert(item->base);
-            llvmpipe_remove_shader_variant(lp, item->base);
-         }
-      }
+      /* Free what the rasterizer is done with, then make room. */
+      llvmpipe_reap_shader_variants(lp, FALSE);
+      evict_shader_variants(lp);
 
       /*
-       * Generate the new variant.
+       * Generate the new variant.  With background compilation this only
+       * queues the job, and the variant is accounted for once it's done.
        */
-      t0 = os_time_get();
       variant = generate_variant(lp, shader, &key);
-      t1 = os_time_get();
-      dt = t1 - t0;
-      LP_COUNT_ADD(llvm_compile_time, dt);
       LP_COUNT_ADD(nr_llvm_compiles, 2);  /* emit vs. omit in/out test */
 
       /* Put the new variant into the list */
@@ -3459,8 +4573,28 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
          insert_at_head(&shader->variants, &variant->list_item_local);
          insert_at_head(&lp->fs_variants_list, &variant->list_item_global);
          lp->nr_fs_variants++;
-         lp->nr_fs_instrs += variant->nr_instrs;
          shader->variants_cached++;
+         account_variant(lp, variant);
+
+         lp->fs_variant_stats.compiles++;
+      }
+   }
+
+   if (variant && variant->async_failed && !variant->reported &&
+       util_queue_fence_is_signalled(&variant->ready)) {
+      lp_fs_variant_recompile(llvmpipe_screen(lp->pipe.screen), variant);
+      variant->reported = TRUE;
+
+      if (variant->dropped) {
+         pipe_debug_message(&lp->debug, OUT_OF_MEMORY,
+                            "couldn't compile FS #%u variant %u, "
+                            "its fragments are dropped",
+                            shader->no, variant->no);
+      } else {
+         pipe_debug_message(&lp->debug, PERF_INFO,
+                            "FS #%u variant %u failed to compile in the "
+                            "background and was compiled synchronously",
+                            shader->no, variant->no);
       }
    }
 
@@ -32,14 +32,18 @@
 
 #include "pipe/p_compiler.h"
 #include "pipe/p_state.h"
+#include "util/u_queue.h"
 #include "tgsi/tgsi_scan.h" /* for tgsi_shader_info */
 #include "gallivm/lp_bld_sample.h" /* for struct lp_sampler_static_state */
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
+#include "gallivm/lp_bld_init.h" /* for enum gallivm_tier */
 #include "lp_bld_interp.h" /* for struct lp_shader_input */
 
 
 struct tgsi_token;
+struct lp_fence;
 struct lp_fragment_shader;
+struct llvmpipe_screen;
 
 
 /** Indexes into jit_function[] array */
@@ -77,6 +81,9 @@ struct lp_fragment_shader_variant_key
    unsigned occlusion_count:1;
    unsigned resource_1d:1;
    unsigned depth_clamp:1;
+   unsigned multisample:1;      /* fb has LP_MAX_SAMPLES samples per pixel */
+   unsigned multisample_rast:1; /* per-sample coverage, only meaningful if multisample */
+   unsigned sample_mask:4;      /* only meaningful if multisample */
 
    enum pipe_format zsbuf_format;
    enum pipe_format cbuf_format[PIPE_MAX_COLOR_BUFS];
@@ -99,6 +106,12 @@ struct lp_fragment_shader_variant
 
    boolean opaque;
 
+   /* LP_HIZ_x flags, see lp_rast.h */
+   unsigned hiz;
+
+   /* LP_BLIT_x mode, see lp_rast.h */
+   unsigned blit;
+
    struct gallivm_state *gallivm;
 
    LLVMTypeRef jit_context_ptr_type;
@@ -112,6 +125,57 @@ struct lp_fragment_shader_variant
    /* Total number of LLVM instructions generated */
    unsigned nr_instrs;
 
+   /* Time it took to generate, in microseconds */
+   int64_t compile_time;
+
+   /* Eviction priority, see llvmpipe_update_fs() */
+   double priority;
+
+   /* Newest scene which may use the variant, once it has been evicted */
+   struct lp_fence *fence;
+
+   /* Signalled once the code has been generated, see lp_fs_variant_wait() */
+   struct util_queue_fence ready;
+
+   /* Whether nr_instrs and compile_time have been added to the context's
+    * totals.  That only happens once the variant is ready.
+    */
+   boolean accounted;
+
+   /* Set when the background compile failed.  The code is then compiled
+    * synchronously on next use instead, see lp_fs_variant_recompile().
+    */
+   boolean async_failed;
+
+   /* Whether the synchronous compile after a failed background one has been
+    * done, and whether it failed too so that the fragments are dropped.
+    */
+   boolean recompiled;
+   boolean dropped;
+
+   /* Whether async_failed has been reported through the debug callback */
+   boolean reported;
+
+   /* Optimization tier of the code in jit_function.  Variants start at the
+    * fast tier when tiered compilation is enabled, and are recompiled at
+    * the full tier once the rasterizer has used them often enough.
+    */
+   enum gallivm_tier tier;
+
+   /* Times the rasterizer bound the variant while at the fast tier */
+   unsigned invocations;
+
+   /* Whether the full tier recompile has been queued */
+   boolean promoting;
+
+   /* Signalled once the full tier recompile is done */
+   struct util_queue_fence promoted;
+
+   /* The fast tier code, which the rasterizer may still be running when
+    * the full tier code is swapped in.  Freed along with the variant.
+    */
+   struct gallivm_state *gallivm_fast;
+
    struct lp_fs_variant_list_item list_item_global, list_item_local;
    struct lp_fragment_shader *shader;
 
@@ -120,6 +184,38 @@ struct lp_fragment_shader_variant
 };
 
 
+void
+lp_fs_variant_recompile(struct llvmpipe_screen *screen,
+                        struct lp_fragment_shader_variant *variant);
+
+
+/**
+ * Wait for the code of a variant which may still be compiling in the
+ * background, and compile it here if that failed.
+ */
+static inline void
+lp_fs_variant_wait(struct llvmpipe_screen *screen,
+                   struct lp_fragment_shader_variant *variant)
+{
+   if (variant) {
+      util_queue_fence_wait(&variant->ready);
+      if (unlikely(variant->async_failed))
+         lp_fs_variant_recompile(screen, variant);
+   }
+}
+
+
+/** Fragment shader variant cache statistics, per context */
+struct lp_fs_variant_stats
+{
+   uint64_t hits;
+   uint64_t compiles;
+   uint64_t evictions;
+   uint64_t promotions;
+   uint64_t compile_time;  /**< total, in microseconds */
+};
+
+
 /** Subclass of pipe_shader_state */
 struct lp_fragment_shader
 {
@@ -139,6 +235,9 @@ struct lp_fragment_shader
 
    /** Fragment shader input interpolation info */
    struct lp_shader_input inputs[PIPE_MAX_SHADER_INPUTS];
+
+   /** Texture coordinate input of a blit shader, or -1, see lp_fs_blit_input() */
+   int blit_input;
 };
 
 
@@ -149,4 +248,10 @@ void
 llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
                                struct lp_fragment_shader_variant *variant);
 
+void
+llvmpipe_promote_hot_shader_variants(struct llvmpipe_context *lp);
+
+void
+llvmpipe_reap_shader_variants(struct llvmpipe_context *lp, boolean force);
+
 #endif /* LP_STATE_FS_H_ */
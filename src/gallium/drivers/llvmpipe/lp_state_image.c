@@ -0,0 +1,98 @@
+/**************************************************************************
+ * 
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ * 
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ * 
+ **************************************************************************/
+
+/**
+ * Shader storage buffer and image state.
+ *
+ * Fragment shader buffers go through the setup module like constants;
+ * compute shader bindings are only read at launch_grid time.
+ */
+
+#include "util/u_inlines.h"
+#include "lp_context.h"
+#include "lp_state.h"
+#include "lp_texture.h"
+
+
+static void
+llvmpipe_set_shader_buffers(struct pipe_context *pipe,
+                            enum pipe_shader_type shader,
+                            unsigned start_slot, unsigned count,
+                            const struct pipe_shader_buffer *buffers)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   unsigned i;
+
+   assert(shader < PIPE_SHADER_TYPES);
+   assert(start_slot + count <= ARRAY_SIZE(llvmpipe->ssbos[shader]));
+
+   for (i = 0; i < count; i++) {
+      util_copy_shader_buffer(&llvmpipe->ssbos[shader][start_slot + i],
+                              buffers ? &buffers[i] : NULL);
+   }
+
+   if (shader == PIPE_SHADER_FRAGMENT)
+      llvmpipe->dirty |= LP_NEW_FS_SSBOS;
+}
+
+
+static void
+llvmpipe_set_shader_images(struct pipe_context *pipe,
+                           enum pipe_shader_type shader,
+                           unsigned start_slot, unsigned count,
+                           const struct pipe_image_view *images)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   unsigned i;
+
+   assert(shader < PIPE_SHADER_TYPES);
+   assert(start_slot + count <= ARRAY_SIZE(llvmpipe->images[shader]));
+
+   for (i = 0; i < count; i++) {
+      util_copy_image_view(&llvmpipe->images[shader][start_slot + i],
+                           images ? &images[i] : NULL);
+
+      /* image loads and stores address linear images */
+      if (images && images[i].resource &&
+          llvmpipe_resource_is_texture(images[i].resource) &&
+          !llvmpipe_resource_untile(pipe, images[i].resource)) {
+         pipe_debug_message(&llvmpipe->debug, OUT_OF_MEMORY,
+                            "couldn't untile image %u, unbinding it",
+                            start_slot + i);
+         util_copy_image_view(&llvmpipe->images[shader][start_slot + i],
+                              NULL);
+      }
+   }
+}
+
+
+void
+llvmpipe_init_image_funcs(struct llvmpipe_context *llvmpipe)
+{
+   llvmpipe->pipe.set_shader_buffers = llvmpipe_set_shader_buffers;
+   llvmpipe->pipe.set_shader_images = llvmpipe_set_shader_images;
+}
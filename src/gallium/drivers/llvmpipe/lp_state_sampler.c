@@ -140,6 +140,17 @@ llvmpipe_set_sampler_views(struct pipe_context *pipe,
       }
       pipe_sampler_view_reference(&llvmpipe->sampler_views[shader][start + i],
                                   views[i]);
+
+      /* the draw module only samples linear images */
+      if ((shader == PIPE_SHADER_VERTEX || shader == PIPE_SHADER_GEOMETRY) &&
+          views[i] && llvmpipe_resource_is_texture(views[i]->texture) &&
+          !llvmpipe_resource_untile(pipe, views[i]->texture)) {
+         pipe_debug_message(&llvmpipe->debug, OUT_OF_MEMORY,
+                            "couldn't untile sampler view %u, unbinding it",
+                            start + i);
+         pipe_sampler_view_release(pipe,
+                                   &llvmpipe->sampler_views[shader][start + i]);
+      }
    }
 
    /* find highest non-null sampler_views[] entry */
@@ -289,7 +300,7 @@ prepare_shader_sampling(
                   num_layers = view->u.tex.last_layer - view->u.tex.first_layer + 1;
                   for (j = first_level; j <= last_level; j++) {
                      mip_offsets[j] += view->u.tex.first_layer *
-                                       lp_tex->img_stride[j];
+                                       llvmpipe_layer_stride(res, j);
                   }
                   if (view->target == PIPE_TEXTURE_CUBE ||
                       view->target == PIPE_TEXTURE_CUBE_ARRAY) {
@@ -363,6 +374,25 @@ llvmpipe_prepare_geometry_sampling(struct llvmpipe_context *lp,
 }
 
 
+/**
+ * lp_sampler_static_texture_state() plus the llvmpipe specific bits:
+ * samples of multisampled textures are fetched from consecutive slices,
+ * and textures may be stored in the tiled layout.
+ */
+void
+llvmpipe_static_texture_state(struct lp_static_texture_state *state,
+                              const struct pipe_sampler_view *view)
+{
+   lp_sampler_static_texture_state(state, view);
+
+   if (view && view->texture) {
+      if (view->texture->nr_samples > 1)
+         state->num_samples = view->texture->nr_samples;
+      state->tiled = llvmpipe_resource(view->texture)->tiled;
+   }
+}
+
+
 void
 llvmpipe_init_sampler_funcs(struct llvmpipe_context *llvmpipe)
 {
@@ -25,6 +25,9 @@
  * 
  **************************************************************************/
 
+#include "util/u_format.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
 #include "util/u_rect.h"
 #include "util/u_surface.h"
 #include "lp_context.h"
@@ -33,6 +36,65 @@
 #include "lp_surface.h"
 #include "lp_texture.h"
 #include "lp_query.h"
+#include "lp_rast.h"
+#include "lp_setup.h"
+
+#if defined(PIPE_ARCH_SSE)
+#include <emmintrin.h>
+#endif
+
+
+/**
+ * Copy a region between two multisampled resources with the same number
+ * of samples.  A mapped layer only starts with sample 0; the other samples
+ * follow each llvmpipe_sample_stride() bytes apart.
+ */
+static void
+lp_resource_copy_ms(struct pipe_context *pipe,
+                    struct pipe_resource *dst, unsigned dst_level,
+                    unsigned dstx, unsigned dsty, unsigned dstz,
+                    struct pipe_resource *src, unsigned src_level,
+                    const struct pipe_box *src_box)
+{
+   struct pipe_transfer *src_trans, *dst_trans;
+   const ubyte *src_map;
+   ubyte *dst_map;
+   struct pipe_box dst_box;
+   unsigned s;
+
+   assert(src->nr_samples == dst->nr_samples);
+   assert(util_format_get_blocksize(src->format) ==
+          util_format_get_blocksize(dst->format));
+
+   u_box_3d(dstx, dsty, dstz, src_box->width, src_box->height,
+            src_box->depth, &dst_box);
+
+   src_map = pipe->transfer_map(pipe, src, src_level, PIPE_TRANSFER_READ,
+                                src_box, &src_trans);
+   if (!src_map)
+      return;
+
+   dst_map = pipe->transfer_map(pipe, dst, dst_level, PIPE_TRANSFER_WRITE,
+                                &dst_box, &dst_trans);
+   if (!dst_map) {
+      pipe->transfer_unmap(pipe, src_trans);
+      return;
+   }
+
+   for (s = 0; s < llvmpipe_resource_samples(src); s++) {
+      util_copy_box(dst_map + s * llvmpipe_sample_stride(dst, dst_level),
+                    dst->format,
+                    dst_trans->stride, dst_trans->layer_stride,
+                    0, 0, 0,
+                    src_box->width, src_box->height, src_box->depth,
+                    src_map + s * llvmpipe_sample_stride(src, src_level),
+                    src_trans->stride, src_trans->layer_stride,
+                    0, 0, 0);
+   }
+
+   pipe->transfer_unmap(pipe, dst_trans);
+   pipe->transfer_unmap(pipe, src_trans);
+}
 
 
 static void
@@ -56,11 +118,141 @@ lp_resource_copy(struct pipe_context *pipe,
                            FALSE, /* do_not_block */
                            "blit src");
 
+   if (src->nr_samples > 1 && dst->nr_samples == src->nr_samples) {
+      lp_resource_copy_ms(pipe, dst, dst_level, dstx, dsty, dstz,
+                          src, src_level, src_box);
+      return;
+   }
+
    util_resource_copy_region(pipe, dst, dst_level, dstx, dsty, dstz,
                              src, src_level, src_box);
 }
 
 
+/**
+ * Average one row of 8-bit unorm samples, n bytes per sample.
+ */
+static void
+resolve_row_unorm8(ubyte *dst, const ubyte *src[4], unsigned n)
+{
+   unsigned i = 0;
+
+#if defined(PIPE_ARCH_SSE)
+   for (; i + 16 <= n; i += 16) {
+      __m128i s0 = _mm_loadu_si128((const __m128i *)(src[0] + i));
+      __m128i s1 = _mm_loadu_si128((const __m128i *)(src[1] + i));
+      __m128i s2 = _mm_loadu_si128((const __m128i *)(src[2] + i));
+      __m128i s3 = _mm_loadu_si128((const __m128i *)(src[3] + i));
+      __m128i avg = _mm_avg_epu8(_mm_avg_epu8(s0, s1), _mm_avg_epu8(s2, s3));
+      _mm_storeu_si128((__m128i *)(dst + i), avg);
+   }
+#endif
+
+   for (; i < n; i++) {
+      dst[i] = (src[0][i] + src[1][i] + src[2][i] + src[3][i] + 2) >> 2;
+   }
+}
+
+
+/**
+ * Resolve a multisampled region into a single sampled resource of the same
+ * format and size.
+ *
+ * Color is the average of the samples (in linear space for sRGB formats);
+ * depth/stencil and integer formats take sample 0.
+ */
+static void
+lp_resolve(struct pipe_context *pipe,
+           struct pipe_resource *dst, unsigned dst_level,
+           const struct pipe_box *dst_box,
+           struct pipe_resource *src, unsigned src_level,
+           const struct pipe_box *src_box)
+{
+   const struct util_format_description *desc =
+      util_format_description(src->format);
+   const unsigned samples = llvmpipe_resource_samples(src);
+   const unsigned sample_stride = llvmpipe_sample_stride(src, src_level);
+   struct pipe_transfer *src_trans, *dst_trans;
+   const ubyte *src_map;
+   ubyte *dst_map;
+   float *tmp = NULL, *sum = NULL;
+   boolean unorm8;
+   unsigned x, y, z, s;
+
+   assert(src->format == dst->format);
+   assert(src_box->width == dst_box->width);
+   assert(src_box->height == dst_box->height);
+   assert(src_box->depth == dst_box->depth);
+
+   if (util_format_is_depth_or_stencil(src->format) ||
+       util_format_is_pure_integer(src->format)) {
+      /* mapped layers of src start with sample 0 */
+      pipe->resource_copy_region(pipe, dst, dst_level,
+                                 dst_box->x, dst_box->y, dst_box->z,
+                                 src, src_level, src_box);
+      return;
+   }
+
+   unorm8 = util_format_is_rgba8_variant(desc) &&
+            desc->colorspace == UTIL_FORMAT_COLORSPACE_RGB &&
+            samples == 4;
+
+   if (!unorm8) {
+      tmp = MALLOC(src_box->width * 4 * sizeof(float));
+      sum = MALLOC(src_box->width * 4 * sizeof(float));
+      if (!tmp || !sum) {
+         FREE(tmp);
+         FREE(sum);
+         return;
+      }
+   }
+
+   src_map = pipe->transfer_map(pipe, src, src_level, PIPE_TRANSFER_READ,
+                                src_box, &src_trans);
+   dst_map = pipe->transfer_map(pipe, dst, dst_level, PIPE_TRANSFER_WRITE,
+                                dst_box, &dst_trans);
+
+   if (src_map && dst_map) {
+      for (z = 0; z < (unsigned)src_box->depth; z++) {
+         for (y = 0; y < (unsigned)src_box->height; y++) {
+            const ubyte *src_row = src_map + z * src_trans->layer_stride +
+                                   y * src_trans->stride;
+            ubyte *dst_row = dst_map + z * dst_trans->layer_stride +
+                             y * dst_trans->stride;
+
+            if (unorm8) {
+               const ubyte *rows[4];
+               for (s = 0; s < 4; s++)
+                  rows[s] = src_row + s * sample_stride;
+               resolve_row_unorm8(dst_row, rows, src_box->width * 4);
+               continue;
+            }
+
+            for (x = 0; x < (unsigned)src_box->width * 4; x++)
+               sum[x] = 0.0f;
+            for (s = 0; s < samples; s++) {
+               desc->unpack_rgba_float(tmp, 0, src_row + s * sample_stride, 0,
+                                       src_box->width, 1);
+               for (x = 0; x < (unsigned)src_box->width * 4; x++)
+                  sum[x] += tmp[x];
+            }
+            for (x = 0; x < (unsigned)src_box->width * 4; x++)
+               sum[x] *= 1.0f / samples;
+            desc->pack_rgba_float(dst_row, 0, sum, 0, src_box->width, 1);
+         }
+      }
+   }
+
+   if (dst_map)
+      pipe->transfer_unmap(pipe, dst_trans);
+   if (src_map)
+      pipe->transfer_unmap(pipe, src_trans);
+
+   FREE(tmp);
+   FREE(sum);
+}
+
+
 static void lp_blit(struct pipe_context *pipe,
                     const struct pipe_blit_info *blit_info)
 {
@@ -71,10 +263,68 @@ static void lp_blit(struct pipe_context *pipe,
       return;
 
    if (info.src.resource->nr_samples > 1 &&
-       info.dst.resource->nr_samples <= 1 &&
-       !util_format_is_depth_or_stencil(info.src.resource->format) &&
-       !util_format_is_pure_integer(info.src.resource->format)) {
-      debug_printf("llvmpipe: color resolve unimplemented\n");
+       info.dst.resource->nr_samples <= 1) {
+      struct pipe_resource *tmp;
+      struct pipe_resource templ;
+
+      if (info.src.format == info.dst.format &&
+          info.src.format == info.src.resource->format &&
+          info.dst.format == info.dst.resource->format &&
+          info.src.box.width == info.dst.box.width &&
+          info.src.box.height == info.dst.box.height &&
+          info.src.box.depth == info.dst.box.depth &&
+          info.dst.box.width > 0 && info.dst.box.height > 0 &&
+          util_format_get_mask(info.dst.format) == info.mask &&
+          !info.scissor_enable) {
+         lp_resolve(pipe, info.dst.resource, info.dst.level, &info.dst.box,
+                    info.src.resource, info.src.level, &info.src.box);
+         return;
+      }
+
+      /*
+       * Scaled, flipped or converting resolve: resolve into a temporary
+       * and blit that.
+       */
+      memset(&templ, 0, sizeof templ);
+      templ.target = info.src.resource->target;
+      templ.format = info.src.resource->format;
+      templ.width0 = abs(info.src.box.width);
+      templ.height0 = abs(info.src.box.height);
+      templ.depth0 = 1;
+      templ.array_size = abs(info.src.box.depth);
+      templ.bind = PIPE_BIND_SAMPLER_VIEW;
+
+      tmp = pipe->screen->resource_create(pipe->screen, &templ);
+      if (!tmp)
+         return;
+
+      u_box_3d(MIN2(info.src.box.x, info.src.box.x + info.src.box.width),
+               MIN2(info.src.box.y, info.src.box.y + info.src.box.height),
+               MIN2(info.src.box.z, info.src.box.z + info.src.box.depth),
+               templ.width0, templ.height0, templ.array_size,
+               &info.src.box);
+
+      {
+         struct pipe_box tmp_box;
+         u_box_3d(0, 0, 0, templ.width0, templ.height0, templ.array_size,
+                  &tmp_box);
+         lp_resolve(pipe, tmp, 0, &tmp_box,
+                    info.src.resource, info.src.level, &info.src.box);
+      }
+
+      /* keep the original orientation of the source box */
+      info.src.box.x = blit_info->src.box.width < 0 ? templ.width0 : 0;
+      info.src.box.y = blit_info->src.box.height < 0 ? templ.height0 : 0;
+      info.src.box.z = blit_info->src.box.depth < 0 ? templ.array_size : 0;
+      info.src.box.width = blit_info->src.box.width;
+      info.src.box.height = blit_info->src.box.height;
+      info.src.box.depth = blit_info->src.box.depth;
+      info.src.resource = tmp;
+      info.src.level = 0;
+
+      lp_blit(pipe, &info);
+
+      pipe_resource_reference(&tmp, NULL);
       return;
    }
 
@@ -104,7 +354,7 @@ static void lp_blit(struct pipe_context *pipe,
    util_blitter_save_blend(lp->blitter, (void*)lp->blend);
    util_blitter_save_depth_stencil_alpha(lp->blitter, (void*)lp->depth_stencil);
    util_blitter_save_stencil_ref(lp->blitter, &lp->stencil_ref);
-   /*util_blitter_save_sample_mask(sp->blitter, lp->sample_mask);*/
+   util_blitter_save_sample_mask(lp->blitter, lp->sample_mask);
    util_blitter_save_framebuffer(lp->blitter, &lp->framebuffer);
    util_blitter_save_fragment_sampler_states(lp->blitter,
                      lp->num_samplers[PIPE_SHADER_FRAGMENT],
@@ -118,6 +368,102 @@ static void lp_blit(struct pipe_context *pipe,
 }
 
 
+/**
+ * Can util_format_translate() convert between the two formats?
+ */
+static boolean
+lp_can_translate(enum pipe_format dst_format, enum pipe_format src_format)
+{
+   const struct util_format_description *src_desc =
+      util_format_description(src_format);
+   const struct util_format_description *dst_desc =
+      util_format_description(dst_format);
+
+   if (!src_desc || !dst_desc ||
+       src_desc->block.width != 1 || src_desc->block.height != 1 ||
+       dst_desc->block.width != 1 || dst_desc->block.height != 1)
+      return FALSE;
+
+   if (util_is_format_compatible(src_desc, dst_desc))
+      return TRUE;
+
+   if (src_desc->colorspace == UTIL_FORMAT_COLORSPACE_ZS ||
+       dst_desc->colorspace == UTIL_FORMAT_COLORSPACE_ZS)
+      return FALSE;
+
+   if (util_format_fits_8unorm(src_desc) || util_format_fits_8unorm(dst_desc))
+      return src_desc->unpack_rgba_8unorm && dst_desc->pack_rgba_8unorm;
+
+   return src_desc->unpack_rgba_float && dst_desc->pack_rgba_float;
+}
+
+
+/**
+ * Read back a region of a bound color buffer without waiting for the
+ * rendering: the copy is binned and done by the rasterizer threads once
+ * the tiles are rendered, while the app carries on with the next frame.
+ * Other textures take the synchronous path in the state tracker.
+ */
+static bool
+lp_read_texture_to_buffer(struct pipe_context *pipe,
+                          struct pipe_resource *dst,
+                          unsigned dst_offset, int dst_stride,
+                          enum pipe_format dst_format,
+                          struct pipe_resource *src,
+                          enum pipe_format src_format,
+                          unsigned src_level,
+                          const struct pipe_box *src_box)
+{
+   struct llvmpipe_context *lp = llvmpipe_context(pipe);
+   const struct pipe_framebuffer_state *fb = &lp->framebuffer;
+   const unsigned row_bytes =
+      src_box->width * util_format_get_blocksize(dst_format);
+   struct lp_rast_readback rb;
+   int64_t first, last;
+   unsigned i;
+
+   if (dst->target != PIPE_BUFFER ||
+       src_box->width <= 0 || src_box->height <= 0 || src_box->depth != 1 ||
+       src->nr_samples > 1 ||
+       !lp_can_translate(dst_format, src_format))
+      return false;
+
+   for (i = 0; i < fb->nr_cbufs; i++) {
+      const struct pipe_surface *cbuf = fb->cbufs[i];
+      if (cbuf && cbuf->texture == src &&
+          cbuf->u.tex.level == src_level &&
+          cbuf->u.tex.first_layer == src_box->z &&
+          util_format_get_blocksize(cbuf->format) ==
+          util_format_get_blocksize(src_format))
+         break;
+   }
+   if (i == fb->nr_cbufs ||
+       src_box->x < 0 || src_box->y < 0 ||
+       src_box->x + src_box->width > fb->width ||
+       src_box->y + src_box->height > fb->height)
+      return false;
+
+   /* the first and the last row written must both lie within dst */
+   first = dst_offset;
+   last = first + (int64_t)(src_box->height - 1) * dst_stride;
+   if (MIN2(first, last) < 0 ||
+       MAX2(first, last) + row_bytes > dst->width0)
+      return false;
+
+   rb.cbuf = i;
+   rb.src_format = src_format;
+   rb.dst_format = dst_format;
+   rb.rect.x0 = src_box->x;
+   rb.rect.y0 = src_box->y;
+   rb.rect.x1 = src_box->x + src_box->width - 1;
+   rb.rect.y1 = src_box->y + src_box->height - 1;
+   rb.dst = (ubyte *)llvmpipe_resource(dst)->data + dst_offset;
+   rb.dst_stride = dst_stride;
+
+   return lp_setup_readback(lp->setup, &rb, dst);
+}
+
+
 static void
 lp_flush_resource(struct pipe_context *ctx, struct pipe_resource *resource)
 {
@@ -141,6 +487,11 @@ llvmpipe_create_surface(struct pipe_context *pipe,
       }
    }
 
+   /* the rasterizer only writes linear images */
+   if (llvmpipe_resource_is_texture(pt) &&
+       !llvmpipe_resource_untile(pipe, pt))
+      return NULL;
+
    ps = CALLOC_STRUCT(pipe_surface);
    if (ps) {
       pipe_reference_init(&ps->reference, 1);
@@ -235,5 +586,6 @@ llvmpipe_init_surface_functions(struct llvmpipe_context *lp)
    lp->pipe.clear_texture = util_clear_texture;
    lp->pipe.resource_copy_region = lp_resource_copy;
    lp->pipe.blit = lp_blit;
+   lp->pipe.read_texture_to_buffer = lp_read_texture_to_buffer;
    lp->pipe.flush_resource = lp_flush_resource;
 }
@@ -43,7 +43,11 @@
 #include "util/simple_list.h"
 #include "util/u_transfer.h"
 
+#include "gallivm/lp_bld_sample.h"
+
 #include "lp_context.h"
+#include "lp_debug.h"
+#include "lp_fence.h"
 #include "lp_flush.h"
 #include "lp_screen.h"
 #include "lp_texture.h"
@@ -60,6 +64,98 @@ static struct llvmpipe_resource resource_list;
 static unsigned id_counter = 0;
 
 
+/**
+ * Should the texture be stored in the tiled layout?
+ *
+ * Sampling with rotations, minification or from 3D textures touches a new
+ * cache line for nearly every texel row of a linear image, while a 4x4
+ * tile of a 32bpp texture fits one cache line.  Only the jit sampling code
+ * and transfers know about this layout, so textures which may be shared,
+ * scanned out, mapped persistently or used as depth buffers stay linear.
+ * Tiled textures which end up being rendered to are converted back by
+ * llvmpipe_resource_untile().
+ */
+static boolean
+llvmpipe_texture_can_tile(const struct pipe_resource *pt)
+{
+   const struct util_format_description *desc =
+      util_format_description(pt->format);
+
+   if (LP_PERF & PERF_NO_TEX_TILING)
+      return FALSE;
+
+   if (!(pt->bind & PIPE_BIND_SAMPLER_VIEW) ||
+       (pt->bind & (PIPE_BIND_DEPTH_STENCIL |
+                    PIPE_BIND_DISPLAY_TARGET |
+                    PIPE_BIND_SCANOUT |
+                    PIPE_BIND_SHARED |
+                    PIPE_BIND_LINEAR)))
+      return FALSE;
+
+   if (pt->usage == PIPE_USAGE_STAGING ||
+       (pt->flags & (PIPE_RESOURCE_FLAG_MAP_PERSISTENT |
+                     PIPE_RESOURCE_FLAG_MAP_COHERENT)))
+      return FALSE;
+
+   /* 1D images are not padded to whole tiles */
+   if (llvmpipe_resource_is_1d(pt) || pt->nr_samples > 1)
+      return FALSE;
+
+   return desc->block.width == 1 &&
+          desc->block.height == 1 &&
+          desc->block.bits % 8 == 0;
+}
+
+
+/**
+ * Byte offset of texel (x, y) of an image in the tiled layout.
+ */
+static inline unsigned
+tiled_texel_offset(unsigned x, unsigned y, unsigned row_stride, unsigned cpp)
+{
+   const unsigned mask = LP_TEXTURE_TILE_SIZE - 1;
+
+   return (y & ~mask) * row_stride +
+          ((x & ~mask) * LP_TEXTURE_TILE_SIZE +
+           (y & mask) * LP_TEXTURE_TILE_SIZE + (x & mask)) * cpp;
+}
+
+
+/**
+ * Copy a box of texels between an image in the tiled layout and a linear
+ * image.  Texels are copied in runs up to the end of each tile row.
+ * \param to_tiled  copy from the linear image into the tiled one
+ */
+static void
+copy_tiled_box(ubyte *tiled, unsigned row_stride,
+               ubyte *linear, unsigned linear_stride,
+               unsigned x0, unsigned y0,
+               unsigned width, unsigned height,
+               unsigned cpp, boolean to_tiled)
+{
+   unsigned x, y;
+
+   for (y = 0; y < height; y++) {
+      ubyte *row = linear + y * linear_stride;
+
+      for (x = 0; x < width; ) {
+         const unsigned n = MIN2(LP_TEXTURE_TILE_SIZE -
+                                 ((x0 + x) & (LP_TEXTURE_TILE_SIZE - 1)),
+                                 width - x);
+         ubyte *texel = tiled + tiled_texel_offset(x0 + x, y0 + y,
+                                                   row_stride, cpp);
+
+         if (to_tiled)
+            memcpy(texel, row + x * cpp, n * cpp);
+         else
+            memcpy(row + x * cpp, texel, n * cpp);
+
+         x += n;
+      }
+   }
+}
+
+
 /**
  * Conventional allocation path for non-display textures:
  * Compute strides and allocate data (unless asked not to).
@@ -146,6 +242,12 @@ llvmpipe_texture_layout(struct llvmpipe_screen *screen,
       else
          num_slices = 1;
 
+      /* Multisampled images store each sample as a separate slice, with
+       * the samples of one layer kept adjacent (slice = layer * nr_samples +
+       * sample) so the rasterizer can step between them with a plain stride.
+       */
+      num_slices *= llvmpipe_resource_samples(&lpr->base);
+
       /* if img_stride * num_slices_faces > LP_MAX_TEXTURE_SIZE */
       mipsize = (uint64_t)lpr->img_stride[level] * num_slices;
       if (mipsize > LP_MAX_TEXTURE_SIZE) {
@@ -166,6 +268,9 @@ llvmpipe_texture_layout(struct llvmpipe_screen *screen,
       depth = u_minify(depth, 1);
    }
 
+   lpr->total_alloc_size = total_size;
+   lpr->tiled = llvmpipe_texture_can_tile(pt);
+
    if (allocate) {
       lpr->tex_data = align_malloc(total_size, mip_align);
       if (!lpr->tex_data) {
@@ -327,16 +432,19 @@ llvmpipe_resource_destroy(struct pipe_screen *pscreen,
    }
    else if (llvmpipe_resource_is_texture(pt)) {
       /* free linear image data */
-      if (lpr->tex_data) {
+      if (lpr->tex_data && !lpr->userBuffer) {
          align_free(lpr->tex_data);
          lpr->tex_data = NULL;
       }
+      align_free(lpr->tiled_data);
    }
    else if (!lpr->userBuffer) {
       assert(lpr->data);
       align_free(lpr->data);
    }
 
+   lp_fence_reference(&lpr->readback_fence, NULL);
+
 #ifdef DEBUG
    if (lpr->next)
       remove_from_list(lpr);
@@ -391,7 +499,9 @@ llvmpipe_resource_map(struct pipe_resource *resource,
    }
    else if (llvmpipe_resource_is_texture(resource)) {
 
-      map = llvmpipe_get_texture_image_address(lpr, layer, level);
+      map = llvmpipe_get_texture_image_address(lpr,
+                                               layer * llvmpipe_resource_samples(resource),
+                                               level);
       return map;
    }
    else {
@@ -504,6 +614,144 @@ llvmpipe_resource_get_handle(struct pipe_screen *screen,
 }
 
 
+/**
+ * Wrap caller-owned memory in a resource, without copying.
+ *
+ * Buffers may be of any size.  Textures are limited to a single 2D level
+ * whose dimensions are multiples of LP_RASTER_BLOCK_SIZE, since the
+ * rasterizer reads and writes whole 4x4 blocks and the caller's memory
+ * has no room for padding; such images use a tightly packed layout.
+ *
+ * The generated fragment code assumes 16 byte aligned resource bases and
+ * row strides (see generate_unswizzled_blend()), so memory or rows which
+ * aren't are refused.
+ */
+static struct pipe_resource *
+llvmpipe_resource_from_user_memory(struct pipe_screen *screen,
+                                   const struct pipe_resource *templat,
+                                   void *user_memory)
+{
+   struct llvmpipe_resource *lpr;
+
+   if ((uintptr_t) user_memory % 16 != 0)
+      return NULL;
+
+   if (templat->target != PIPE_BUFFER) {
+      if ((templat->target != PIPE_TEXTURE_2D &&
+           templat->target != PIPE_TEXTURE_RECT) ||
+          templat->last_level != 0 ||
+          templat->array_size != 1 ||
+          templat->nr_samples > 1 ||
+          util_format_is_compressed(templat->format) ||
+          templat->width0 % LP_RASTER_BLOCK_SIZE != 0 ||
+          templat->height0 % LP_RASTER_BLOCK_SIZE != 0)
+         return NULL;
+   }
+
+   lpr = CALLOC_STRUCT(llvmpipe_resource);
+   if (!lpr)
+      return NULL;
+
+   lpr->base = *templat;
+   pipe_reference_init(&lpr->base.reference, 1);
+   lpr->base.screen = screen;
+   lpr->userBuffer = TRUE;
+
+   if (templat->target == PIPE_BUFFER) {
+      assert(util_format_get_blocksize(templat->format) == 1);
+      lpr->row_stride[0] = templat->width0;
+      lpr->data = user_memory;
+   }
+   else {
+      lpr->row_stride[0] = util_format_get_stride(templat->format,
+                                                  templat->width0);
+      if (lpr->row_stride[0] % 16 != 0) {
+         FREE(lpr);
+         return NULL;
+      }
+      if ((uint64_t)lpr->row_stride[0] * templat->height0 >
+          LP_MAX_TEXTURE_SIZE) {
+         FREE(lpr);
+         return NULL;
+      }
+      lpr->img_stride[0] = lpr->row_stride[0] * templat->height0;
+      lpr->mip_offsets[0] = 0;
+      lpr->tex_data = user_memory;
+   }
+
+   lpr->id = id_counter++;
+
+#ifdef DEBUG
+   insert_at_tail(&resource_list, lpr);
+#endif
+
+   return &lpr->base;
+}
+
+
+/**
+ * Map a box of a tiled texture through a linear staging copy, which
+ * llvmpipe_transfer_unmap() writes back.
+ */
+static void *
+tiled_transfer_map(struct llvmpipe_transfer *lpt)
+{
+   struct pipe_transfer *pt = &lpt->base;
+   struct llvmpipe_resource *lpr = llvmpipe_resource(pt->resource);
+   const struct pipe_box *box = &pt->box;
+   const unsigned cpp = util_format_get_blocksize(lpr->base.format);
+   unsigned z;
+
+   pt->stride = align(box->width * cpp, 16);
+   pt->layer_stride = pt->stride * box->height;
+
+   lpt->staging = align_malloc(MAX2(pt->layer_stride * box->depth, 1), 16);
+   if (!lpt->staging)
+      return NULL;
+
+   if (pt->usage & (PIPE_TRANSFER_DISCARD_RANGE |
+                    PIPE_TRANSFER_DISCARD_WHOLE_RESOURCE))
+      return lpt->staging;
+
+   for (z = 0; z < box->depth; z++) {
+      copy_tiled_box(llvmpipe_get_texture_image_address(lpr, box->z + z,
+                                                        pt->level),
+                     lpr->row_stride[pt->level],
+                     (ubyte *)lpt->staging + z * pt->layer_stride, pt->stride,
+                     box->x, box->y, box->width, box->height,
+                     cpp, FALSE);
+   }
+
+   return lpt->staging;
+}
+
+
+static void
+tiled_transfer_unmap(struct llvmpipe_transfer *lpt)
+{
+   struct pipe_transfer *pt = &lpt->base;
+   struct llvmpipe_resource *lpr = llvmpipe_resource(pt->resource);
+   const struct pipe_box *box = &pt->box;
+   const unsigned cpp = util_format_get_blocksize(lpr->base.format);
+   unsigned z;
+
+   if (pt->usage & PIPE_TRANSFER_WRITE) {
+      for (z = 0; z < box->depth; z++) {
+         copy_tiled_box(llvmpipe_get_texture_image_address(lpr, box->z + z,
+                                                           pt->level),
+                        lpr->row_stride[pt->level],
+                        (ubyte *)lpt->staging + z * pt->layer_stride,
+                        pt->stride,
+                        box->x, box->y, box->width, box->height,
+                        cpp, TRUE);
+      }
+   }
+
+   align_free(lpt->staging);
+   lpt->staging = NULL;
+}
+
+
 static void *
 llvmpipe_transfer_map( struct pipe_context *pipe,
                        struct pipe_resource *resource,
@@ -525,6 +773,10 @@ llvmpipe_transfer_map( struct pipe_context *pipe,
    assert(resource);
    assert(level <= resource->last_level);
 
+   /* tiled textures need a staging copy */
+   if (lpr->tiled && (usage & PIPE_TRANSFER_MAP_DIRECTLY))
+      return NULL;
+
    /*
     * Transfers, like other pipe operations, must happen in order, so flush the
     * context if necessary.
@@ -567,7 +819,7 @@ llvmpipe_transfer_map( struct pipe_context *pipe,
    pt->box = *box;
    pt->level = level;
    pt->stride = lpr->row_stride[level];
-   pt->layer_stride = lpr->img_stride[level];
+   pt->layer_stride = llvmpipe_layer_stride(resource, level);
    pt->usage = usage;
    *transfer = pt;
 
@@ -596,12 +848,6 @@ llvmpipe_transfer_map( struct pipe_context *pipe,
 
    format = lpr->base.format;
 
-   map = llvmpipe_resource_map(resource,
-                               level,
-                               box->z,
-                               tex_usage);
-
-
    /* May want to do different things here depending on read/write nature
     * of the map:
     */
@@ -611,6 +857,21 @@ llvmpipe_transfer_map( struct pipe_context *pipe,
       screen->timestamp++;
    }
 
+   if (lpr->tiled) {
+      map = tiled_transfer_map(lpt);
+      if (!map) {
+         pipe_resource_reference(&pt->resource, NULL);
+         FREE(lpt);
+         *transfer = NULL;
+      }
+      return map;
+   }
+
+   map = llvmpipe_resource_map(resource,
+                               level,
+                               box->z,
+                               tex_usage);
+
    map +=
       box->y / util_format_get_blockheight(format) * pt->stride +
       box->x / util_format_get_blockwidth(format) * util_format_get_blocksize(format);
@@ -623,15 +884,21 @@ static void
 llvmpipe_transfer_unmap(struct pipe_context *pipe,
                         struct pipe_transfer *transfer)
 {
+   struct llvmpipe_transfer *lpt = llvmpipe_transfer(transfer);
+
    assert(transfer->resource);
 
+   if (lpt->staging)
+      tiled_transfer_unmap(lpt);
+
    llvmpipe_resource_unmap(transfer->resource,
                            transfer->level,
                            transfer->box.z);
 
    /* Effectively do the texture_update work here - if texture images
     * needed post-processing to put them into hardware layout, this is
-    * where it would happen.  For llvmpipe, nothing to do.
+    * where it would happen.  For llvmpipe, only tiled textures need it
+    * and that was done above.
     */
    assert (transfer->resource);
    pipe_resource_reference(&transfer->resource, NULL);
@@ -747,6 +1014,139 @@ llvmpipe_get_texture_image_address(struct llvmpipe_resource *lpr,
 }
 
 
+/**
+ * Convert the images of a tiled texture to the linear layout where they
+ * are, one row of tiles at a time.  A row of tiles covers the same bytes in
+ * both layouts, so only that much temporary memory is needed.
+ */
+static boolean
+untile_in_place(struct llvmpipe_resource *lpr, unsigned cpp)
+{
+   struct pipe_resource *resource = &lpr->base;
+   const unsigned tile_row_size = LP_TEXTURE_TILE_SIZE * lpr->row_stride[0];
+   ubyte *tmp;
+   unsigned level, slice, y;
+
+   tmp = MALLOC(tile_row_size);
+   if (!tmp)
+      return FALSE;
+
+   for (level = 0; level <= resource->last_level; level++) {
+      const unsigned num_slices = resource->target == PIPE_TEXTURE_3D ?
+         u_minify(resource->depth0, level) : resource->array_size;
+      const unsigned width = u_minify(resource->width0, level);
+      const unsigned height = u_minify(resource->height0, level);
+      const unsigned stride = lpr->row_stride[level];
+
+      for (slice = 0; slice < num_slices; slice++) {
+         ubyte *image = llvmpipe_get_texture_image_address(lpr, slice, level);
+
+         for (y = 0; y < height; y += LP_TEXTURE_TILE_SIZE) {
+            ubyte *rows = image + y * stride;
+
+            memcpy(tmp, rows, LP_TEXTURE_TILE_SIZE * stride);
+            copy_tiled_box(tmp, stride, rows, stride,
+                           0, 0, width,
+                           MIN2(LP_TEXTURE_TILE_SIZE, height - y),
+                           cpp, FALSE);
+         }
+      }
+   }
+
+   FREE(tmp);
+   return TRUE;
+}
+
+
+/**
+ * Switch a tiled texture to the linear layout, for good.  Called before
+ * the texture is rendered to, bound as a shader image or sampled by the
+ * draw module, none of which know about the tiled layout.
+ *
+ * Returns FALSE, with the texture still tiled, if we ran out of memory.
+ */
+boolean
+llvmpipe_resource_untile(struct pipe_context *pipe,
+                         struct pipe_resource *resource)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(resource->screen);
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+   const unsigned cpp = util_format_get_blocksize(resource->format);
+   const unsigned mip_align = MAX2(64, util_cpu_caps.cacheline);
+   ubyte *linear;
+   unsigned level, slice;
+
+   if (!lpr->tiled)
+      return TRUE;
+
+   /* scenes may still be sampling the tiled images */
+   llvmpipe_flush_resource(pipe, resource, 0,
+                           FALSE, /* read_only */
+                           TRUE, /* cpu_access */
+                           FALSE, /* do_not_block */
+                           __FUNCTION__);
+
+   LP_DBG(DEBUG_TEX, "untiling texture %u (%ux%ux%u)\n", lpr->id,
+          resource->width0, resource->height0, resource->depth0);
+
+   linear = align_malloc(lpr->total_alloc_size, mip_align);
+   if (linear) {
+      for (level = 0; level <= resource->last_level; level++) {
+         const unsigned num_slices = resource->target == PIPE_TEXTURE_3D ?
+            u_minify(resource->depth0, level) : resource->array_size;
+
+         for (slice = 0; slice < num_slices; slice++) {
+            ubyte *image = llvmpipe_get_texture_image_address(lpr, slice,
+                                                              level);
+
+            copy_tiled_box(image, lpr->row_stride[level],
+                           linear + (image - (ubyte *)lpr->tex_data),
+                           lpr->row_stride[level],
+                           0, 0,
+                           u_minify(resource->width0, level),
+                           u_minify(resource->height0, level),
+                           cpp, FALSE);
+         }
+      }
+
+      /*
+       * Other contexts of the share group may have scenes binned or in
+       * flight which still sample the tiled images.  Those scenes hold a
+       * reference to the texture, so the old storage is freed along with it.
+       */
+      assert(!lpr->tiled_data);
+      lpr->tiled_data = lpr->tex_data;
+      lpr->tex_data = linear;
+   }
+   else {
+      struct lp_fence *fence = NULL;
+
+      /*
+       * Convert in place once the rasterizer is done with every context's
+       * queued scenes.  Scenes which other contexts haven't flushed yet
+       * will sample the wrong layout, but not freed memory.
+       */
+      mtx_lock(&screen->rast_mutex);
+      lp_fence_reference(&fence, screen->last_fence);
+      mtx_unlock(&screen->rast_mutex);
+      if (fence) {
+         lp_fence_wait(fence);
+         lp_fence_reference(&fence, NULL);
+      }
+
+      if (!untile_in_place(lpr, cpp))
+         return FALSE;
+   }
+
+   lpr->tiled = FALSE;
+
+   /* make all contexts rebuild their sampling code and texture pointers */
+   screen->timestamp++;
+
+   return TRUE;
+}
+
+
 /**
  * Return size of resource in bytes
  */
@@ -809,6 +1209,7 @@ llvmpipe_init_screen_resource_funcs(struct pipe_screen *screen)
    screen->resource_destroy = llvmpipe_resource_destroy;
    screen->resource_from_handle = llvmpipe_resource_from_handle;
    screen->resource_get_handle = llvmpipe_resource_get_handle;
+   screen->resource_from_user_memory = llvmpipe_resource_from_user_memory;
    screen->can_create_resource = llvmpipe_can_create_resource;
 }
 
@@ -47,6 +47,7 @@ struct pipe_screen;
 struct llvmpipe_context;
 
 struct sw_displaytarget;
+struct lp_fence;
 
 
 /**
@@ -85,9 +86,24 @@ struct llvmpipe_resource
     */
    void *data;
 
-   boolean userBuffer;  /** Is this a user-space buffer? */
+   /**
+    * Are the texture images stored in the tiled layout of
+    * LP_TEXTURE_TILE_SIZE?  Strides and offsets are the same as for the
+    * linear layout.  Only the jit sampling code and transfers understand
+    * this layout, so it is dropped for good by llvmpipe_resource_untile()
+    * before the texture is used in any other way.
+    */
+   boolean tiled;
+
+   /** Tiled storage replaced by llvmpipe_resource_untile(), see there */
+   void *tiled_data;
+
+   boolean userBuffer;  /** Is the storage owned by the user? */
    unsigned timestamp;
 
+   /** Fence of a scene with a pending lp_setup_readback() into this buffer */
+   struct lp_fence *readback_fence;
+
    unsigned id;  /**< temporary, for debugging */
 
 #ifdef DEBUG
@@ -102,6 +118,9 @@ struct llvmpipe_transfer
    struct pipe_transfer base;
 
    unsigned long offset;
+
+   /** Linear copy of the mapped box of a tiled texture */
+   void *staging;
 };
 
 
@@ -175,13 +194,40 @@ llvmpipe_resource_is_1d(const struct pipe_resource *resource)
 }
 
 
+/**
+ * Number of samples per pixel (1 for single-sampled resources).
+ */
+static inline unsigned
+llvmpipe_resource_samples(const struct pipe_resource *resource)
+{
+   return MAX2(resource->nr_samples, 1);
+}
+
+
+/**
+ * Distance in bytes between two samples of the same pixel.
+ */
+static inline unsigned
+llvmpipe_sample_stride(struct pipe_resource *resource,
+                       unsigned level)
+{
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+   assert(level < LP_MAX_TEXTURE_2D_LEVELS);
+   return lpr->img_stride[level];
+}
+
+
+/**
+ * Distance in bytes between two layers; for multisampled resources this
+ * covers all the samples of a layer.
+ */
 static inline unsigned
 llvmpipe_layer_stride(struct pipe_resource *resource,
                       unsigned level)
 {
    struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
    assert(level < LP_MAX_TEXTURE_2D_LEVELS);
-   return lpr->img_stride[level];
+   return lpr->img_stride[level] * llvmpipe_resource_samples(resource);
 }
 
 
@@ -220,6 +266,11 @@ llvmpipe_get_texture_image_address(struct llvmpipe_resource *lpr,
                                    unsigned face_slice, unsigned level);
 
 
+boolean
+llvmpipe_resource_untile(struct pipe_context *pipe,
+                         struct pipe_resource *resource);
+
+
 extern void
 llvmpipe_print_resources(void);
 
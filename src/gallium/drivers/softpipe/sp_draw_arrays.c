@@ -39,6 +39,7 @@
 
 #include "sp_context.h"
 #include "sp_query.h"
+#include "sp_rast.h"
 #include "sp_state.h"
 #include "sp_texture.h"
 #include "sp_screen.h"
@@ -165,6 +166,9 @@ softpipe_draw_vbo(struct pipe_context *pipe,
     */
    draw_flush(draw);
 
+   if (sp->rast)
+      sp_rast_end(sp->rast);
+
    /* Note: leave drawing surfaces mapped */
    sp->dirty_render_cache = TRUE;
 }
@@ -0,0 +1,802 @@
+/**************************************************************************
+ *
+ * Copyright 2018 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * Tile-parallel rasterization for softpipe.
+ *
+ * A batch covers the primitives of one draw call with unchanged state.
+ * The worker contexts are set up from the main context when the batch
+ * begins, and all tiles are rendered when it ends, so any state the
+ * workers reference is still alive.  Since every tile is rendered by
+ * exactly one worker, with the primitives in submission order and the
+ * same quad batches the serial path produces, the results match rendering
+ * on the main thread, except where tile cache evictions in the serial path
+ * changed the precision of intermediate float colors.
+ */
+
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
+#include "util/u_dynarray.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_queue.h"
+#include "tgsi/tgsi_exec.h"
+
+#include "sp_context.h"
+#include "sp_flush.h"
+#include "sp_quad_pipe.h"
+#include "sp_rast.h"
+#include "sp_setup.h"
+#include "sp_state.h"
+#include "sp_tex_sample.h"
+#include "sp_tex_tile_cache.h"
+#include "sp_texture.h"
+#include "sp_tile_cache.h"
+
+
+/** Maximum number of rasterization threads, including the main thread */
+#define SP_RAST_MAX_THREADS 8
+
+/**
+ * Batches with fewer bin entries than this are rendered on the main thread
+ * since handing them to the workers costs more than it saves.
+ */
+#define SP_RAST_MIN_THREADED_ENTRIES 64
+
+
+/** A binned primitive */
+struct sp_rast_prim {
+   unsigned prim;       /**< PIPE_PRIM_POINTS, _LINES or _TRIANGLES */
+   unsigned vertex;     /**< byte offset of the first vertex */
+   unsigned count_tile; /**< tile which counts the primitive for queries */
+};
+
+
+struct sp_rast_worker {
+   struct sp_rast *rast;
+   unsigned index;
+
+   /** Write back the tile caches instead of rendering tiles */
+   boolean flush;
+   /** Some tile owned by this worker has primitives */
+   boolean busy;
+   struct util_queue_fence fence;
+
+   /**
+    * Private copy of the main context, pointing to the worker's own
+    * machine, sampler, caches and quad stages.
+    */
+   struct softpipe_context softpipe;
+   struct setup_context *setup;
+
+   struct tgsi_exec_machine *fs_machine;
+   struct sp_tgsi_sampler *sampler;
+   struct softpipe_tile_cache *cbuf_cache[PIPE_MAX_COLOR_BUFS];
+   struct softpipe_tile_cache *zsbuf_cache;
+   /** Created when a sampler view slot is first used */
+   struct softpipe_tex_tile_cache *tex_cache[PIPE_MAX_SHADER_SAMPLER_VIEWS];
+
+   struct {
+      struct quad_stage *shade;
+      struct quad_stage *depth_test;
+      struct quad_stage *blend;
+      struct quad_stage *pstipple;
+   } quad;
+};
+
+
+struct sp_rast {
+   struct softpipe_context *softpipe;
+
+   struct util_queue queue;
+   unsigned num_workers;
+   struct sp_rast_worker *workers[SP_RAST_MAX_THREADS];
+
+   /** Primitives are being binned */
+   boolean binning;
+   /** The worker tile caches may hold rendering */
+   boolean dirty;
+
+   unsigned vertex_size;
+   unsigned tiles_x, tiles_y;
+
+   struct util_dynarray vertices;  /**< copied vertex data */
+   struct util_dynarray prims;     /**< struct sp_rast_prim */
+   struct util_dynarray *bins;     /**< per tile list of prim indices */
+   unsigned max_bins;
+   unsigned num_entries;           /**< sum of all bin sizes */
+};
+
+
+static void
+destroy_worker(struct sp_rast_worker *w)
+{
+   unsigned i;
+
+   util_queue_fence_destroy(&w->fence);
+
+   if (w->setup)
+      sp_setup_destroy_context(w->setup);
+
+   if (w->quad.shade)
+      w->quad.shade->destroy(w->quad.shade);
+   if (w->quad.depth_test)
+      w->quad.depth_test->destroy(w->quad.depth_test);
+   if (w->quad.blend)
+      w->quad.blend->destroy(w->quad.blend);
+   if (w->quad.pstipple)
+      w->quad.pstipple->destroy(w->quad.pstipple);
+
+   for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++) {
+      if (w->cbuf_cache[i])
+         sp_destroy_tile_cache(w->cbuf_cache[i]);
+   }
+   if (w->zsbuf_cache)
+      sp_destroy_tile_cache(w->zsbuf_cache);
+
+   for (i = 0; i < PIPE_MAX_SHADER_SAMPLER_VIEWS; i++) {
+      if (w->tex_cache[i])
+         sp_destroy_tex_tile_cache(w->tex_cache[i]);
+   }
+
+   if (w->fs_machine)
+      tgsi_exec_machine_destroy(w->fs_machine);
+   FREE(w->sampler);
+
+   FREE(w);
+}
+
+
+static struct sp_rast_worker *
+create_worker(struct sp_rast *rast, unsigned index)
+{
+   struct softpipe_context *sp = rast->softpipe;
+   struct sp_rast_worker *w = CALLOC_STRUCT(sp_rast_worker);
+   unsigned i;
+
+   if (!w)
+      return NULL;
+
+   w->rast = rast;
+   w->index = index;
+   util_queue_fence_init(&w->fence);
+
+   /* The stages and the setup context only keep a pointer to the context,
+    * which gets filled in at the beginning of each batch.
+    */
+   w->setup = sp_setup_create_context(&w->softpipe);
+   w->quad.shade = sp_quad_shade_stage(&w->softpipe);
+   w->quad.depth_test = sp_quad_depth_test_stage(&w->softpipe);
+   w->quad.blend = sp_quad_blend_stage(&w->softpipe);
+   w->quad.pstipple = sp_quad_polygon_stipple_stage(&w->softpipe);
+   if (!w->setup || !w->quad.shade || !w->quad.depth_test ||
+       !w->quad.blend || !w->quad.pstipple)
+      goto fail;
+
+   for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++) {
+      w->cbuf_cache[i] = sp_create_tile_cache(&sp->pipe);
+      if (!w->cbuf_cache[i])
+         goto fail;
+   }
+   w->zsbuf_cache = sp_create_tile_cache(&sp->pipe);
+   if (!w->zsbuf_cache)
+      goto fail;
+
+   w->fs_machine = tgsi_exec_machine_create(PIPE_SHADER_FRAGMENT);
+   w->sampler = sp_create_tgsi_sampler();
+   if (!w->fs_machine || !w->sampler)
+      goto fail;
+
+   return w;
+
+fail:
+   destroy_worker(w);
+   return NULL;
+}
+
+
+/**
+ * Start the rasterization threads, unless SOFTPIPE_NUM_THREADS says
+ * otherwise or there is just one CPU.  Returns NULL if all rendering
+ * should be done on the main thread.
+ */
+struct sp_rast *
+sp_rast_create(struct softpipe_context *softpipe)
+{
+   struct sp_rast *rast;
+   unsigned num_threads, i;
+
+   util_cpu_detect();
+
+   num_threads = debug_get_num_option("SOFTPIPE_NUM_THREADS",
+                                      MIN2(util_cpu_caps.nr_cpus,
+                                           SP_RAST_MAX_THREADS));
+   num_threads = MIN2(num_threads, SP_RAST_MAX_THREADS);
+   if (num_threads < 2)
+      return NULL;
+
+   rast = CALLOC_STRUCT(sp_rast);
+   if (!rast)
+      return NULL;
+
+   rast->softpipe = softpipe;
+   util_dynarray_init(&rast->vertices, NULL);
+   util_dynarray_init(&rast->prims, NULL);
+
+   /* The main thread renders the tiles of the first worker itself. */
+   if (!util_queue_init(&rast->queue, "sprast", num_threads,
+                        num_threads - 1, 0)) {
+      FREE(rast);
+      return NULL;
+   }
+
+   for (i = 0; i < num_threads; i++) {
+      rast->workers[i] = create_worker(rast, i);
+      if (!rast->workers[i])
+         break;
+      rast->num_workers++;
+   }
+
+   if (rast->num_workers < 2) {
+      sp_rast_destroy(rast);
+      return NULL;
+   }
+
+   return rast;
+}
+
+
+void
+sp_rast_destroy(struct sp_rast *rast)
+{
+   unsigned i;
+
+   sp_rast_flush(rast, 0);
+
+   util_queue_destroy(&rast->queue);
+
+   for (i = 0; i < rast->num_workers; i++)
+      destroy_worker(rast->workers[i]);
+
+   for (i = 0; i < rast->max_bins; i++)
+      util_dynarray_fini(&rast->bins[i]);
+   FREE(rast->bins);
+
+   util_dynarray_fini(&rast->vertices);
+   util_dynarray_fini(&rast->prims);
+
+   FREE(rast);
+}
+
+
+/**
+ * Point the worker's sampler views at its own texture caches.
+ */
+static boolean
+setup_worker_samplers(struct sp_rast_worker *w)
+{
+   struct softpipe_context *sp = w->rast->softpipe;
+   const struct sp_tgsi_sampler *sampler =
+      sp->tgsi.sampler[PIPE_SHADER_FRAGMENT];
+   unsigned i;
+
+   memcpy(w->sampler->sp_sampler, sampler->sp_sampler,
+          sizeof(sampler->sp_sampler));
+
+   for (i = 0; i < sp->num_sampler_views[PIPE_SHADER_FRAGMENT]; i++) {
+      struct pipe_sampler_view *view =
+         sp->sampler_views[PIPE_SHADER_FRAGMENT][i];
+      struct softpipe_tex_tile_cache *tc;
+
+      w->sampler->sp_sview[i] = sampler->sp_sview[i];
+      if (!view)
+         continue;
+
+      if (!w->tex_cache[i]) {
+         w->tex_cache[i] = sp_create_tex_tile_cache(&sp->pipe);
+         if (!w->tex_cache[i])
+            return FALSE;
+      }
+
+      tc = w->tex_cache[i];
+      sp_tex_tile_cache_set_sampler_view(tc, view);
+      if (tc->texture) {
+         struct softpipe_resource *spt = softpipe_resource(tc->texture);
+         if (spt->timestamp != tc->timestamp) {
+            sp_tex_tile_cache_validate_texture(tc);
+            tc->timestamp = spt->timestamp;
+         }
+      }
+
+      w->sampler->sp_sview[i].cache = tc;
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Copy the current state of the main context to the worker.
+ */
+static boolean
+setup_worker(struct sp_rast_worker *w)
+{
+   struct softpipe_context *sp = w->rast->softpipe;
+   struct softpipe_context *wsp = &w->softpipe;
+   unsigned i;
+
+   if (!setup_worker_samplers(w))
+      return FALSE;
+
+   memcpy(wsp, sp, sizeof *sp);
+
+   wsp->fs_machine = w->fs_machine;
+   wsp->tgsi.sampler[PIPE_SHADER_FRAGMENT] = w->sampler;
+   if (w->fs_machine->Tokens != sp->fs_variant->tokens) {
+      sp->fs_variant->prepare(sp->fs_variant,
+                              w->fs_machine,
+                              (struct tgsi_sampler *) w->sampler,
+                              (struct tgsi_image *)
+                                 sp->tgsi.image[PIPE_SHADER_FRAGMENT],
+                              (struct tgsi_buffer *)
+                                 sp->tgsi.buffer[PIPE_SHADER_FRAGMENT]);
+   }
+
+   for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++) {
+      sp_tile_cache_set_surface(w->cbuf_cache[i],
+                                i < sp->framebuffer.nr_cbufs ?
+                                sp->framebuffer.cbufs[i] : NULL);
+      wsp->cbuf_cache[i] = w->cbuf_cache[i];
+   }
+   sp_tile_cache_set_surface(w->zsbuf_cache, sp->framebuffer.zsbuf);
+   wsp->zsbuf_cache = w->zsbuf_cache;
+
+   wsp->quad.shade = w->quad.shade;
+   wsp->quad.depth_test = w->quad.depth_test;
+   wsp->quad.blend = w->quad.blend;
+   wsp->quad.pstipple = w->quad.pstipple;
+   sp_build_quad_pipeline(wsp);
+
+   wsp->rast = NULL;
+   wsp->dirty = 0;
+   wsp->occlusion_count = 0;
+   memset(&wsp->pipeline_statistics, 0, sizeof wsp->pipeline_statistics);
+
+   return TRUE;
+}
+
+
+/**
+ * Hand the clears pending in one of the main tile caches to the workers.
+ * \param cbuf  color buffer index, or PIPE_MAX_COLOR_BUFS for the zsbuf
+ */
+static void
+move_clears(struct sp_rast *rast, struct softpipe_tile_cache *tc,
+            unsigned cbuf, unsigned tiles_x, unsigned num_tiles)
+{
+   unsigned t;
+
+   for (t = 0; t < num_tiles; t++) {
+      struct sp_rast_worker *w = rast->workers[t % rast->num_workers];
+
+      sp_tile_cache_move_clear(cbuf < PIPE_MAX_COLOR_BUFS ?
+                               w->cbuf_cache[cbuf] : w->zsbuf_cache, tc,
+                               (t % tiles_x) * TILE_SIZE,
+                               (t / tiles_x) * TILE_SIZE);
+   }
+}
+
+
+/**
+ * Start binning primitives, or keep binning into the current batch.
+ * Called by the setup stage after validating the state for a new set of
+ * primitives.  Returns FALSE if they have to be rendered on the main
+ * thread.
+ */
+boolean
+sp_rast_begin(struct sp_rast *rast)
+{
+   struct softpipe_context *sp = rast->softpipe;
+   const unsigned vertex_size = sp->vertex_info.size * sizeof(float);
+   unsigned tiles_x, tiles_y, num_tiles, i;
+
+   if (rast->binning) {
+      if (rast->vertex_size == vertex_size)
+         return TRUE;
+      sp_rast_end(rast);
+   }
+
+   tiles_x = DIV_ROUND_UP(sp->framebuffer.width, TILE_SIZE);
+   tiles_y = DIV_ROUND_UP(sp->framebuffer.height, TILE_SIZE);
+   num_tiles = tiles_x * tiles_y;
+
+   /* Shaders with side effects must run in primitive order. */
+   if (!sp->fs_variant || sp->fs_variant->info.writes_memory ||
+       sp->no_rast || !num_tiles)
+      goto serial;
+
+   if (num_tiles > rast->max_bins) {
+      struct util_dynarray *bins =
+         REALLOC(rast->bins, rast->max_bins * sizeof *bins,
+                 num_tiles * sizeof *bins);
+      if (!bins)
+         goto serial;
+      for (i = rast->max_bins; i < num_tiles; i++)
+         util_dynarray_init(&bins[i], NULL);
+      rast->bins = bins;
+      rast->max_bins = num_tiles;
+   }
+
+   rast->dirty = TRUE;
+   for (i = 0; i < rast->num_workers; i++) {
+      if (!setup_worker(rast->workers[i]))
+         goto serial;
+   }
+
+   /* Pending clears go to the worker owning the tile, anything else the
+    * main tile caches hold must land in the surfaces first.
+    */
+   for (i = 0; i < sp->framebuffer.nr_cbufs; i++) {
+      if (sp->framebuffer.cbufs[i])
+         move_clears(rast, sp->cbuf_cache[i], i, tiles_x, num_tiles);
+      sp_flush_tile_cache(sp->cbuf_cache[i]);
+   }
+   if (sp->framebuffer.zsbuf)
+      move_clears(rast, sp->zsbuf_cache, PIPE_MAX_COLOR_BUFS,
+                  tiles_x, num_tiles);
+   sp_flush_tile_cache(sp->zsbuf_cache);
+
+   rast->tiles_x = tiles_x;
+   rast->tiles_y = tiles_y;
+   rast->vertex_size = vertex_size;
+   rast->binning = TRUE;
+   return TRUE;
+
+serial:
+   sp_rast_flush(rast, 0);
+   return FALSE;
+}
+
+
+/**
+ * Copy the vertices of a primitive and add it to the bins of all tiles its
+ * bounding box, grown by \p pad pixels, overlaps.
+ */
+static void
+bin_prim(struct sp_rast *rast, unsigned prim,
+         const float (*v[3])[4], unsigned nr, float pad)
+{
+   struct sp_rast_prim *p;
+   float minx = v[0][0][0], maxx = v[0][0][0];
+   float miny = v[0][0][1], maxy = v[0][0][1];
+   unsigned tx0, ty0, tx1, ty1, tx, ty;
+   unsigned index, i;
+   char *vertices;
+
+   assert(rast->binning);
+
+   vertices = util_dynarray_grow(&rast->vertices, nr * rast->vertex_size);
+   p = util_dynarray_grow(&rast->prims, sizeof *p);
+   if (!vertices || !p)
+      return;
+
+   index = rast->prims.size / sizeof *p - 1;
+   p->prim = prim;
+   p->vertex = (unsigned) (vertices - (char *) rast->vertices.data);
+
+   for (i = 0; i < nr; i++) {
+      memcpy(vertices + i * rast->vertex_size, v[i], rast->vertex_size);
+      minx = MIN2(minx, v[i][0][0]);
+      maxx = MAX2(maxx, v[i][0][0]);
+      miny = MIN2(miny, v[i][0][1]);
+      maxy = MAX2(maxy, v[i][0][1]);
+   }
+
+   if (minx <= maxx && miny <= maxy) {
+      const float xmax = (float) (rast->tiles_x * TILE_SIZE - 1);
+      const float ymax = (float) (rast->tiles_y * TILE_SIZE - 1);
+
+      tx0 = (unsigned) CLAMP(minx - pad, 0.0f, xmax) / TILE_SIZE;
+      tx1 = (unsigned) CLAMP(maxx + pad, 0.0f, xmax) / TILE_SIZE;
+      ty0 = (unsigned) CLAMP(miny - pad, 0.0f, ymax) / TILE_SIZE;
+      ty1 = (unsigned) CLAMP(maxy + pad, 0.0f, ymax) / TILE_SIZE;
+   }
+   else {
+      /* NaN coordinates, which setup culls; one tile is enough */
+      tx0 = tx1 = ty0 = ty1 = 0;
+   }
+
+   p->count_tile = ty0 * rast->tiles_x + tx0;
+
+   for (ty = ty0; ty <= ty1; ty++) {
+      for (tx = tx0; tx <= tx1; tx++) {
+         util_dynarray_append(&rast->bins[ty * rast->tiles_x + tx],
+                              unsigned, index);
+      }
+   }
+   rast->num_entries += (tx1 - tx0 + 1) * (ty1 - ty0 + 1);
+}
+
+
+void
+sp_rast_tri(struct sp_rast *rast,
+            const float (*v0)[4],
+            const float (*v1)[4],
+            const float (*v2)[4])
+{
+   const float (*v[3])[4] = { v0, v1, v2 };
+
+   bin_prim(rast, PIPE_PRIM_TRIANGLES, v, 3, 1.0f);
+}
+
+
+void
+sp_rast_line(struct sp_rast *rast,
+             const float (*v0)[4],
+             const float (*v1)[4])
+{
+   const float (*v[3])[4] = { v0, v1, NULL };
+
+   bin_prim(rast, PIPE_PRIM_LINES, v, 2, 1.0f);
+}
+
+
+void
+sp_rast_point(struct sp_rast *rast,
+              const float (*v0)[4])
+{
+   const struct softpipe_context *sp = rast->softpipe;
+   const int sizeAttr = sp->psize_slot;
+   const float size = sizeAttr > 0 ? v0[sizeAttr][0]
+                                   : sp->rasterizer->point_size;
+   const float (*v[3])[4] = { v0, NULL, NULL };
+
+   bin_prim(rast, PIPE_PRIM_POINTS, v, 1, 0.5f * fabsf(size) + 1.0f);
+}
+
+
+/**
+ * Render the binned primitives of the worker's tiles, or write back its
+ * tile caches.
+ */
+static void
+rast_worker_execute(void *data, int thread_index)
+{
+   struct sp_rast_worker *w = data;
+   struct sp_rast *rast = w->rast;
+   struct softpipe_context *wsp = &w->softpipe;
+   const struct softpipe_context *sp = rast->softpipe;
+   const unsigned num_tiles = rast->tiles_x * rast->tiles_y;
+   unsigned t, i, vp;
+
+   if (w->flush) {
+      for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++)
+         sp_flush_tile_cache(w->cbuf_cache[i]);
+      sp_flush_tile_cache(w->zsbuf_cache);
+      return;
+   }
+
+   sp_setup_prepare(w->setup);
+
+   for (t = w->index; t < num_tiles; t += rast->num_workers) {
+      const struct util_dynarray *bin = &rast->bins[t];
+      const int minx = (t % rast->tiles_x) * TILE_SIZE;
+      const int miny = (t / rast->tiles_x) * TILE_SIZE;
+
+      if (!bin->size)
+         continue;
+
+      for (vp = 0; vp < PIPE_MAX_VIEWPORTS; vp++) {
+         const struct pipe_scissor_state *clip = &sp->cliprect[vp];
+         struct pipe_scissor_state *wclip = &wsp->cliprect[vp];
+
+         wclip->minx = MAX2((int) clip->minx, minx);
+         wclip->miny = MAX2((int) clip->miny, miny);
+         wclip->maxx = MIN2((int) clip->maxx, minx + TILE_SIZE);
+         wclip->maxy = MIN2((int) clip->maxy, miny + TILE_SIZE);
+      }
+
+      util_dynarray_foreach(bin, unsigned, index) {
+         const struct sp_rast_prim *p =
+            util_dynarray_element(&rast->prims, struct sp_rast_prim, *index);
+         const char *vertices = (const char *) rast->vertices.data + p->vertex;
+         const float (*v0)[4] = (const float (*)[4]) vertices;
+         const float (*v1)[4] =
+            (const float (*)[4]) (vertices + rast->vertex_size);
+         const float (*v2)[4] =
+            (const float (*)[4]) (vertices + 2 * rast->vertex_size);
+         const uint64_t c_primitives = wsp->pipeline_statistics.c_primitives;
+
+         wsp->reduced_prim = p->prim;
+
+         switch (p->prim) {
+         case PIPE_PRIM_TRIANGLES:
+            sp_setup_tri(w->setup, v0, v1, v2);
+            break;
+         case PIPE_PRIM_LINES:
+            sp_setup_line(w->setup, v0, v1);
+            break;
+         default:
+            sp_setup_point(w->setup, v0);
+            break;
+         }
+
+         /* only count primitives spanning several tiles once */
+         if (p->count_tile != t)
+            wsp->pipeline_statistics.c_primitives = c_primitives;
+      }
+   }
+}
+
+
+/**
+ * Run the job of every busy worker, the first one on the calling thread,
+ * and wait for them.
+ */
+static void
+run_workers(struct sp_rast *rast, boolean threaded)
+{
+   unsigned i;
+
+   for (i = 1; i < rast->num_workers; i++) {
+      struct sp_rast_worker *w = rast->workers[i];
+      if (!w->busy)
+         continue;
+      if (threaded)
+         util_queue_add_job(&rast->queue, w, &w->fence,
+                            rast_worker_execute, NULL);
+      else
+         rast_worker_execute(w, 0);
+   }
+
+   if (rast->workers[0]->busy)
+      rast_worker_execute(rast->workers[0], 0);
+
+   if (threaded) {
+      for (i = 1; i < rast->num_workers; i++)
+         util_queue_fence_wait(&rast->workers[i]->fence);
+   }
+}
+
+
+/**
+ * Render all binned primitives.  Called at the end of each draw and
+ * whenever state changes.
+ */
+void
+sp_rast_end(struct sp_rast *rast)
+{
+   struct softpipe_context *sp = rast->softpipe;
+   const unsigned num_tiles = rast->tiles_x * rast->tiles_y;
+   unsigned num_busy = 0, t, i;
+
+   if (!rast->binning)
+      return;
+
+   rast->binning = FALSE;
+
+   for (i = 0; i < rast->num_workers; i++) {
+      rast->workers[i]->busy = FALSE;
+      rast->workers[i]->flush = FALSE;
+   }
+
+   if (rast->num_entries) {
+      for (t = 0; t < num_tiles; t++) {
+         struct sp_rast_worker *w = rast->workers[t % rast->num_workers];
+         if (rast->bins[t].size && !w->busy) {
+            w->busy = TRUE;
+            num_busy++;
+         }
+      }
+
+      run_workers(rast, num_busy > 1 &&
+                  rast->num_entries >= SP_RAST_MIN_THREADED_ENTRIES);
+
+      for (i = 0; i < rast->num_workers; i++) {
+         const struct softpipe_context *wsp = &rast->workers[i]->softpipe;
+
+         if (!rast->workers[i]->busy)
+            continue;
+
+         sp->occlusion_count += wsp->occlusion_count;
+         sp->pipeline_statistics.ps_invocations +=
+            wsp->pipeline_statistics.ps_invocations;
+         sp->pipeline_statistics.c_primitives +=
+            wsp->pipeline_statistics.c_primitives;
+      }
+   }
+
+   for (t = 0; t < num_tiles; t++)
+      util_dynarray_clear(&rast->bins[t]);
+   util_dynarray_clear(&rast->vertices);
+   util_dynarray_clear(&rast->prims);
+   rast->num_entries = 0;
+}
+
+
+/**
+ * Write back everything the workers rendered and release the surfaces.
+ * Texture caches are flushed as well if SP_FLUSH_TEXTURE_CACHE is set.
+ */
+void
+sp_rast_flush(struct sp_rast *rast, unsigned flags)
+{
+   unsigned i, j;
+
+   sp_rast_end(rast);
+
+   if (rast->dirty) {
+      for (i = 0; i < rast->num_workers; i++) {
+         rast->workers[i]->busy = TRUE;
+         rast->workers[i]->flush = TRUE;
+      }
+
+      run_workers(rast, TRUE);
+
+      /* Surfaces may go away once the framebuffer changes. */
+      for (i = 0; i < rast->num_workers; i++) {
+         struct sp_rast_worker *w = rast->workers[i];
+
+         for (j = 0; j < PIPE_MAX_COLOR_BUFS; j++)
+            sp_tile_cache_set_surface(w->cbuf_cache[j], NULL);
+         sp_tile_cache_set_surface(w->zsbuf_cache, NULL);
+      }
+
+      rast->dirty = FALSE;
+   }
+
+   if (flags & SP_FLUSH_TEXTURE_CACHE) {
+      for (i = 0; i < rast->num_workers; i++) {
+         struct sp_rast_worker *w = rast->workers[i];
+
+         for (j = 0; j < PIPE_MAX_SHADER_SAMPLER_VIEWS; j++) {
+            if (w->tex_cache[j])
+               sp_flush_tex_tile_cache(w->tex_cache[j]);
+         }
+      }
+   }
+}
+
+
+/**
+ * Called before a fragment shader variant is deleted.
+ */
+void
+sp_rast_unbind_fs_variant(struct sp_rast *rast,
+                          const struct sp_fragment_shader_variant *var)
+{
+   unsigned i;
+
+   sp_rast_end(rast);
+
+   for (i = 0; i < rast->num_workers; i++) {
+      struct tgsi_exec_machine *machine = rast->workers[i]->fs_machine;
+
+      if (machine->Tokens == var->tokens)
+         tgsi_exec_machine_bind_shader(machine, NULL, NULL, NULL, NULL);
+   }
+}
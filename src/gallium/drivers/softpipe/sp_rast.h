@@ -0,0 +1,86 @@
+/**************************************************************************
+ *
+ * Copyright 2018 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * Tile-parallel rasterization.
+ *
+ * While binning, the primitives which the setup stage receives are copied
+ * and sorted into bins for the TILE_SIZE x TILE_SIZE screen tiles they
+ * touch.  At the end of the batch every worker thread runs the regular
+ * setup and quad pipeline, clipped to its tiles, on a private copy of the
+ * context with its own tile caches, fragment shader machine and texture
+ * caches.  Tiles are statically assigned to the threads so the tile caches
+ * stay warm between batches.
+ */
+
+#ifndef SP_RAST_H
+#define SP_RAST_H
+
+#include "pipe/p_compiler.h"
+
+
+struct softpipe_context;
+struct sp_fragment_shader_variant;
+struct sp_rast;
+
+
+struct sp_rast *
+sp_rast_create(struct softpipe_context *softpipe);
+
+void
+sp_rast_destroy(struct sp_rast *rast);
+
+boolean
+sp_rast_begin(struct sp_rast *rast);
+
+void
+sp_rast_end(struct sp_rast *rast);
+
+void
+sp_rast_tri(struct sp_rast *rast,
+            const float (*v0)[4],
+            const float (*v1)[4],
+            const float (*v2)[4]);
+
+void
+sp_rast_line(struct sp_rast *rast,
+             const float (*v0)[4],
+             const float (*v1)[4]);
+
+void
+sp_rast_point(struct sp_rast *rast,
+              const float (*v0)[4]);
+
+void
+sp_rast_flush(struct sp_rast *rast, unsigned flags);
+
+void
+sp_rast_unbind_fs_variant(struct sp_rast *rast,
+                          const struct sp_fragment_shader_variant *var);
+
+
+#endif /* SP_RAST_H */
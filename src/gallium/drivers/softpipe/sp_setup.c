@@ -35,6 +35,7 @@
 #include "sp_context.h"
 #include "sp_quad.h"
 #include "sp_quad_pipe.h"
+#include "sp_rast.h"
 #include "sp_setup.h"
 #include "sp_state.h"
 #include "draw/draw_context.h"
@@ -113,6 +114,9 @@ struct setup_context {
 
    unsigned cull_face;		/* which faces cull */
    unsigned nr_vertex_attrs;
+
+   /** Hand the primitives to the tile-parallel rasterizer */
+   boolean bin;
 };
 
 
@@ -821,6 +825,11 @@ sp_setup_tri(struct setup_context *setup,
 
    if (setup->softpipe->no_rast || setup->softpipe->rasterizer->rasterizer_discard)
       return;
+
+   if (setup->bin) {
+      sp_rast_tri(setup->softpipe->rast, v0, v1, v2);
+      return;
+   }
    
    det = calc_det(v0, v1, v2);
    /*
@@ -1110,6 +1119,11 @@ sp_setup_line(struct setup_context *setup,
    if (dx == 0 && dy == 0)
       return;
 
+   if (setup->bin) {
+      sp_rast_line(setup->softpipe->rast, v0, v1);
+      return;
+   }
+
    if (!setup_line_coefficients(setup, v0, v1))
       return;
 
@@ -1254,6 +1268,11 @@ sp_setup_point(struct setup_context *setup,
    if (setup->softpipe->no_rast || setup->softpipe->rasterizer->rasterizer_discard)
       return;
 
+   if (setup->bin) {
+      sp_rast_point(setup->softpipe->rast, v0);
+      return;
+   }
+
    assert(setup->softpipe->reduced_prim == PIPE_PRIM_POINTS);
 
    if (setup->softpipe->layer_slot > 0) {
@@ -1455,6 +1474,9 @@ sp_setup_prepare(struct setup_context *setup)
    int i;
    unsigned max_layer = ~0;
    if (sp->dirty) {
+      /* primitives binned so far were set up for the old state */
+      if (sp->rast)
+         sp_rast_end(sp->rast);
       softpipe_update_derived(sp, sp->reduced_api_prim);
    }
 
@@ -1490,6 +1512,8 @@ sp_setup_prepare(struct setup_context *setup)
       /* 'draw' will do culling */
       setup->cull_face = PIPE_FACE_NONE;
    }
+
+   setup->bin = sp->rast && sp_rast_begin(sp->rast);
 }
 
 
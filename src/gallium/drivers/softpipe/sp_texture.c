@@ -216,6 +216,41 @@ softpipe_resource_destroy(struct pipe_screen *pscreen,
 }
 
 
+/**
+ * Wrap caller-owned memory in a resource, without copying.  The memory
+ * must hold the same packed layout softpipe_resource_layout() computes.
+ */
+static struct pipe_resource *
+softpipe_resource_from_user_memory(struct pipe_screen *screen,
+                                   const struct pipe_resource *templat,
+                                   void *user_memory)
+{
+   struct softpipe_resource *spr = CALLOC_STRUCT(softpipe_resource);
+   if (!spr)
+      return NULL;
+
+   assert(templat->format != PIPE_FORMAT_NONE);
+
+   spr->base = *templat;
+   pipe_reference_init(&spr->base.reference, 1);
+   spr->base.screen = screen;
+
+   spr->pot = (util_is_power_of_two_or_zero(templat->width0) &&
+               util_is_power_of_two_or_zero(templat->height0) &&
+               util_is_power_of_two_or_zero(templat->depth0));
+
+   if (!softpipe_resource_layout(screen, spr, FALSE)) {
+      FREE(spr);
+      return NULL;
+   }
+
+   spr->data = user_memory;
+   spr->userBuffer = TRUE;
+
+   return &spr->base;
+}
+
+
 static struct pipe_resource *
 softpipe_resource_from_handle(struct pipe_screen *screen,
                               const struct pipe_resource *templat,
@@ -533,5 +568,6 @@ softpipe_init_screen_texture_funcs(struct pipe_screen *screen)
    screen->resource_destroy = softpipe_resource_destroy;
    screen->resource_from_handle = softpipe_resource_from_handle;
    screen->resource_get_handle = softpipe_resource_get_handle;
+   screen->resource_from_user_memory = softpipe_resource_from_user_memory;
    screen->can_create_resource = softpipe_can_create_resource;
 }
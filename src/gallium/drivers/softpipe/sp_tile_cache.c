@@ -650,3 +650,31 @@ sp_tile_cache_clear(struct softpipe_tile_cache *tc,
    }
    tc->last_tile_addr.bits.invalid = 1;
 }
+
+
+/**
+ * Hand the pending clears of the tile at (x,y), in all layers, over to
+ * another cache of the same surface.  The clear happens when \p dst first
+ * uses the tile, just like it would have in \p src.
+ */
+void
+sp_tile_cache_move_clear(struct softpipe_tile_cache *dst,
+                         struct softpipe_tile_cache *src,
+                         unsigned x, unsigned y)
+{
+   int layer;
+
+   assert(dst->surface == src->surface);
+
+   for (layer = 0; layer < src->num_maps; layer++) {
+      union tile_address addr = tile_address(x, y, layer);
+      int pos = addr_to_clear_pos(addr);
+
+      if (is_clear_flag_set(src->clear_flags, addr, src->clear_flags_size)) {
+         clear_clear_flag(src->clear_flags, addr, src->clear_flags_size);
+         dst->clear_flags[pos / 32] |= 1 << (pos & 31);
+         dst->clear_color = src->clear_color;
+         dst->clear_val = src->clear_val;
+      }
+   }
+}
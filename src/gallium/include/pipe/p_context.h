@@ -447,6 +447,28 @@ struct pipe_context {
    void (*blit)(struct pipe_context *pipe,
                 const struct pipe_blit_info *info);
 
+   /**
+    * Copy a 2D region of a texture into a buffer, converting the pixels
+    * from src_format (which must have the texture format's block size) to
+    * dst_format.  Rows are written dst_stride bytes apart, starting at
+    * dst_offset; a negative stride flips the image vertically.
+    *
+    * Unlike mapping the texture this needn't wait for pending rendering:
+    * the copy may be done asynchronously, as long as it's ordered after
+    * that rendering and before any later access to the buffer.
+    *
+    * Optional.  Returns false without doing anything if the driver can't
+    * handle the request.
+    */
+   bool (*read_texture_to_buffer)(struct pipe_context *pipe,
+                                  struct pipe_resource *dst,
+                                  unsigned dst_offset, int dst_stride,
+                                  enum pipe_format dst_format,
+                                  struct pipe_resource *src,
+                                  enum pipe_format src_format,
+                                  unsigned src_level,
+                                  const struct pipe_box *src_box);
+
    /*@}*/
 
    /**
@@ -31,16 +31,16 @@
  * Otherwise we use softpipe.  The GALLIUM_DRIVER environment variable
  * may be set to "softpipe" or "llvmpipe" to override.
  *
- * With softpipe we could render directly into the user's buffer by using a
- * display target resource.  However, softpipe doesn't support "upside-down"
- * rendering which would be needed for the OSMESA_Y_UP=TRUE case.
+ * When the driver can wrap user memory in a resource we render directly
+ * into the user's buffer, provided the layout the driver picks for it
+ * matches the buffer's row stride.  The drivers can't render "upside-down",
+ * so this isn't possible in the (default) OSMESA_Y_UP=TRUE case, and
+ * llvmpipe also needs the width and height to be multiples of 4 because it
+ * always writes whole 4x4 pixel blocks.
  *
- * With llvmpipe we could only render directly into the user's buffer when its
- * width and height is a multiple of the tile size (64 pixels).
- *
- * Because of these constraints we always render into ordinary resources then
- * copy the results to the user's buffer in the flush_front() function which
- * is called when the app calls glFlush/Finish.
+ * Otherwise we render into an ordinary resource then copy the results to
+ * the user's buffer in the flush_front() function which is called when the
+ * app calls glFlush/Finish.
  *
  * In general, the OSMesa interface is pretty ugly and not a good match
  * for Gallium.  But we're interested in doing the best we can to preserve
@@ -88,6 +88,15 @@ struct osmesa_buffer
 
    void *map;
 
+   /**
+    * The user buffer and row stride the front color attachment was last
+    * validated against for in-place rendering (NULL/0 if not wanted), and
+    * whether that attachment actually wraps the user's buffer.
+    */
+   void *in_place_map;
+   int in_place_stride;
+   boolean in_place;
+
    struct osmesa_buffer *next;  /**< next in linked list */
 };
 
@@ -300,9 +309,69 @@ stfbi_to_osbuffer(struct st_framebuffer_iface *stfbi)
 }
 
 
+/**
+ * Return the row stride, in bytes, of the user's buffer.
+ */
+static int
+osmesa_user_stride(const struct osmesa_context *osmesa,
+                   const struct osmesa_buffer *osbuffer)
+{
+   unsigned bpp = util_format_get_blocksize(osbuffer->visual.color_format);
+
+   if (osmesa->user_row_length)
+      return bpp * osmesa->user_row_length;
+   else
+      return bpp * osbuffer->width;
+}
+
+
+/**
+ * Return the user's buffer if we should try to render into it directly,
+ * or NULL if we have to render into a private resource and copy.
+ */
+static void *
+osmesa_in_place_map(const struct osmesa_context *osmesa,
+                    const struct osmesa_buffer *osbuffer)
+{
+   struct pipe_screen *screen = get_st_manager()->screen;
+
+   /* the drivers can't render upside down */
+   if (osmesa->y_up || !osbuffer->map)
+      return NULL;
+
+   /*
+    * Not PIPE_CAP_RESOURCE_FROM_USER_MEMORY: that would also expose
+    * GL_AMD_pinned_memory, which llvmpipe and softpipe don't advertise.
+    * Drivers may still refuse a particular layout or alignment.
+    */
+   if (!screen->resource_from_user_memory)
+      return NULL;
+
+   return osbuffer->map;
+}
+
+
+/**
+ * Called when the user's buffer or its layout may have changed.  If that
+ * affects in-place rendering, bump the framebuffer stamp so the state
+ * tracker revalidates it and we get to rebuild the color attachment.
+ */
+static void
+osmesa_check_in_place(const struct osmesa_context *osmesa,
+                      struct osmesa_buffer *osbuffer)
+{
+   void *map = osmesa_in_place_map(osmesa, osbuffer);
+   int stride = map ? osmesa_user_stride(osmesa, osbuffer) : 0;
+
+   if (map != osbuffer->in_place_map || stride != osbuffer->in_place_stride)
+      p_atomic_inc(&osbuffer->stfb->stamp);
+}
+
+
 /**
  * Called via glFlush/glFinish.  This is where we copy the contents
- * of the driver's color buffer into the user-specified buffer.
+ * of the driver's color buffer into the user-specified buffer, unless
+ * the driver has been rendering into it directly.
  */
 static boolean
 osmesa_st_framebuffer_flush_front(struct st_context_iface *stctx,
@@ -344,21 +413,28 @@ osmesa_st_framebuffer_flush_front(struct st_context_iface *stctx,
 
    u_box_2d(0, 0, res->width0, res->height0, &box);
 
+   /* Even when rendering in place, mapping waits for rendering to finish. */
    map = pipe->transfer_map(pipe, res, 0, PIPE_TRANSFER_READ, &box,
                             &transfer);
+   if (!map)
+      return FALSE;
 
-   /*
-    * Copy the color buffer from the resource to the user's buffer.
-    */
    bpp = util_format_get_blocksize(osbuffer->visual.color_format);
    src = map;
    dst = osbuffer->map;
-   if (osmesa->user_row_length)
-      dst_stride = bpp * osmesa->user_row_length;
-   else
-      dst_stride = bpp * osbuffer->width;
+   dst_stride = osmesa_user_stride(osmesa, osbuffer);
    bytes = bpp * res->width0;
 
+   if (src == dst && transfer->stride == dst_stride && !osmesa->y_up) {
+      /* rendered directly into the user's buffer, nothing to copy */
+      pipe->transfer_unmap(pipe, transfer);
+      return TRUE;
+   }
+
+   /*
+    * Copy the color buffer from the resource to the user's buffer.
+    */
+
    if (osmesa->y_up) {
       /* need to flip image upside down */
       dst = dst + (res->height0 - 1) * dst_stride;
@@ -377,6 +453,95 @@ osmesa_st_framebuffer_flush_front(struct st_context_iface *stctx,
 }
 
 
+/**
+ * Check that the driver laid out a user memory resource with the
+ * stride of the user's buffer.
+ */
+static boolean
+osmesa_check_stride(struct pipe_context *pipe, struct pipe_resource *res,
+                    int stride)
+{
+   struct pipe_transfer *transfer = NULL;
+   struct pipe_box box;
+   boolean ok;
+
+   u_box_2d(0, 0, 1, 1, &box);
+   if (!pipe->transfer_map(pipe, res, 0,
+                           PIPE_TRANSFER_READ | PIPE_TRANSFER_UNSYNCHRONIZED,
+                           &box, &transfer))
+      return FALSE;
+
+   ok = transfer->stride == stride;
+   pipe->transfer_unmap(pipe, transfer);
+
+   return ok;
+}
+
+
+/**
+ * (Re)create the front color attachment, backed by the user's buffer
+ * if possible.  The existing attachment is kept when nothing relevant
+ * changed.
+ */
+static void
+osmesa_validate_color(struct st_context_iface *stctx,
+                      struct osmesa_buffer *osbuffer,
+                      const struct pipe_resource *templat)
+{
+   struct pipe_screen *screen = get_st_manager()->screen;
+   struct pipe_context *pipe = stctx->pipe;
+   const struct osmesa_context *osmesa = stctx->st_manager_private;
+   struct pipe_resource *old = osbuffer->textures[ST_ATTACHMENT_FRONT_LEFT];
+   struct pipe_resource *res = NULL;
+   void *map = osmesa_in_place_map(osmesa, osbuffer);
+   int stride = map ? osmesa_user_stride(osmesa, osbuffer) : 0;
+   boolean was_in_place = osbuffer->in_place;
+
+   if (old &&
+       map == osbuffer->in_place_map &&
+       stride == osbuffer->in_place_stride)
+      return;
+
+   osbuffer->in_place_map = map;
+   osbuffer->in_place_stride = stride;
+
+   if (map) {
+      res = screen->resource_from_user_memory(screen, templat, map);
+      if (res && !osmesa_check_stride(pipe, res, stride))
+         pipe_resource_reference(&res, NULL);
+   }
+
+   if (!res) {
+      /* keep rendering into the private resource we already have */
+      if (old && !was_in_place)
+         return;
+
+      res = screen->resource_create(screen, templat);
+      if (!res)
+         return;
+      osbuffer->in_place = FALSE;
+   }
+   else {
+      osbuffer->in_place = TRUE;
+   }
+
+   /* Carry over what was rendered so far into a private resource.  An old
+    * user buffer already holds its results, and the app may have freed it
+    * by now, so we never read from it.
+    */
+   if (old && !was_in_place) {
+      struct pipe_box box;
+
+      u_box_2d(0, 0, res->width0, res->height0, &box);
+      pipe->resource_copy_region(pipe, res, 0, 0, 0, 0, old, 0, &box);
+   }
+
+   pipe_resource_reference(&osbuffer->textures[ST_ATTACHMENT_FRONT_LEFT],
+                           res);
+   pipe_resource_reference(&res, NULL);
+}
+
+
 /**
  * Called by the st manager to validate the framebuffer (allocate
  * its resources).
@@ -433,9 +598,17 @@ osmesa_st_framebuffer_validate(struct st_context_iface *stctx,
 
       templat.format = format;
       templat.bind = bind;
-      pipe_resource_reference(&out[i], NULL);
-      out[i] = osbuffer->textures[statts[i]] =
-         screen->resource_create(screen, &templat);
+
+      if (statts[i] == ST_ATTACHMENT_FRONT_LEFT) {
+         osmesa_validate_color(stctx, osbuffer, &templat);
+      }
+      else if (!osbuffer->textures[statts[i]]) {
+         /* other attachments keep their contents across revalidation */
+         osbuffer->textures[statts[i]] =
+            screen->resource_create(screen, &templat);
+      }
+
+      pipe_resource_reference(&out[i], osbuffer->textures[statts[i]]);
    }
 
    return TRUE;
@@ -514,6 +687,7 @@ static void
 osmesa_destroy_buffer(struct osmesa_buffer *osbuffer)
 {
    struct st_api *stapi = get_st_api();
+   unsigned i;
 
    /*
     * Notify the state manager that the associated framebuffer interface
@@ -521,6 +695,9 @@ osmesa_destroy_buffer(struct osmesa_buffer *osbuffer)
     */
    stapi->destroy_drawable(stapi, osbuffer->stfb);
 
+   for (i = 0; i < ARRAY_SIZE(osbuffer->textures); i++)
+      pipe_resource_reference(&osbuffer->textures[i], NULL);
+
    FREE(osbuffer->stfb);
    FREE(osbuffer);
 }
@@ -790,12 +967,14 @@ OSMesaMakeCurrent(OSMesaContext osmesa, void *buffer, GLenum type,
    osbuffer->height = height;
    osbuffer->map = buffer;
 
-   /* XXX unused for now */
-   (void) osmesa_destroy_buffer;
-
    osmesa->current_buffer = osbuffer;
    osmesa->type = type;
 
+   osmesa_check_in_place(osmesa, osbuffer);
+
+   /* XXX unused for now */
+   (void) osmesa_destroy_buffer;
+
    stapi->make_current(stapi, osmesa->stctx, osbuffer->stfb, osbuffer->stfb);
 
    if (!osmesa->ever_used) {
@@ -852,6 +1031,9 @@ OSMesaPixelStore(GLint pname, GLint value)
       fprintf(stderr, "Invalid pname in OSMesaPixelStore()\n");
       return;
    }
+
+   if (osmesa->current_buffer)
+      osmesa_check_in_place(osmesa, osmesa->current_buffer);
 }
 
 
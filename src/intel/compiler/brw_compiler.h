@@ -92,6 +92,13 @@ struct brw_compiler {
    void (*shader_debug_log)(void *, const char *str, ...) PRINTFLIKE(2, 3);
    void (*shader_perf_log)(void *, const char *str, ...) PRINTFLIKE(2, 3);
 
+   /**
+    * Optional callback receiving the time in nanoseconds spent in each
+    * backend pass, for profiling the compiler offline.  Passes that run
+    * several times per compile are reported every time.
+    */
+   void (*shader_pass_time_log)(void *, const char *pass, int64_t ns);
+
    bool scalar_stage[MESA_SHADER_STAGES];
    struct gl_shader_compiler_options glsl_compiler_options[MESA_SHADER_STAGES];
 
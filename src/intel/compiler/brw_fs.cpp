@@ -6240,7 +6240,11 @@ fs_visitor::optimize()
 
 #define OPT(pass, args...) ({                                           \
       pass_num++;                                                       \
-      bool this_progress = pass(args);                                  \
+      bool this_progress;                                               \
+      {                                                                 \
+         brw_pass_timer pass_timer(compiler, log_data, #pass);          \
+         this_progress = pass(args);                                    \
+      }                                                                 \
                                                                         \
       if (unlikely(INTEL_DEBUG & DEBUG_OPTIMIZER) && this_progress) {   \
          char filename[64];                                             \
@@ -1757,6 +1757,8 @@ fs_generator::enable_debug(const char *shader_name)
 int
 fs_generator::generate_code(const cfg_t *cfg, int dispatch_width)
 {
+   brw_pass_timer pass_timer(compiler, log_data, "generate_code");
+
    /* align to 64 byte boundary. */
    while (p->next_insn_offset % 64)
       brw_NOP(p);
@@ -32,6 +32,8 @@ using namespace brw::surface_access;
 void
 fs_visitor::emit_nir_code()
 {
+   brw_pass_timer pass_timer(compiler, log_data, "emit_nir_code");
+
    /* emit the arrays used for inputs and outputs - load/store intrinsics will
     * be converted to reads/writes of these arrays
     */
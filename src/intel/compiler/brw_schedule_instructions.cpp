@@ -1719,6 +1719,8 @@ instruction_scheduler::run(cfg_t *cfg)
 void
 fs_visitor::schedule_instructions(instruction_scheduler_mode mode)
 {
+   brw_pass_timer pass_timer(compiler, log_data, "schedule_instructions");
+
    if (mode != SCHEDULE_POST)
       calculate_live_intervals();
 
@@ -1738,6 +1740,8 @@ fs_visitor::schedule_instructions(instruction_scheduler_mode mode)
 void
 vec4_visitor::opt_schedule_instructions()
 {
+   brw_pass_timer pass_timer(compiler, log_data, "schedule_instructions");
+
    vec4_instruction_scheduler sched(this, prog_data->total_grf);
    sched.run(cfg);
 
@@ -30,6 +30,7 @@
 #include "brw_eu_defines.h"
 #include "brw_inst.h"
 #include "compiler/nir/nir.h"
+#include "util/os_time.h"
 
 #ifdef __cplusplus
 #include "brw_ir_allocator.h"
@@ -181,6 +182,34 @@ struct backend_instruction {
 
 #ifdef __cplusplus
 
+/**
+ * Reports the time spent in the enclosing scope to
+ * brw_compiler::shader_pass_time_log, if the caller installed one.
+ */
+class brw_pass_timer {
+public:
+   brw_pass_timer(const struct brw_compiler *compiler, void *log_data,
+                  const char *pass) :
+      compiler(compiler), log_data(log_data), pass(pass),
+      start(compiler->shader_pass_time_log ? os_time_get_nano() : 0)
+   {
+   }
+
+   ~brw_pass_timer()
+   {
+      if (unlikely(compiler->shader_pass_time_log)) {
+         compiler->shader_pass_time_log(log_data, pass,
+                                        os_time_get_nano() - start);
+      }
+   }
+
+private:
+   const struct brw_compiler *compiler;
+   void *log_data;
+   const char *pass;
+   int64_t start;
+};
+
 enum instruction_scheduler_mode {
    SCHEDULE_PRE,
    SCHEDULE_PRE_NON_LIFO,
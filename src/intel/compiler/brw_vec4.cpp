@@ -2659,7 +2659,11 @@ vec4_visitor::run()
 
 #define OPT(pass, args...) ({                                          \
       pass_num++;                                                      \
-      bool this_progress = pass(args);                                 \
+      bool this_progress;                                              \
+      {                                                                \
+         brw_pass_timer pass_timer(compiler, log_data, #pass);         \
+         this_progress = pass(args);                                   \
+      }                                                                \
                                                                        \
       if (unlikely(INTEL_DEBUG & DEBUG_OPTIMIZER) && this_progress) {  \
          char filename[64];                                            \
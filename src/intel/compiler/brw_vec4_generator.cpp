@@ -2232,7 +2232,10 @@ brw_vec4_generate_assembly(const struct brw_compiler *compiler,
    brw_init_codegen(compiler->devinfo, p, mem_ctx);
    brw_set_default_access_mode(p, BRW_ALIGN_16);
 
-   generate_code(p, compiler, log_data, nir, prog_data, cfg);
+   {
+      brw_pass_timer pass_timer(compiler, log_data, "generate_code");
+      generate_code(p, compiler, log_data, nir, prog_data, cfg);
+   }
 
    return brw_get_program(p, &prog_data->base.program_size);
 }
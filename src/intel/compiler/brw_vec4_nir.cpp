@@ -34,6 +34,8 @@ namespace brw {
 void
 vec4_visitor::emit_nir_code()
 {
+   brw_pass_timer pass_timer(compiler, log_data, "emit_nir_code");
+
    if (nir->num_uniforms > 0)
       nir_setup_uniforms();
 
@@ -0,0 +1,1105 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Offline driver for the brw compiler.
+ *
+ * Compiles SPIR-V shaders for a given platform without any hardware, the
+ * same way anv would, and reports the statistics of the generated code.
+ * Every shader can be compiled several times, spread over a pool of
+ * threads, which makes this usable for measuring compile throughput and
+ * the time spent in each backend pass.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#include "compiler/brw_compiler.h"
+#include "compiler/brw_nir.h"
+#include "compiler/spirv/nir_spirv.h"
+#include "common/gen_debug.h"
+#include "dev/gen_device_info.h"
+#include "nir/nir_builder.h"
+#include "util/macros.h"
+#include "util/os_time.h"
+#include "util/ralloc.h"
+#include "util/u_queue.h"
+
+/* Matches the push constant space anv gives to every shader */
+#define PUSH_CONSTANTS_SIZE 128
+#define PARAM_PUSH(offset) ((1 << 16) | (uint32_t)(offset))
+
+#define MAX_PASSES 64
+
+struct shader_file {
+   const char *path;
+   gl_shader_stage stage;
+   uint32_t *spirv;
+   size_t word_count;
+};
+
+struct pass_time {
+   const char *name;
+   unsigned calls;
+   int64_t ns;
+};
+
+struct compile_stats {
+   unsigned instructions;
+   unsigned loops;
+   unsigned cycles;
+   unsigned spills;
+   unsigned fills;
+};
+
+struct compile_job {
+   const struct shader_file *file;
+   bool print;
+
+   struct util_queue_fence fence;
+
+   bool failed;
+   char *error;
+   char *log;
+
+   struct compile_stats stats;
+   struct pass_time passes[MAX_PASSES];
+   unsigned num_passes;
+};
+
+static const struct brw_compiler *compiler;
+static const char *entrypoint = "main";
+static bool verbose;
+
+static void
+add_pass_time(struct compile_job *job, const char *pass, int64_t ns)
+{
+   unsigned i;
+
+   for (i = 0; i < job->num_passes; i++) {
+      if (job->passes[i].name == pass || !strcmp(job->passes[i].name, pass))
+         break;
+   }
+
+   if (i == job->num_passes) {
+      if (i == MAX_PASSES)
+         return;
+      job->passes[i].name = pass;
+      job->num_passes++;
+   }
+
+   job->passes[i].calls++;
+   job->passes[i].ns += ns;
+}
+
+static void
+append_log(struct compile_job *job, const char *fmt, va_list args)
+{
+   if (!job->print)
+      return;
+
+   if (job->log == NULL)
+      job->log = ralloc_strdup(NULL, "");
+
+   ralloc_asprintf_append(&job->log, "%s: ", job->file->path);
+   ralloc_vasprintf_append(&job->log, fmt, args);
+   ralloc_strcat(&job->log, "\n");
+}
+
+static void
+shader_debug_log(void *data, const char *fmt, ...)
+{
+   struct compile_job *job = data;
+   struct compile_stats stats;
+   char *str;
+   va_list args;
+
+   va_start(args, fmt);
+   str = ralloc_vasprintf(NULL, fmt, args);
+   va_end(args);
+
+   /* Both generators report "... shader: N inst, N loops, N cycles,
+    * N:N spills:fills, ..." once per program they emit.
+    */
+   const char *s = strstr(str, "shader: ");
+   if (s && sscanf(s, "shader: %u inst, %u loops, %u cycles, %u:%u",
+                   &stats.instructions, &stats.loops, &stats.cycles,
+                   &stats.spills, &stats.fills) == 5) {
+      job->stats.instructions += stats.instructions;
+      job->stats.loops += stats.loops;
+      job->stats.cycles += stats.cycles;
+      job->stats.spills += stats.spills;
+      job->stats.fills += stats.fills;
+   }
+
+   va_start(args, fmt);
+   append_log(job, fmt, args);
+   va_end(args);
+
+   ralloc_free(str);
+}
+
+static void
+shader_perf_log(void *data, const char *fmt, ...)
+{
+   va_list args;
+
+   if (!verbose)
+      return;
+
+   va_start(args, fmt);
+   append_log(data, fmt, args);
+   va_end(args);
+}
+
+static void
+shader_pass_time_log(void *data, const char *pass, int64_t ns)
+{
+   add_pass_time(data, pass, ns);
+}
+
+/**
+ * Binding table and sampler table slots of one descriptor set binding.
+ *
+ * Without a pipeline layout we lay the bindings out the way anv would for
+ * a layout containing exactly the bindings the shader uses.
+ */
+struct binding {
+   unsigned set, binding;
+   unsigned array_size;
+   int surface, sampler, image;
+};
+
+struct binding_layout {
+   struct binding *bindings;
+   unsigned num_bindings;
+   bool uses_constants;
+   int constants_surface;
+   unsigned surface_count, sampler_count, image_count;
+};
+
+static struct binding *
+find_binding(struct binding_layout *layout, unsigned set, unsigned binding)
+{
+   for (unsigned i = 0; i < layout->num_bindings; i++) {
+      if (layout->bindings[i].set == set &&
+          layout->bindings[i].binding == binding)
+         return &layout->bindings[i];
+   }
+
+   return NULL;
+}
+
+static void
+add_binding(void *mem_ctx, struct binding_layout *layout,
+            unsigned set, unsigned binding)
+{
+   if (find_binding(layout, set, binding))
+      return;
+
+   layout->bindings = reralloc(mem_ctx, layout->bindings, struct binding,
+                               layout->num_bindings + 1);
+   layout->bindings[layout->num_bindings++] = (struct binding) {
+      .set = set,
+      .binding = binding,
+      .array_size = 1,
+      .surface = -1,
+      .sampler = -1,
+      .image = -1,
+   };
+}
+
+static void
+add_deref_binding(void *mem_ctx, struct binding_layout *layout, nir_src src)
+{
+   nir_variable *var = nir_deref_instr_get_variable(nir_src_as_deref(src));
+   add_binding(mem_ctx, layout, var->data.descriptor_set, var->data.binding);
+}
+
+static void
+gather_bindings(void *mem_ctx, nir_shader *nir, struct binding_layout *layout)
+{
+   nir_foreach_function(function, nir) {
+      if (!function->impl)
+         continue;
+
+      nir_foreach_block(block, function->impl) {
+         nir_foreach_instr(instr, block) {
+            if (instr->type == nir_instr_type_tex) {
+               nir_tex_instr *tex = nir_instr_as_tex(instr);
+               for (unsigned i = 0; i < tex->num_srcs; i++) {
+                  if (tex->src[i].src_type == nir_tex_src_texture_deref ||
+                      tex->src[i].src_type == nir_tex_src_sampler_deref)
+                     add_deref_binding(mem_ctx, layout, tex->src[i].src);
+               }
+               continue;
+            }
+
+            if (instr->type != nir_instr_type_intrinsic)
+               continue;
+
+            nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+            switch (intrin->intrinsic) {
+            case nir_intrinsic_vulkan_resource_index:
+               add_binding(mem_ctx, layout, nir_intrinsic_desc_set(intrin),
+                           nir_intrinsic_binding(intrin));
+               break;
+            case nir_intrinsic_image_deref_load:
+            case nir_intrinsic_image_deref_store:
+            case nir_intrinsic_image_deref_atomic_add:
+            case nir_intrinsic_image_deref_atomic_min:
+            case nir_intrinsic_image_deref_atomic_max:
+            case nir_intrinsic_image_deref_atomic_and:
+            case nir_intrinsic_image_deref_atomic_or:
+            case nir_intrinsic_image_deref_atomic_xor:
+            case nir_intrinsic_image_deref_atomic_exchange:
+            case nir_intrinsic_image_deref_atomic_comp_swap:
+            case nir_intrinsic_image_deref_size:
+            case nir_intrinsic_image_deref_samples:
+               add_deref_binding(mem_ctx, layout, intrin->src[0]);
+               break;
+            case nir_intrinsic_load_constant:
+               layout->uses_constants = true;
+               break;
+            default:
+               break;
+            }
+         }
+      }
+   }
+}
+
+static void
+assign_bindings(nir_shader *nir, struct binding_layout *layout,
+                unsigned surface_bias)
+{
+   unsigned surface = surface_bias;
+
+   if (layout->uses_constants)
+      layout->constants_surface = surface++;
+
+   for (unsigned i = 0; i < layout->num_bindings; i++) {
+      struct binding *b = &layout->bindings[i];
+      const struct glsl_type *type = NULL;
+
+      nir_foreach_variable(var, &nir->uniforms) {
+         if (var->data.descriptor_set == b->set &&
+             var->data.binding == b->binding) {
+            type = var->type;
+            break;
+         }
+      }
+
+      /* Buffers don't always have a variable, and are never arrays of
+       * arrays, so one slot per element is all they need.
+       */
+      if (type && glsl_type_is_array(type))
+         b->array_size = glsl_get_aoa_size(type);
+
+      const struct glsl_type *elem = type ? glsl_without_array(type) : NULL;
+      if (elem && glsl_type_is_sampler(elem)) {
+         b->sampler = layout->sampler_count;
+         layout->sampler_count += b->array_size;
+
+         /* Pure samplers don't take a surface */
+         if (glsl_get_sampler_result_type(elem) == GLSL_TYPE_VOID)
+            continue;
+      }
+
+      b->surface = surface;
+      surface += b->array_size;
+
+      if (elem && glsl_type_is_image(elem)) {
+         b->image = layout->image_count;
+         layout->image_count += b->array_size;
+      }
+   }
+
+   layout->surface_count = surface;
+}
+
+static void
+lower_res_index(nir_builder *b, nir_intrinsic_instr *intrin,
+                struct binding_layout *layout)
+{
+   const struct binding *binding =
+      find_binding(layout, nir_intrinsic_desc_set(intrin),
+                   nir_intrinsic_binding(intrin));
+   nir_const_value *const_index = nir_src_as_const_value(intrin->src[0]);
+   nir_ssa_def *index;
+
+   b->cursor = nir_before_instr(&intrin->instr);
+
+   if (const_index) {
+      index = nir_imm_int(b, binding->surface +
+                             MIN2(const_index->u32[0],
+                                  binding->array_size - 1));
+   } else {
+      index = nir_iadd(b, nir_imm_int(b, binding->surface),
+                       nir_ssa_for_src(b, intrin->src[0], 1));
+   }
+
+   nir_ssa_def_rewrite_uses(&intrin->dest.ssa, nir_src_for_ssa(index));
+   nir_instr_remove(&intrin->instr);
+}
+
+static void
+lower_res_reindex(nir_builder *b, nir_intrinsic_instr *intrin)
+{
+   b->cursor = nir_before_instr(&intrin->instr);
+
+   nir_ssa_def *index = nir_iadd(b, intrin->src[0].ssa, intrin->src[1].ssa);
+
+   nir_ssa_def_rewrite_uses(&intrin->dest.ssa, nir_src_for_ssa(index));
+   nir_instr_remove(&intrin->instr);
+}
+
+static void
+lower_load_constant(nir_builder *b, nir_intrinsic_instr *intrin,
+                    struct binding_layout *layout)
+{
+   b->cursor = nir_before_instr(&intrin->instr);
+
+   nir_ssa_def *offset = nir_iadd(b, nir_ssa_for_src(b, intrin->src[0], 1),
+                                  nir_imm_int(b, nir_intrinsic_base(intrin)));
+
+   nir_intrinsic_instr *load_ubo =
+      nir_intrinsic_instr_create(b->shader, nir_intrinsic_load_ubo);
+   load_ubo->num_components = intrin->num_components;
+   load_ubo->src[0] = nir_src_for_ssa(nir_imm_int(b,
+                                                  layout->constants_surface));
+   load_ubo->src[1] = nir_src_for_ssa(offset);
+   nir_ssa_dest_init(&load_ubo->instr, &load_ubo->dest,
+                     intrin->dest.ssa.num_components,
+                     intrin->dest.ssa.bit_size, NULL);
+   nir_builder_instr_insert(b, &load_ubo->instr);
+
+   nir_ssa_def_rewrite_uses(&intrin->dest.ssa,
+                            nir_src_for_ssa(&load_ubo->dest.ssa));
+   nir_instr_remove(&intrin->instr);
+}
+
+static void
+lower_tex_deref(nir_builder *b, nir_tex_instr *tex,
+                nir_tex_src_type deref_src_type,
+                struct binding_layout *layout)
+{
+   int deref_src_idx = nir_tex_instr_src_index(tex, deref_src_type);
+   if (deref_src_idx < 0)
+      return;
+
+   nir_deref_instr *deref = nir_src_as_deref(tex->src[deref_src_idx].src);
+   nir_variable *var = nir_deref_instr_get_variable(deref);
+   const struct binding *binding =
+      find_binding(layout, var->data.descriptor_set, var->data.binding);
+
+   unsigned *base_index;
+   nir_tex_src_type offset_src_type;
+   if (deref_src_type == nir_tex_src_texture_deref) {
+      base_index = &tex->texture_index;
+      *base_index = binding->surface;
+      offset_src_type = nir_tex_src_texture_offset;
+   } else {
+      base_index = &tex->sampler_index;
+      *base_index = binding->sampler;
+      offset_src_type = nir_tex_src_sampler_offset;
+   }
+
+   nir_ssa_def *index = NULL;
+   if (deref->deref_type == nir_deref_type_array) {
+      nir_const_value *const_index = nir_src_as_const_value(deref->arr.index);
+      if (const_index) {
+         *base_index += MIN2(const_index->u32[0], binding->array_size - 1);
+      } else {
+         b->cursor = nir_before_instr(&tex->instr);
+         index = nir_ssa_for_src(b, deref->arr.index, 1);
+      }
+   }
+
+   if (index) {
+      nir_instr_rewrite_src(&tex->instr, &tex->src[deref_src_idx].src,
+                            nir_src_for_ssa(index));
+      tex->src[deref_src_idx].src_type = offset_src_type;
+   } else {
+      nir_tex_instr_remove_src(tex, deref_src_idx);
+   }
+}
+
+static void
+setup_vec4_param(uint32_t *param, unsigned n)
+{
+   for (unsigned i = 0; i < 4; i++)
+      param[i] = i < n ? PARAM_PUSH(0) : BRW_PARAM_BUILTIN_ZERO;
+}
+
+/**
+ * Does what anv_nir_lower_push_constants and anv_nir_apply_pipeline_layout
+ * do with a real pipeline layout: push constants become uniforms and
+ * descriptors become binding table and sampler indices.
+ */
+static void
+lower_resources(void *mem_ctx, nir_shader *nir,
+                struct brw_stage_prog_data *prog_data, unsigned surface_bias)
+{
+   struct binding_layout layout = { .constants_surface = -1 };
+
+   if (prog_data->param == NULL)
+      prog_data->param = ralloc_array(mem_ctx, uint32_t, 0);
+
+   gather_bindings(mem_ctx, nir, &layout);
+   assign_bindings(nir, &layout, surface_bias);
+
+   nir_foreach_function(function, nir) {
+      if (!function->impl)
+         continue;
+
+      nir_builder b;
+      nir_builder_init(&b, function->impl);
+
+      nir_foreach_block(block, function->impl) {
+         nir_foreach_instr_safe(instr, block) {
+            if (instr->type == nir_instr_type_tex) {
+               nir_tex_instr *tex = nir_instr_as_tex(instr);
+               lower_tex_deref(&b, tex, nir_tex_src_texture_deref, &layout);
+               lower_tex_deref(&b, tex, nir_tex_src_sampler_deref, &layout);
+               tex->texture_array_size = 1;
+               continue;
+            }
+
+            if (instr->type != nir_instr_type_intrinsic)
+               continue;
+
+            nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+            switch (intrin->intrinsic) {
+            case nir_intrinsic_load_push_constant:
+               intrin->intrinsic = nir_intrinsic_load_uniform;
+               break;
+            case nir_intrinsic_vulkan_resource_index:
+               lower_res_index(&b, intrin, &layout);
+               break;
+            case nir_intrinsic_vulkan_resource_reindex:
+               lower_res_reindex(&b, intrin);
+               break;
+            case nir_intrinsic_load_constant:
+               lower_load_constant(&b, intrin, &layout);
+               break;
+            default:
+               break;
+            }
+         }
+      }
+
+      nir_metadata_preserve(function->impl, nir_metadata_block_index |
+                                            nir_metadata_dominance);
+   }
+
+   /* Like anv, give every shader using push constants all of them */
+   if (nir->num_uniforms > 0) {
+      nir->num_uniforms = PUSH_CONSTANTS_SIZE;
+      uint32_t *param =
+         brw_stage_prog_data_add_params(prog_data, PUSH_CONSTANTS_SIZE / 4);
+      for (unsigned i = 0; i < PUSH_CONSTANTS_SIZE / 4; i++)
+         param[i] = PARAM_PUSH(i * 4);
+   }
+
+   if (layout.image_count > 0) {
+      nir_foreach_variable(var, &nir->uniforms) {
+         if (!glsl_type_is_image(glsl_without_array(var->type)))
+            continue;
+
+         const struct binding *binding =
+            find_binding(&layout, var->data.descriptor_set,
+                         var->data.binding);
+         if (binding == NULL)
+            continue;
+
+         var->data.driver_location = nir->num_uniforms +
+            binding->image * BRW_IMAGE_PARAM_SIZE * 4;
+      }
+
+      uint32_t *param =
+         brw_stage_prog_data_add_params(prog_data, layout.image_count *
+                                                   BRW_IMAGE_PARAM_SIZE);
+      for (unsigned i = 0; i < layout.image_count; i++) {
+         setup_vec4_param(param + BRW_IMAGE_PARAM_SURFACE_IDX_OFFSET, 1);
+         setup_vec4_param(param + BRW_IMAGE_PARAM_OFFSET_OFFSET, 2);
+         setup_vec4_param(param + BRW_IMAGE_PARAM_SIZE_OFFSET, 3);
+         setup_vec4_param(param + BRW_IMAGE_PARAM_STRIDE_OFFSET, 4);
+         setup_vec4_param(param + BRW_IMAGE_PARAM_TILING_OFFSET, 3);
+         setup_vec4_param(param + BRW_IMAGE_PARAM_SWIZZLING_OFFSET, 2);
+         param += BRW_IMAGE_PARAM_SIZE;
+      }
+
+      nir->num_uniforms += layout.image_count * BRW_IMAGE_PARAM_SIZE * 4;
+   }
+
+   prog_data->binding_table.size_bytes = 0;
+   prog_data->binding_table.texture_start = surface_bias;
+   prog_data->binding_table.gather_texture_start = surface_bias;
+   prog_data->binding_table.ubo_start = surface_bias;
+   prog_data->binding_table.ssbo_start = surface_bias;
+   prog_data->binding_table.image_start = surface_bias;
+}
+
+/**
+ * Translates the SPIR-V module into NIR and runs the same preprocessing as
+ * anv_shader_compile_to_nir().
+ */
+static nir_shader *
+spirv_to_brw_nir(void *mem_ctx, const struct shader_file *file)
+{
+   const struct gen_device_info *devinfo = compiler->devinfo;
+   const nir_shader_compiler_options *nir_options =
+      compiler->glsl_compiler_options[file->stage].NirOptions;
+
+   const struct spirv_to_nir_options spirv_options = {
+      .lower_workgroup_access_to_offsets = true,
+      .caps = {
+         .float64 = devinfo->gen >= 8,
+         .int64 = devinfo->gen >= 8,
+         .tessellation = true,
+         .device_group = true,
+         .draw_parameters = true,
+         .image_write_without_format = true,
+         .multiview = true,
+         .variable_pointers = true,
+         .storage_16bit = devinfo->gen >= 8,
+         .int16 = devinfo->gen >= 8,
+         .shader_viewport_index_layer = true,
+         .subgroup_arithmetic = true,
+         .subgroup_basic = true,
+         .subgroup_ballot = true,
+         .subgroup_quad = true,
+         .subgroup_shuffle = true,
+         .subgroup_vote = true,
+         .stencil_export = devinfo->gen >= 9,
+         .storage_8bit = devinfo->gen >= 8,
+         .post_depth_coverage = devinfo->gen >= 9,
+      },
+   };
+
+   nir_function *entry_point =
+      spirv_to_nir(file->spirv, file->word_count, NULL, 0,
+                   file->stage, entrypoint, &spirv_options, nir_options);
+   if (entry_point == NULL)
+      return NULL;
+
+   nir_shader *nir = entry_point->shader;
+   ralloc_steal(mem_ctx, nir);
+
+   NIR_PASS_V(nir, nir_lower_constant_initializers, nir_var_local);
+   NIR_PASS_V(nir, nir_lower_returns);
+   NIR_PASS_V(nir, nir_inline_functions);
+   NIR_PASS_V(nir, nir_copy_prop);
+
+   foreach_list_typed_safe(nir_function, func, node, &nir->functions) {
+      if (func != entry_point)
+         exec_node_remove(&func->node);
+   }
+   entry_point->name = ralloc_strdup(entry_point, "main");
+
+   NIR_PASS_V(nir, nir_lower_constant_initializers, ~0);
+   NIR_PASS_V(nir, nir_split_var_copies);
+   NIR_PASS_V(nir, nir_split_per_member_structs);
+   NIR_PASS_V(nir, nir_remove_dead_variables,
+              nir_var_shader_in | nir_var_shader_out | nir_var_system_value);
+
+   if (file->stage == MESA_SHADER_FRAGMENT)
+      NIR_PASS_V(nir, nir_lower_wpos_center, false);
+
+   NIR_PASS_V(nir, nir_propagate_invariant);
+   NIR_PASS_V(nir, nir_lower_io_to_temporaries,
+              entry_point->impl, true, false);
+
+   nir->info.separate_shader = true;
+
+   return brw_preprocess_nir(compiler, nir);
+}
+
+static void
+populate_sampler_prog_key(struct brw_sampler_prog_key_data *key)
+{
+   key->compressed_multisample_layout_mask = ~0;
+   if (compiler->devinfo->gen >= 9)
+      key->msaa_16 = ~0;
+   for (unsigned i = 0; i < MAX_SAMPLERS; i++)
+      key->swizzles[i] = SWIZZLE_XYZW;
+}
+
+static const unsigned *
+compile_vs(void *mem_ctx, struct compile_job *job, nir_shader *nir,
+           char **error)
+{
+   struct brw_vs_prog_key key = { 0 };
+   struct brw_vs_prog_data *prog_data =
+      rzalloc(mem_ctx, struct brw_vs_prog_data);
+
+   populate_sampler_prog_key(&key.tex);
+   lower_resources(mem_ctx, nir, &prog_data->base.base, 0);
+
+   brw_compute_vue_map(compiler->devinfo, &prog_data->base.vue_map,
+                       nir->info.outputs_written, nir->info.separate_shader);
+
+   return brw_compile_vs(compiler, job, mem_ctx, &key, prog_data, nir,
+                         -1, error);
+}
+
+static const unsigned *
+compile_fs(void *mem_ctx, struct compile_job *job, nir_shader *nir,
+           char **error)
+{
+   struct brw_wm_prog_key key = { 0 };
+   struct brw_wm_prog_data *prog_data =
+      rzalloc(mem_ctx, struct brw_wm_prog_data);
+   unsigned num_rts = 1;
+
+   populate_sampler_prog_key(&key.tex);
+
+   /* Assume a render target for every color output, and that the previous
+    * stage writes exactly the varyings we read.
+    */
+   nir_foreach_variable(var, &nir->outputs) {
+      if (var->data.location < FRAG_RESULT_DATA0)
+         continue;
+
+      const unsigned rt = var->data.location - FRAG_RESULT_DATA0;
+      const unsigned array_len =
+         glsl_type_is_array(var->type) ? glsl_get_length(var->type) : 1;
+      num_rts = MAX2(num_rts, MIN2(rt + array_len, BRW_MAX_DRAW_BUFFERS));
+   }
+
+   key.nr_color_regions = num_rts;
+   key.color_outputs_valid = (1 << num_rts) - 1;
+   key.input_slots_valid = nir->info.inputs_read | VARYING_BIT_POS;
+
+   lower_resources(mem_ctx, nir, &prog_data->base, num_rts);
+
+   return brw_compile_fs(compiler, job, mem_ctx, &key, prog_data, nir,
+                         NULL, -1, -1, -1, true, false, NULL, error);
+}
+
+static const unsigned *
+compile_cs(void *mem_ctx, struct compile_job *job, nir_shader *nir,
+           char **error)
+{
+   struct brw_cs_prog_key key = { 0 };
+   struct brw_cs_prog_data *prog_data =
+      rzalloc(mem_ctx, struct brw_cs_prog_data);
+
+   populate_sampler_prog_key(&key.tex);
+
+   prog_data->base.total_shared = nir->num_shared;
+
+   /* Surface 0 is the work group count */
+   lower_resources(mem_ctx, nir, &prog_data->base, 1);
+
+   return brw_compile_cs(compiler, job, mem_ctx, &key, prog_data, nir,
+                         -1, error);
+}
+
+static void
+compile_job_execute(void *data, int thread_index)
+{
+   struct compile_job *job = data;
+   void *mem_ctx = ralloc_context(NULL);
+   char *error = NULL;
+   const unsigned *assembly = NULL;
+
+   int64_t start = os_time_get_nano();
+   nir_shader *nir = spirv_to_brw_nir(mem_ctx, job->file);
+   add_pass_time(job, "spirv_to_nir", os_time_get_nano() - start);
+
+   if (nir == NULL) {
+      job->failed = true;
+      job->error = ralloc_strdup(NULL, "SPIR-V to NIR translation failed");
+      ralloc_free(mem_ctx);
+      return;
+   }
+
+   nir_shader_gather_info(nir, nir_shader_get_entrypoint(nir));
+
+   start = os_time_get_nano();
+   switch (job->file->stage) {
+   case MESA_SHADER_VERTEX:
+      assembly = compile_vs(mem_ctx, job, nir, &error);
+      break;
+   case MESA_SHADER_FRAGMENT:
+      assembly = compile_fs(mem_ctx, job, nir, &error);
+      break;
+   case MESA_SHADER_COMPUTE:
+      assembly = compile_cs(mem_ctx, job, nir, &error);
+      break;
+   default:
+      unreachable("unsupported stage");
+   }
+   add_pass_time(job, "brw_compile", os_time_get_nano() - start);
+
+   if (assembly == NULL) {
+      job->failed = true;
+      job->error = ralloc_strdup(NULL, error ? error : "compile failed");
+   }
+
+   ralloc_free(mem_ctx);
+}
+
+static bool
+stage_from_path(const char *path, gl_shader_stage *stage)
+{
+   static const struct {
+      const char *ext;
+      gl_shader_stage stage;
+   } exts[] = {
+      { ".vert", MESA_SHADER_VERTEX },
+      { ".frag", MESA_SHADER_FRAGMENT },
+      { ".comp", MESA_SHADER_COMPUTE },
+   };
+
+   for (unsigned i = 0; i < ARRAY_SIZE(exts); i++) {
+      const char *s = strstr(path, exts[i].ext);
+      if (s && (s[5] == '\0' || s[5] == '.')) {
+         *stage = exts[i].stage;
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static bool
+stage_from_name(const char *name, gl_shader_stage *stage)
+{
+   if (!strcmp(name, "vert") || !strcmp(name, "vs"))
+      *stage = MESA_SHADER_VERTEX;
+   else if (!strcmp(name, "frag") || !strcmp(name, "fs"))
+      *stage = MESA_SHADER_FRAGMENT;
+   else if (!strcmp(name, "comp") || !strcmp(name, "cs"))
+      *stage = MESA_SHADER_COMPUTE;
+   else
+      return false;
+
+   return true;
+}
+
+static bool
+load_shader_file(struct shader_file *file)
+{
+   FILE *f = fopen(file->path, "rb");
+   if (f == NULL) {
+      fprintf(stderr, "%s: failed to open\n", file->path);
+      return false;
+   }
+
+   fseek(f, 0, SEEK_END);
+   long size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+
+   if (size <= 0 || size % 4 != 0) {
+      fprintf(stderr, "%s: not a SPIR-V binary\n", file->path);
+      fclose(f);
+      return false;
+   }
+
+   file->spirv = malloc(size);
+   file->word_count = size / 4;
+   if (file->spirv == NULL ||
+       fread(file->spirv, 4, file->word_count, f) != file->word_count ||
+       file->spirv[0] != 0x07230203) {
+      fprintf(stderr, "%s: not a SPIR-V binary\n", file->path);
+      fclose(f);
+      return false;
+   }
+
+   fclose(f);
+   return true;
+}
+
+static int
+compare_pass_time(const void *a, const void *b)
+{
+   const struct pass_time *pa = a, *pb = b;
+   return pa->ns < pb->ns ? 1 : pa->ns > pb->ns ? -1 : 0;
+}
+
+static void
+print_pass_times(const struct pass_time *passes, unsigned num_passes,
+                 unsigned iterations)
+{
+   const struct pass_time *frontend = NULL, *backend = NULL;
+   struct pass_time sorted[MAX_PASSES];
+   unsigned num_sorted = 0;
+
+   for (unsigned i = 0; i < num_passes; i++) {
+      if (!strcmp(passes[i].name, "spirv_to_nir"))
+         frontend = &passes[i];
+      else if (!strcmp(passes[i].name, "brw_compile"))
+         backend = &passes[i];
+      else
+         sorted[num_sorted++] = passes[i];
+   }
+
+   qsort(sorted, num_sorted, sizeof(sorted[0]), compare_pass_time);
+
+   printf("\n");
+   if (frontend) {
+      printf("SPIR-V to NIR: %10.3f ms per iteration\n",
+             frontend->ns / 1e6 / iterations);
+   }
+   if (backend) {
+      printf("brw compile:   %10.3f ms per iteration\n",
+             backend->ns / 1e6 / iterations);
+   }
+
+   printf("\n%-32s %10s %12s %10s %7s\n",
+          "backend pass", "calls", "total ms", "avg us", "%");
+   for (unsigned i = 0; i < num_sorted; i++) {
+      printf("%-32s %10u %12.3f %10.3f %6.1f%%\n",
+             sorted[i].name, sorted[i].calls / iterations,
+             sorted[i].ns / 1e6 / iterations,
+             sorted[i].ns / 1e3 / sorted[i].calls,
+             backend ? 100.0 * sorted[i].ns / backend->ns : 0.0);
+   }
+}
+
+static void
+print_help(const char *progname, FILE *file)
+{
+   fprintf(file,
+           "Usage: %s [OPTION]... FILE...\n"
+           "Compile SPIR-V shaders for an Intel GPU and report statistics.\n"
+           "The stage is taken from the file name (foo.frag.spv, foo.comp,\n"
+           "...) unless --stage is given.  GLSL can be compiled to SPIR-V\n"
+           "with glslangValidator -V first.\n\n"
+           "      --help             display this help and exit\n"
+           "  -p, --platform=NAME    compile for the given platform (3 letter\n"
+           "                         platform name or PCI id, default skl)\n"
+           "  -s, --stage=STAGE      stage of all shaders: vert, frag or comp\n"
+           "  -e, --entrypoint=NAME  name of the entry point (default main)\n"
+           "  -j, --jobs=N           number of compiler threads (default: one\n"
+           "                         per CPU)\n"
+           "  -n, --iterations=N     compile every shader N times\n"
+           "  -t, --pass-times       report the time spent in every pass\n"
+           "  -q, --quiet            don't print per-shader statistics\n"
+           "  -v, --verbose          also print performance warnings\n",
+           progname);
+}
+
+int
+main(int argc, char *argv[])
+{
+   struct gen_device_info devinfo;
+   const char *platform = "skl";
+   gl_shader_stage forced_stage = MESA_SHADER_NONE;
+   unsigned num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+   unsigned iterations = 1;
+   bool help = false, pass_times = false, quiet = false;
+   int c, i;
+   const struct option opts[] = {
+      { "help",       no_argument,       (int *) &help, true },
+      { "platform",   required_argument, NULL,          'p' },
+      { "stage",      required_argument, NULL,          's' },
+      { "entrypoint", required_argument, NULL,          'e' },
+      { "jobs",       required_argument, NULL,          'j' },
+      { "iterations", required_argument, NULL,          'n' },
+      { "pass-times", no_argument,       NULL,          't' },
+      { "quiet",      no_argument,       NULL,          'q' },
+      { "verbose",    no_argument,       NULL,          'v' },
+      { NULL,         0,                 NULL,          0 }
+   };
+
+   i = 0;
+   while ((c = getopt_long(argc, argv, "p:s:e:j:n:tqv", opts, &i)) != -1) {
+      switch (c) {
+      case 'p':
+         platform = optarg;
+         break;
+      case 's':
+         if (!stage_from_name(optarg, &forced_stage)) {
+            fprintf(stderr, "invalid stage: '%s', expected vert, frag or "
+                            "comp\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'e':
+         entrypoint = optarg;
+         break;
+      case 'j':
+         num_threads = MAX2(atoi(optarg), 1);
+         break;
+      case 'n':
+         iterations = MAX2(atoi(optarg), 1);
+         break;
+      case 't':
+         pass_times = true;
+         break;
+      case 'q':
+         quiet = true;
+         break;
+      case 'v':
+         verbose = true;
+         break;
+      case 0:
+         break;
+      default:
+         print_help(argv[0], stderr);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if (help || optind == argc) {
+      print_help(argv[0], help ? stdout : stderr);
+      exit(help ? EXIT_SUCCESS : EXIT_FAILURE);
+   }
+
+   int pci_id = gen_device_name_to_pci_device_id(platform);
+   if (pci_id < 0)
+      pci_id = strtol(platform, NULL, 16);
+   if (!gen_get_device_info(pci_id, &devinfo)) {
+      fprintf(stderr, "can't parse platform: '%s', expected ivb, byt, hsw, "
+                      "bdw, chv, skl, kbl, bxt, glk, cnl, icl or a PCI id\n",
+              platform);
+      exit(EXIT_FAILURE);
+   }
+   if (devinfo.gen < 7) {
+      fprintf(stderr, "SPIR-V shaders need gen7 or newer\n");
+      exit(EXIT_FAILURE);
+   }
+
+   brw_process_intel_debug_variable();
+
+   struct brw_compiler *brw = brw_compiler_create(NULL, &devinfo);
+   brw->shader_debug_log = shader_debug_log;
+   brw->shader_perf_log = shader_perf_log;
+   brw->shader_pass_time_log = pass_times ? shader_pass_time_log : NULL;
+   brw->supports_pull_constants = false;
+   brw->constant_buffer_0_is_relative = devinfo.gen < 8;
+   brw->supports_shader_constants = true;
+   compiler = brw;
+
+   const unsigned num_files = argc - optind;
+   struct shader_file *files = calloc(num_files, sizeof(*files));
+   for (unsigned f = 0; f < num_files; f++) {
+      files[f].path = argv[optind + f];
+      files[f].stage = forced_stage;
+
+      if (files[f].stage == MESA_SHADER_NONE &&
+          !stage_from_path(files[f].path, &files[f].stage)) {
+         fprintf(stderr, "%s: can't tell the stage from the file name, "
+                         "use --stage\n", files[f].path);
+         exit(EXIT_FAILURE);
+      }
+
+      if (!load_shader_file(&files[f]))
+         exit(EXIT_FAILURE);
+   }
+
+   const unsigned num_jobs = num_files * iterations;
+   struct compile_job *jobs = calloc(num_jobs, sizeof(*jobs));
+   struct util_queue queue;
+
+   if (!util_queue_init(&queue, "brw_compile", 64, num_threads, 0)) {
+      fprintf(stderr, "failed to create the compiler threads\n");
+      exit(EXIT_FAILURE);
+   }
+
+   int64_t start = os_time_get_nano();
+
+   for (unsigned j = 0; j < num_jobs; j++) {
+      jobs[j].file = &files[j % num_files];
+      jobs[j].print = j < num_files;
+      util_queue_fence_init(&jobs[j].fence);
+      util_queue_add_job(&queue, &jobs[j], &jobs[j].fence,
+                         compile_job_execute, NULL);
+   }
+
+   for (unsigned j = 0; j < num_jobs; j++)
+      util_queue_fence_wait(&jobs[j].fence);
+
+   int64_t elapsed = os_time_get_nano() - start;
+
+   util_queue_destroy(&queue);
+
+   struct compile_stats total = { 0 };
+   struct pass_time passes[MAX_PASSES];
+   unsigned num_passes = 0, failures = 0;
+
+   for (unsigned j = 0; j < num_jobs; j++) {
+      struct compile_job *job = &jobs[j];
+
+      if (job->print) {
+         if (!quiet && job->log)
+            fputs(job->log, stdout);
+         if (job->failed)
+            fprintf(stderr, "%s: error: %s\n", job->file->path, job->error);
+
+         failures += job->failed;
+         total.instructions += job->stats.instructions;
+         total.loops += job->stats.loops;
+         total.cycles += job->stats.cycles;
+         total.spills += job->stats.spills;
+         total.fills += job->stats.fills;
+      }
+
+      for (unsigned p = 0; p < job->num_passes; p++) {
+         unsigned k;
+         for (k = 0; k < num_passes; k++) {
+            if (!strcmp(passes[k].name, job->passes[p].name))
+               break;
+         }
+         if (k == num_passes) {
+            passes[k] = (struct pass_time) { .name = job->passes[p].name };
+            num_passes++;
+         }
+         passes[k].calls += job->passes[p].calls;
+         passes[k].ns += job->passes[p].ns;
+      }
+
+      util_queue_fence_destroy(&job->fence);
+      ralloc_free(job->log);
+      ralloc_free(job->error);
+   }
+
+   printf("%s (gen%d), %u threads: compiled %u shaders x %u in %.3f s, "
+          "%.1f shaders/s\n",
+          gen_get_device_name(pci_id), devinfo.gen, num_threads, num_files,
+          iterations, elapsed / 1e9, num_jobs / (elapsed / 1e9));
+   printf("total: %u inst, %u loops, %u cycles, %u:%u spills:fills, "
+          "%u failed\n", total.instructions, total.loops, total.cycles,
+          total.spills, total.fills, failures);
+
+   if (pass_times)
+      print_pass_times(passes, num_passes, iterations);
+
+   for (unsigned f = 0; f < num_files; f++)
+      free(files[f].spirv);
+   free(files);
+   free(jobs);
+   ralloc_free(brw);
+
+   return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -492,6 +492,16 @@ struct dd_function_table {
     */
    GLboolean (*LinkShader)(struct gl_context *ctx,
                            struct gl_shader_program *shader);
+
+   /**
+    * Called on the application's thread once a program linked by
+    * LinkShader is needed.  With GL_KHR_parallel_shader_compile, LinkShader
+    * may have run on a compiler thread, so any work that needs the
+    * driver's context (such as creating hardware shaders up front) belongs
+    * here rather than there.  Optional.
+    */
+   void (*FinishLinkShader)(struct gl_context *ctx,
+                            struct gl_shader_program *shader);
    /*@}*/
 
 
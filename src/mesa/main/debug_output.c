@@ -730,6 +730,38 @@ _mesa_unlock_debug_state(struct gl_context *ctx)
    simple_mtx_unlock(&ctx->DebugMutex);
 }
 
+/**
+ * Wait for the GL_KHR_parallel_shader_compile threads, which may be logging
+ * compiler messages, before the debug output state they'd see changes.
+ * Shaders are only compiled in the background while messages can't reach
+ * the application's callback, see _mesa_debug_output_is_synchronous().
+ */
+static void
+finish_shader_compiler_jobs(struct gl_context *ctx)
+{
+   if (util_queue_is_initialized(&ctx->ShaderCompilerQueue))
+      util_queue_finish(&ctx->ShaderCompilerQueue);
+}
+
+/**
+ * Return true if debug messages have to be generated on the application's
+ * thread: because they may be passed to its callback, or because it asked
+ * for GL_DEBUG_OUTPUT_SYNCHRONOUS.
+ */
+bool
+_mesa_debug_output_is_synchronous(struct gl_context *ctx)
+{
+   bool sync;
+
+   simple_mtx_lock(&ctx->DebugMutex);
+   sync = ctx->Debug &&
+          (ctx->Debug->SyncOutput ||
+           (ctx->Debug->DebugOutput && ctx->Debug->Callback));
+   simple_mtx_unlock(&ctx->DebugMutex);
+
+   return sync;
+}
+
 /**
  * Set the integer debug state specified by \p pname.  This can be called from
  * _mesa_set_enable for example.
@@ -737,7 +769,11 @@ _mesa_unlock_debug_state(struct gl_context *ctx)
 bool
 _mesa_set_debug_state_int(struct gl_context *ctx, GLenum pname, GLint val)
 {
-   struct gl_debug_state *debug = _mesa_lock_debug_state(ctx);
+   struct gl_debug_state *debug;
+
+   finish_shader_compiler_jobs(ctx);
+
+   debug = _mesa_lock_debug_state(ctx);
 
    if (!debug)
       return false;
@@ -1160,7 +1196,11 @@ void GLAPIENTRY
 _mesa_DebugMessageCallback(GLDEBUGPROC callback, const void *userParam)
 {
    GET_CURRENT_CONTEXT(ctx);
-   struct gl_debug_state *debug = _mesa_lock_debug_state(ctx);
+   struct gl_debug_state *debug;
+
+   finish_shader_compiler_jobs(ctx);
+
+   debug = _mesa_lock_debug_state(ctx);
    if (debug) {
       debug->Callback = callback;
       debug->CallbackData = userParam;
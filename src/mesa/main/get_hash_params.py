@@ -356,6 +356,9 @@ descriptor=[
   [ "CONTEXT_ROBUST_ACCESS", "CONTEXT_ENUM16(Const.RobustAccess), extra_KHR_robustness" ],
   [ "RESET_NOTIFICATION_STRATEGY_ARB", "CONTEXT_ENUM16(Const.ResetStrategy), extra_KHR_robustness_or_GL" ],
 
+# GL_KHR_parallel_shader_compile
+  [ "MAX_SHADER_COMPILER_THREADS_KHR", "CONTEXT_UINT(Hint.MaxShaderCompilerThreads), extra_KHR_parallel_shader_compile" ],
+
 # GL_NV_conservative_raster
   [ "SUBPIXEL_PRECISION_BIAS_X_BITS_NV", "CONTEXT_UINT(SubpixelPrecisionBias[0]), extra_NV_conservative_raster" ],
   [ "SUBPIXEL_PRECISION_BIAS_Y_BITS_NV", "CONTEXT_UINT(SubpixelPrecisionBias[1]), extra_NV_conservative_raster" ],
@@ -130,6 +130,22 @@ invalid_target:
    return;
 }
 
+/* GL_KHR_parallel_shader_compile */
+void GLAPIENTRY
+_mesa_MaxShaderCompilerThreadsKHR(GLuint count)
+{
+   GET_CURRENT_CONTEXT(ctx);
+
+   if (!ctx->Extensions.KHR_parallel_shader_compile) {
+      _mesa_error(ctx, GL_INVALID_OPERATION,
+                  "glMaxShaderCompilerThreadsKHR(not supported)");
+      return;
+   }
+
+   /* The compiler threads are resized the next time they are used. */
+   ctx->Hint.MaxShaderCompilerThreads = count;
+}
+
 
 /**********************************************************************/
 /*****                      Initialization                        *****/
@@ -146,4 +162,5 @@ void _mesa_init_hint( struct gl_context * ctx )
    ctx->Hint.TextureCompression = GL_DONT_CARE;
    ctx->Hint.GenerateMipmap = GL_DONT_CARE;
    ctx->Hint.FragmentShaderDerivative = GL_DONT_CARE;
+   ctx->Hint.MaxShaderCompilerThreads = 0xffffffff;
 }
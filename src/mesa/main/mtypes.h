@@ -49,6 +49,7 @@
 #include "compiler/glsl/list.h"
 #include "util/simple_mtx.h"
 #include "util/u_dynarray.h"
+#include "util/u_queue.h"
 
 
 #ifdef __cplusplus
@@ -585,6 +586,7 @@ struct gl_hint_attrib
    GLenum16 TextureCompression;   /**< GL_ARB_texture_compression */
    GLenum16 GenerateMipmap;       /**< GL_SGIS_generate_mipmap */
    GLenum16 FragmentShaderDerivative; /**< GL_ARB_fragment_shader */
+   GLuint MaxShaderCompilerThreads;   /**< GL_KHR_parallel_shader_compile */
 };
 
 
@@ -2568,6 +2570,16 @@ struct gl_shader
 
    enum gl_compile_status CompileStatus;
 
+   /**
+    * Signalled once a compile queued on a GL_KHR_parallel_shader_compile
+    * thread has finished.  Everything the compiler writes (CompileStatus,
+    * InfoLog, ir, ...) must not be read before waiting on it.
+    */
+   struct util_queue_fence CompileFence;
+
+   /** Number of queued links that may still read this shader's IR. */
+   unsigned PendingLinks;
+
 #ifdef DEBUG
    unsigned SourceChecksum;       /**< for debug/logging purposes */
 #endif
@@ -2927,6 +2939,19 @@ struct gl_shader_program
    GLuint NumShaders;          /**< number of attached shaders */
    struct gl_shader **Shaders; /**< List of attached the shaders */
 
+   /**
+    * Signalled once a link queued on a GL_KHR_parallel_shader_compile
+    * thread has finished.
+    */
+   struct util_queue_fence LinkFence;
+
+   /**
+    * Set while a queued link still needs to be completed on the application
+    * thread, see _mesa_wait_shader_program_link().  Accessed atomically, as
+    * contexts sharing the program may test and clear it concurrently.
+    */
+   bool LinkFinishPending;
+
    /**
     * User-defined attribute bindings
     *
@@ -4057,6 +4082,13 @@ struct gl_constants
 
    /** GL_ARB_gl_spirv */
    struct spirv_supported_capabilities SpirVCapabilities;
+
+   /**
+    * GL_KHR_parallel_shader_compile: the most threads the driver allows
+    * GLSL compiles and links to run on.  0 keeps them on the application
+    * thread.
+    */
+   GLuint MaxShaderCompilerThreads;
 };
 
 
@@ -4252,6 +4284,7 @@ struct gl_extensions
    GLboolean INTEL_performance_query;
    GLboolean KHR_blend_equation_advanced;
    GLboolean KHR_blend_equation_advanced_coherent;
+   GLboolean KHR_parallel_shader_compile;
    GLboolean KHR_robustness;
    GLboolean KHR_texture_compression_astc_hdr;
    GLboolean KHR_texture_compression_astc_ldr;
@@ -4758,6 +4791,14 @@ struct gl_context
 
    struct glthread_state *GLThread;
 
+   /**
+    * \name GL_KHR_parallel_shader_compile
+    */
+   /*@{*/
+   struct util_queue ShaderCompilerQueue;  /**< created on first use */
+   unsigned ShaderCompilerQueueThreads;    /**< threads it was created with */
+   /*@}*/
+
    struct gl_config Visual;
    struct gl_framebuffer *DrawBuffer;	/**< buffer for writing */
    struct gl_framebuffer *ReadBuffer;	/**< buffer for reading */
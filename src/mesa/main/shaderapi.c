@@ -41,6 +41,7 @@
 #include <c99_alloca.h>
 #include "main/glheader.h"
 #include "main/context.h"
+#include "main/debug_output.h"
 #include "main/enums.h"
 #include "main/glspirv.h"
 #include "main/hash.h"
@@ -61,6 +62,7 @@
 #include "program/prog_parameter.h"
 #include "util/ralloc.h"
 #include "util/hash_table.h"
+#include "util/u_atomic.h"
 #include "util/mesa-sha1.h"
 #include "util/crc32.h"
 
@@ -157,6 +159,8 @@ _mesa_init_shader_state(struct gl_context *ctx)
 void
 _mesa_free_shader_state(struct gl_context *ctx)
 {
+   _mesa_destroy_shader_compiler_queue(ctx);
+
    for (int i = 0; i < MESA_SHADER_STAGES; i++) {
       _mesa_reference_program(ctx, &ctx->Shader.CurrentProgram[i], NULL);
       _mesa_reference_shader_program(ctx,
@@ -658,7 +662,8 @@ get_programiv(struct gl_context *ctx, GLuint program, GLenum pname,
               GLint *params)
 {
    struct gl_shader_program *shProg
-      = _mesa_lookup_shader_program_err(ctx, program, "glGetProgramiv(program)");
+      = _mesa_lookup_shader_program_err_nowait(ctx, program,
+                                               "glGetProgramiv(program)");
 
    /* Is transform feedback available in this context?
     */
@@ -685,6 +690,15 @@ get_programiv(struct gl_context *ctx, GLuint program, GLenum pname,
       return;
    }
 
+   /* Polling GL_COMPLETION_STATUS_KHR must not wait for a queued link. */
+   if (pname == GL_COMPLETION_STATUS_KHR &&
+       ctx->Extensions.KHR_parallel_shader_compile) {
+      *params = util_queue_fence_is_signalled(&shProg->LinkFence);
+      return;
+   }
+
+   _mesa_wait_shader_program_link(ctx, shProg);
+
    switch (pname) {
    case GL_DELETE_STATUS:
       *params = shProg->DeletePending;
@@ -961,9 +975,11 @@ get_shaderiv(struct gl_context *ctx, GLuint name, GLenum pname, GLint *params)
       *params = shader->DeletePending;
       break;
    case GL_COMPILE_STATUS:
+      util_queue_fence_wait(&shader->CompileFence);
       *params = shader->CompileStatus ? GL_TRUE : GL_FALSE;
       break;
    case GL_INFO_LOG_LENGTH:
+      util_queue_fence_wait(&shader->CompileFence);
       *params = (shader->InfoLog && shader->InfoLog[0] != '\0') ?
          strlen(shader->InfoLog) + 1 : 0;
       break;
@@ -973,6 +989,13 @@ get_shaderiv(struct gl_context *ctx, GLuint name, GLenum pname, GLint *params)
    case GL_SPIR_V_BINARY_ARB:
       *params = (shader->spirv_data != NULL);
       break;
+   case GL_COMPLETION_STATUS_KHR:
+      if (!ctx->Extensions.KHR_parallel_shader_compile) {
+         _mesa_error(ctx, GL_INVALID_ENUM, "glGetShaderiv(pname)");
+         return;
+      }
+      *params = util_queue_fence_is_signalled(&shader->CompileFence);
+      break;
    default:
       _mesa_error(ctx, GL_INVALID_ENUM, "glGetShaderiv(pname)");
       return;
@@ -1029,6 +1052,7 @@ get_shader_info_log(struct gl_context *ctx, GLuint shader, GLsizei bufSize,
       return;
    }
 
+   util_queue_fence_wait(&sh->CompileFence);
    _mesa_copy_string(infoLog, bufSize, length, sh->InfoLog);
 }
 
@@ -1093,26 +1117,104 @@ set_shader_source(struct gl_shader *sh, const GLchar *source)
 
 
 /**
- * Compile a shader.
+ * Return the queue GL_KHR_parallel_shader_compile compiles and links are
+ * handed to, (re)creating its threads to match
+ * GL_MAX_SHADER_COMPILER_THREADS_KHR, or NULL if they have to run on the
+ * application's thread.
+ */
+static struct util_queue *
+get_shader_compiler_queue(struct gl_context *ctx)
+{
+   unsigned num_threads = MIN2(ctx->Hint.MaxShaderCompilerThreads,
+                               ctx->Const.MaxShaderCompilerThreads);
+
+   /* Compiler messages must reach the application's debug callback on the
+    * thread that made the GL call.  Not only debug contexts may install
+    * one, so check the live state.
+    */
+   if ((ctx->Const.ContextFlags & GL_CONTEXT_FLAG_DEBUG_BIT) ||
+       _mesa_debug_output_is_synchronous(ctx))
+      num_threads = 0;
+
+   if (num_threads != ctx->ShaderCompilerQueueThreads) {
+      _mesa_destroy_shader_compiler_queue(ctx);
+
+      if (num_threads &&
+          util_queue_init(&ctx->ShaderCompilerQueue, "glsl", 64, num_threads,
+                          UTIL_QUEUE_INIT_RESIZE_IF_FULL))
+         ctx->ShaderCompilerQueueThreads = num_threads;
+   }
+
+   return ctx->ShaderCompilerQueueThreads ? &ctx->ShaderCompilerQueue : NULL;
+}
+
+
+/**
+ * Wait for all queued compiles and links of this context and stop its
+ * compiler threads.  Jobs reference the context, so this must happen before
+ * it is destroyed.
  */
 void
-_mesa_compile_shader(struct gl_context *ctx, struct gl_shader *sh)
+_mesa_destroy_shader_compiler_queue(struct gl_context *ctx)
 {
-   if (!sh)
+   if (!util_queue_is_initialized(&ctx->ShaderCompilerQueue))
       return;
 
-   /* The GL_ARB_gl_spirv spec says:
-    *
-    *    "Add a new error for the CompileShader command:
-    *
-    *      An INVALID_OPERATION error is generated if the SPIR_V_BINARY_ARB
-    *      state of <shader> is TRUE."
-    */
-   if (sh->spirv_data) {
-      _mesa_error(ctx, GL_INVALID_OPERATION, "glCompileShader(SPIR-V)");
+   util_queue_finish(&ctx->ShaderCompilerQueue);
+   util_queue_destroy(&ctx->ShaderCompilerQueue);
+   memset(&ctx->ShaderCompilerQueue, 0, sizeof(ctx->ShaderCompilerQueue));
+   ctx->ShaderCompilerQueueThreads = 0;
+}
+
+
+/** A compile or link handed to a compiler thread. */
+struct shader_compiler_job
+{
+   struct gl_context *ctx;
+   struct gl_shader *sh;
+   struct gl_shader_program *shProg;
+};
+
+
+static void
+wait_for_link_cb(GLuint id, void *data, void *userData)
+{
+   struct gl_shader_program *shProg = (struct gl_shader_program *) data;
+   struct gl_shader *sh = (struct gl_shader *) userData;
+
+   if (shProg->Type != GL_SHADER_PROGRAM_MESA)
       return;
+
+   for (unsigned i = 0; i < shProg->NumShaders; i++) {
+      if (shProg->Shaders[i] == sh) {
+         util_queue_fence_wait(&shProg->LinkFence);
+         return;
+      }
    }
+}
+
+
+/**
+ * Wait until no compiler thread uses \p sh any more, before its source is
+ * replaced or it gets recompiled.
+ */
+static void
+wait_for_shader_idle(struct gl_context *ctx, struct gl_shader *sh)
+{
+   util_queue_fence_wait(&sh->CompileFence);
 
+   /* Rare: the shader is attached to programs whose link is still queued. */
+   if (p_atomic_read(&sh->PendingLinks))
+      _mesa_HashWalk(ctx->Shared->ShaderObjects, wait_for_link_cb, sh);
+}
+
+
+/**
+ * Compile a shader.  This is the part that may run on a compiler thread.
+ */
+static void
+compile_shader(struct gl_context *ctx, struct gl_shader *sh)
+{
    if (!sh->Source) {
       /* If the user called glCompileShader without first calling
        * glShaderSource, we should fail to compile, but not raise a GL_ERROR.
@@ -1170,12 +1272,211 @@ _mesa_compile_shader(struct gl_context *ctx, struct gl_shader *sh)
 }
 
 
+static void
+compile_shader_job(void *data, int thread_index)
+{
+   struct shader_compiler_job *job = (struct shader_compiler_job *) data;
+
+   compile_shader(job->ctx, job->sh);
+   free(job);
+}
+
+
 /**
- * Link a program's shaders.
+ * Compile a shader, on a compiler thread if \p queue is non-NULL.
+ */
+static void
+compile_shader_queued(struct gl_context *ctx, struct gl_shader *sh,
+                      struct util_queue *queue)
+{
+   if (!sh)
+      return;
+
+   /* The GL_ARB_gl_spirv spec says:
+    *
+    *    "Add a new error for the CompileShader command:
+    *
+    *      An INVALID_OPERATION error is generated if the SPIR_V_BINARY_ARB
+    *      state of <shader> is TRUE."
+    */
+   if (sh->spirv_data) {
+      _mesa_error(ctx, GL_INVALID_OPERATION, "glCompileShader(SPIR-V)");
+      return;
+   }
+
+   wait_for_shader_idle(ctx, sh);
+
+   if (queue && sh->Source) {
+      struct shader_compiler_job *job = malloc(sizeof(*job));
+
+      if (job) {
+         job->ctx = ctx;
+         job->sh = sh;
+         job->shProg = NULL;
+         util_queue_add_job(queue, job, &sh->CompileFence,
+                            compile_shader_job, NULL);
+         return;
+      }
+   }
+
+   compile_shader(ctx, sh);
+}
+
+
+/**
+ * Compile a shader.  The results are available when this returns.
+ */
+void
+_mesa_compile_shader(struct gl_context *ctx, struct gl_shader *sh)
+{
+   compile_shader_queued(ctx, sh, NULL);
+}
+
+
+/**
+ * Link a program once all of its shaders have finished compiling.  This is
+ * the part that may run on a compiler thread.
+ */
+static void
+link_shader_program(struct gl_context *ctx, struct gl_shader_program *shProg)
+{
+   for (unsigned i = 0; i < shProg->NumShaders; i++)
+      util_queue_fence_wait(&shProg->Shaders[i]->CompileFence);
+
+   _mesa_glsl_link_shader(ctx, shProg);
+}
+
+
+static void
+link_program_job(void *data, int thread_index)
+{
+   struct shader_compiler_job *job = (struct shader_compiler_job *) data;
+   struct gl_shader_program *shProg = job->shProg;
+
+   link_shader_program(job->ctx, shProg);
+
+   for (unsigned i = 0; i < shProg->NumShaders; i++)
+      p_atomic_dec(&shProg->Shaders[i]->PendingLinks);
+
+   free(job);
+}
+
+
+/**
+ * Hand the link of \p shProg to a compiler thread.  Returns false if it has
+ * to be linked right away instead.
+ */
+static bool
+queue_link_program(struct gl_context *ctx, struct gl_shader_program *shProg,
+                   struct util_queue *queue)
+{
+   /* Only programs nobody else holds a reference to can be linked in the
+    * background: anything bound through glUseProgram, a pipeline object or
+    * glActiveShaderProgram would otherwise see the program change under it.
+    */
+   if (!queue || shProg->RefCount != 1 || shProg->DeletePending)
+      return false;
+
+   for (unsigned i = 0; i < shProg->NumShaders; i++) {
+      if (shProg->Shaders[i]->spirv_data)
+         return false;
+   }
+
+   struct shader_compiler_job *job = malloc(sizeof(*job));
+   if (!job)
+      return false;
+
+   /* Freeing the previous executable may have to destroy driver shaders,
+    * which needs the driver context, so do it here rather than on the
+    * compiler thread.
+    */
+   _mesa_clear_shader_program_data(ctx, shProg);
+
+   for (unsigned i = 0; i < shProg->NumShaders; i++)
+      p_atomic_inc(&shProg->Shaders[i]->PendingLinks);
+
+   job->ctx = ctx;
+   job->sh = NULL;
+   job->shProg = shProg;
+   p_atomic_set(&shProg->LinkFinishPending, true);
+   util_queue_add_job(queue, job, &shProg->LinkFence, link_program_job, NULL);
+   return true;
+}
+
+
+/**
+ * Everything after the actual link that has to happen on the application's
+ * thread.
+ */
+static void
+finish_link_program(struct gl_context *ctx, struct gl_shader_program *shProg)
+{
+   if (shProg->data->LinkStatus && ctx->Driver.FinishLinkShader)
+      ctx->Driver.FinishLinkShader(ctx, shProg);
+
+   /* Capture .shader_test files. */
+   const char *capture_path = _mesa_get_shader_capture_path();
+   if (shProg->Name != 0 && shProg->Name != ~0 && capture_path != NULL) {
+      FILE *file;
+      char *filename = ralloc_asprintf(NULL, "%s/%u.shader_test",
+                                       capture_path, shProg->Name);
+      file = fopen(filename, "w");
+      if (file) {
+         fprintf(file, "[require]\nGLSL%s >= %u.%02u\n",
+                 shProg->IsES ? " ES" : "",
+                 shProg->data->Version / 100, shProg->data->Version % 100);
+         if (shProg->SeparateShader)
+            fprintf(file, "GL_ARB_separate_shader_objects\nSSO ENABLED\n");
+         fprintf(file, "\n");
+
+         for (unsigned i = 0; i < shProg->NumShaders; i++) {
+            fprintf(file, "[%s shader]\n%s\n",
+                    _mesa_shader_stage_to_string(shProg->Shaders[i]->Stage),
+                    shProg->Shaders[i]->Source);
+         }
+         fclose(file);
+      } else {
+         _mesa_warning(ctx, "Failed to open %s", filename);
+      }
+
+      ralloc_free(filename);
+   }
+
+   if (shProg->data->LinkStatus == LINKING_FAILURE &&
+       (ctx->_Shader->Flags & GLSL_REPORT_ERRORS)) {
+      _mesa_debug(ctx, "Error linking program %u:\n%s\n",
+                  shProg->Name, shProg->data->InfoLog);
+   }
+}
+
+
+/**
+ * Wait for a link queued on a compiler thread to finish, and complete it.
+ * Called whenever a program object is looked up by name.
+ */
+void
+_mesa_wait_shader_program_link(struct gl_context *ctx,
+                               struct gl_shader_program *shProg)
+{
+   if (!p_atomic_read(&shProg->LinkFinishPending))
+      return;
+
+   /* Contexts sharing the program may get here at the same time; all of
+    * them wait, but only one finishes the link.
+    */
+   util_queue_fence_wait(&shProg->LinkFence);
+   if (p_atomic_cmpxchg(&shProg->LinkFinishPending, true, false))
+      finish_link_program(ctx, shProg);
+}
+
+
+/**
+ * Link a program's shaders, on a compiler thread if \p queue is non-NULL
+ * and the program isn't in use.
  */
 static ALWAYS_INLINE void
 link_program(struct gl_context *ctx, struct gl_shader_program *shProg,
-             bool no_error)
+             struct util_queue *queue, bool no_error)
 {
    if (!shProg)
       return;
@@ -1203,7 +1504,11 @@ link_program(struct gl_context *ctx, struct gl_shader_program *shProg,
    }
 
    FLUSH_VERTICES(ctx, 0);
-   _mesa_glsl_link_shader(ctx, shProg);
+
+   if (!programs_in_use && queue_link_program(ctx, shProg, queue))
+      return;
+
+   link_shader_program(ctx, shProg);
 
    /* From section 7.3 (Program Objects) of the OpenGL 4.5 spec:
     *
@@ -1227,39 +1532,7 @@ link_program(struct gl_context *ctx, struct gl_shader_program *shProg,
       }
    }
 
-   /* Capture .shader_test files. */
-   const char *capture_path = _mesa_get_shader_capture_path();
-   if (shProg->Name != 0 && shProg->Name != ~0 && capture_path != NULL) {
-      FILE *file;
-      char *filename = ralloc_asprintf(NULL, "%s/%u.shader_test",
-                                       capture_path, shProg->Name);
-      file = fopen(filename, "w");
-      if (file) {
-         fprintf(file, "[require]\nGLSL%s >= %u.%02u\n",
-                 shProg->IsES ? " ES" : "",
-                 shProg->data->Version / 100, shProg->data->Version % 100);
-         if (shProg->SeparateShader)
-            fprintf(file, "GL_ARB_separate_shader_objects\nSSO ENABLED\n");
-         fprintf(file, "\n");
-
-         for (unsigned i = 0; i < shProg->NumShaders; i++) {
-            fprintf(file, "[%s shader]\n%s\n",
-                    _mesa_shader_stage_to_string(shProg->Shaders[i]->Stage),
-                    shProg->Shaders[i]->Source);
-         }
-         fclose(file);
-      } else {
-         _mesa_warning(ctx, "Failed to open %s", filename);
-      }
-
-      ralloc_free(filename);
-   }
-
-   if (shProg->data->LinkStatus == LINKING_FAILURE &&
-       (ctx->_Shader->Flags & GLSL_REPORT_ERRORS)) {
-      _mesa_debug(ctx, "Error linking program %u:\n%s\n",
-                  shProg->Name, shProg->data->InfoLog);
-   }
+   finish_link_program(ctx, shProg);
 
    _mesa_update_vertex_processing_mode(ctx);
 
@@ -1281,23 +1554,28 @@ link_program(struct gl_context *ctx, struct gl_shader_program *shProg,
 
 
 static void
-link_program_error(struct gl_context *ctx, struct gl_shader_program *shProg)
+link_program_error(struct gl_context *ctx, struct gl_shader_program *shProg,
+                   struct util_queue *queue)
 {
-   link_program(ctx, shProg, false);
+   link_program(ctx, shProg, queue, false);
 }
 
 
 static void
-link_program_no_error(struct gl_context *ctx, struct gl_shader_program *shProg)
+link_program_no_error(struct gl_context *ctx, struct gl_shader_program *shProg,
+                      struct util_queue *queue)
 {
-   link_program(ctx, shProg, true);
+   link_program(ctx, shProg, queue, true);
 }
 
 
+/**
+ * Link a program.  The results are available when this returns.
+ */
 void
 _mesa_link_program(struct gl_context *ctx, struct gl_shader_program *shProg)
 {
-   link_program_error(ctx, shProg);
+   link_program_error(ctx, shProg, NULL);
 }
 
 
@@ -1478,8 +1756,9 @@ _mesa_CompileShader(GLuint shaderObj)
    GET_CURRENT_CONTEXT(ctx);
    if (MESA_VERBOSE & VERBOSE_API)
       _mesa_debug(ctx, "glCompileShader %u\n", shaderObj);
-   _mesa_compile_shader(ctx, _mesa_lookup_shader_err(ctx, shaderObj,
-                                                     "glCompileShader"));
+   compile_shader_queued(ctx, _mesa_lookup_shader_err(ctx, shaderObj,
+                                                      "glCompileShader"),
+                         get_shader_compiler_queue(ctx));
 }
 
 
@@ -1761,7 +2040,7 @@ _mesa_LinkProgram_no_error(GLuint programObj)
 
    struct gl_shader_program *shProg =
       _mesa_lookup_shader_program(ctx, programObj);
-   link_program_no_error(ctx, shProg);
+   link_program_no_error(ctx, shProg, get_shader_compiler_queue(ctx));
 }
 
 
@@ -1775,7 +2054,7 @@ _mesa_LinkProgram(GLuint programObj)
 
    struct gl_shader_program *shProg =
       _mesa_lookup_shader_program_err(ctx, programObj, "glLinkProgram");
-   link_program_error(ctx, shProg);
+   link_program_error(ctx, shProg, get_shader_compiler_queue(ctx));
 }
 
 #ifdef ENABLE_SHADER_CACHE
@@ -1980,6 +2259,8 @@ shader_source(struct gl_context *ctx, GLuint shaderObj, GLsizei count,
    }
 #endif /* ENABLE_SHADER_CACHE */
 
+   /* A queued compile or link may still be reading the old source. */
+   wait_for_shader_idle(ctx, sh);
    set_shader_source(sh, source);
 
    free(offsets);
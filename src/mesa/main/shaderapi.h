@@ -69,6 +69,13 @@ _mesa_compile_shader(struct gl_context *ctx, struct gl_shader *sh);
 extern void
 _mesa_link_program(struct gl_context *ctx, struct gl_shader_program *sh_prog);
 
+extern void
+_mesa_wait_shader_program_link(struct gl_context *ctx,
+                               struct gl_shader_program *shProg);
+
+extern void
+_mesa_destroy_shader_compiler_queue(struct gl_context *ctx);
+
 extern unsigned
 _mesa_count_active_attribs(struct gl_shader_program *shProg);
 
@@ -150,17 +150,17 @@ st_delete_program(struct gl_context *ctx, struct gl_program *prog)
 
 
 /**
- * Called via ctx->Driver.ProgramStringNotify()
- * Called when the program's text/code is changed.  We have to free
+ * Translate a program whose text/code has changed.  We have to free
  * all shader variants and corresponding gallium shaders when this happens.
+ *
+ * This only talks to the screen, not the pipe context, so it may be called
+ * from a GL_KHR_parallel_shader_compile link thread.
  */
-static GLboolean
-st_program_string_notify( struct gl_context *ctx,
-                                           GLenum target,
-                                           struct gl_program *prog )
+GLboolean
+st_translate_program_string(struct gl_context *ctx, GLenum target,
+                            struct gl_program *prog)
 {
    struct st_context *st = st_context(ctx);
-   gl_shader_stage stage = _mesa_program_enum_to_shader_stage(target);
 
    if (target == GL_FRAGMENT_PROGRAM_ARB) {
       struct st_fragment_program *stfp = (struct st_fragment_program *) prog;
@@ -245,13 +245,58 @@ st_program_string_notify( struct gl_context *ctx,
          st->dirty |= stfp->affected_states;
    }
 
+   return GL_TRUE;
+}
+
+
+/**
+ * Create the default variant up front if the driver wants it, so that the
+ * first draw doesn't have to.
+ */
+static void
+st_maybe_precompile_program(struct st_context *st, struct gl_program *prog)
+{
    if (ST_DEBUG & DEBUG_PRECOMPILE ||
-       st->shader_has_one_variant[stage])
+       st->shader_has_one_variant[prog->info.stage])
       st_precompile_shader_variant(st, prog);
+}
 
+
+/**
+ * Called via ctx->Driver.ProgramStringNotify()
+ * Called when the program's text/code is changed.
+ */
+static GLboolean
+st_program_string_notify( struct gl_context *ctx,
+                                           GLenum target,
+                                           struct gl_program *prog )
+{
+   if (!st_translate_program_string(ctx, target, prog))
+      return false;
+
+   st_maybe_precompile_program(st_context(ctx), prog);
    return GL_TRUE;
 }
 
+
+/**
+ * Called via ctx->Driver.FinishLinkShader()
+ * Precompiling needs the pipe context, so it's deferred from st_link_shader
+ * until we're back on the application thread.
+ */
+static void
+st_finish_link_shader(struct gl_context *ctx, struct gl_shader_program *prog)
+{
+   struct st_context *st = st_context(ctx);
+
+   for (unsigned i = 0; i < MESA_SHADER_STAGES; i++) {
+      struct gl_linked_shader *shader = prog->_LinkedShaders[i];
+
+      if (shader && shader->Program)
+         st_maybe_precompile_program(st, shader->Program);
+   }
+}
+
 /**
  * Called via ctx->Driver.NewATIfs()
  * Called in glEndFragmentShaderATI()
@@ -278,4 +323,5 @@ st_init_program_functions(struct dd_function_table *functions)
    functions->NewATIfs = st_new_ati_fs;
    
    functions->LinkShader = st_link_shader;
+   functions->FinishLinkShader = st_finish_link_shader;
 }
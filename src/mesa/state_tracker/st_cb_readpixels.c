@@ -32,6 +32,7 @@
 #include "main/readpix.h"
 #include "main/enums.h"
 #include "main/framebuffer.h"
+#include "main/glformats.h"
 #include "util/u_inlines.h"
 #include "util/u_format.h"
 #include "cso_cache/cso_context.h"
@@ -40,6 +41,7 @@
 #include "st_atom.h"
 #include "st_context.h"
 #include "st_cb_bitmap.h"
+#include "st_cb_bufferobjects.h"
 #include "st_cb_readpixels.h"
 #include "st_debug.h"
 #include "state_tracker/st_cb_texture.h"
@@ -251,6 +253,70 @@ fail:
    return success;
 }
 
+/**
+ * Let the driver copy the pixels into the PBO on its own, which it may do
+ * asynchronously once the pending rendering is done.  This is for drivers
+ * that prefer CPU copies, where mapping the renderbuffer would wait for
+ * all rendering to finish.
+ */
+static bool
+try_driver_pbo_readpixels(struct st_context *st, struct st_renderbuffer *strb,
+                          bool invert_y,
+                          GLint x, GLint y, GLsizei width, GLsizei height,
+                          GLenum format, GLenum type,
+                          const struct gl_pixelstore_attrib *pack,
+                          void *pixels)
+{
+   struct gl_context *ctx = st->ctx;
+   struct pipe_context *pipe = st->pipe;
+   struct pipe_resource *texture = strb->texture;
+   struct pipe_surface *surface = strb->surface;
+   struct gl_renderbuffer *rb = &strb->Base;
+   enum pipe_format src_format, dst_format;
+   struct pipe_box box;
+   GLintptr offset;
+   int stride;
+
+   if (!pipe->read_texture_to_buffer || !texture || !surface)
+      return false;
+
+   if (!_mesa_is_color_format(format) ||
+       rb->_BaseFormat != _mesa_get_format_base_format(rb->Format) ||
+       _mesa_readpixels_needs_slow_path(ctx, format, type, GL_TRUE) ||
+       needs_integer_signed_unsigned_conversion(ctx, format, type))
+      return false;
+
+   /* Interpret the texels the same way as the blit path does. */
+   src_format = util_format_linear(texture->format);
+   src_format = util_format_luminance_to_red(src_format);
+   src_format = util_format_intensity_to_red(src_format);
+
+   dst_format = st_choose_matching_format(st, 0, format, type,
+                                          pack->SwapBytes);
+   if (dst_format == PIPE_FORMAT_NONE)
+      return false;
+
+   /* "pixels" is an offset into the PBO */
+   offset = (GLintptr) _mesa_image_address2d(pack, pixels, width, height,
+                                             format, type, 0, 0);
+   stride = _mesa_image_row_stride(pack, width, format, type);
+
+   if (invert_y) {
+      y = rb->Height - y - height;
+      offset += (GLintptr) (height - 1) * stride;
+      stride = -stride;
+   }
+
+   u_box_2d_zslice(x, y, surface->u.tex.first_layer, width, height, &box);
+
+   return pipe->read_texture_to_buffer(pipe,
+                                       st_buffer_object(pack->BufferObj)->buffer,
+                                       offset, stride, dst_format,
+                                       texture, src_format,
+                                       surface->u.tex.level, &box);
+}
+
+
 /**
  * Create a staging texture and blit the requested region to it.
  */
@@ -417,6 +483,13 @@ st_ReadPixels(struct gl_context *ctx, GLint x, GLint y,
    st_validate_state(st, ST_PIPELINE_UPDATE_FRAMEBUFFER);
    st_flush_bitmap_cache(st);
 
+   if (_mesa_is_bufferobj(pack->BufferObj) &&
+       try_driver_pbo_readpixels(st, strb,
+                                 st_fb_orientation(ctx->ReadBuffer) == Y_0_TOP,
+                                 x, y, width, height, format, type,
+                                 pack, pixels))
+      return;
+
    if (!st->prefer_blit_based_texture_transfer) {
       goto fallback;
    }
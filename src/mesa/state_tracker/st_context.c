@@ -31,6 +31,7 @@
 #include "main/context.h"
 #include "main/glthread.h"
 #include "main/samplerobj.h"
+#include "main/shaderapi.h"
 #include "main/shaderobj.h"
 #include "main/version.h"
 #include "main/vtxfmt.h"
@@ -629,6 +630,9 @@ st_destroy_context(struct st_context *st)
    /* This must be called first so that glthread has a chance to finish */
    _mesa_glthread_destroy(ctx);
 
+   /* Background shader compiles and links may still reference our programs */
+   _mesa_destroy_shader_compiler_queue(ctx);
+
    _mesa_HashWalk(ctx->Shared->TexObjects, destroy_tex_sampler_cb, st);
 
    st_reference_fragprog(st, &st->fp, NULL);
@@ -37,6 +37,7 @@
 #include "pipe/p_defines.h"
 #include "pipe/p_screen.h"
 #include "tgsi/tgsi_from_mesa.h"
+#include "util/u_cpu_detect.h"
 #include "util/u_math.h"
 
 #include "st_context.h"
@@ -1326,6 +1327,13 @@ void st_init_extensions(struct pipe_screen *screen,
 
    extensions->KHR_robustness = extensions->ARB_robust_buffer_access_behavior;
 
+   /* GLSL compiling and linking is CPU work in the state tracker, so allow
+    * one background compiler thread per core.
+    */
+   util_cpu_detect();
+   consts->MaxShaderCompilerThreads = util_cpu_caps.nr_cpus;
+   extensions->KHR_parallel_shader_compile = GL_TRUE;
+
    /* If we support ES 3.1, we support the ES3_1_compatibility ext. However
     * there's no clean way of telling whether we would support ES 3.1 from
     * here, so copy the condition from compute_version_es2 here. A lot of
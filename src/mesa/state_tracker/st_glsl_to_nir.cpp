@@ -767,9 +767,9 @@ st_link_nir(struct gl_context *ctx,
       st_glsl_to_nir_post_opts(st, shader->Program, shader_program);
 
       assert(shader->Program);
-      if (!ctx->Driver.ProgramStringNotify(ctx,
-                                           _mesa_shader_stage_to_program(i),
-                                           shader->Program)) {
+      if (!st_translate_program_string(ctx,
+                                       _mesa_shader_stage_to_program(i),
+                                       shader->Program)) {
          _mesa_reference_program(ctx, &shader->Program, NULL);
          return false;
       }
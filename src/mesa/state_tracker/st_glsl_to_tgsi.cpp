@@ -7247,9 +7247,12 @@ st_link_shader(struct gl_context *ctx, struct gl_shader_program *prog)
       st_set_prog_affected_state_flags(linked_prog);
 
       if (linked_prog) {
-         if (!ctx->Driver.ProgramStringNotify(ctx,
-                                              _mesa_shader_stage_to_program(i),
-                                              linked_prog)) {
+         /* The precompile happens later in Driver.FinishLinkShader, since
+          * this may be running on a parallel shader compile thread.
+          */
+         if (!st_translate_program_string(ctx,
+                                          _mesa_shader_stage_to_program(i),
+                                          linked_prog)) {
             _mesa_reference_program(ctx, &shader->Program, NULL);
             return GL_FALSE;
          }
@@ -460,6 +460,10 @@ extern void
 st_precompile_shader_variant(struct st_context *st,
                              struct gl_program *prog);
 
+extern GLboolean
+st_translate_program_string(struct gl_context *ctx, GLenum target,
+                            struct gl_program *prog);
+
 #ifdef __cplusplus
 }
 #endif
@@ -366,8 +366,18 @@ st_deserialise_ir_program(struct gl_context *ctx,
 
    st_set_prog_affected_state_flags(prog);
    _mesa_associate_uniform_storage(ctx, shProg, prog, false);
+}
+
+/**
+ * Create Gallium shaders now instead of on demand.  The disk cache path
+ * leaves this to Driver.FinishLinkShader because it may be running on a
+ * parallel shader compile thread; glProgramBinary does it here.
+ */
+static void
+st_precompile_binary_program(struct gl_context *ctx, struct gl_program *prog)
+{
+   struct st_context *st = st_context(ctx);
 
-   /* Create Gallium shaders now instead of on demand. */
    if (ST_DEBUG & DEBUG_PRECOMPILE ||
        st->shader_has_one_variant[prog->info.stage])
       st_precompile_shader_variant(st, prog);
@@ -428,6 +438,7 @@ st_deserialise_tgsi_program(struct gl_context *ctx,
                             struct gl_program *prog)
 {
    st_deserialise_ir_program(ctx, shProg, prog, false);
+   st_precompile_binary_program(ctx, prog);
 }
 
 void
@@ -450,4 +461,5 @@ st_deserialise_nir_program(struct gl_context *ctx,
                            struct gl_program *prog)
 {
    st_deserialise_ir_program(ctx, shProg, prog, true);
+   st_precompile_binary_program(ctx, prog);
 }
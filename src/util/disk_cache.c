@@ -37,7 +37,6 @@
 #include <pwd.h>
 #include <errno.h>
 #include <dirent.h>
-#include "zlib.h"
 
 #include "util/crc32.h"
 #include "util/debug.h"
@@ -50,6 +49,8 @@
 #include "main/errors.h"
 
 #include "disk_cache.h"
+#include "disk_cache_codec.h"
+#include "disk_cache_pack.h"
 
 /* Number of bits to mask off from a cache key to get an index. */
 #define CACHE_INDEX_KEY_BITS 16
@@ -72,7 +73,7 @@
  * - There is no strict requirement that cache versions be backwards
  *   compatible but effort should be taken to limit disruption where possible.
  */
-#define CACHE_VERSION 1
+#define CACHE_VERSION 2
 
 struct disk_cache {
    /* The path to the cache directory. */
@@ -82,6 +83,22 @@ struct disk_cache {
    /* Thread queue for compressing and writing cache entries to disk */
    struct util_queue cache_queue;
 
+   /* Single-file storage of the cache entries, NULL if they are stored as
+    * individual files.
+    */
+   struct disk_cache_pack *pack;
+
+   /* Prebuilt, read-only pack that is looked at before the cache itself. */
+   struct disk_cache_pack *bundle;
+
+   /* Codec used to compress new entries. */
+   enum disk_cache_codec codec;
+
+   /* Number of put jobs queued for the pack, pending entries are flushed
+    * once this drops to zero.
+    */
+   int pack_jobs;
+
    /* Seed for rand, which is used to pick a random directory */
    uint64_t seed_xorshift128plus[2];
 
@@ -370,6 +387,14 @@ disk_cache_create(const char *gpu_name, const char *timestamp,
 
    cache->max_size = max_size;
 
+   cache->codec = disk_cache_codec_choose();
+
+   /* At user request, store all entries in a single pack file. Stay with
+    * individual files if the pack can't be opened.
+    */
+   if (env_var_as_boolean("MESA_GLSL_CACHE_PACK", false))
+      cache->pack = disk_cache_pack_open(cache, cache->path, max_size);
+
    /* 1 thread was chosen because we don't really care about getting things
     * to disk quickly just that it's not blocking other tasks.
     *
@@ -414,6 +439,11 @@ disk_cache_create(const char *gpu_name, const char *timestamp,
    DRV_KEY_CPY(drv_key_blob, &ptr_size, ptr_size_size)
    DRV_KEY_CPY(drv_key_blob, &driver_flags, driver_flags_size)
 
+   /* A prebuilt bundle is usable even if the cache directory isn't. */
+   char *bundle = getenv("MESA_GLSL_CACHE_BUNDLE");
+   if (bundle)
+      cache->bundle = disk_cache_pack_open_bundle(cache, bundle);
+
    /* Seed our rand function */
    s_rand_xorshift128plus(cache->seed_xorshift128plus, true);
 
@@ -436,9 +466,13 @@ disk_cache_destroy(struct disk_cache *cache)
 {
    if (cache && !cache->path_init_failed) {
       util_queue_destroy(&cache->cache_queue);
+      disk_cache_pack_close(cache->pack);
       munmap(cache->index_mmap, cache->index_mmap_size);
    }
 
+   if (cache)
+      disk_cache_pack_close(cache->bundle);
+
    ralloc_free(cache);
 }
 
@@ -671,6 +705,11 @@ disk_cache_remove(struct disk_cache *cache, const cache_key key)
 {
    struct stat sb;
 
+   if (cache->pack) {
+      disk_cache_pack_remove(cache->pack, key);
+      return;
+   }
+
    char *filename = get_cache_file(cache, key);
    if (filename == NULL) {
       return;
@@ -718,75 +757,6 @@ write_all(int fd, const void *buf, size_t count)
    return done;
 }
 
-/* From the zlib docs:
- *    "If the memory is available, buffers sizes on the order of 128K or 256K
- *    bytes should be used."
- */
-#define BUFSIZE 256 * 1024
-
-/**
- * Compresses cache entry in memory and writes it to disk. Returns the size
- * of the data written to disk.
- */
-static size_t
-deflate_and_write_to_disk(const void *in_data, size_t in_data_size, int dest,
-                          const char *filename)
-{
-   unsigned char out[BUFSIZE];
-
-   /* allocate deflate state */
-   z_stream strm;
-   strm.zalloc = Z_NULL;
-   strm.zfree = Z_NULL;
-   strm.opaque = Z_NULL;
-   strm.next_in = (uint8_t *) in_data;
-   strm.avail_in = in_data_size;
-
-   int ret = deflateInit(&strm, Z_BEST_COMPRESSION);
-   if (ret != Z_OK)
-       return 0;
-
-   /* compress until end of in_data */
-   size_t compressed_size = 0;
-   int flush;
-   do {
-      int remaining = in_data_size - BUFSIZE;
-      flush = remaining > 0 ? Z_NO_FLUSH : Z_FINISH;
-      in_data_size -= BUFSIZE;
-
-      /* Run deflate() on input until the output buffer is not full (which
-       * means there is no more data to deflate).
-       */
-      do {
-         strm.avail_out = BUFSIZE;
-         strm.next_out = out;
-
-         ret = deflate(&strm, flush);    /* no bad return value */
-         assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
-
-         size_t have = BUFSIZE - strm.avail_out;
-         compressed_size += have;
-
-         ssize_t written = write_all(dest, out, have);
-         if (written == -1) {
-            (void)deflateEnd(&strm);
-            return 0;
-         }
-      } while (strm.avail_out == 0);
-
-      /* all input should be used */
-      assert(strm.avail_in == 0);
-
-   } while (flush != Z_FINISH);
-
-   /* stream should be complete */
-   assert(ret == Z_STREAM_END);
-
-   /* clean up and return */
-   (void)deflateEnd(&strm);
-   return compressed_size;
-}
-
 static struct disk_cache_put_job *
 create_put_job(struct disk_cache *cache, const cache_key key,
                const void *data, size_t size,
@@ -846,8 +816,68 @@ destroy_put_job(void *job, int thread_index)
 struct cache_entry_file_data {
    uint32_t crc32;
    uint32_t uncompressed_size;
+   uint32_t codec;
 };
 
+/**
+ * Lays out a cache entry in memory: the driver keys, the cache item
+ * metadata, the CRC and size of the data, and finally the compressed data.
+ * Returns a malloc'ed buffer, or NULL on failure.
+ */
+static uint8_t *
+serialize_cache_entry(struct disk_cache_put_job *dc_job, size_t *size)
+{
+   struct disk_cache *cache = dc_job->cache;
+   struct cache_item_metadata *md = &dc_job->cache_item_metadata;
+
+   size_t md_size = sizeof(uint32_t);
+   if (md->type == CACHE_ITEM_TYPE_GLSL)
+      md_size += sizeof(uint32_t) + md->num_keys * sizeof(cache_key);
+
+   /* Create CRC of the data. We will read this when restoring the cache and
+    * use it to check for corruption.
+    */
+   struct cache_entry_file_data cf_data;
+   cf_data.crc32 = util_hash_crc32(dc_job->data, dc_job->size);
+   cf_data.uncompressed_size = dc_job->size;
+   cf_data.codec = cache->codec;
+
+   size_t header_size = cache->driver_keys_blob_size + md_size +
+                        sizeof(cf_data);
+   size_t max_compressed_size =
+      disk_cache_codec_max_compressed_size(cache->codec, dc_job->size);
+
+   uint8_t *entry = malloc(header_size + max_compressed_size);
+   if (!entry)
+      return NULL;
+
+   /* The driver_keys_blob can be used find information about the mesa
+    * version that produced the entry or deal with hash collisions, should
+    * that ever become a real problem. The cache item metadata can be used
+    * to deal with hash collisions, as well as providing useful information
+    * to 3rd party tools reading the cache files.
+    */
+   uint8_t *p = entry;
+   DRV_KEY_CPY(p, cache->driver_keys_blob, cache->driver_keys_blob_size)
+   DRV_KEY_CPY(p, &md->type, sizeof(uint32_t))
+   if (md->type == CACHE_ITEM_TYPE_GLSL) {
+      DRV_KEY_CPY(p, &md->num_keys, sizeof(uint32_t))
+      DRV_KEY_CPY(p, md->keys, md->num_keys * sizeof(cache_key))
+   }
+   DRV_KEY_CPY(p, &cf_data, sizeof(cf_data))
+
+   size_t compressed_size =
+      disk_cache_codec_compress(cache->codec, dc_job->data, dc_job->size,
+                                p, max_compressed_size);
+   if (compressed_size == 0 && dc_job->size != 0) {
+      free(entry);
+      return NULL;
+   }
+
+   *size = header_size + compressed_size;
+   return entry;
+}
+
 static void
 cache_put(void *job, int thread_index)
 {
@@ -856,6 +886,8 @@ cache_put(void *job, int thread_index)
    int fd = -1, fd_final = -1, err, ret;
    unsigned i = 0;
    char *filename = NULL, *filename_tmp = NULL;
+   uint8_t *entry;
+   size_t entry_size;
    struct disk_cache_put_job *dc_job = (struct disk_cache_put_job *) job;
 
    filename = get_cache_file(dc_job->cache, dc_job->key);
@@ -916,69 +948,23 @@ cache_put(void *job, int thread_index)
     * by some other process.
     */
 
-   /* Write the driver_keys_blob, this can be used find information about the
-    * mesa version that produced the entry or deal with hash collisions,
-    * should that ever become a real problem.
+   /* Write out the whole entry to the temporary file, then rename it
+    * atomically to the destination filename, and also perform an atomic
+    * increment of the total cache size.
     */
-   ret = write_all(fd, dc_job->cache->driver_keys_blob,
-                   dc_job->cache->driver_keys_blob_size);
-   if (ret == -1) {
+   entry = serialize_cache_entry(dc_job, &entry_size);
+   if (entry == NULL) {
       unlink(filename_tmp);
       goto done;
    }
 
-   /* Write the cache item metadata. This data can be used to deal with
-    * hash collisions, as well as providing useful information to 3rd party
-    * tools reading the cache files.
-    */
-   ret = write_all(fd, &dc_job->cache_item_metadata.type,
-                   sizeof(uint32_t));
-   if (ret == -1) {
-      unlink(filename_tmp);
-      goto done;
-   }
-
-   if (dc_job->cache_item_metadata.type == CACHE_ITEM_TYPE_GLSL) {
-      ret = write_all(fd, &dc_job->cache_item_metadata.num_keys,
-                      sizeof(uint32_t));
-      if (ret == -1) {
-         unlink(filename_tmp);
-         goto done;
-      }
-
-      ret = write_all(fd, dc_job->cache_item_metadata.keys[0],
-                      dc_job->cache_item_metadata.num_keys *
-                      sizeof(cache_key));
-      if (ret == -1) {
-         unlink(filename_tmp);
-         goto done;
-      }
-   }
-
-   /* Create CRC of the data. We will read this when restoring the cache and
-    * use it to check for corruption.
-    */
-   struct cache_entry_file_data cf_data;
-   cf_data.crc32 = util_hash_crc32(dc_job->data, dc_job->size);
-   cf_data.uncompressed_size = dc_job->size;
-
-   size_t cf_data_size = sizeof(cf_data);
-   ret = write_all(fd, &cf_data, cf_data_size);
+   ret = write_all(fd, entry, entry_size);
+   free(entry);
    if (ret == -1) {
       unlink(filename_tmp);
       goto done;
    }
 
-   /* Now, finally, write out the contents to the temporary file, then
-    * rename them atomically to the destination filename, and also
-    * perform an atomic increment of the total cache size.
-    */
-   size_t file_size = deflate_and_write_to_disk(dc_job->data, dc_job->size,
-                                                fd, filename_tmp);
-   if (file_size == 0) {
-      unlink(filename_tmp);
-      goto done;
-   }
    ret = rename(filename_tmp, filename);
    if (ret == -1) {
       unlink(filename_tmp);
@@ -1006,6 +992,27 @@ cache_put(void *job, int thread_index)
    free(filename);
 }
 
+static void
+cache_put_pack(void *job, int thread_index)
+{
+   assert(job);
+
+   struct disk_cache_put_job *dc_job = (struct disk_cache_put_job *) job;
+   struct disk_cache *cache = dc_job->cache;
+   bool flush = false;
+   size_t size;
+
+   uint8_t *entry = serialize_cache_entry(dc_job, &size);
+   if (entry) {
+      flush = disk_cache_pack_append(cache->pack, dc_job->key, entry, size);
+      free(entry);
+   }
+
+   /* Batch up the entries of back-to-back puts into a single write. */
+   if (p_atomic_dec_zero(&cache->pack_jobs) || flush)
+      disk_cache_pack_flush(cache->pack);
+}
+
 void
 disk_cache_put(struct disk_cache *cache, const cache_key key,
                const void *data, size_t size,
@@ -1024,48 +1031,93 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
 
    if (dc_job) {
       util_queue_fence_init(&dc_job->fence);
-      util_queue_add_job(&cache->cache_queue, dc_job, &dc_job->fence,
-                         cache_put, destroy_put_job);
+
+      if (cache->pack) {
+         p_atomic_inc(&cache->pack_jobs);
+         util_queue_add_job(&cache->cache_queue, dc_job, &dc_job->fence,
+                            cache_put_pack, destroy_put_job);
+      } else {
+         util_queue_add_job(&cache->cache_queue, dc_job, &dc_job->fence,
+                            cache_put, destroy_put_job);
+      }
    }
 }
 
 /**
- * Decompresses cache entry, returns true if successful.
+ * Validates a cache entry, (as laid out by serialize_cache_entry()), and
+ * decompresses its data. Returns the malloc'ed data, or NULL on failure.
  */
-static bool
-inflate_cache_data(uint8_t *in_data, size_t in_data_size,
-                   uint8_t *out_data, size_t out_data_size)
+static void *
+parse_cache_entry(struct disk_cache *cache, const uint8_t *entry,
+                  size_t entry_size, size_t *size)
 {
-   z_stream strm;
-
-   /* allocate inflate state */
-   strm.zalloc = Z_NULL;
-   strm.zfree = Z_NULL;
-   strm.opaque = Z_NULL;
-   strm.next_in = in_data;
-   strm.avail_in = in_data_size;
-   strm.next_out = out_data;
-   strm.avail_out = out_data_size;
-
-   int ret = inflateInit(&strm);
-   if (ret != Z_OK)
-      return false;
+   const uint8_t *p = entry, *end = entry + entry_size;
 
-   ret = inflate(&strm, Z_NO_FLUSH);
-   assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
+   size_t ck_size = cache->driver_keys_blob_size;
+   if (entry_size < ck_size)
+      return NULL;
 
-   /* Unless there was an error we should have decompressed everything in one
-    * go as we know the uncompressed file size.
-    */
-   if (ret != Z_STREAM_END) {
-      (void)inflateEnd(&strm);
-      return false;
+   /* Check for extremely unlikely hash collisions */
+   if (memcmp(cache->driver_keys_blob, p, ck_size) != 0) {
+      assert(!"Mesa cache keys mismatch!");
+      return NULL;
    }
-   assert(strm.avail_out == 0);
+   p += ck_size;
 
-   /* clean up and return */
-   (void)inflateEnd(&strm);
-   return true;
+   uint32_t md_type;
+   if (end - p < sizeof(md_type))
+      return NULL;
+   memcpy(&md_type, p, sizeof(md_type));
+   p += sizeof(md_type);
+
+   if (md_type == CACHE_ITEM_TYPE_GLSL) {
+      uint32_t num_keys;
+      if (end - p < sizeof(num_keys))
+         return NULL;
+      memcpy(&num_keys, p, sizeof(num_keys));
+      p += sizeof(num_keys);
+
+      /* The cache item metadata is currently just used for distributing
+       * precompiled shaders, they are not used by Mesa so just skip them for
+       * now.
+       * TODO: pass the metadata back to the caller and do some basic
+       * validation.
+       */
+      if ((end - p) / sizeof(cache_key) < num_keys)
+         return NULL;
+      p += num_keys * sizeof(cache_key);
+   }
+
+   /* Load the CRC that was created when the entry was written. */
+   struct cache_entry_file_data cf_data;
+   if (end - p < sizeof(cf_data))
+      return NULL;
+   memcpy(&cf_data, p, sizeof(cf_data));
+   p += sizeof(cf_data);
+
+   /* Uncompress the cache data */
+   uint8_t *uncompressed_data = malloc(cf_data.uncompressed_size);
+   if (!uncompressed_data)
+      return NULL;
+
+   if (!disk_cache_codec_decompress(cf_data.codec, p, end - p,
+                                    uncompressed_data,
+                                    cf_data.uncompressed_size))
+      goto fail;
+
+   /* Check the data for corruption */
+   if (cf_data.crc32 != util_hash_crc32(uncompressed_data,
+                                        cf_data.uncompressed_size))
+      goto fail;
+
+   if (size)
+      *size = cf_data.uncompressed_size;
+
+   return uncompressed_data;
+
+ fail:
+   free(uncompressed_data);
+   return NULL;
 }
 
 void *
@@ -1076,7 +1128,6 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    char *filename = NULL;
    uint8_t *data = NULL;
    uint8_t *uncompressed_data = NULL;
-   uint8_t *file_header = NULL;
 
    if (size)
       *size = 0;
@@ -1103,6 +1154,33 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
       return blob;
    }
 
+   /* Entries in packs are decompressed straight out of the mapping. */
+   if (cache->bundle) {
+      size_t entry_size;
+      const uint8_t *entry =
+         disk_cache_pack_lookup(cache->bundle, key, &entry_size);
+
+      if (entry) {
+         void *data = parse_cache_entry(cache, entry, entry_size, size);
+         disk_cache_pack_release(cache->bundle, entry);
+         if (data)
+            return data;
+      }
+   }
+
+   if (cache->pack) {
+      size_t entry_size;
+      const uint8_t *entry =
+         disk_cache_pack_lookup(cache->pack, key, &entry_size);
+
+      if (!entry)
+         return NULL;
+
+      uncompressed_data = parse_cache_entry(cache, entry, entry_size, size);
+      disk_cache_pack_release(cache->pack, entry);
+      return uncompressed_data;
+   }
+
    filename = get_cache_file(cache, key);
    if (filename == NULL)
       goto fail;
@@ -1118,97 +1196,21 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    if (data == NULL)
       goto fail;
 
-   size_t ck_size = cache->driver_keys_blob_size;
-   file_header = malloc(ck_size);
-   if (!file_header)
-      goto fail;
-
-   if (sb.st_size < ck_size)
-      goto fail;
-
-   ret = read_all(fd, file_header, ck_size);
+   ret = read_all(fd, data, sb.st_size);
    if (ret == -1)
       goto fail;
 
-   /* Check for extremely unlikely hash collisions */
-   if (memcmp(cache->driver_keys_blob, file_header, ck_size) != 0) {
-      assert(!"Mesa cache keys mismatch!");
-      goto fail;
-   }
-
-   size_t cache_item_md_size = sizeof(uint32_t);
-   uint32_t md_type;
-   ret = read_all(fd, &md_type, cache_item_md_size);
-   if (ret == -1)
-      goto fail;
-
-   if (md_type == CACHE_ITEM_TYPE_GLSL) {
-      uint32_t num_keys;
-      cache_item_md_size += sizeof(uint32_t);
-      ret = read_all(fd, &num_keys, sizeof(uint32_t));
-      if (ret == -1)
-         goto fail;
-
-      /* The cache item metadata is currently just used for distributing
-       * precompiled shaders, they are not used by Mesa so just skip them for
-       * now.
-       * TODO: pass the metadata back to the caller and do some basic
-       * validation.
-       */
-      cache_item_md_size += num_keys * sizeof(cache_key);
-      ret = lseek(fd, num_keys * sizeof(cache_key), SEEK_CUR);
-      if (ret == -1)
-         goto fail;
-   }
-
-   /* Load the CRC that was created when the file was written. */
-   struct cache_entry_file_data cf_data;
-   size_t cf_data_size = sizeof(cf_data);
-   ret = read_all(fd, &cf_data, cf_data_size);
-   if (ret == -1)
-      goto fail;
-
-   /* Load the actual cache data. */
-   size_t cache_data_size =
-      sb.st_size - cf_data_size - ck_size - cache_item_md_size;
-   ret = read_all(fd, data, cache_data_size);
-   if (ret == -1)
-      goto fail;
-
-   /* Uncompress the cache data */
-   uncompressed_data = malloc(cf_data.uncompressed_size);
-   if (!inflate_cache_data(data, cache_data_size, uncompressed_data,
-                           cf_data.uncompressed_size))
-      goto fail;
-
-   /* Check the data for corruption */
-   if (cf_data.crc32 != util_hash_crc32(uncompressed_data,
-                                        cf_data.uncompressed_size))
-      goto fail;
-
-   free(data);
-   free(filename);
-   free(file_header);
-   close(fd);
-
-   if (size)
-      *size = cf_data.uncompressed_size;
-
-   return uncompressed_data;
+   uncompressed_data = parse_cache_entry(cache, data, sb.st_size, size);
 
  fail:
    if (data)
       free(data);
-   if (uncompressed_data)
-      free(uncompressed_data);
    if (filename)
       free(filename);
-   if (file_header)
-      free(file_header);
    if (fd != -1)
       close(fd);
 
-   return NULL;
+   return uncompressed_data;
 }
 
 void
@@ -1229,6 +1231,10 @@ disk_cache_put_key(struct disk_cache *cache, const cache_key key)
    entry = &cache->stored_keys[i * CACHE_KEY_SIZE];
 
    memcpy(entry, key, CACHE_KEY_SIZE);
+
+   /* Also record the key in the pack so that it ends up in bundles. */
+   if (cache->pack && !disk_cache_pack_has_key(cache->pack, key))
+      disk_cache_pack_put_key(cache->pack, key);
 }
 
 /* This function lets us test whether a given key was previously
@@ -1250,6 +1256,9 @@ disk_cache_has_key(struct disk_cache *cache, const cache_key key)
       return cache->blob_get_cb(key, CACHE_KEY_SIZE, &blob, sizeof(uint32_t));
    }
 
+   if (cache->bundle && disk_cache_pack_has_key(cache->bundle, key))
+      return true;
+
    if (cache->path_init_failed)
       return false;
 
@@ -0,0 +1,233 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifdef ENABLE_SHADER_CACHE
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zlib.h"
+
+#ifdef HAVE_ZSTD
+#include "zstd.h"
+#endif
+
+#include "util/macros.h"
+
+#include "disk_cache_codec.h"
+
+struct codec_funcs {
+   const char *name;
+
+   size_t (*max_compressed_size)(size_t size);
+
+   size_t (*compress)(const void *in, size_t in_size,
+                      void *out, size_t out_size);
+
+   bool (*decompress)(const void *in, size_t in_size,
+                      void *out, size_t out_size);
+};
+
+static size_t
+none_max_compressed_size(size_t size)
+{
+   return size;
+}
+
+static size_t
+none_compress(const void *in, size_t in_size, void *out, size_t out_size)
+{
+   if (out_size < in_size)
+      return 0;
+
+   memcpy(out, in, in_size);
+   return in_size;
+}
+
+static bool
+none_decompress(const void *in, size_t in_size, void *out, size_t out_size)
+{
+   if (in_size != out_size)
+      return false;
+
+   memcpy(out, in, in_size);
+   return true;
+}
+
+static size_t
+zlib_max_compressed_size(size_t size)
+{
+   return compressBound(size);
+}
+
+static size_t
+zlib_compress(const void *in, size_t in_size, void *out, size_t out_size)
+{
+   uLongf compressed_size = out_size;
+
+   if (compress2(out, &compressed_size, in, in_size,
+                 Z_BEST_COMPRESSION) != Z_OK)
+      return 0;
+
+   return compressed_size;
+}
+
+static bool
+zlib_decompress(const void *in, size_t in_size, void *out, size_t out_size)
+{
+   z_stream strm;
+
+   /* allocate inflate state */
+   strm.zalloc = Z_NULL;
+   strm.zfree = Z_NULL;
+   strm.opaque = Z_NULL;
+   strm.next_in = (uint8_t *) in;
+   strm.avail_in = in_size;
+   strm.next_out = out;
+   strm.avail_out = out_size;
+
+   int ret = inflateInit(&strm);
+   if (ret != Z_OK)
+      return false;
+
+   ret = inflate(&strm, Z_NO_FLUSH);
+   assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
+
+   /* Unless there was an error we should have decompressed everything in one
+    * go as we know the uncompressed file size.
+    */
+   if (ret != Z_STREAM_END) {
+      (void)inflateEnd(&strm);
+      return false;
+   }
+   assert(strm.avail_out == 0);
+
+   /* clean up and return */
+   (void)inflateEnd(&strm);
+   return true;
+}
+
+#ifdef HAVE_ZSTD
+/* Level 1 compresses shader binaries a little less than zlib's best, at a
+ * small fraction of the cost, and decompresses several times faster.
+ */
+#define ZSTD_COMPRESSION_LEVEL 1
+
+static size_t
+zstd_max_compressed_size(size_t size)
+{
+   return ZSTD_compressBound(size);
+}
+
+static size_t
+zstd_compress(const void *in, size_t in_size, void *out, size_t out_size)
+{
+   size_t ret = ZSTD_compress(out, out_size, in, in_size,
+                              ZSTD_COMPRESSION_LEVEL);
+   if (ZSTD_isError(ret))
+      return 0;
+
+   return ret;
+}
+
+static bool
+zstd_decompress(const void *in, size_t in_size, void *out, size_t out_size)
+{
+   size_t ret = ZSTD_decompress(out, out_size, in, in_size);
+
+   return !ZSTD_isError(ret) && ret == out_size;
+}
+#endif
+
+static const struct codec_funcs codecs[] = {
+   [DISK_CACHE_CODEC_NONE] = {
+      "none", none_max_compressed_size, none_compress, none_decompress
+   },
+   [DISK_CACHE_CODEC_ZLIB] = {
+      "zlib", zlib_max_compressed_size, zlib_compress, zlib_decompress
+   },
+#ifdef HAVE_ZSTD
+   [DISK_CACHE_CODEC_ZSTD] = {
+      "zstd", zstd_max_compressed_size, zstd_compress, zstd_decompress
+   },
+#endif
+};
+
+static const struct codec_funcs *
+get_codec(enum disk_cache_codec codec)
+{
+   if (codec >= ARRAY_SIZE(codecs) || !codecs[codec].name)
+      return NULL;
+
+   return &codecs[codec];
+}
+
+enum disk_cache_codec
+disk_cache_codec_choose(void)
+{
+   const char *name = getenv("MESA_GLSL_CACHE_CODEC");
+
+   if (name) {
+      for (unsigned i = 0; i < ARRAY_SIZE(codecs); i++) {
+         if (codecs[i].name && strcmp(codecs[i].name, name) == 0)
+            return i;
+      }
+   }
+
+#ifdef HAVE_ZSTD
+   return DISK_CACHE_CODEC_ZSTD;
+#else
+   return DISK_CACHE_CODEC_ZLIB;
+#endif
+}
+
+size_t
+disk_cache_codec_max_compressed_size(enum disk_cache_codec codec,
+                                     size_t size)
+{
+   const struct codec_funcs *funcs = get_codec(codec);
+
+   return funcs ? funcs->max_compressed_size(size) : 0;
+}
+
+size_t
+disk_cache_codec_compress(enum disk_cache_codec codec,
+                          const void *in, size_t in_size,
+                          void *out, size_t out_size)
+{
+   const struct codec_funcs *funcs = get_codec(codec);
+
+   return funcs ? funcs->compress(in, in_size, out, out_size) : 0;
+}
+
+bool
+disk_cache_codec_decompress(enum disk_cache_codec codec,
+                            const void *in, size_t in_size,
+                            void *out, size_t out_size)
+{
+   const struct codec_funcs *funcs = get_codec(codec);
+
+   return funcs && funcs->decompress(in, in_size, out, out_size);
+}
+
+#endif /* ENABLE_SHADER_CACHE */
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Compression codecs for on-disk shader cache entries.
+ *
+ * The codec used for an entry is recorded in the entry, so entries written
+ * with any codec this build supports can be read back regardless of the
+ * codec currently selected for writing.
+ */
+
+#ifndef DISK_CACHE_CODEC_H
+#define DISK_CACHE_CODEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* These values are stored in cache entries, don't renumber them. */
+enum disk_cache_codec {
+   DISK_CACHE_CODEC_NONE = 0,
+   DISK_CACHE_CODEC_ZLIB = 1,
+   DISK_CACHE_CODEC_ZSTD = 2,
+};
+
+/**
+ * Return the codec selected with MESA_GLSL_CACHE_CODEC, or the fastest
+ * built-in codec that still compresses if it is unset or unsupported.
+ */
+enum disk_cache_codec
+disk_cache_codec_choose(void);
+
+/**
+ * Return the size of the buffer disk_cache_codec_compress() needs to
+ * compress \size bytes with \codec.
+ */
+size_t
+disk_cache_codec_max_compressed_size(enum disk_cache_codec codec,
+                                     size_t size);
+
+/**
+ * Compress \in_size bytes from \in to \out.
+ *
+ * Returns the compressed size, or 0 on failure.
+ */
+size_t
+disk_cache_codec_compress(enum disk_cache_codec codec,
+                          const void *in, size_t in_size,
+                          void *out, size_t out_size);
+
+/**
+ * Decompress \in_size bytes from \in to \out, which must be exactly the
+ * size of the uncompressed data.
+ *
+ * Returns false on failure, including when \codec isn't supported by this
+ * build.
+ */
+bool
+disk_cache_codec_decompress(enum disk_cache_codec codec,
+                            const void *in, size_t in_size,
+                            void *out, size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DISK_CACHE_CODEC_H */
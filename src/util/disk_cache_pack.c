@@ -0,0 +1,720 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifdef ENABLE_SHADER_CACHE
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "util/crc32.h"
+#include "util/hash_table.h"
+#include "util/macros.h"
+#include "util/ralloc.h"
+#include "util/simple_mtx.h"
+#include "util/u_dynarray.h"
+
+#include "disk_cache_pack.h"
+
+/* The pack file starts with a struct pack_file_header, followed by a
+ * sequence of records. Each record is a struct pack_record_header followed
+ * by its payload, padded to PACK_RECORD_ALIGNMENT bytes so that every header
+ * is naturally aligned within the mapping. A record with a size of zero
+ * marks the removal of its key. Key records have no payload and store keys
+ * passed to disk_cache_put_key().
+ *
+ * The version should be bumped whenever the layout changes; a pack with a
+ * different version is discarded.
+ */
+#define PACK_FILE_MAGIC    0x4b43504d  /* "MPCK" */
+#define PACK_FILE_VERSION  1
+#define PACK_RECORD_MAGIC  0x5243504d  /* "MPCR" */
+#define PACK_KEY_MAGIC     0x594b504d  /* "MPKY" */
+
+#define PACK_RECORD_ALIGNMENT 8
+
+/* Flush pending entries once this many bytes have accumulated. */
+#define PACK_BATCH_SIZE (1024 * 1024)
+
+/* Granularity at which the mapping of the pack grows. */
+#define PACK_MAP_GRANULARITY (4 * 1024 * 1024)
+
+struct pack_file_header {
+   uint32_t magic;
+   uint32_t version;
+};
+
+struct pack_record_header {
+   uint32_t magic;
+
+   /* Size of the payload following the header, without padding. */
+   uint32_t size;
+
+   cache_key key;
+
+   /* CRC of the fields above. The payload is not covered, disk_cache.c
+    * already checks the entry data for corruption when reading it.
+    */
+   uint32_t crc32;
+};
+
+struct pack_index_entry {
+   cache_key key;
+
+   /* Offset of the payload within the pack file, zero for keys that are
+    * still pending a flush.
+    */
+   uint64_t offset;
+
+   /* Size of the payload, zero for keys without data. */
+   uint32_t size;
+};
+
+struct pack_mapping {
+   void *map;
+   size_t size;
+
+   /* Lookups whose pointer into the mapping hasn't been released yet. */
+   unsigned readers;
+};
+
+struct disk_cache_pack {
+   char *path;
+   char *tmp_path;
+
+   /* Bundles are opened read-only and assumed to never change. */
+   bool read_only;
+
+   /* Maximum size of the pack file before it is compacted. */
+   uint64_t max_size;
+
+   /* File taking the flock that serializes writers across processes. The
+    * pack itself can't be used for that as compaction replaces it.
+    */
+   int lock_fd;
+
+   /* Protects everything below. */
+   simple_mtx_t mutex;
+
+   int fd;
+   ino_t ino;
+
+   /* Read-only mapping of the pack file, covering at least [0, end). */
+   uint8_t *map;
+   size_t map_size;
+   unsigned map_readers;
+
+   /* Mappings that were replaced by a larger one, or that belong to a pack
+    * file that has since been replaced, while lookups still pointed into
+    * them. Each is unmapped once its last reader is released.
+    */
+   struct util_dynarray old_mappings;
+
+   /* End of the last valid record that has been indexed. */
+   uint64_t end;
+
+   /* Maps cache keys to struct pack_index_entry. Entries are ralloc'ed off
+    * of index_ctx, which is thrown away whenever the pack file is reopened.
+    */
+   void *index_ctx;
+   struct hash_table *index;
+
+   /* Records waiting for the next flush. */
+   struct util_dynarray pending;
+};
+
+static uint32_t
+key_hash(const void *key)
+{
+   uint32_t hash;
+
+   /* Keys are SHA-1 hashes already. */
+   memcpy(&hash, key, sizeof(hash));
+   return hash;
+}
+
+static bool
+key_equals(const void *a, const void *b)
+{
+   return memcmp(a, b, CACHE_KEY_SIZE) == 0;
+}
+
+static uint32_t
+record_crc(const struct pack_record_header *rec)
+{
+   return util_hash_crc32(rec, offsetof(struct pack_record_header, crc32));
+}
+
+static uint64_t
+record_size(uint32_t payload_size)
+{
+   return sizeof(struct pack_record_header) +
+          ALIGN_POT((uint64_t) payload_size, PACK_RECORD_ALIGNMENT);
+}
+
+static ssize_t
+pwrite_all(int fd, const void *buf, size_t count, off_t offset)
+{
+   const char *out = buf;
+   ssize_t written;
+   size_t done;
+
+   for (done = 0; done < count; done += written) {
+      written = pwrite(fd, out + done, count - done, offset + done);
+      if (written == -1)
+         return -1;
+   }
+   return done;
+}
+
+static void
+retire_mapping(struct disk_cache_pack *pack)
+{
+   if (pack->map_readers) {
+      struct pack_mapping old = { pack->map, pack->map_size,
+                                  pack->map_readers };
+      util_dynarray_append(&pack->old_mappings, struct pack_mapping, old);
+   } else if (pack->map) {
+      munmap(pack->map, pack->map_size);
+   }
+
+   pack->map = NULL;
+   pack->map_size = 0;
+   pack->map_readers = 0;
+}
+
+/* Make sure the first \size bytes of the pack file are mapped. Mapping past
+ * the end of the file is fine, we never touch those pages.
+ */
+static bool
+map_pack(struct disk_cache_pack *pack, uint64_t size)
+{
+   if (size <= pack->map_size)
+      return true;
+
+   size_t map_size = MAX2(ALIGN_POT(size, PACK_MAP_GRANULARITY),
+                          pack->map_size * 2);
+   void *map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, pack->fd, 0);
+   if (map == MAP_FAILED)
+      return false;
+
+   retire_mapping(pack);
+   pack->map = map;
+   pack->map_size = map_size;
+
+   return true;
+}
+
+static void
+index_record(struct disk_cache_pack *pack,
+             const struct pack_record_header *rec, uint64_t offset)
+{
+   struct hash_entry *he;
+   struct pack_index_entry *entry;
+
+   if (!pack->index)
+      return;
+
+   he = _mesa_hash_table_search(pack->index, rec->key);
+   entry = he ? he->data : NULL;
+
+   if (rec->magic == PACK_KEY_MAGIC) {
+      /* Don't shadow an entry that has data. */
+      if (entry && entry->size)
+         return;
+   } else if (rec->size == 0) {
+      if (he) {
+         _mesa_hash_table_remove(pack->index, he);
+         ralloc_free(entry);
+      }
+      return;
+   }
+
+   if (!entry) {
+      entry = ralloc(pack->index_ctx, struct pack_index_entry);
+      if (!entry)
+         return;
+
+      memcpy(entry->key, rec->key, CACHE_KEY_SIZE);
+      _mesa_hash_table_insert(pack->index, entry->key, entry);
+   }
+
+   entry->offset = offset;
+   entry->size = rec->size;
+}
+
+/* Index any records that were appended to the pack file since the last
+ * scan, (by this or any other process). Scanning stops at the first record
+ * that is incomplete or corrupt, it is picked up again by a later scan if it
+ * was still being written.
+ */
+static void
+scan_pack(struct disk_cache_pack *pack)
+{
+   struct stat sb;
+
+   if (fstat(pack->fd, &sb) == -1 || sb.st_size <= pack->end)
+      return;
+
+   uint64_t file_size = sb.st_size;
+   if (!map_pack(pack, file_size))
+      return;
+
+   while (pack->end + sizeof(struct pack_record_header) <= file_size) {
+      const struct pack_record_header *rec =
+         (const struct pack_record_header *) (pack->map + pack->end);
+
+      if ((rec->magic != PACK_RECORD_MAGIC && rec->magic != PACK_KEY_MAGIC) ||
+          rec->crc32 != record_crc(rec))
+         break;
+
+      uint64_t next = pack->end + record_size(rec->size);
+      if (next > file_size)
+         break;
+
+      index_record(pack, rec, pack->end + sizeof(*rec));
+      pack->end = next;
+   }
+}
+
+/* (Re)open the pack file and rebuild the index from scratch. With \create
+ * set, (which requires holding the flock), a missing or stale pack file is
+ * replaced with an empty one.
+ */
+static bool
+reopen_pack(struct disk_cache_pack *pack, bool create)
+{
+   struct pack_file_header header;
+   struct stat sb;
+
+   if (pack->fd != -1)
+      close(pack->fd);
+   retire_mapping(pack);
+
+   ralloc_free(pack->index_ctx);
+   pack->index_ctx = ralloc_context(pack);
+   pack->index = _mesa_hash_table_create(pack->index_ctx, key_hash,
+                                         key_equals);
+   pack->end = 0;
+
+   pack->fd = open(pack->path,
+                   (pack->read_only ? O_RDONLY : O_RDWR) | O_CLOEXEC |
+                   (create ? O_CREAT : 0), 0644);
+   if (pack->fd == -1 || !pack->index)
+      goto fail;
+
+   if (fstat(pack->fd, &sb) == -1)
+      goto fail;
+
+   if (sb.st_size < (off_t) sizeof(header) ||
+       pread(pack->fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+       header.magic != PACK_FILE_MAGIC ||
+       header.version != PACK_FILE_VERSION) {
+      if (!create)
+         goto fail;
+
+      header.magic = PACK_FILE_MAGIC;
+      header.version = PACK_FILE_VERSION;
+
+      if (ftruncate(pack->fd, 0) == -1 ||
+          pwrite_all(pack->fd, &header, sizeof(header), 0) == -1)
+         goto fail;
+   }
+
+   pack->ino = sb.st_ino;
+   pack->end = sizeof(header);
+   scan_pack(pack);
+
+   return true;
+
+ fail:
+   if (pack->fd != -1)
+      close(pack->fd);
+   pack->fd = -1;
+   return false;
+}
+
+/* Catch up with changes other processes made to the pack file: either pick
+ * up newly appended records, or switch over to a compacted pack.
+ */
+static bool
+refresh_pack(struct disk_cache_pack *pack, bool create)
+{
+   struct stat sb;
+
+   if (pack->read_only)
+      return pack->fd != -1;
+
+   if (pack->fd == -1 || stat(pack->path, &sb) == -1 ||
+       sb.st_ino != pack->ino)
+      return reopen_pack(pack, create);
+
+   scan_pack(pack);
+   return true;
+}
+
+static int
+compare_entry_offsets(const void *a, const void *b)
+{
+   const struct pack_index_entry *ea = *(const struct pack_index_entry **) a;
+   const struct pack_index_entry *eb = *(const struct pack_index_entry **) b;
+
+   return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+}
+
+/* Replace the pack file with one containing only the most recently written
+ * entries, using up to half of the maximum size so that compaction doesn't
+ * happen again right away. The most recent entry is always kept. Must be
+ * called with the flock and the mutex held.
+ */
+static void
+compact_pack(struct disk_cache_pack *pack)
+{
+   struct pack_file_header header = { PACK_FILE_MAGIC, PACK_FILE_VERSION };
+   unsigned num_entries = pack->index->entries;
+   struct pack_index_entry **entries;
+   int fd = -1;
+
+   entries = malloc(MAX2(num_entries, 1) * sizeof(*entries));
+   if (!entries)
+      return;
+
+   unsigned i = 0;
+   struct hash_entry *he;
+   hash_table_foreach(pack->index, he) {
+      struct pack_index_entry *entry = he->data;
+      if (entry->offset)
+         entries[i++] = entry;
+   }
+   num_entries = i;
+
+   qsort(entries, num_entries, sizeof(*entries), compare_entry_offsets);
+
+   /* Walk back from the newest entry to find the oldest one we keep. */
+   uint64_t budget = pack->max_size / 2;
+   uint64_t size = sizeof(header);
+   unsigned first = num_entries;
+   while (first > 0) {
+      uint64_t rec_size = record_size(entries[first - 1]->size);
+      if (first < num_entries && size + rec_size > budget)
+         break;
+
+      size += rec_size;
+      first--;
+   }
+
+   fd = open(pack->tmp_path, O_WRONLY | O_CLOEXEC | O_CREAT | O_TRUNC, 0644);
+   if (fd == -1)
+      goto done;
+
+   if (pwrite_all(fd, &header, sizeof(header), 0) == -1)
+      goto fail;
+
+   /* Records are copied verbatim, header and padding included. */
+   uint64_t offset = sizeof(header);
+   for (i = first; i < num_entries; i++) {
+      uint64_t rec_offset = entries[i]->offset - sizeof(struct pack_record_header);
+      uint64_t rec_size = record_size(entries[i]->size);
+
+      if (pwrite_all(fd, pack->map + rec_offset, rec_size, offset) == -1)
+         goto fail;
+
+      offset += rec_size;
+   }
+
+   if (rename(pack->tmp_path, pack->path) == -1)
+      goto fail;
+
+   reopen_pack(pack, true);
+   goto done;
+
+ fail:
+   unlink(pack->tmp_path);
+ done:
+   if (fd != -1)
+      close(fd);
+   free(entries);
+}
+
+struct disk_cache_pack *
+disk_cache_pack_open(void *mem_ctx, const char *dir, uint64_t max_size)
+{
+   struct disk_cache_pack *pack = rzalloc(mem_ctx, struct disk_cache_pack);
+   if (!pack)
+      return NULL;
+
+   pack->fd = -1;
+   pack->lock_fd = -1;
+   pack->max_size = max_size;
+   simple_mtx_init(&pack->mutex, mtx_plain);
+   util_dynarray_init(&pack->old_mappings, pack);
+   util_dynarray_init(&pack->pending, pack);
+
+   pack->path = ralloc_asprintf(pack, "%s/pack", dir);
+   pack->tmp_path = ralloc_asprintf(pack, "%s/pack.tmp", dir);
+   char *lock_path = ralloc_asprintf(pack, "%s/pack.lock", dir);
+   if (!pack->path || !pack->tmp_path || !lock_path)
+      goto fail;
+
+   pack->lock_fd = open(lock_path, O_RDWR | O_CLOEXEC | O_CREAT, 0644);
+   if (pack->lock_fd == -1)
+      goto fail;
+
+   if (flock(pack->lock_fd, LOCK_EX) == -1)
+      goto fail;
+
+   bool ok = reopen_pack(pack, true);
+   flock(pack->lock_fd, LOCK_UN);
+
+   if (!ok)
+      goto fail;
+
+   return pack;
+
+ fail:
+   disk_cache_pack_close(pack);
+   return NULL;
+}
+
+struct disk_cache_pack *
+disk_cache_pack_open_bundle(void *mem_ctx, const char *path)
+{
+   struct disk_cache_pack *pack = rzalloc(mem_ctx, struct disk_cache_pack);
+   if (!pack)
+      return NULL;
+
+   pack->fd = -1;
+   pack->lock_fd = -1;
+   pack->read_only = true;
+   simple_mtx_init(&pack->mutex, mtx_plain);
+   util_dynarray_init(&pack->old_mappings, pack);
+   util_dynarray_init(&pack->pending, pack);
+
+   pack->path = ralloc_strdup(pack, path);
+   if (!pack->path || !reopen_pack(pack, false)) {
+      disk_cache_pack_close(pack);
+      return NULL;
+   }
+
+   return pack;
+}
+
+void
+disk_cache_pack_close(struct disk_cache_pack *pack)
+{
+   if (!pack)
+      return;
+
+   if (pack->lock_fd != -1) {
+      disk_cache_pack_flush(pack);
+      close(pack->lock_fd);
+   }
+
+   if (pack->fd != -1)
+      close(pack->fd);
+
+   retire_mapping(pack);
+   util_dynarray_foreach(&pack->old_mappings, struct pack_mapping, m)
+      munmap(m->map, m->size);
+
+   simple_mtx_destroy(&pack->mutex);
+   ralloc_free(pack);
+}
+
+bool
+disk_cache_pack_append(struct disk_cache_pack *pack, const cache_key key,
+                       const void *data, size_t size)
+{
+   struct pack_record_header rec;
+   bool full;
+
+   if (size > UINT32_MAX)
+      return false;
+
+   rec.magic = PACK_RECORD_MAGIC;
+   rec.size = size;
+   memcpy(rec.key, key, CACHE_KEY_SIZE);
+   rec.crc32 = record_crc(&rec);
+
+   simple_mtx_lock(&pack->mutex);
+
+   uint8_t *dst = util_dynarray_grow(&pack->pending, record_size(size));
+   memcpy(dst, &rec, sizeof(rec));
+   memcpy(dst + sizeof(rec), data, size);
+   memset(dst + sizeof(rec) + size, 0, record_size(size) - sizeof(rec) - size);
+
+   full = pack->pending.size >= PACK_BATCH_SIZE;
+
+   simple_mtx_unlock(&pack->mutex);
+
+   return full;
+}
+
+static void
+append_empty_record(struct disk_cache_pack *pack, const cache_key key,
+                    uint32_t magic)
+{
+   struct pack_record_header rec;
+
+   rec.magic = magic;
+   rec.size = 0;
+   memcpy(rec.key, key, CACHE_KEY_SIZE);
+   rec.crc32 = record_crc(&rec);
+
+   simple_mtx_lock(&pack->mutex);
+
+   index_record(pack, &rec, 0);
+   util_dynarray_append(&pack->pending, struct pack_record_header, rec);
+
+   simple_mtx_unlock(&pack->mutex);
+}
+
+void
+disk_cache_pack_remove(struct disk_cache_pack *pack, const cache_key key)
+{
+   append_empty_record(pack, key, PACK_RECORD_MAGIC);
+}
+
+void
+disk_cache_pack_put_key(struct disk_cache_pack *pack, const cache_key key)
+{
+   append_empty_record(pack, key, PACK_KEY_MAGIC);
+}
+
+void
+disk_cache_pack_flush(struct disk_cache_pack *pack)
+{
+   struct util_dynarray batch;
+
+   /* Take the pending records so that appends can continue meanwhile. */
+   simple_mtx_lock(&pack->mutex);
+   batch = pack->pending;
+   util_dynarray_init(&pack->pending, pack);
+   simple_mtx_unlock(&pack->mutex);
+
+   if (batch.size == 0)
+      goto done;
+
+   if (flock(pack->lock_fd, LOCK_EX) == -1)
+      goto done;
+
+   simple_mtx_lock(&pack->mutex);
+
+   if (refresh_pack(pack, true)) {
+      /* Drop whatever a writer that died mid-append left behind. */
+      if (ftruncate(pack->fd, pack->end) == 0 &&
+          pwrite_all(pack->fd, batch.data, batch.size, pack->end) != -1)
+         scan_pack(pack);
+
+      if (pack->end > pack->max_size)
+         compact_pack(pack);
+   }
+
+   simple_mtx_unlock(&pack->mutex);
+
+   flock(pack->lock_fd, LOCK_UN);
+
+ done:
+   util_dynarray_fini(&batch);
+}
+
+const void *
+disk_cache_pack_lookup(struct disk_cache_pack *pack, const cache_key key,
+                       size_t *size)
+{
+   const void *data = NULL;
+
+   simple_mtx_lock(&pack->mutex);
+
+   struct hash_entry *he = NULL;
+   if (pack->index)
+      he = _mesa_hash_table_search(pack->index, key);
+   if (!he && refresh_pack(pack, false) && pack->index)
+      he = _mesa_hash_table_search(pack->index, key);
+
+   if (he) {
+      struct pack_index_entry *entry = he->data;
+
+      if (entry->size) {
+         data = pack->map + entry->offset;
+         *size = entry->size;
+         pack->map_readers++;
+      }
+   }
+
+   simple_mtx_unlock(&pack->mutex);
+
+   return data;
+}
+
+void
+disk_cache_pack_release(struct disk_cache_pack *pack, const void *data)
+{
+   const uint8_t *ptr = data;
+
+   simple_mtx_lock(&pack->mutex);
+
+   if (ptr >= pack->map && ptr < pack->map + pack->map_size) {
+      assert(pack->map_readers > 0);
+      pack->map_readers--;
+   } else {
+      util_dynarray_foreach(&pack->old_mappings, struct pack_mapping, m) {
+         if (ptr < (uint8_t *) m->map || ptr >= (uint8_t *) m->map + m->size)
+            continue;
+
+         assert(m->readers > 0);
+         if (--m->readers == 0) {
+            munmap(m->map, m->size);
+            *m = util_dynarray_pop(&pack->old_mappings, struct pack_mapping);
+         }
+         break;
+      }
+   }
+
+   simple_mtx_unlock(&pack->mutex);
+}
+
+bool
+disk_cache_pack_has_key(struct disk_cache_pack *pack, const cache_key key)
+{
+   bool found = false;
+
+   simple_mtx_lock(&pack->mutex);
+
+   if (pack->index)
+      found = _mesa_hash_table_search(pack->index, key) != NULL;
+
+   simple_mtx_unlock(&pack->mutex);
+
+   return found;
+}
+
+#endif /* ENABLE_SHADER_CACHE */
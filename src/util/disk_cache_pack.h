@@ -0,0 +1,139 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Single-file storage for the on-disk shader cache.
+ *
+ * All entries live in one append-only "pack" file within the cache
+ * directory. Each process memory-maps the pack and keeps an in-memory hash
+ * table from cache key to the location of the entry within the mapping, so
+ * a lookup costs no syscalls when the entry is known. New entries are
+ * batched in memory and appended under an flock, and once the pack grows
+ * beyond the maximum cache size it is compacted into a new file that only
+ * keeps the most recently written entries.
+ *
+ * The payload of each entry is opaque to the pack; disk_cache.c stores the
+ * same data it would otherwise write to an individual cache file.
+ *
+ * A copy of a pack can also be opened read-only as a prebuilt "bundle".
+ */
+
+#ifndef DISK_CACHE_PACK_H
+#define DISK_CACHE_PACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "disk_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct disk_cache_pack;
+
+/**
+ * Open, (creating if needed), the pack file within the cache directory
+ * \dir and index its contents. The pack is ralloc'ed off of \mem_ctx.
+ *
+ * Returns NULL if the pack cannot be used, in which case the caller should
+ * fall back to storing entries as individual files.
+ */
+struct disk_cache_pack *
+disk_cache_pack_open(void *mem_ctx, const char *dir, uint64_t max_size);
+
+/**
+ * Open the pack file at \path read-only. Bundles are never written to and
+ * are assumed not to change while they are open.
+ */
+struct disk_cache_pack *
+disk_cache_pack_open_bundle(void *mem_ctx, const char *path);
+
+/**
+ * Write out any pending entries and release all resources. All pointers
+ * returned by disk_cache_pack_lookup() must have been released.
+ */
+void
+disk_cache_pack_close(struct disk_cache_pack *pack);
+
+/**
+ * Queue an entry for writing with the next disk_cache_pack_flush().
+ *
+ * Returns true once enough data is pending that the caller should flush.
+ */
+bool
+disk_cache_pack_append(struct disk_cache_pack *pack, const cache_key key,
+                       const void *data, size_t size);
+
+/**
+ * Remove the entry \key from the pack, (the removal is recorded in the pack
+ * file with the next disk_cache_pack_flush()).
+ */
+void
+disk_cache_pack_remove(struct disk_cache_pack *pack, const cache_key key);
+
+/**
+ * Record \key, (without any associated data), in the pack so that it can
+ * be found with disk_cache_pack_has_key().
+ */
+void
+disk_cache_pack_put_key(struct disk_cache_pack *pack, const cache_key key);
+
+/**
+ * Append all pending entries to the pack file, compacting it if it has
+ * grown beyond the maximum cache size.
+ *
+ * Must not be called concurrently with itself.
+ */
+void
+disk_cache_pack_flush(struct disk_cache_pack *pack);
+
+/**
+ * Look up the entry \key. On success \size is set to the size of the entry
+ * and a pointer to it within the pack's mapping is returned, which stays
+ * valid until it is passed to disk_cache_pack_release(). Entries still
+ * pending a flush are not visible.
+ */
+const void *
+disk_cache_pack_lookup(struct disk_cache_pack *pack, const cache_key key,
+                       size_t *size);
+
+/**
+ * Release a pointer returned by disk_cache_pack_lookup(). Mappings that
+ * were replaced since are unmapped once their last pointer is released.
+ */
+void
+disk_cache_pack_release(struct disk_cache_pack *pack, const void *data);
+
+/**
+ * Test whether \key was stored in the pack, with or without data. Unlike
+ * lookups this never checks the pack file for new entries.
+ */
+bool
+disk_cache_pack_has_key(struct disk_cache_pack *pack, const cache_key key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DISK_CACHE_PACK_H */
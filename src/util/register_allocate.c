@@ -68,18 +68,43 @@
  * up front and stored in a 2-dimensional array, so that the cost of
  * coloring a node is constant with the number of registers.  We do
  * this during ra_set_finalize().
+ *
+ * Large shaders can have thousands of nodes, so the allocator avoids
+ * anything quadratic in the number of nodes.  Small graphs keep an
+ * adjacency bitset per node to reject duplicate interferences, larger
+ * ones (see ra_set_sparse_interference_threshold()) only keep adjacency
+ * lists which are deduplicated lazily.  The simplify step keeps the
+ * trivially colorable nodes and the candidates for optimistic coloring in
+ * worklists which are updated as q totals go down, instead of rescanning
+ * every node until nothing changes.
  */
 
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #include "ralloc.h"
 #include "main/imports.h"
 #include "main/macros.h"
 #include "util/bitset.h"
+#include "util/u_atomic.h"
 #include "register_allocate.h"
 
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
 #define NO_REG ~0U
 
+/**
+ * Graphs with at least this many nodes don't get an adjacency bitset,
+ * which takes count^2 bits.
+ */
+#define RA_DEFAULT_SPARSE_THRESHOLD 1024
+
 struct ra_reg {
    BITSET_WORD *conflicts;
    unsigned int *conflict_list;
@@ -95,6 +120,9 @@ struct ra_regs {
    unsigned int class_count;
 
    bool round_robin;
+
+   /** Node count from which interference graphs use sparse adjacency. */
+   unsigned int sparse_threshold;
 };
 
 struct ra_class {
@@ -125,11 +153,16 @@ struct ra_node {
     *
     * List of which nodes this node interferes with.  This should be
     * symmetric with the other node.
+    *
+    * In sparse graphs there is no adjacency bitset and the list may
+    * contain duplicates past the first adjacency_unique entries until
+    * ra_compact_adjacency() is called.
     */
    BITSET_WORD *adjacency;
    unsigned int *adjacency_list;
    unsigned int adjacency_list_size;
    unsigned int adjacency_count;
+   unsigned int adjacency_unique;
    /** @} */
 
    unsigned int class;
@@ -177,6 +210,31 @@ struct ra_graph {
    unsigned int (*select_reg_callback)(struct ra_graph *g, BITSET_WORD *regs,
                                        void *data);
    void *select_reg_callback_data;
+
+   /** @{
+    *
+    * Sparse adjacency.  seen[n] == seen_gen marks the neighbors already
+    * visited while compacting an adjacency list.
+    */
+   bool sparse;
+   bool adjacency_dirty;
+   unsigned int *seen;
+   unsigned int seen_gen;
+   /** @} */
+};
+
+/**
+ * Binary heap of node indices, used for the worklists of ra_simplify().
+ *
+ * pos is only allocated for heaps that need ra_heap_update() or
+ * ra_heap_remove(); it tracks the position of every node in the heap, or
+ * NO_REG for nodes which aren't in it.
+ */
+struct ra_heap {
+   unsigned int *nodes;
+   unsigned int count;
+   unsigned int *pos;
+   bool (*before)(const struct ra_graph *g, unsigned int a, unsigned int b);
 };
 
 /**
@@ -212,6 +270,8 @@ ra_alloc_reg_set(void *mem_ctx, unsigned int count, bool need_conflict_lists)
       regs->regs[i].num_conflicts = 1;
    }
 
+   regs->sparse_threshold = RA_DEFAULT_SPARSE_THRESHOLD;
+
    return regs;
 }
 
@@ -231,6 +291,20 @@ ra_set_allocate_round_robin(struct ra_regs *regs)
    regs->round_robin = true;
 }
 
+/**
+ * Sets the number of nodes from which interference graphs allocated for
+ * this register set stop tracking adjacency in a count x count bitset.
+ *
+ * The allocation result doesn't depend on it; sparse graphs use memory
+ * linear in the number of interferences, dense graphs are a bit faster to
+ * build.  0 makes every graph sparse, UINT_MAX makes every graph dense.
+ */
+void
+ra_set_sparse_interference_threshold(struct ra_regs *regs, unsigned int count)
+{
+   regs->sparse_threshold = count;
+}
+
 static void
 ra_add_conflict_list(struct ra_regs *regs, unsigned int r1, unsigned int r2)
 {
@@ -390,27 +464,102 @@ ra_set_finalize(struct ra_regs *regs, unsigned int **q_values)
    }
 }
 
+/**
+ * Removes the duplicates from the adjacency list of a node of a sparse
+ * graph.
+ *
+ * The first occurrence of every neighbor is kept, so the list ends up in
+ * the same order as it would have with an adjacency bitset.
+ */
+static void
+ra_compact_node_adjacency(struct ra_graph *g, unsigned int n)
+{
+   struct ra_node *node = &g->nodes[n];
+   int n_class = node->class;
+   unsigned int i, count;
+
+   if (node->adjacency_unique == node->adjacency_count)
+      return;
+
+   if (++g->seen_gen == 0) {
+      memset(g->seen, 0, g->count * sizeof(*g->seen));
+      g->seen_gen = 1;
+   }
+
+   for (i = 0; i < node->adjacency_unique; i++)
+      g->seen[node->adjacency_list[i]] = g->seen_gen;
+
+   count = node->adjacency_unique;
+   for (; i < node->adjacency_count; i++) {
+      unsigned int n2 = node->adjacency_list[i];
+
+      if (g->seen[n2] == g->seen_gen) {
+         int n2_class = g->nodes[n2].class;
+         node->q_total -= g->regs->classes[n_class]->q[n2_class];
+         continue;
+      }
+
+      g->seen[n2] = g->seen_gen;
+      node->adjacency_list[count++] = n2;
+   }
+
+   node->adjacency_count = count;
+   node->adjacency_unique = count;
+}
+
+/**
+ * Deduplicates all the adjacency lists of a sparse graph, has to be done
+ * before anything walks the lists.
+ */
+static void
+ra_compact_adjacency(struct ra_graph *g)
+{
+   unsigned int n;
+
+   if (!g->adjacency_dirty)
+      return;
+
+   for (n = 0; n < g->count; n++)
+      ra_compact_node_adjacency(g, n);
+
+   g->adjacency_dirty = false;
+}
+
 static void
 ra_add_node_adjacency(struct ra_graph *g, unsigned int n1, unsigned int n2)
 {
-   BITSET_SET(g->nodes[n1].adjacency, n2);
+   struct ra_node *node = &g->nodes[n1];
 
    assert(n1 != n2);
 
-   int n1_class = g->nodes[n1].class;
+   int n1_class = node->class;
    int n2_class = g->nodes[n2].class;
-   g->nodes[n1].q_total += g->regs->classes[n1_class]->q[n2_class];
-
-   if (g->nodes[n1].adjacency_count >=
-       g->nodes[n1].adjacency_list_size) {
-      g->nodes[n1].adjacency_list_size *= 2;
-      g->nodes[n1].adjacency_list = reralloc(g, g->nodes[n1].adjacency_list,
-                                             unsigned int,
-                                             g->nodes[n1].adjacency_list_size);
+   node->q_total += g->regs->classes[n1_class]->q[n2_class];
+
+   if (node->adjacency_count >= node->adjacency_list_size) {
+      /* Only grow the list of a sparse graph if it is still at least half
+       * full after dropping the duplicates.  That keeps the duplicates
+       * from using more than half of the list and makes the compaction
+       * amortized constant time per interference.
+       */
+      if (g->sparse)
+         ra_compact_node_adjacency(g, n1);
+
+      if (node->adjacency_count * 2 > node->adjacency_list_size) {
+         node->adjacency_list_size *= 2;
+         node->adjacency_list = reralloc(g, node->adjacency_list,
+                                         unsigned int,
+                                         node->adjacency_list_size);
+      }
    }
 
-   g->nodes[n1].adjacency_list[g->nodes[n1].adjacency_count] = n2;
-   g->nodes[n1].adjacency_count++;
+   node->adjacency_list[node->adjacency_count] = n2;
+   node->adjacency_count++;
+
+   if (g->sparse)
+      g->adjacency_dirty = true;
+   else
+      node->adjacency_unique = node->adjacency_count;
 }
 
 struct ra_graph *
@@ -426,9 +575,15 @@ ra_alloc_interference_graph(struct ra_regs *regs, unsigned int count)
 
    g->stack = rzalloc_array(g, unsigned int, count);
 
+   g->sparse = count >= regs->sparse_threshold;
+   if (g->sparse)
+      g->seen = rzalloc_array(g, unsigned int, count);
+
    for (i = 0; i < count; i++) {
-      int bitset_count = BITSET_WORDS(count);
-      g->nodes[i].adjacency = rzalloc_array(g, BITSET_WORD, bitset_count);
+      if (!g->sparse) {
+         int bitset_count = BITSET_WORDS(count);
+         g->nodes[i].adjacency = rzalloc_array(g, BITSET_WORD, bitset_count);
+      }
 
       g->nodes[i].adjacency_list_size = 4;
       g->nodes[i].adjacency_list =
@@ -463,7 +618,15 @@ void
 ra_add_node_interference(struct ra_graph *g,
                          unsigned int n1, unsigned int n2)
 {
-   if (n1 != n2 && !BITSET_TEST(g->nodes[n1].adjacency, n2)) {
+   if (n1 == n2)
+      return;
+
+   if (g->sparse) {
+      ra_add_node_adjacency(g, n1, n2);
+      ra_add_node_adjacency(g, n2, n1);
+   } else if (!BITSET_TEST(g->nodes[n1].adjacency, n2)) {
+      BITSET_SET(g->nodes[n1].adjacency, n2);
+      BITSET_SET(g->nodes[n2].adjacency, n1);
       ra_add_node_adjacency(g, n1, n2);
       ra_add_node_adjacency(g, n2, n1);
    }
@@ -478,19 +641,187 @@ pq_test(struct ra_graph *g, unsigned int n)
 }
 
 static void
-decrement_q(struct ra_graph *g, unsigned int n)
+ra_heap_swap(struct ra_heap *heap, unsigned int i, unsigned int j)
+{
+   unsigned int tmp = heap->nodes[i];
+
+   heap->nodes[i] = heap->nodes[j];
+   heap->nodes[j] = tmp;
+
+   if (heap->pos) {
+      heap->pos[heap->nodes[i]] = i;
+      heap->pos[heap->nodes[j]] = j;
+   }
+}
+
+static void
+ra_heap_sift_up(const struct ra_graph *g, struct ra_heap *heap, unsigned int i)
+{
+   while (i > 0) {
+      unsigned int parent = (i - 1) / 2;
+
+      if (!heap->before(g, heap->nodes[i], heap->nodes[parent]))
+         break;
+
+      ra_heap_swap(heap, i, parent);
+      i = parent;
+   }
+}
+
+static void
+ra_heap_sift_down(const struct ra_graph *g, struct ra_heap *heap,
+                  unsigned int i)
+{
+   for (;;) {
+      unsigned int first = i;
+      unsigned int child = 2 * i + 1;
+
+      if (child < heap->count &&
+          heap->before(g, heap->nodes[child], heap->nodes[first]))
+         first = child;
+      if (child + 1 < heap->count &&
+          heap->before(g, heap->nodes[child + 1], heap->nodes[first]))
+         first = child + 1;
+
+      if (first == i)
+         break;
+
+      ra_heap_swap(heap, i, first);
+      i = first;
+   }
+}
+
+static void
+ra_heap_push(const struct ra_graph *g, struct ra_heap *heap, unsigned int n)
+{
+   heap->nodes[heap->count] = n;
+   if (heap->pos)
+      heap->pos[n] = heap->count;
+   heap->count++;
+
+   ra_heap_sift_up(g, heap, heap->count - 1);
+}
+
+static void
+ra_heap_remove_at(const struct ra_graph *g, struct ra_heap *heap,
+                  unsigned int i)
+{
+   if (heap->pos)
+      heap->pos[heap->nodes[i]] = NO_REG;
+
+   heap->count--;
+   if (i == heap->count)
+      return;
+
+   heap->nodes[i] = heap->nodes[heap->count];
+   if (heap->pos)
+      heap->pos[heap->nodes[i]] = i;
+
+   ra_heap_sift_up(g, heap, i);
+   ra_heap_sift_down(g, heap, i);
+}
+
+static unsigned int
+ra_heap_pop(const struct ra_graph *g, struct ra_heap *heap)
+{
+   unsigned int n = heap->nodes[0];
+
+   ra_heap_remove_at(g, heap, 0);
+
+   return n;
+}
+
+/**
+ * Restores the heap order after the key of n went towards the front.
+ */
+static void
+ra_heap_update(const struct ra_graph *g, struct ra_heap *heap, unsigned int n)
+{
+   ra_heap_sift_up(g, heap, heap->pos[n]);
+}
+
+static void
+ra_heap_remove(const struct ra_graph *g, struct ra_heap *heap, unsigned int n)
+{
+   ra_heap_remove_at(g, heap, heap->pos[n]);
+}
+
+/**
+ * Order of the trivially colorable nodes: highest node index first.
+ */
+static bool
+ra_colorable_before(const struct ra_graph *g, unsigned int a, unsigned int b)
+{
+   return a > b;
+}
+
+/**
+ * Order of the optimistic candidates: lowest q total first, the highest
+ * node index among the ones with the same q total.
+ */
+static bool
+ra_optimistic_before(const struct ra_graph *g, unsigned int a, unsigned int b)
+{
+   if (g->nodes[a].q_total != g->nodes[b].q_total)
+      return g->nodes[a].q_total < g->nodes[b].q_total;
+
+   return a > b;
+}
+
+struct ra_simplify_state {
+   /** Trivially colorable nodes below scan_pos */
+   struct ra_heap colorable;
+
+   /** Trivially colorable nodes at or above scan_pos */
+   unsigned int *next_pass;
+   unsigned int next_pass_count;
+
+   /** Nodes which fail the pq test */
+   struct ra_heap optimistic;
+
+   unsigned int scan_pos;
+};
+
+/**
+ * Pushes n on the stack and removes its edges from the graph, moving the
+ * neighbors that become trivially colorable to the colorable worklists.
+ */
+static void
+ra_push_node(struct ra_graph *g, struct ra_simplify_state *state,
+             unsigned int n)
 {
    unsigned int i;
    int n_class = g->nodes[n].class;
 
+   g->stack[g->stack_count] = n;
+   g->stack_count++;
+   g->nodes[n].in_stack = true;
+
    for (i = 0; i < g->nodes[n].adjacency_count; i++) {
       unsigned int n2 = g->nodes[n].adjacency_list[i];
       unsigned int n2_class = g->nodes[n2].class;
 
-      if (!g->nodes[n2].in_stack) {
-         assert(g->nodes[n2].q_total >= g->regs->classes[n2_class]->q[n_class]);
-         g->nodes[n2].q_total -= g->regs->classes[n2_class]->q[n_class];
+      if (g->nodes[n2].in_stack)
+         continue;
+
+      bool was_colorable = pq_test(g, n2);
+
+      assert(g->nodes[n2].q_total >= g->regs->classes[n2_class]->q[n_class]);
+      g->nodes[n2].q_total -= g->regs->classes[n2_class]->q[n_class];
+
+      if (g->nodes[n2].reg != NO_REG || was_colorable)
+         continue;
+
+      if (!pq_test(g, n2)) {
+         ra_heap_update(g, &state->optimistic, n2);
+         continue;
       }
+
+      ra_heap_remove(g, &state->optimistic, n2);
+      if (n2 < state->scan_pos)
+         ra_heap_push(g, &state->colorable, n2);
+      else
+         state->next_pass[state->next_pass_count++] = n2;
    }
 }
 
@@ -503,51 +834,77 @@ decrement_q(struct ra_graph *g, unsigned int n)
  * we optimistically choose a node and push it on the stack. We heuristically
  * push the node with the lowest total q value, since it has the fewest
  * neighbors and therefore is most likely to be allocated.
+ *
+ * The nodes are pushed in the order of repeated passes over all the nodes,
+ * from the highest index to the lowest, which push every trivially
+ * colorable node they come across.  Rather than doing those passes, the
+ * worklists track which node such a pass would find next: the colorable
+ * ones below the current position of the pass, the ones which became
+ * colorable behind it and wait for the next pass, and the optimistic
+ * candidates, ordered by q total, for when a pass finds nothing.
  */
 static void
 ra_simplify(struct ra_graph *g)
 {
-   bool progress = true;
+   struct ra_simplify_state state;
    unsigned int stack_optimistic_start = UINT_MAX;
-   int i;
-
-   while (progress) {
-      unsigned int best_optimistic_node = ~0;
-      unsigned int lowest_q_total = ~0;
-
-      progress = false;
-
-      for (i = g->count - 1; i >= 0; i--) {
-	 if (g->nodes[i].in_stack || g->nodes[i].reg != NO_REG)
-	    continue;
-
-	 if (pq_test(g, i)) {
-	    decrement_q(g, i);
-	    g->stack[g->stack_count] = i;
-	    g->stack_count++;
-	    g->nodes[i].in_stack = true;
-	    progress = true;
-	 } else {
-	    unsigned int new_q_total = g->nodes[i].q_total;
-	    if (new_q_total < lowest_q_total) {
-	       best_optimistic_node = i;
-	       lowest_q_total = new_q_total;
-	    }
-	 }
-      }
+   unsigned int i;
 
-      if (!progress && best_optimistic_node != ~0U) {
+   state.colorable.nodes = malloc(g->count * sizeof(unsigned int));
+   state.colorable.count = 0;
+   state.colorable.pos = NULL;
+   state.colorable.before = ra_colorable_before;
+   state.next_pass = malloc(g->count * sizeof(unsigned int));
+   state.next_pass_count = 0;
+   state.optimistic.nodes = malloc(g->count * sizeof(unsigned int));
+   state.optimistic.count = 0;
+   state.optimistic.pos = malloc(g->count * sizeof(unsigned int));
+   state.optimistic.before = ra_optimistic_before;
+   state.scan_pos = g->count;
+
+   for (i = 0; i < g->count; i++) {
+      state.optimistic.pos[i] = NO_REG;
+
+      if (g->nodes[i].in_stack || g->nodes[i].reg != NO_REG)
+         continue;
+
+      if (pq_test(g, i))
+         ra_heap_push(g, &state.colorable, i);
+      else
+         ra_heap_push(g, &state.optimistic, i);
+   }
+
+   for (;;) {
+      unsigned int n;
+
+      if (state.colorable.count) {
+         n = ra_heap_pop(g, &state.colorable);
+         state.scan_pos = n;
+      } else if (state.next_pass_count) {
+         /* Start a new pass from the top. */
+         for (i = 0; i < state.next_pass_count; i++)
+            ra_heap_push(g, &state.colorable, state.next_pass[i]);
+         state.next_pass_count = 0;
+         state.scan_pos = g->count;
+         continue;
+      } else if (state.optimistic.count) {
          if (stack_optimistic_start == UINT_MAX)
             stack_optimistic_start = g->stack_count;
 
-	 decrement_q(g, best_optimistic_node);
-	 g->stack[g->stack_count] = best_optimistic_node;
-	 g->stack_count++;
-	 g->nodes[best_optimistic_node].in_stack = true;
-	 progress = true;
+         n = ra_heap_pop(g, &state.optimistic);
+         state.scan_pos = g->count;
+      } else {
+         break;
       }
+
+      ra_push_node(g, &state, n);
    }
 
+   free(state.colorable.nodes);
+   free(state.next_pass);
+   free(state.optimistic.nodes);
+   free(state.optimistic.pos);
+
    g->stack_optimistic_start = stack_optimistic_start;
 }
 
@@ -676,9 +1033,87 @@ ra_select(struct ra_graph *g)
    return true;
 }
 
+/**
+ * Writes the register set and the interference graph to a new file in
+ * MESA_RA_DUMP_PATH, so that the allocation can be replayed by
+ * src/util/tests/register_allocate/ra_bench.
+ *
+ * Select callbacks aren't recorded, and the order of the adjacency lists is
+ * only approximated by listing, for each node, the neighbors with a higher
+ * index in the order they appear in its list.
+ */
+static void
+ra_dump_graph(struct ra_graph *g, const char *path)
+{
+   static unsigned int dump_count;
+   struct ra_regs *regs = g->regs;
+   unsigned int i, j;
+   char filename[1024];
+   FILE *fp;
+
+   snprintf(filename, sizeof(filename), "%s/ra-%d-%u.txt", path,
+            (int)getpid(), p_atomic_inc_return(&dump_count));
+
+   fp = fopen(filename, "w");
+   if (!fp) {
+      fprintf(stderr, "Failed to open %s to dump the register allocation\n",
+              filename);
+      return;
+   }
+
+   fprintf(fp, "regs %u %u %u\n", regs->count, regs->class_count,
+           regs->round_robin ? 1 : 0);
+
+   for (i = 0; i < regs->count; i++) {
+      BITSET_WORD tmp;
+      int c;
+
+      fprintf(fp, "conflicts %u", i);
+      BITSET_FOREACH_SET(c, tmp, regs->regs[i].conflicts, regs->count) {
+         if ((unsigned)c > i)
+            fprintf(fp, " %d", c);
+      }
+      fprintf(fp, "\n");
+   }
+
+   for (i = 0; i < regs->class_count; i++) {
+      BITSET_WORD tmp;
+      int r;
+
+      fprintf(fp, "class %u", i);
+      BITSET_FOREACH_SET(r, tmp, regs->classes[i]->regs, regs->count)
+         fprintf(fp, " %d", r);
+      fprintf(fp, "\nq %u", i);
+      for (j = 0; j < regs->class_count; j++)
+         fprintf(fp, " %u", regs->classes[i]->q[j]);
+      fprintf(fp, "\n");
+   }
+
+   fprintf(fp, "graph %u\n", g->count);
+
+   for (i = 0; i < g->count; i++) {
+      fprintf(fp, "node %u %u %d %.9g", i, g->nodes[i].class,
+              (int)g->nodes[i].reg, g->nodes[i].spill_cost);
+      for (j = 0; j < g->nodes[i].adjacency_count; j++) {
+         if (g->nodes[i].adjacency_list[j] > i)
+            fprintf(fp, " %u", g->nodes[i].adjacency_list[j]);
+      }
+      fprintf(fp, "\n");
+   }
+
+   fclose(fp);
+}
+
 bool
 ra_allocate(struct ra_graph *g)
 {
+   const char *dump_path = getenv("MESA_RA_DUMP_PATH");
+
+   ra_compact_adjacency(g);
+
+   if (dump_path)
+      ra_dump_graph(g, dump_path);
+
    ra_simplify(g);
    return ra_select(g);
 }
@@ -742,6 +1177,8 @@ ra_get_best_spill_node(struct ra_graph *g)
    float best_benefit = 0.0;
    unsigned int n;
 
+   ra_compact_adjacency(g);
+
    /* Consider any nodes that we colored successfully or the node we failed to
     * color for spilling. When we failed to color a node in ra_select(), we
     * only considered these nodes, so spilling any other ones would not result
@@ -0,0 +1,269 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Replays the interference graphs dumped by ra_allocate() when
+ * MESA_RA_DUMP_PATH is set, and reports how long allocating them takes.
+ *
+ *    ra_bench [-n iterations] [-t sparse_threshold] file...
+ *
+ * Each graph is rebuilt from scratch for every iteration; only ra_allocate()
+ * is timed.  Select callbacks aren't recorded in the dumps, so graphs from
+ * backends which use one may color differently than they did originally.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "ralloc.h"
+#include "os_time.h"
+#include "macros.h"
+#include "register_allocate.h"
+
+struct dump_node {
+   unsigned class;
+   int reg;
+   float spill_cost;
+   unsigned *neighbors;
+   unsigned neighbor_count;
+};
+
+struct dump {
+   struct ra_regs *regs;
+   unsigned node_count;
+   struct dump_node *nodes;
+};
+
+/**
+ * Parses a list of unsigned integers from \p s, allocated out of \p mem_ctx.
+ */
+static unsigned
+parse_list(void *mem_ctx, const char *s, unsigned **list)
+{
+   unsigned count = 0, size = 8;
+   char *end;
+
+   *list = ralloc_array(mem_ctx, unsigned, size);
+
+   for (;;) {
+      unsigned long v = strtoul(s, &end, 10);
+      if (end == s)
+         break;
+      if (count == size) {
+         size *= 2;
+         *list = reralloc(mem_ctx, *list, unsigned, size);
+      }
+      (*list)[count++] = v;
+      s = end;
+   }
+
+   return count;
+}
+
+static bool
+read_dump(void *mem_ctx, const char *filename, struct dump *d,
+          unsigned sparse_threshold)
+{
+   unsigned reg_count = 0, class_count = 0, round_robin = 0;
+   unsigned **q_values = NULL;
+   char *line = NULL;
+   size_t line_size = 0;
+   bool ok = false;
+   FILE *fp;
+
+   memset(d, 0, sizeof(*d));
+
+   fp = fopen(filename, "r");
+   if (!fp) {
+      fprintf(stderr, "%s: can't open\n", filename);
+      return false;
+   }
+
+   while (getline(&line, &line_size, fp) > 0) {
+      unsigned i, n, count, *list;
+      int offset;
+
+      if (sscanf(line, "regs %u %u %u", &reg_count, &class_count,
+                 &round_robin) == 3) {
+         d->regs = ra_alloc_reg_set(mem_ctx, reg_count, false);
+         if (round_robin)
+            ra_set_allocate_round_robin(d->regs);
+         if (sparse_threshold != UINT_MAX)
+            ra_set_sparse_interference_threshold(d->regs, sparse_threshold);
+         for (i = 0; i < class_count; i++)
+            ra_alloc_reg_class(d->regs);
+         q_values = rzalloc_array(mem_ctx, unsigned *, class_count);
+      } else if (!d->regs) {
+         goto fail;
+      } else if (sscanf(line, "conflicts %u%n", &n, &offset) == 1) {
+         if (n >= reg_count)
+            goto fail;
+         count = parse_list(mem_ctx, line + offset, &list);
+         for (i = 0; i < count; i++) {
+            if (list[i] >= reg_count)
+               goto fail;
+            ra_add_reg_conflict(d->regs, n, list[i]);
+         }
+      } else if (sscanf(line, "class %u%n", &n, &offset) == 1) {
+         if (n >= class_count)
+            goto fail;
+         count = parse_list(mem_ctx, line + offset, &list);
+         for (i = 0; i < count; i++) {
+            if (list[i] >= reg_count)
+               goto fail;
+            ra_class_add_reg(d->regs, n, list[i]);
+         }
+      } else if (sscanf(line, "q %u%n", &n, &offset) == 1) {
+         if (n >= class_count ||
+             parse_list(mem_ctx, line + offset, &q_values[n]) != class_count)
+            goto fail;
+      } else if (sscanf(line, "graph %u", &d->node_count) == 1) {
+         for (i = 0; i < class_count; i++) {
+            if (!q_values[i])
+               goto fail;
+         }
+         ra_set_finalize(d->regs, q_values);
+         d->nodes = rzalloc_array(mem_ctx, struct dump_node, d->node_count);
+      } else if (!d->nodes) {
+         goto fail;
+      } else {
+         struct dump_node node;
+
+         if (sscanf(line, "node %u %u %d %f%n", &n, &node.class, &node.reg,
+                    &node.spill_cost, &offset) != 4 ||
+             n >= d->node_count || node.class >= class_count)
+            goto fail;
+
+         node.neighbor_count = parse_list(mem_ctx, line + offset,
+                                          &node.neighbors);
+         for (i = 0; i < node.neighbor_count; i++) {
+            if (node.neighbors[i] >= d->node_count)
+               goto fail;
+         }
+         d->nodes[n] = node;
+      }
+   }
+
+   ok = d->nodes != NULL;
+
+fail:
+   if (!ok)
+      fprintf(stderr, "%s: malformed register allocation dump\n", filename);
+   free(line);
+   fclose(fp);
+   return ok;
+}
+
+static struct ra_graph *
+build_graph(const struct dump *d)
+{
+   struct ra_graph *g = ra_alloc_interference_graph(d->regs, d->node_count);
+   unsigned i, j;
+
+   /* Interferences account for the classes of both nodes, so every class
+    * has to be set before the first edge is added.
+    */
+   for (i = 0; i < d->node_count; i++) {
+      const struct dump_node *node = &d->nodes[i];
+
+      ra_set_node_class(g, i, node->class);
+      if (node->reg >= 0)
+         ra_set_node_reg(g, i, node->reg);
+      ra_set_node_spill_cost(g, i, node->spill_cost);
+   }
+
+   for (i = 0; i < d->node_count; i++) {
+      const struct dump_node *node = &d->nodes[i];
+
+      for (j = 0; j < node->neighbor_count; j++)
+         ra_add_node_interference(g, i, node->neighbors[j]);
+   }
+
+   return g;
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned iterations = 1, sparse_threshold = UINT_MAX;
+   int ret = EXIT_SUCCESS;
+   int i;
+
+   for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+      if (!strcmp(argv[i], "-n") && i + 1 < argc)
+         iterations = strtoul(argv[++i], NULL, 0);
+      else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+         sparse_threshold = strtoul(argv[++i], NULL, 0);
+      else
+         break;
+   }
+
+   if (i == argc || iterations == 0) {
+      fprintf(stderr, "usage: %s [-n iterations] [-t sparse_threshold] "
+              "file...\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   for (; i < argc; i++) {
+      void *mem_ctx = ralloc_context(NULL);
+      int64_t best = INT64_MAX, total = 0;
+      bool colored = false;
+      int spill = -1;
+      struct dump d;
+      unsigned iter;
+
+      if (!read_dump(mem_ctx, argv[i], &d, sparse_threshold)) {
+         ralloc_free(mem_ctx);
+         ret = EXIT_FAILURE;
+         continue;
+      }
+
+      for (iter = 0; iter < iterations; iter++) {
+         struct ra_graph *g = build_graph(&d);
+         int64_t t0 = os_time_get_nano();
+         int64_t t;
+
+         colored = ra_allocate(g);
+         t = os_time_get_nano() - t0;
+         if (!colored)
+            spill = ra_get_best_spill_node(g);
+
+         best = MIN2(best, t);
+         total += t;
+         ralloc_free(g);
+      }
+
+      printf("%s: %u nodes, ", argv[i], d.node_count);
+      if (colored)
+         printf("colored");
+      else
+         printf("spills node %d", spill);
+      printf(", best %.3f ms, average %.3f ms\n",
+             best / 1000000.0, total / 1000000.0 / iterations);
+
+      ralloc_free(mem_ctx);
+   }
+
+   return ret;
+}
@@ -0,0 +1,324 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Allocates random interference graphs with the dense and the sparse
+ * adjacency representations, checks that both give the same result and
+ * that the result is a valid coloring.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "ralloc.h"
+#include "register_allocate.h"
+
+#define NUM_BASE_REGS 32
+
+/* Unlike assert(), also fails the test in release builds. */
+#define CHECK(cond)                                                      \
+   do {                                                                  \
+      if (!(cond)) {                                                     \
+         fprintf(stderr, "%s:%d: check failed: %s\n",                    \
+                 __FILE__, __LINE__, #cond);                             \
+         exit(EXIT_FAILURE);                                             \
+      }                                                                  \
+   } while (0)
+
+static uint32_t rand_state;
+
+static unsigned
+rand_below(unsigned n)
+{
+   rand_state = rand_state * 1103515245 + 12345;
+   return (rand_state >> 8) % n;
+}
+
+struct test_regs {
+   struct ra_regs *regs;
+   /* First register of the classes of 1, 2 and 4 contiguous base regs */
+   unsigned class_first[3];
+   unsigned classes[3];
+};
+
+static void
+create_regs(struct test_regs *t, void *mem_ctx, bool round_robin)
+{
+   unsigned count = 0, i, j, c;
+
+   for (c = 0; c < 3; c++) {
+      t->class_first[c] = count;
+      count += NUM_BASE_REGS - (1 << c) + 1;
+   }
+
+   t->regs = ra_alloc_reg_set(mem_ctx, count, true);
+   if (round_robin)
+      ra_set_allocate_round_robin(t->regs);
+
+   for (c = 0; c < 3; c++) {
+      t->classes[c] = ra_alloc_reg_class(t->regs);
+
+      for (i = 0; i < NUM_BASE_REGS - (1 << c) + 1; i++) {
+         unsigned reg = t->class_first[c] + i;
+
+         ra_class_add_reg(t->regs, t->classes[c], reg);
+         if (c == 0)
+            continue;
+
+         for (j = 0; j < (1u << c); j++)
+            ra_add_transitive_reg_conflict(t->regs, i + j, reg);
+      }
+   }
+
+   ra_set_finalize(t->regs, NULL);
+}
+
+struct test_graph {
+   unsigned count;
+   unsigned *class;
+   unsigned *forced_reg;
+   float *spill_cost;
+   /* Pairs of interfering nodes, with duplicates */
+   unsigned *edges;
+   unsigned num_edges;
+};
+
+/**
+ * Makes a graph out of random live ranges, the way a backend would.
+ */
+static void
+create_graph(struct test_graph *tg, const struct test_regs *t,
+             unsigned count, unsigned length)
+{
+   unsigned *start = malloc(count * sizeof(unsigned));
+   unsigned *end = malloc(count * sizeof(unsigned));
+   unsigned max_edges = 16 * count, i, j;
+
+   tg->count = count;
+   tg->class = malloc(count * sizeof(unsigned));
+   tg->forced_reg = malloc(count * sizeof(unsigned));
+   tg->spill_cost = malloc(count * sizeof(float));
+   tg->edges = malloc(2 * max_edges * sizeof(unsigned));
+   tg->num_edges = 0;
+
+   for (i = 0; i < count; i++) {
+      unsigned c = rand_below(8) < 5 ? 0 : rand_below(8) < 6 ? 1 : 2;
+
+      start[i] = rand_below(length);
+      end[i] = start[i] + 1 + rand_below(rand_below(4) ? 8 : length / 4 + 1);
+      tg->class[i] = t->classes[c];
+      tg->forced_reg[i] = ~0u;
+      tg->spill_cost[i] = rand_below(4) ? 1.0f + rand_below(100) : 0.0f;
+
+      /* The first few nodes are payload in fixed base registers */
+      if (i < 4) {
+         tg->class[i] = t->classes[0];
+         tg->forced_reg[i] = i;
+         start[i] = 0;
+      }
+   }
+
+   for (i = 0; i < count; i++) {
+      for (j = i + 1; j < count; j++) {
+         if (start[i] >= end[j] || start[j] >= end[i])
+            continue;
+
+         /* Backends happily add the same interference several times */
+         do {
+            if (tg->num_edges == max_edges) {
+               max_edges *= 2;
+               tg->edges = realloc(tg->edges,
+                                   2 * max_edges * sizeof(unsigned));
+            }
+            tg->edges[2 * tg->num_edges + 0] = rand_below(2) ? i : j;
+            tg->edges[2 * tg->num_edges + 1] =
+               tg->edges[2 * tg->num_edges + 0] == i ? j : i;
+            tg->num_edges++;
+         } while (rand_below(4) == 0);
+      }
+   }
+
+   /* Shuffle a bit so that duplicates aren't always next to each other */
+   for (i = 0; i + 1 < tg->num_edges; i++) {
+      if (rand_below(8) == 0) {
+         unsigned k = i + rand_below(tg->num_edges - i), tmp;
+         for (j = 0; j < 2; j++) {
+            tmp = tg->edges[2 * i + j];
+            tg->edges[2 * i + j] = tg->edges[2 * k + j];
+            tg->edges[2 * k + j] = tmp;
+         }
+      }
+   }
+
+   free(start);
+   free(end);
+}
+
+static void
+destroy_graph(struct test_graph *tg)
+{
+   free(tg->class);
+   free(tg->forced_reg);
+   free(tg->spill_cost);
+   free(tg->edges);
+}
+
+static struct ra_graph *
+build_graph(const struct test_graph *tg, struct ra_regs *regs)
+{
+   struct ra_graph *g = ra_alloc_interference_graph(regs, tg->count);
+   unsigned i;
+
+   for (i = 0; i < tg->count; i++) {
+      ra_set_node_class(g, i, tg->class[i]);
+      if (tg->forced_reg[i] != ~0u)
+         ra_set_node_reg(g, i, tg->forced_reg[i]);
+      if (tg->spill_cost[i] > 0.0f)
+         ra_set_node_spill_cost(g, i, tg->spill_cost[i]);
+   }
+
+   for (i = 0; i < tg->num_edges; i++)
+      ra_add_node_interference(g, tg->edges[2 * i], tg->edges[2 * i + 1]);
+
+   return g;
+}
+
+/**
+ * Returns true if registers a and b share a base register.
+ */
+static bool
+regs_overlap(const struct test_regs *t, unsigned a, unsigned b)
+{
+   unsigned base[2] = { 0 }, size[2] = { 0 }, r[2] = { a, b }, i, c;
+
+   for (i = 0; i < 2; i++) {
+      for (c = 3; c-- > 0;) {
+         if (r[i] >= t->class_first[c]) {
+            base[i] = r[i] - t->class_first[c];
+            size[i] = 1 << c;
+            break;
+         }
+      }
+   }
+
+   return base[0] < base[1] + size[1] && base[1] < base[0] + size[0];
+}
+
+static void
+check_coloring(const struct test_graph *tg, const struct test_regs *t,
+               struct ra_graph *g)
+{
+   unsigned i;
+
+   for (i = 0; i < tg->count; i++) {
+      unsigned reg = ra_get_node_reg(g, i);
+      unsigned c;
+
+      for (c = 0; c < 3; c++) {
+         if (tg->class[i] == t->classes[c])
+            break;
+      }
+      CHECK(reg >= t->class_first[c]);
+      CHECK(c == 2 || reg < t->class_first[c + 1]);
+
+      if (tg->forced_reg[i] != ~0u)
+         CHECK(reg == tg->forced_reg[i]);
+   }
+
+   for (i = 0; i < tg->num_edges; i++) {
+      unsigned a = ra_get_node_reg(g, tg->edges[2 * i]);
+      unsigned b = ra_get_node_reg(g, tg->edges[2 * i + 1]);
+
+      /* The forced payload registers are allowed to overlap */
+      if (tg->forced_reg[tg->edges[2 * i]] != ~0u &&
+          tg->forced_reg[tg->edges[2 * i + 1]] != ~0u)
+         continue;
+
+      CHECK(!regs_overlap(t, a, b));
+   }
+}
+
+static unsigned
+run_test(const struct test_regs *t, unsigned count, unsigned length)
+{
+   struct test_graph tg;
+   struct ra_graph *dense, *sparse;
+   bool dense_ok, sparse_ok;
+   unsigned i;
+
+   create_graph(&tg, t, count, length);
+
+   ra_set_sparse_interference_threshold(t->regs, UINT_MAX);
+   dense = build_graph(&tg, t->regs);
+   ra_set_sparse_interference_threshold(t->regs, 0);
+   sparse = build_graph(&tg, t->regs);
+
+   dense_ok = ra_allocate(dense);
+   sparse_ok = ra_allocate(sparse);
+   CHECK(dense_ok == sparse_ok);
+
+   if (dense_ok) {
+      for (i = 0; i < count; i++)
+         CHECK(ra_get_node_reg(dense, i) == ra_get_node_reg(sparse, i));
+      check_coloring(&tg, t, sparse);
+   } else {
+      CHECK(ra_get_best_spill_node(dense) ==
+             ra_get_best_spill_node(sparse));
+   }
+
+   ralloc_free(dense);
+   ralloc_free(sparse);
+   destroy_graph(&tg);
+
+   return dense_ok;
+}
+
+int
+main(int argc, char **argv)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   struct test_regs t[2];
+   unsigned colored = 0, total = 0, i;
+
+   (void) argc;
+   (void) argv;
+
+   create_regs(&t[0], mem_ctx, false);
+   create_regs(&t[1], mem_ctx, true);
+
+   for (i = 0; i < 200; i++) {
+      rand_state = i;
+      colored += run_test(&t[i % 2], 20 + rand_below(400),
+                          50 + rand_below(400));
+      total++;
+   }
+
+   /* Both outcomes should have been covered */
+   CHECK(colored > 0 && colored < total);
+   printf("%u of %u graphs colored\n", colored, total);
+
+   ralloc_free(mem_ctx);
+
+   return 0;
+}
@@ -70,6 +70,30 @@ static inline void u_thread_setname( const char *name )
    (void)name;
 }
 
+/**
+ * Restrict the calling thread to run on the given logical CPU.
+ * Returns false if pinning isn't supported or the call failed.
+ */
+static inline bool u_thread_pin_to_cpu( unsigned cpu )
+{
+#if defined(HAVE_PTHREAD)
+#  if defined(__GNU_LIBRARY__) && defined(__GLIBC__) && defined(__GLIBC_MINOR__) && \
+      (__GLIBC__ >= 3 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 4)) && \
+      defined(__linux__)
+   cpu_set_t set;
+
+   if (cpu >= CPU_SETSIZE)
+      return false;
+
+   CPU_ZERO(&set);
+   CPU_SET(cpu, &set);
+   return pthread_setaffinity_np(pthread_self(), sizeof set, &set) == 0;
+#  endif
+#endif
+   (void)cpu;
+   return false;
+}
+
 /*
  * Thread statistics.
  */